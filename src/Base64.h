@@ -0,0 +1,324 @@
+// Base64 (RFC 4648) encoding and decoding.
+//
+// base64::decode and base64::encode write into memory that the caller allocated, so
+// that a blob can be decoded straight into its final destination without intermediate
+// strings; decode_into does that for any contiguous container with resize().
+//
+// Both have three kernels:
+//
+//   - scalar: table driven, four characters at a time.
+//   - sse41:  sixteen characters (twelve bytes) at a time, using pshufb lookups
+//             (SSSE3) and ptest (SSE4.1) to validate a whole vector at once.
+//   - avx2:   the same, thirty-two characters (twenty-four bytes) at a time.
+//
+// The best kernel that the CPU supports is used by default. The vector kernels stop at
+// the first vector that contains anything other than the 64 base64 characters (line
+// breaks, padding, or garbage); the scalar code then takes over until the next four
+// character boundary, after which the vector kernel is tried again. Hence base64 with
+// MIME line breaks every 76 characters is still mostly decoded by the vector kernel.
+//
+// Decoding skips white space, accepts missing padding and returns nullptr on any other
+// invalid input.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86 1
+#endif
+
+namespace base64 {
+
+enum class Kernel { scalar, sse41, avx2 };
+
+inline Kernel best_kernel()
+{
+#ifdef BASE64_X86
+  static Kernel const kernel = __builtin_cpu_supports("avx2") ? Kernel::avx2 : __builtin_cpu_supports("sse4.1") ? Kernel::sse41 : Kernel::scalar;
+  return kernel;
+#else
+  return Kernel::scalar;
+#endif
+}
+
+// The number of characters that encode writes for len bytes.
+inline size_t encoded_size(size_t len) { return (len + 2) / 3 * 4; }
+
+// An upper bound for the number of bytes that decode writes for len characters.
+inline size_t decoded_size_upper_bound(size_t len) { return (len + 3) / 4 * 3; }
+
+namespace detail {
+
+unsigned char constexpr invalid = 0xff;
+unsigned char constexpr white_space = 0xfe;
+
+struct DecodeTable
+{
+  unsigned char m_value[256];
+
+  constexpr DecodeTable() : m_value()
+  {
+    for (int c = 0; c < 256; ++c)
+      m_value[c] = invalid;
+    for (int i = 0; i < 26; ++i)
+    {
+      m_value['A' + i] = i;
+      m_value['a' + i] = 26 + i;
+    }
+    for (int i = 0; i < 10; ++i)
+      m_value['0' + i] = 52 + i;
+    m_value['+'] = 62;
+    m_value['/'] = 63;
+    m_value[' '] = m_value['\t'] = m_value['\r'] = m_value['\n'] = white_space;
+  }
+};
+
+inline constexpr DecodeTable decode_table;
+inline constexpr char encode_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#ifdef BASE64_X86
+// Decode as many whole vectors of sixteen characters as possible, stopping before the
+// first vector that contains a non-base64 character. Advances in and out.
+__attribute__((target("sse4.1")))
+inline void decode_sse41(char const*& in, char const* in_end, char*& out)
+{
+  __m128i const lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  __m128i const lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  __m128i const lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  __m128i const mask_2f = _mm_set1_epi8(0x2f);
+  // Every store writes sixteen bytes of which twelve are used; 24 remaining characters guarantee room for that.
+  while (in_end - in >= 24)
+  {
+    __m128i str = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+    __m128i const hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+    __m128i const lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(str, mask_2f));
+    __m128i const hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm_testz_si128(lo, hi))
+      break;
+    __m128i const eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+    __m128i const roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    str = _mm_add_epi8(str, roll);      // Sextets.
+    // Pack four sextets into three bytes, in each 32-bit word.
+    __m128i const merged = _mm_madd_epi16(_mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+    __m128i const packed = _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+    in += 16;
+    out += 12;
+  }
+}
+
+__attribute__((target("avx2")))
+inline void decode_avx2(char const*& in, char const* in_end, char*& out)
+{
+  __m256i const lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  __m256i const lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  __m256i const lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  __m256i const mask_2f = _mm256_set1_epi8(0x2f);
+  // Every store writes thirty-two bytes of which twenty-four are used; 48 remaining characters guarantee room for that.
+  while (in_end - in >= 48)
+  {
+    __m256i str = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in));
+    __m256i const hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+    __m256i const lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(str, mask_2f));
+    __m256i const hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256(lo, hi))
+      break;
+    __m256i const eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+    __m256i const roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+    __m256i const merged = _mm256_madd_epi16(_mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+    __m256i const packed = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    // Move the twelve bytes of the high lane next to those of the low lane.
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7)));
+    in += 32;
+    out += 24;
+  }
+}
+
+// Map sextets to base64 characters.
+__attribute__((target("sse4.1")))
+inline __m128i encode_translate_sse41(__m128i indices)
+{
+  __m128i const lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  __m128i const offset = _mm_sub_epi8(_mm_subs_epu8(indices, _mm_set1_epi8(51)), _mm_cmpgt_epi8(indices, _mm_set1_epi8(25)));
+  return _mm_add_epi8(indices, _mm_shuffle_epi8(lut, offset));
+}
+
+// Spread twelve bytes (in the low twelve bytes of in) over sixteen sextets.
+__attribute__((target("sse4.1")))
+inline __m128i encode_reshuffle_sse41(__m128i in)
+{
+  in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  __m128i const t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+  __m128i const t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t0, t1);
+}
+
+// Encode twelve bytes at a time while sixteen bytes can be loaded. Advances in and out.
+__attribute__((target("sse4.1")))
+inline void encode_sse41(unsigned char const*& in, unsigned char const* in_end, char*& out)
+{
+  while (in_end - in >= 16)
+  {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encode_translate_sse41(encode_reshuffle_sse41(v)));
+    in += 12;
+    out += 16;
+  }
+}
+
+__attribute__((target("avx2")))
+inline void encode_avx2(unsigned char const*& in, unsigned char const* in_end, char*& out)
+{
+  __m256i const shuffle = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  __m256i const lut = _mm256_setr_epi8(
+      65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+      65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  // Each lane gets twelve bytes; the high lane is loaded from in + 12, which reads up to in + 28.
+  while (in_end - in >= 28)
+  {
+    __m128i const lo = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+    __m128i const hi = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + 12));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    v = _mm256_shuffle_epi8(v, shuffle);
+    __m256i const t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+    __m256i const t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+    __m256i const indices = _mm256_or_si256(t0, t1);
+    __m256i const offset = _mm256_sub_epi8(_mm256_subs_epu8(indices, _mm256_set1_epi8(51)), _mm256_cmpgt_epi8(indices, _mm256_set1_epi8(25)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_add_epi8(indices, _mm256_shuffle_epi8(lut, offset)));
+    in += 24;
+    out += 32;
+  }
+}
+#endif // BASE64_X86
+
+} // namespace detail
+
+// Decode the base64 characters in [in, in + len) to out, which must have room for
+// decoded_size_upper_bound(len) bytes. Returns the end of the decoded data, or nullptr
+// if the input is not valid base64.
+inline char* decode(char const* in, size_t len, char* out, Kernel kernel = best_kernel())
+{
+  char const* const in_end = in + len;
+  uint32_t accumulator = 0;
+  int sextets = 0;              // The number of sextets in accumulator.
+  while (in < in_end)
+  {
+#ifdef BASE64_X86
+    if (sextets == 0)
+    {
+      if (kernel == Kernel::avx2)
+        detail::decode_avx2(in, in_end, out);
+      if (kernel != Kernel::scalar)
+        detail::decode_sse41(in, in_end, out);
+      if (in == in_end)
+        break;
+    }
+#endif
+    unsigned char const value = detail::decode_table.m_value[static_cast<unsigned char>(*in)];
+    if (value < 64)
+    {
+      accumulator = (accumulator << 6) | value;
+      if (++sextets == 4)
+      {
+        out[0] = accumulator >> 16;
+        out[1] = accumulator >> 8;
+        out[2] = accumulator;
+        out += 3;
+        sextets = 0;
+      }
+    }
+    else if (value != detail::white_space)
+    {
+      if (*in != '=')
+        return nullptr;
+      break;
+    }
+    ++in;
+  }
+  // Padding, if any: in points to the first '='.
+  int padding = 0;
+  for (; in < in_end; ++in)
+  {
+    if (*in == '=')
+      ++padding;
+    else if (detail::decode_table.m_value[static_cast<unsigned char>(*in)] != detail::white_space)
+      return nullptr;
+  }
+  // Padding only completes a final group of two or three sextets.
+  if (sextets == 1 || (padding > 0 && (sextets < 2 || sextets + padding != 4)))
+    return nullptr;
+  if (sextets == 2)
+    *out++ = accumulator >> 4;
+  else if (sextets == 3)
+  {
+    *out++ = accumulator >> 10;
+    *out++ = accumulator >> 2;
+  }
+  return out;
+}
+
+// Encode [in, in + len) to out, which must have room for encoded_size(len) characters.
+// Returns the end of the encoded characters.
+inline char* encode(char const* data, size_t len, char* out, Kernel kernel = best_kernel())
+{
+  unsigned char const* in = reinterpret_cast<unsigned char const*>(data);
+  unsigned char const* const in_end = in + len;
+#ifdef BASE64_X86
+  if (kernel == Kernel::avx2)
+    detail::encode_avx2(in, in_end, out);
+  if (kernel != Kernel::scalar)
+    detail::encode_sse41(in, in_end, out);
+#endif
+  for (; in_end - in >= 3; in += 3)
+  {
+    uint32_t const triple = (in[0] << 16) | (in[1] << 8) | in[2];
+    out[0] = detail::encode_table[triple >> 18];
+    out[1] = detail::encode_table[(triple >> 12) & 0x3f];
+    out[2] = detail::encode_table[(triple >> 6) & 0x3f];
+    out[3] = detail::encode_table[triple & 0x3f];
+    out += 4;
+  }
+  if (in < in_end)
+  {
+    uint32_t const triple = (in[0] << 16) | (in_end - in == 2 ? in[1] << 8 : 0);
+    out[0] = detail::encode_table[triple >> 18];
+    out[1] = detail::encode_table[(triple >> 12) & 0x3f];
+    out[2] = in_end - in == 2 ? detail::encode_table[(triple >> 6) & 0x3f] : '=';
+    out[3] = '=';
+    out += 4;
+  }
+  return out;
+}
+
+// Decode base64 into container (for example a std::vector<char> or std::string), which
+// is resized to the decoded size. Returns false if the input is not valid base64.
+template<class Container>
+bool decode_into(Container& container, std::string_view base64_str, Kernel kernel = best_kernel())
+{
+  container.resize(decoded_size_upper_bound(base64_str.size()));
+  char* const begin = reinterpret_cast<char*>(container.data());
+  char* const end = decode(base64_str.data(), base64_str.size(), begin, kernel);
+  if (!end)
+  {
+    container.clear();
+    return false;
+  }
+  container.resize(end - begin);
+  return true;
+}
+
+} // namespace base64
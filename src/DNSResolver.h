@@ -0,0 +1,752 @@
+// A non-blocking DNS stub resolver that runs on the event loop.
+//
+// gethostbyname(3) and friends block the calling thread for the full resolution,
+// which in a thread pool means that a worker is lost for up to seconds. dns::Resolver
+// is an evio device around one connected UDP socket instead: lookup() queues a query
+// and returns immediately, the response is read by the event loop and the callback is
+// called from the thread that handles the input (or immediately, from the calling
+// thread, if the answer is in the cache).
+//
+// Queries are A, AAAA and PTR (lookup_ptr uses SocketAddress::ptr_qname to build the
+// in-addr.arpa / ip6.arpa name). Responses are matched on their random id and on the
+// question, CNAME chains are followed, and positive answers are cached for their TTL;
+// NXDOMAIN and empty answers are cached as well, for the TTL of the SOA record in the
+// authority section (RFC 2308). A lookup of a name that already has a query in flight
+// doesn't send another query: the callback is added to the query that is in flight.
+// Queries that aren't answered are sent again after the timeout, up to the given
+// number of attempts; this is checked by a timer that only runs while queries are
+// in flight. All of that bookkeeping is done by a QueryTable, which does no I/O and
+// is given the time, so that it can be tested without a nameserver or event loop.
+//
+// Only plain UDP without EDNS is used, so a response is at most 512 bytes; the records
+// of a truncated response (TC bit set) are used, there is no fallback to TCP.
+//
+// Source port randomization (RFC 5452) is a non-goal. The socket is connected once, so
+// every query uses the same source port (an ephemeral port picked by the kernel), and a
+// response is only accepted when it comes from the nameserver, carries the random
+// 16-bit id of a query in flight and repeats its question. That is not enough against
+// an off-path attacker that can flood the resolver with guesses; use this resolver
+// only with a nameserver on the local host or a trusted network (such as a local
+// caching resolver), not with a nameserver across the internet.
+
+#pragma once
+
+#include "evio/InputDevice.h"
+#include "evio/OutputDevice.h"
+#include "evio/SocketAddress.h"
+#include "evio/inet_support.h"
+#include "threadpool/Timer.h"
+#include "utils/AIAlert.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace dns {
+
+// The query types.
+enum type_type : uint16_t
+{
+  t_a = 1,
+  t_cname = 5,
+  t_soa = 6,
+  t_ptr = 12,
+  t_aaaa = 28
+};
+
+// The positive values are the RCODE of the response; the negative values are detected locally.
+enum error_type : int
+{
+  no_error = 0,
+  format_error = 1,
+  server_failure = 2,
+  name_error = 3,               // NXDOMAIN: the name doesn't exist.
+  not_implemented = 4,
+  refused = 5,
+  no_data = -1,                 // The name exists, but has no records of the requested type.
+  timed_out = -2,
+  malformed_response = -3,
+  invalid_name = -4
+};
+
+inline char const* error_str(int error)
+{
+  switch (error)
+  {
+    case no_error: return "No error.";
+    case format_error: return "Format error.";
+    case server_failure: return "Server failure.";
+    case name_error: return "No such name.";
+    case not_implemented: return "Not implemented.";
+    case refused: return "Refused.";
+    case no_data: return "No data.";
+    case timed_out: return "Timed out.";
+    case malformed_response: return "Malformed response.";
+    case invalid_name: return "Invalid name.";
+  }
+  return "Unknown error.";
+}
+
+struct Result
+{
+  int m_error = no_error;
+  std::vector<std::string> m_values;    // The addresses (in presentation format) for t_a and t_aaaa, the host names for t_ptr.
+  uint32_t m_ttl = 0;                   // The number of seconds that this result may be cached.
+};
+
+using Callback = std::function<void(Result const& result)>;
+
+size_t constexpr max_name_size = 253;                   // Without the trailing dot.
+size_t constexpr max_query_size = 12 + 255 + 4;         // Header, encoded name and type plus class.
+size_t constexpr max_response_size = 512;
+
+namespace detail {
+
+inline uint16_t get16(unsigned char const* p) { return (p[0] << 8) | p[1]; }
+inline uint32_t get32(unsigned char const* p) { return (static_cast<uint32_t>(get16(p)) << 16) | get16(p + 2); }
+inline void put16(unsigned char* p, uint16_t value) { p[0] = value >> 8; p[1] = value & 0xff; }
+
+inline char to_lower(char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+
+// Read the (possibly compressed) name at pos in msg into name: in lower case, without trailing dot.
+// Returns the position directly after the name at pos, or 0 if the name is invalid.
+inline size_t read_name(unsigned char const* msg, size_t len, size_t pos, std::string& name)
+{
+  name.clear();
+  size_t end = 0;
+  int pointers = 0;
+  for (;;)
+  {
+    if (pos >= len)
+      return 0;
+    unsigned int const label_len = msg[pos];
+    if (label_len == 0)
+      return end ? end : pos + 1;
+    if ((label_len & 0xc0) == 0xc0)
+    {
+      // A compression pointer. Limit the number of pointers to catch loops.
+      if (pos + 1 >= len || ++pointers > 64)
+        return 0;
+      if (!end)
+        end = pos + 2;
+      pos = ((label_len & 0x3f) << 8) | msg[pos + 1];
+      continue;
+    }
+    if ((label_len & 0xc0) != 0 || pos + 1 + label_len > len || name.size() + 1 + label_len > max_name_size + 1)
+      return 0;
+    if (!name.empty())
+      name += '.';
+    for (unsigned int i = 1; i <= label_len; ++i)
+      name += to_lower(msg[pos + i]);
+    pos += 1 + label_len;
+  }
+}
+
+} // namespace detail
+
+// Return name in lower case and without trailing dot; this is the form that is cached and compared.
+inline std::string canonical_name(std::string_view name)
+{
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  std::string result(name);
+  for (char& c : result)
+    c = detail::to_lower(c);
+  return result;
+}
+
+// Write a query with the given id for name and type to out, which must have room for max_query_size bytes.
+// Returns the size of the query, or 0 if name is not a valid domain name.
+inline size_t encode_query(uint16_t id, std::string_view name, uint16_t type, char* out)
+{
+  unsigned char* p = reinterpret_cast<unsigned char*>(out);
+  detail::put16(p, id);
+  detail::put16(p + 2, 0x0100);         // A standard query with RD (recursion desired).
+  detail::put16(p + 4, 1);              // One question.
+  std::memset(p + 6, 0, 6);
+  p += 12;
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  if (name.empty() || name.size() > max_name_size)
+    return 0;
+  for (;;)
+  {
+    size_t const dot = name.find('.');
+    std::string_view const label = name.substr(0, dot);
+    if (label.empty() || label.size() > 63)
+      return 0;
+    *p++ = label.size();
+    std::memcpy(p, label.data(), label.size());
+    p += label.size();
+    if (dot == std::string_view::npos)
+      break;
+    name.remove_prefix(dot + 1);
+  }
+  *p++ = 0;
+  detail::put16(p, type);
+  detail::put16(p + 2, 1);              // Class IN.
+  return p + 4 - reinterpret_cast<unsigned char*>(out);
+}
+
+// Parse the response in data to the query with the given id for name (in canonical form) and type.
+// Returns false if the data is not a response to that query; it must be ignored then.
+// Otherwise result is set, including when the response is an error or malformed.
+inline bool parse_response(char const* data, size_t len, uint16_t id, std::string_view name, uint16_t type, Result& result)
+{
+  using detail::get16;
+  using detail::get32;
+  unsigned char const* const msg = reinterpret_cast<unsigned char const*>(data);
+  if (len < 12 || get16(msg) != id || !(msg[2] & 0x80) || get16(msg + 4) != 1)
+    return false;
+  std::string owner;
+  size_t pos = detail::read_name(msg, len, 12, owner);
+  if (pos == 0 || pos + 4 > len || owner != name || get16(msg + pos) != type || get16(msg + pos + 2) != 1)
+    return false;
+  pos += 4;
+
+  result = Result();
+  unsigned int const answers = get16(msg + 6);
+  unsigned int const records = answers + get16(msg + 8);
+  uint32_t ttl = std::numeric_limits<uint32_t>::max();
+  uint32_t negative_ttl = 0;            // The TTL of a negative answer; zero when there is no SOA record.
+  std::string record_name;
+  std::string target;
+  for (unsigned int i = 0; i < records; ++i)
+  {
+    if (pos == len && (msg[2] & 0x02))
+      break;                            // A truncated response ends after the last record that fitted.
+    pos = detail::read_name(msg, len, pos, record_name);
+    if (pos == 0 || pos + 10 > len)
+    {
+      result.m_error = malformed_response;
+      break;
+    }
+    uint16_t const record_type = get16(msg + pos);
+    uint16_t const record_class = get16(msg + pos + 2);
+    uint32_t const record_ttl = get32(msg + pos + 4);
+    size_t const rdata = pos + 10;
+    size_t const rdlength = get16(msg + pos + 8);
+    if (rdata + rdlength > len)
+    {
+      result.m_error = malformed_response;
+      break;
+    }
+    pos = rdata + rdlength;
+    if (record_class != 1)
+      continue;
+    if (i < answers && record_name == owner)
+    {
+      // Follow CNAME's: after "name CNAME target" the records of target are the ones that we want.
+      if (record_type == t_cname)
+      {
+        if (detail::read_name(msg, len, rdata, target) != pos)
+        {
+          result.m_error = malformed_response;
+          break;
+        }
+        owner = target;
+        ttl = std::min(ttl, record_ttl);
+        continue;
+      }
+      if (record_type != type)
+        continue;
+      char buf[INET6_ADDRSTRLEN];
+      if (type == t_ptr)
+      {
+        if (detail::read_name(msg, len, rdata, target) != pos)
+        {
+          result.m_error = malformed_response;
+          break;
+        }
+        result.m_values.push_back(target);
+      }
+      else if (rdlength == (type == t_a ? 4 : 16))
+        result.m_values.emplace_back(inet_ntop(type == t_a ? AF_INET : AF_INET6, msg + rdata, buf, sizeof(buf)));
+      else
+      {
+        result.m_error = malformed_response;
+        break;
+      }
+      ttl = std::min(ttl, record_ttl);
+    }
+    else if (i >= answers && record_type == t_soa)
+    {
+      // The TTL of a negative answer is the minimum of the TTL of the SOA record and its MINIMUM field.
+      size_t p = detail::read_name(msg, len, rdata, target);                  // MNAME.
+      p = p ? detail::read_name(msg, len, p, target) : 0;                    // RNAME.
+      if (p == 0 || p + 20 != pos)
+      {
+        result.m_error = malformed_response;
+        break;
+      }
+      negative_ttl = std::min(record_ttl, get32(msg + p + 16));
+    }
+  }
+  if (result.m_error == malformed_response)
+    result.m_values.clear();
+  else if ((result.m_error = msg[3] & 0x0f) != no_error)
+    result.m_ttl = result.m_error == name_error ? negative_ttl : 0;
+  else if (result.m_values.empty())
+  {
+    result.m_error = no_data;
+    result.m_ttl = negative_ttl;
+  }
+  else
+    result.m_ttl = ttl;
+  return true;
+}
+
+// The results of earlier lookups, until their TTL expires.
+class Cache
+{
+ public:
+  using clock_type = std::chrono::steady_clock;
+  using key_type = std::pair<std::string, uint16_t>;    // The canonical name and the type.
+
+ private:
+  struct Entry
+  {
+    Result m_result;
+    clock_type::time_point m_expires;
+  };
+
+  std::map<key_type, Entry> m_entries;
+  size_t m_max_entries;
+
+ public:
+  Cache(size_t max_entries = 4096) : m_max_entries(max_entries) { }
+
+  // If key is cached, set result to it (with the remaining TTL) and return true.
+  bool find(key_type const& key, clock_type::time_point now, Result& result)
+  {
+    auto entry = m_entries.find(key);
+    if (entry == m_entries.end())
+      return false;
+    if (entry->second.m_expires <= now)
+    {
+      m_entries.erase(entry);
+      return false;
+    }
+    result = entry->second.m_result;
+    result.m_ttl = std::chrono::duration_cast<std::chrono::seconds>(entry->second.m_expires - now).count();
+    return true;
+  }
+
+  // Cache result for key, unless its TTL is zero.
+  void insert(key_type const& key, Result const& result, clock_type::time_point now)
+  {
+    if (result.m_ttl == 0 || m_max_entries == 0)
+      return;
+    if (m_entries.size() >= m_max_entries && m_entries.find(key) == m_entries.end())
+    {
+      // Make room: remove all expired entries, or else the entry that expires first.
+      auto first = m_entries.end();
+      for (auto entry = m_entries.begin(); entry != m_entries.end();)
+      {
+        if (entry->second.m_expires <= now)
+          entry = m_entries.erase(entry);
+        else
+        {
+          if (first == m_entries.end() || entry->second.m_expires < first->second.m_expires)
+            first = entry;
+          ++entry;
+        }
+      }
+      if (m_entries.size() >= m_max_entries)
+        m_entries.erase(first);
+    }
+    m_entries[key] = Entry{result, now + std::chrono::seconds(result.m_ttl)};
+  }
+
+  size_t size() const { return m_entries.size(); }
+};
+
+// The queries that are in flight, in front of a Cache: coalesces lookups of the same
+// name and type, matches responses to queries and decides when a query has to be sent
+// again or has timed out. It doesn't do any I/O and doesn't read the clock itself, and
+// it is not thread-safe; Resolver calls it with its mutex locked.
+class QueryTable
+{
+ public:
+  using clock_type = Cache::clock_type;
+  using key_type = Cache::key_type;
+
+  enum lookup_type
+  {
+    l_answered,         // The result is known already (cached, or the name is invalid).
+    l_coalesced,        // The callback was added to the query that is in flight.
+    l_send              // A new query; its packet has to be sent.
+  };
+
+ private:
+  struct Query
+  {
+    uint16_t m_id;
+    int m_attempts;                             // The number of times that the query was sent.
+    clock_type::time_point m_deadline;          // When the query has to be sent again.
+    std::vector<Callback> m_callbacks;
+  };
+
+  std::chrono::milliseconds const m_timeout;    // The time to wait for a response before sending the query again.
+  int const m_max_attempts;
+  Cache m_cache;
+  std::map<key_type, Query> m_queries;
+  std::unordered_map<uint16_t, std::map<key_type, Query>::iterator> m_ids;     // The same queries, by id.
+  std::mt19937 m_random;
+
+ public:
+  QueryTable(std::chrono::milliseconds timeout, int attempts, size_t cache_size, std::mt19937::result_type seed = std::random_device{}()) :
+    m_timeout(timeout), m_max_attempts(attempts), m_cache(cache_size), m_random(seed) { }
+
+  // Look up key at time now. If l_answered is returned then result is set and callback must be
+  // called with it; otherwise callback was moved into the table. If l_send is returned then packet
+  // is set to the query that has to be sent.
+  lookup_type lookup(key_type&& key, Callback& callback, clock_type::time_point now, Result& result, std::string& packet);
+
+  // Handle the response in data. Returns false if it doesn't answer a query in flight; it must be
+  // ignored then. Otherwise result is set and callbacks are those of the query, which was removed.
+  bool response(char const* data, size_t len, clock_type::time_point now, Result& result, std::vector<Callback>& callbacks);
+
+  // Append the packets of the queries that have to be sent again at time now to packets, and remove
+  // the queries that were sent too often; their callbacks are appended to timed_out.
+  void tick(clock_type::time_point now, std::vector<std::string>& packets, std::vector<Callback>& timed_out);
+
+  // Remove all queries in flight; returns their callbacks.
+  std::vector<Callback> clear();
+
+  // The number of queries that are in flight.
+  size_t in_flight() const { return m_queries.size(); }
+
+ private:
+  // Return the packet for query, which is sent (again) at time now.
+  std::string send(key_type const& key, Query& query, clock_type::time_point now)
+  {
+    char buf[max_query_size];
+    size_t const len = encode_query(query.m_id, key.first, key.second, buf);
+    ++query.m_attempts;
+    query.m_deadline = now + m_timeout;
+    return std::string(buf, len);
+  }
+
+  // Remove the query from the queries in flight and return its callbacks.
+  std::vector<Callback> remove(std::map<key_type, Query>::iterator query)
+  {
+    std::vector<Callback> callbacks = std::move(query->second.m_callbacks);
+    m_ids.erase(query->second.m_id);
+    m_queries.erase(query);
+    return callbacks;
+  }
+};
+
+inline QueryTable::lookup_type QueryTable::lookup(key_type&& key, Callback& callback, clock_type::time_point now, Result& result, std::string& packet)
+{
+  if (m_cache.find(key, now, result))
+    return l_answered;
+  auto query = m_queries.find(key);
+  if (query != m_queries.end())
+  {
+    // Coalesce with the query that is in flight.
+    query->second.m_callbacks.push_back(std::move(callback));
+    return l_coalesced;
+  }
+  char buf[max_query_size];
+  if (encode_query(0, key.first, key.second, buf) == 0)
+  {
+    result.m_error = invalid_name;
+    return l_answered;
+  }
+  // Use a random id that isn't in use; see the remark about spoofing at the top of this file.
+  uint16_t id;
+  do
+    id = m_random();
+  while (m_ids.find(id) != m_ids.end());
+  query = m_queries.emplace(std::move(key), Query{id, 0, now, {}}).first;
+  query->second.m_callbacks.push_back(std::move(callback));
+  m_ids.emplace(id, query);
+  packet = send(query->first, query->second, now);
+  return l_send;
+}
+
+inline bool QueryTable::response(char const* data, size_t len, clock_type::time_point now, Result& result, std::vector<Callback>& callbacks)
+{
+  if (len < 2)
+    return false;
+  auto id = m_ids.find(detail::get16(reinterpret_cast<unsigned char const*>(data)));
+  if (id == m_ids.end())
+    return false;                       // A late response to a query that was already answered, or not ours at all.
+  auto query = id->second;
+  if (!parse_response(data, len, id->first, query->first.first, query->first.second, result))
+    return false;
+  if (result.m_error == no_error || result.m_error == name_error || result.m_error == no_data)
+    m_cache.insert(query->first, result, now);
+  callbacks = remove(query);
+  return true;
+}
+
+inline void QueryTable::tick(clock_type::time_point now, std::vector<std::string>& packets, std::vector<Callback>& timed_out)
+{
+  for (auto query = m_queries.begin(); query != m_queries.end();)
+  {
+    auto current = query++;
+    if (current->second.m_deadline > now)
+      continue;
+    if (current->second.m_attempts < m_max_attempts)
+      packets.push_back(send(current->first, current->second, now));
+    else
+      for (Callback& callback : remove(current))
+        timed_out.push_back(std::move(callback));
+  }
+}
+
+inline std::vector<Callback> QueryTable::clear()
+{
+  std::vector<Callback> callbacks;
+  for (auto& query : m_queries)
+    for (Callback& callback : query.second.m_callbacks)
+      callbacks.push_back(std::move(callback));
+  m_ids.clear();
+  m_queries.clear();
+  return callbacks;
+}
+
+class Resolver : public evio::InputDevice, public evio::OutputDevice
+{
+ public:
+  using clock_type = QueryTable::clock_type;
+  using key_type = QueryTable::key_type;
+  using tick_interval = threadpool::Interval<100, std::chrono::milliseconds>;
+
+ private:
+  std::mutex m_mutex;
+  QueryTable m_table;                                   // Protected by m_mutex, as are all members below.
+  std::deque<std::string> m_send_queue;                 // Encoded queries that still have to be sent.
+  threadpool::Timer m_timer;
+  bool m_timer_running;
+
+ public:
+  Resolver(std::chrono::milliseconds timeout = std::chrono::seconds(1), int attempts = 3, size_t cache_size = 4096) :
+    m_table(timeout, attempts, cache_size), m_timer_running(false) { }
+
+  // Connect to nameserver (port 53 unless given otherwise) and start reading responses.
+  void init(evio::SocketAddress const& nameserver)
+  {
+    int fd = socket(nameserver->sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+      THROW_ALERTE("socket");
+    if (::connect(fd, nameserver, evio::size_of_addr(nameserver)) == -1)
+    {
+      int const err = errno;
+      ::close(fd);
+      errno = err;
+      THROW_ALERTE("connect([SA])", AIArgs("[SA]", nameserver));
+    }
+    fd_init(fd, false);                 // Already non-blocking.
+    start_input_device();
+  }
+
+  // Look up the records of type for name; callback is called exactly once.
+  void lookup(std::string_view name, uint16_t type, Callback callback);
+
+  // Look up the host name of address.
+  void lookup_ptr(evio::SocketAddress const& address, Callback callback)
+  {
+    evio::SocketAddress::arpa_buf_t arpa_buf;
+    address.ptr_qname(arpa_buf);
+    lookup(arpa_buf.data(), t_ptr, std::move(callback));
+  }
+
+  // Stop reading responses. The queries in flight fail with timed_out right away, so that
+  // the timer (which keeps a reference to this object) stops at its next tick.
+  void close();
+
+  // The number of queries that are in flight.
+  size_t in_flight()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_table.in_flight();
+  }
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+  void write_to_fd(int& allow_deletion_count, int fd) override;
+
+ private:
+  // Queue packet for sending. Must be called with m_mutex locked.
+  void send(std::string&& packet)
+  {
+    m_send_queue.push_back(std::move(packet));
+    start_output_device();
+  }
+
+  // Start the timer if it isn't running. Must be called with m_mutex locked.
+  void start_timer()
+  {
+    if (m_timer_running)
+      return;
+    m_timer_running = true;
+    boost::intrusive_ptr<Resolver> self(this);
+    m_timer.start(tick_interval(), [self]() mutable {
+        // release_callback destroys this lambda, including self; keep the reference alive until tick() returned.
+        boost::intrusive_ptr<Resolver> resolver(std::move(self));
+        resolver->m_timer.release_callback();
+        resolver->tick();
+    });
+  }
+
+  // Called by the timer: send queries again that timed out, or fail them.
+  void tick();
+};
+
+inline void Resolver::lookup(std::string_view name, uint16_t type, Callback callback)
+{
+  Result result;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string packet;
+    switch (m_table.lookup(key_type(canonical_name(name), type), callback, clock_type::now(), result, packet))
+    {
+      case QueryTable::l_answered:
+        break;
+      case QueryTable::l_coalesced:
+        return;
+      case QueryTable::l_send:
+        send(std::move(packet));
+        start_timer();
+        return;
+    }
+  }
+  callback(result);
+}
+
+inline void Resolver::close()
+{
+  std::vector<Callback> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    callbacks = m_table.clear();
+    m_send_queue.clear();
+  }
+  FileDescriptor::close();
+  Result result;
+  result.m_error = timed_out;
+  for (auto const& callback : callbacks)
+    callback(result);
+}
+
+inline void Resolver::tick()
+{
+  std::vector<Callback> timed_out_callbacks;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> packets;
+    m_table.tick(clock_type::now(), packets, timed_out_callbacks);
+    for (std::string& packet : packets)
+      send(std::move(packet));
+    m_timer_running = false;
+    if (m_table.in_flight() > 0)
+      start_timer();
+  }
+  Result result;
+  result.m_error = timed_out;
+  for (auto const& callback : timed_out_callbacks)
+    callback(result);
+}
+
+inline void Resolver::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "dns::Resolver::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  for (;;)
+  {
+    char buf[max_response_size];
+    ssize_t len = ::recv(fd, buf, sizeof(buf), 0);
+    if (len == -1)
+    {
+      if (errno == EINTR || errno == ECONNREFUSED)      // ECONNREFUSED: an ICMP port unreachable for an earlier query.
+        continue;
+      if (errno != EAGAIN)
+        read_error(allow_deletion_count, errno);
+      return;
+    }
+    Result result;
+    std::vector<Callback> callbacks;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_table.response(buf, len, clock_type::now(), result, callbacks))
+        continue;
+    }
+    for (auto const& callback : callbacks)
+      callback(result);
+  }
+}
+
+inline void Resolver::write_to_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "dns::Resolver::write_to_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  for (;;)
+  {
+    std::string query;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_send_queue.empty())
+      {
+        // Stop while holding the lock, so that a concurrent send restarts us.
+        stop_output_device(allow_deletion_count);
+        return;
+      }
+      query = std::move(m_send_queue.front());
+      m_send_queue.pop_front();
+    }
+    if (::send(fd, query.data(), query.size(), 0) == -1)
+    {
+      if (errno == EINTR)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_send_queue.push_front(std::move(query));
+        continue;
+      }
+      if (errno == EAGAIN)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_send_queue.push_front(std::move(query));
+        return;
+      }
+      // ECONNREFUSED is an ICMP port unreachable for an earlier query; the query that we lose is sent again after the timeout.
+      if (errno != ECONNREFUSED)
+      {
+        write_error(allow_deletion_count, errno);
+        return;
+      }
+    }
+  }
+}
+
+// The first nameserver in /etc/resolv.conf, or 127.0.0.1 if there is none.
+inline evio::SocketAddress system_nameserver()
+{
+  std::ifstream resolv_conf("/etc/resolv.conf");
+  std::string keyword;
+  std::string address;
+  while (resolv_conf >> keyword)
+  {
+    if (keyword == "nameserver" && resolv_conf >> address)
+      return evio::SocketAddress(address.c_str(), 53);
+    std::getline(resolv_conf, keyword);
+  }
+  return evio::SocketAddress("127.0.0.1", 53);
+}
+
+} // namespace dns
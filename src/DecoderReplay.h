@@ -0,0 +1,54 @@
+// Drive a protocol decoder from memory, without an InputDevice.
+//
+// DecoderAccess calls the protected end_of_msg_finder and decode of any
+// evio::protocol::Decoder, so that a benchmark can measure a decoder without the event
+// loop.
+//
+// replay(decoder, stream, read_size) passes stream to decoder the way an InputDevice
+// would after reading read_size bytes at a time: end_of_msg_finder only sees the bytes
+// that it didn't see before, while decode gets the whole message, which may span reads.
+// The decoder may modify the data in place (websocket::Decoder unmasks frames), so
+// stream must not refer to a const object.
+
+#pragma once
+
+#include "evio/protocol/Decoder.h"
+#include <algorithm>
+#include <string>
+
+// Gives access to the protected virtual functions of any Decoder.
+class DecoderAccess : public evio::protocol::Decoder
+{
+ public:
+  static size_t call_end_of_msg_finder(evio::protocol::Decoder& decoder, char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& result)
+  {
+    return (decoder.*&DecoderAccess::end_of_msg_finder)(new_data, rlen, result);
+  }
+
+  static void call_decode(evio::protocol::Decoder& decoder, int& allow_deletion_count, evio::MsgBlock&& msg)
+  {
+    (decoder.*&DecoderAccess::decode)(allow_deletion_count, std::move(msg));
+  }
+};
+
+// Feed stream to decoder in reads of read_size bytes.
+inline void replay(evio::protocol::Decoder& decoder, std::string const& stream, size_t read_size)
+{
+  int allow_deletion_count = 0;
+  evio::EndOfMsgFinderResult result;
+  char const* const begin = stream.data();
+  char const* const end = begin + stream.size();
+  char const* msg_start = begin;
+  for (char const* read_end = begin; read_end < end;)
+  {
+    char const* new_data = read_end;
+    read_end = std::min(end, read_end + read_size);
+    size_t len;
+    while (new_data < read_end && (len = DecoderAccess::call_end_of_msg_finder(decoder, new_data, read_end - new_data, result)) > 0)
+    {
+      new_data += len;
+      DecoderAccess::call_decode(decoder, allow_deletion_count, evio::MsgBlock(msg_start, new_data - msg_start, nullptr));
+      msg_start = new_data;
+    }
+  }
+}
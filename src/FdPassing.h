@@ -0,0 +1,246 @@
+// Passing file descriptors to another process.
+//
+// A supervisor process can hand accepted connections (or any other fd) to worker
+// processes over UNIX sockets (SCM_RIGHTS ancillary data), instead of proxying the
+// bytes. Every fd is sent together with one byte; hence the fds and the byte stream
+// stay in sync, even when the kernel splits or merges the data.
+//
+// HandoffSender is an OutputDevice (the supervisor side of a socketpair(2)) with a
+// queue of fds; write_to_fd sends up to max_fds_per_message fds per sendmsg(2) and
+// closes them once they are sent. FdReceiver is an InputDevice (the worker side)
+// whose read_from_fd uses recvmsg(2): the received fds are queued and the bytes are
+// passed to the protocol decoder as usual. A decoder derived from FdDecoder gets a
+// call to fd_received(fd) for each byte, with the fd that belongs to it. A worker
+// can then adopt a socket by calling init(fd, remote_address) on a freshly created
+// evio::Socket.
+
+#pragma once
+
+#include "evio/InputDevice.h"
+#include "evio/OutputDevice.h"
+#include "evio/protocol/Decoder.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static constexpr size_t max_fds_per_message = 32;
+
+//=============================================================================
+// Supervisor side.
+//
+
+class HandoffSender : public evio::OutputDevice
+{
+ private:
+  std::mutex m_queue_mutex;
+  std::deque<int> m_queue;      // The fds that still have to be sent.
+  size_t m_unsent_bytes;        // Bytes of a partial sendmsg whose fds were already sent.
+
+ public:
+  HandoffSender() : m_unsent_bytes(0) { }
+
+  ~HandoffSender()
+  {
+    for (int fd : m_queue)
+      ::close(fd);
+  }
+
+  void init(int fd) { fd_init(fd); }
+
+  // Pass fd to the worker process. The fd is closed in this process once it is sent.
+  void send_fd(int fd)
+  {
+    std::lock_guard<std::mutex> lock(m_queue_mutex);
+    m_queue.push_back(fd);
+    start_output_device();
+  }
+
+ protected:
+  void write_to_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline void HandoffSender::write_to_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "HandoffSender::write_to_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  static std::array<char, max_fds_per_message> const payload = {};
+  for (;;)
+  {
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(payload.data());
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(max_fds_per_message * sizeof(int))];
+    std::array<int, max_fds_per_message> fds;
+    size_t number_of_fds = 0;
+    if (m_unsent_bytes > 0)
+      iov.iov_len = m_unsent_bytes;             // Send the remaining bytes of the previous message, without fds.
+    else
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        number_of_fds = std::min(m_queue.size(), max_fds_per_message);
+        if (number_of_fds == 0)
+        {
+          // Stop while holding the lock, so that a concurrent send_fd restarts us.
+          stop_output_device(allow_deletion_count);
+          return;
+        }
+        std::copy(m_queue.begin(), m_queue.begin() + number_of_fds, fds.begin());
+      }
+      iov.iov_len = number_of_fds;
+      msg.msg_control = control;
+      msg.msg_controllen = CMSG_SPACE(number_of_fds * sizeof(int));
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(number_of_fds * sizeof(int));
+      std::memcpy(CMSG_DATA(cmsg), fds.data(), number_of_fds * sizeof(int));
+    }
+    ssize_t wlen = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (wlen == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        write_error(allow_deletion_count, errno);
+      return;
+    }
+    if (number_of_fds == 0)
+    {
+      m_unsent_bytes -= wlen;
+      continue;
+    }
+    // The fds are attached to the first byte; after a partial write they were all sent nevertheless.
+    m_unsent_bytes = number_of_fds - wlen;
+    for (size_t i = 0; i < number_of_fds; ++i)
+      ::close(fds[i]);
+    std::lock_guard<std::mutex> lock(m_queue_mutex);
+    m_queue.erase(m_queue.begin(), m_queue.begin() + number_of_fds);
+  }
+}
+
+//=============================================================================
+// Worker side.
+//
+
+class FdReceiver : public evio::InputDevice
+{
+ private:
+  std::deque<int> m_received_fds;       // Received fds whose byte wasn't decoded yet.
+
+ public:
+  ~FdReceiver()
+  {
+    for (int fd : m_received_fds)
+      ::close(fd);
+  }
+
+  void init(int fd) { fd_init(fd); }
+
+  // Return the fd that belongs to the byte that is being decoded, or -1 if it didn't come with one.
+  int pop_fd()
+  {
+    if (m_received_fds.empty())
+      return -1;
+    int fd = m_received_fds.front();
+    m_received_fds.pop_front();
+    return fd;
+  }
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline void FdReceiver::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "FdReceiver::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  for (;;)
+  {
+    size_t space = m_ibuffer->dev2buf_contiguous();
+    if (space == 0 && (space = m_ibuffer->dev2buf_contiguous_forced()) == 0)
+    {
+      stop_input_device();
+      return;
+    }
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    struct iovec iov;
+    iov.iov_base = m_ibuffer->dev2buf_ptr();
+    iov.iov_len = space;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(max_fds_per_message * sizeof(int))];
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t rlen = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (rlen == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        read_error(allow_deletion_count, errno);
+      return;
+    }
+    if (rlen == 0)
+    {
+      read_returned_zero(allow_deletion_count);
+      return;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+      size_t const number_of_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      int const* fds = reinterpret_cast<int const*>(CMSG_DATA(cmsg));
+      for (size_t i = 0; i < number_of_fds; ++i)
+        m_received_fds.push_back(fds[i]);
+    }
+    // This can only happen when the sender sends more fds per message than max_fds_per_message.
+    // The kernel discarded fds, so the bytes and m_received_fds are no longer in step; give up.
+    if ((msg.msg_flags & MSG_CTRUNC))
+    {
+      Dout(dc::warning, "FdReceiver: fds were discarded because the control buffer is too small.");
+      for (int received_fd : m_received_fds)
+        ::close(received_fd);
+      m_received_fds.clear();
+      read_error(allow_deletion_count, EMSGSIZE);
+      return;
+    }
+    char* new_data = m_ibuffer->dev2buf_ptr();
+    m_ibuffer->dev2buf_bump(rlen);
+    data_received(allow_deletion_count, new_data, rlen);
+    // Stop when the decoder closed this device.
+    if (!state_t::wat(m_state)->m_flags.is_r_open())
+      return;
+  }
+}
+
+// Every byte received by an FdReceiver is a message that carries one fd.
+class FdDecoder : public evio::protocol::Decoder
+{
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t UNUSED_ARG(rlen), evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override
+  {
+    return 1;
+  }
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& UNUSED_ARG(msg)) override
+  {
+    int fd = static_cast<FdReceiver*>(m_input_device)->pop_fd();
+    if (fd == -1)
+    {
+      Dout(dc::warning, "FdDecoder: received a byte without an fd.");
+      return;
+    }
+    fd_received(allow_deletion_count, fd);
+  }
+
+  // Called with every received fd. The decoder takes ownership of fd.
+  virtual void fd_received(int& allow_deletion_count, int fd) = 0;
+};
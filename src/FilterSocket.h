@@ -0,0 +1,618 @@
+// Filter stages between the buffers of a socket and its fd.
+//
+// TLSSocket puts protocol::TLS between the OutputBuffer and write(2), and between
+// read(2) and the InputBuffer. FilterSocket does the same for any pair of stages:
+// OutputStream users write plain data, the decoder receives plain data, and the fd
+// carries the transformed stream.
+//
+// A stage is any class with the following (non-virtual) members:
+//
+//   // Consume input from [in, in_end) and produce output into [out, out_end), advancing
+//   // in and out. If flush is set then all data that is buffered inside the stage must
+//   // be produced as well, as far as output space allows.
+//   void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool flush);
+//
+//   // Return true if the stage has output that didn't fit in the last call.
+//   bool has_pending_output() const;
+//
+//   // Return a description of the error if the input couldn't be transformed (for example,
+//   // a corrupt compressed stream), or nullptr. After an error transform does nothing.
+//   char const* error() const;
+//
+// A stage never throws on bad input: the input comes from the peer, and FilterSocket
+// reports a stage error through read_error (with EPROTO), like any other read error.
+//
+// Several stages can be layered in any order with filter::Chain<Stage1, Stage2, ...>,
+// which is itself a stage; for example
+//
+//   FilterSocket<filter::Chain<filter::ChecksumEncoder, filter::ZlibCompressor, filter::FrameEncoder>,
+//                filter::Chain<filter::FrameDecoder, filter::ZlibDecompressor, filter::ChecksumDecoder>>
+//
+// The output stage reads directly from the MemoryBlocks of the OutputBuffer and the
+// input stage writes directly into the MemoryBlocks of the InputBuffer; the only other
+// buffers are the two wire buffers of wire_buffer_size bytes, plus one intermediate
+// buffer between every two stages of a Chain.
+//
+// When the InputBuffer is full, data that was already read from the fd (or that is
+// still inside the input stage) can't be passed on. The input device is then stopped
+// and, because the fd won't become readable for data that we already have, a timer
+// checks every input_retry_interval whether the decoder or the GetThread made space;
+// once everything was passed on, reading from the fd resumes.
+
+#pragma once
+
+#include "evio/Socket.h"
+#include "threadpool/Timer.h"
+#include "utils/AIAlert.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace filter {
+
+// Passes the data unchanged.
+class Identity
+{
+ public:
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool UNUSED_ARG(flush))
+  {
+    size_t const len = std::min(in_end - in, out_end - out);
+    std::memcpy(out, in, len);
+    in += len;
+    out += len;
+  }
+
+  bool has_pending_output() const { return false; }
+  char const* error() const { return nullptr; }
+};
+
+// Streaming zlib (deflate) compression. Every flush ends with a Z_SYNC_FLUSH, so that
+// the peer can decompress everything that was sent so far.
+class ZlibCompressor
+{
+ private:
+  z_stream m_stream;
+  bool m_pending_output;
+
+ public:
+  ZlibCompressor(int level = Z_DEFAULT_COMPRESSION) : m_pending_output(false)
+  {
+    std::memset(&m_stream, 0, sizeof(m_stream));
+    if (deflateInit(&m_stream, level) != Z_OK)
+      THROW_ALERT("deflateInit failed");
+  }
+
+  ZlibCompressor(ZlibCompressor const&) = delete;
+  ~ZlibCompressor() { deflateEnd(&m_stream); }
+
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool flush)
+  {
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+    m_stream.avail_in = in_end - in;
+    m_stream.next_out = reinterpret_cast<Bytef*>(out);
+    m_stream.avail_out = out_end - out;
+    deflate(&m_stream, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+    in = reinterpret_cast<char const*>(m_stream.next_in);
+    out = reinterpret_cast<char*>(m_stream.next_out);
+    // If all output space was used then deflate might have more.
+    m_pending_output = m_stream.avail_out == 0;
+  }
+
+  bool has_pending_output() const { return m_pending_output; }
+  char const* error() const { return nullptr; }
+};
+
+class ZlibDecompressor
+{
+ private:
+  z_stream m_stream;
+  bool m_pending_output;
+  bool m_stream_end;            // Set when inflate returned Z_STREAM_END.
+  char const* m_error;
+
+ public:
+  ZlibDecompressor() : m_pending_output(false), m_stream_end(false), m_error(nullptr)
+  {
+    std::memset(&m_stream, 0, sizeof(m_stream));
+    if (inflateInit(&m_stream) != Z_OK)
+      THROW_ALERT("inflateInit failed");
+  }
+
+  ZlibDecompressor(ZlibDecompressor const&) = delete;
+  ~ZlibDecompressor() { inflateEnd(&m_stream); }
+
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool UNUSED_ARG(flush))
+  {
+    if (m_error)
+      return;
+    if (m_stream_end)
+    {
+      // The compressed stream ended; nothing may follow it.
+      if (in != in_end)
+        m_error = "inflate: data after the end of the stream";
+      m_pending_output = false;
+      return;
+    }
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+    m_stream.avail_in = in_end - in;
+    m_stream.next_out = reinterpret_cast<Bytef*>(out);
+    m_stream.avail_out = out_end - out;
+    int ret = inflate(&m_stream, Z_SYNC_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+    {
+      m_error = m_stream.msg ? m_stream.msg : "inflate: error";
+      m_pending_output = false;
+      return;
+    }
+    in = reinterpret_cast<char const*>(m_stream.next_in);
+    out = reinterpret_cast<char*>(m_stream.next_out);
+    m_stream_end = ret == Z_STREAM_END;
+    m_pending_output = !m_stream_end && m_stream.avail_out == 0;
+  }
+
+  bool has_pending_output() const { return m_pending_output; }
+  char const* error() const { return m_error; }
+};
+
+#ifdef HAVE_ZSTD
+// Streaming zstd compression. Every flush ends with ZSTD_e_flush, which ends the current block.
+class ZstdCompressor
+{
+ private:
+  ZSTD_CCtx* m_cctx;
+  bool m_pending_output;
+
+ public:
+  ZstdCompressor(int level = 3) : m_cctx(ZSTD_createCCtx()), m_pending_output(false)
+  {
+    ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel, level);
+  }
+
+  ZstdCompressor(ZstdCompressor const&) = delete;
+  ~ZstdCompressor() { ZSTD_freeCCtx(m_cctx); }
+
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool flush)
+  {
+    ZSTD_inBuffer input = { in, static_cast<size_t>(in_end - in), 0 };
+    ZSTD_outBuffer output = { out, static_cast<size_t>(out_end - out), 0 };
+    size_t remaining = ZSTD_compressStream2(m_cctx, &output, &input, flush ? ZSTD_e_flush : ZSTD_e_continue);
+    if (ZSTD_isError(remaining))
+      THROW_ALERT("ZSTD_compressStream2: [MSG]", AIArgs("[MSG]", ZSTD_getErrorName(remaining)));
+    in += input.pos;
+    out += output.pos;
+    m_pending_output = flush && remaining > 0;
+  }
+
+  bool has_pending_output() const { return m_pending_output; }
+  char const* error() const { return nullptr; }
+};
+
+class ZstdDecompressor
+{
+ private:
+  ZSTD_DCtx* m_dctx;
+  bool m_pending_output;
+  char const* m_error;
+
+ public:
+  ZstdDecompressor() : m_dctx(ZSTD_createDCtx()), m_pending_output(false), m_error(nullptr) { }
+  ZstdDecompressor(ZstdDecompressor const&) = delete;
+  ~ZstdDecompressor() { ZSTD_freeDCtx(m_dctx); }
+
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool UNUSED_ARG(flush))
+  {
+    if (m_error)
+      return;
+    ZSTD_inBuffer input = { in, static_cast<size_t>(in_end - in), 0 };
+    ZSTD_outBuffer output = { out, static_cast<size_t>(out_end - out), 0 };
+    size_t ret = ZSTD_decompressStream(m_dctx, &output, &input);
+    if (ZSTD_isError(ret))
+    {
+      m_error = ZSTD_getErrorName(ret);
+      m_pending_output = false;
+      return;
+    }
+    in += input.pos;
+    out += output.pos;
+    m_pending_output = output.pos == output.size;
+  }
+
+  bool has_pending_output() const { return m_pending_output; }
+  char const* error() const { return m_error; }
+};
+#endif // HAVE_ZSTD
+
+// Splits the stream into blocks of at most max_block_size bytes, each preceded by its
+// size as a 32-bit big-endian integer and, if WithChecksum, followed by the CRC-32 of
+// the block.
+template<bool WithChecksum, size_t max_block_size = 16384>
+class BlockEncoder
+{
+ private:
+  static constexpr size_t overhead = WithChecksum ? 8 : 4;
+
+ public:
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool UNUSED_ARG(flush))
+  {
+    while (in < in_end && out_end - out > static_cast<ptrdiff_t>(overhead))
+    {
+      size_t const len = std::min({static_cast<size_t>(in_end - in), static_cast<size_t>(out_end - out) - overhead, max_block_size});
+      out = put_uint32(out, len);
+      std::memcpy(out, in, len);
+      if constexpr (WithChecksum)
+        out = put_uint32(out + len, crc32(0, reinterpret_cast<Bytef const*>(in), len));
+      else
+        out += len;
+      in += len;
+    }
+  }
+
+  bool has_pending_output() const { return false; }
+  char const* error() const { return nullptr; }
+
+ private:
+  static char* put_uint32(char* out, uint32_t value)
+  {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      *out++ = static_cast<char>(value >> shift);
+    return out;
+  }
+};
+
+// The reverse of BlockEncoder. A checksum that doesn't match is an error.
+template<bool WithChecksum>
+class BlockDecoder
+{
+ private:
+  enum state_type { header, payload, trailer };
+  state_type m_state;
+  uint32_t m_value;             // The header or trailer, as far as it was received.
+  int m_value_bytes;            // The number of bytes of m_value that were received.
+  uint32_t m_remaining;         // The number of payload bytes of the current block that weren't received yet.
+  uLong m_crc;                  // The CRC-32 of the payload of the current block received so far.
+  char const* m_error;
+
+ public:
+  BlockDecoder() : m_state(header), m_value(0), m_value_bytes(0), m_remaining(0), m_crc(0), m_error(nullptr) { }
+
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool UNUSED_ARG(flush))
+  {
+    while (in < in_end && !m_error)
+    {
+      if (m_state == payload)
+      {
+        size_t const len = std::min({static_cast<size_t>(in_end - in), static_cast<size_t>(out_end - out), static_cast<size_t>(m_remaining)});
+        if (len == 0)
+          return;               // The output is full.
+        std::memcpy(out, in, len);
+        if constexpr (WithChecksum)
+          m_crc = crc32(m_crc, reinterpret_cast<Bytef const*>(in), len);
+        in += len;
+        out += len;
+        if ((m_remaining -= len) == 0)
+          m_state = WithChecksum ? trailer : header;
+        continue;
+      }
+      m_value = (m_value << 8) | static_cast<unsigned char>(*in++);
+      if (++m_value_bytes < 4)
+        continue;
+      if (m_state == header)
+      {
+        m_remaining = m_value;
+        m_crc = crc32(0, nullptr, 0);
+        m_state = m_remaining > 0 ? payload : (WithChecksum ? trailer : header);
+      }
+      else
+      {
+        if (m_value != m_crc)
+        {
+          m_error = "BlockDecoder: checksum mismatch";
+          return;
+        }
+        m_state = header;
+      }
+      m_value = 0;
+      m_value_bytes = 0;
+    }
+  }
+
+  bool has_pending_output() const { return false; }
+  char const* error() const { return m_error; }
+};
+
+using FrameEncoder = BlockEncoder<false>;
+using FrameDecoder = BlockDecoder<false>;
+using ChecksumEncoder = BlockEncoder<true>;
+using ChecksumDecoder = BlockDecoder<true>;
+
+// Two stages in series, with an intermediate buffer of buffer_size bytes.
+template<class First, class Second, size_t buffer_size = 16384>
+class Pipeline
+{
+ private:
+  First m_first;
+  Second m_second;
+  char m_buffer[buffer_size];
+  char const* m_start;          // Output of m_first that wasn't consumed by m_second yet
+  char* m_end;                  // is in the range [m_start, m_end).
+
+ public:
+  Pipeline() : m_start(m_buffer), m_end(m_buffer) { }
+  Pipeline(Pipeline const&) = delete;
+
+  void transform(char const*& in, char const* in_end, char*& out, char* out_end, bool flush)
+  {
+    for (;;)
+    {
+      if (m_start == m_end)
+        m_start = m_end = m_buffer;
+      char const* const in_before = in;
+      char* const end_before = m_end;
+      m_first.transform(in, in_end, m_end, m_buffer + buffer_size, flush);
+      // Only flush the second stage once the first stage is completely flushed.
+      bool const first_flushed = flush && in == in_end && !m_first.has_pending_output();
+      char const* const start_before = m_start;
+      char* const out_before = out;
+      m_second.transform(m_start, m_end, out, out_end, first_flushed);
+      if (out == out_end || (in == in_before && m_end == end_before && m_start == start_before && out == out_before))
+        break;
+    }
+  }
+
+  bool has_pending_output() const { return !error() && (m_start != m_end || m_first.has_pending_output() || m_second.has_pending_output()); }
+  char const* error() const { return m_first.error() ? m_first.error() : m_second.error(); }
+};
+
+// Any number of stages in series, composed at compile time: the data passes through
+// Stages from left to right. Since the stages aren't polymorphic, all transform
+// calls can be inlined.
+template<class... Stages>
+struct ChainHelper;
+
+template<class Stage>
+struct ChainHelper<Stage>
+{
+  using type = Stage;
+};
+
+template<class First, class... Rest>
+struct ChainHelper<First, Rest...>
+{
+  using type = Pipeline<First, typename ChainHelper<Rest...>::type>;
+};
+
+template<class... Stages>
+using Chain = typename ChainHelper<Stages...>::type;
+
+} // namespace filter
+
+template<class OutputStage, class InputStage>
+class FilterSocket : public evio::Socket
+{
+ public:
+  static constexpr size_t wire_buffer_size = 65536;
+  using input_retry_interval = threadpool::Interval<1, std::chrono::milliseconds>;
+
+ protected:
+  OutputStage m_output_stage;
+  InputStage m_input_stage;
+
+ private:
+  std::unique_ptr<char[]> m_wire_out;   // Transformed data that still has to be written to the fd.
+  char const* m_wire_out_start;
+  char const* m_wire_out_end;
+  bool m_output_unflushed;              // Set when the output stage might hold data that still has to be flushed.
+  std::unique_ptr<char[]> m_wire_in;    // Data read from the fd that wasn't passed through the input stage yet.
+  char const* m_wire_in_start;
+  char const* m_wire_in_end;
+  size_t m_wire_bytes_written;
+  size_t m_wire_bytes_read;
+  std::mutex m_input_mutex;             // Serializes read_from_fd and retry_input.
+  threadpool::Timer m_input_retry_timer;
+  bool m_input_retry_pending;           // Set while m_input_retry_timer runs. Protected by m_input_mutex.
+
+  enum input_result_type
+  {
+    need_more_input,                    // Everything was passed on; read from the fd.
+    input_buffer_full,                  // There is more, but the InputBuffer is full.
+    input_closed                        // The device was closed, or an error was reported.
+  };
+
+ public:
+  FilterSocket() :
+    m_wire_out(new char[wire_buffer_size]), m_wire_out_start(m_wire_out.get()), m_wire_out_end(m_wire_out.get()), m_output_unflushed(false),
+    m_wire_in(new char[wire_buffer_size]), m_wire_in_start(m_wire_in.get()), m_wire_in_end(m_wire_in.get()),
+    m_wire_bytes_written(0), m_wire_bytes_read(0), m_input_retry_pending(false) { }
+
+  size_t wire_bytes_written() const { return m_wire_bytes_written; }
+  size_t wire_bytes_read() const { return m_wire_bytes_read; }
+
+ protected:
+  void write_to_fd(int& allow_deletion_count, int fd) override;
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+
+ private:
+  input_result_type process_input(int& allow_deletion_count);
+  void wait_for_input_space();
+  void retry_input();
+};
+
+template<class OutputStage, class InputStage>
+void FilterSocket<OutputStage, InputStage>::write_to_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::evio, "FilterSocket::write_to_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  if (!(m_connected_flags & is_connected))
+  {
+    // Let Socket handle the completion of connect(). Nothing may be written to the OutputStream before the socket is connected.
+    evio::Socket::write_to_fd(allow_deletion_count, fd);
+    return;
+  }
+  for (;;)
+  {
+    // Write what is left in the wire buffer first.
+    while (m_wire_out_start < m_wire_out_end)
+    {
+      ssize_t wlen = ::write(fd, m_wire_out_start, m_wire_out_end - m_wire_out_start);
+      if (wlen == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        if (errno != EAGAIN)
+          write_error(allow_deletion_count, errno);
+        return;
+      }
+      m_wire_out_start += wlen;
+      m_wire_bytes_written += wlen;
+    }
+    char* out = m_wire_out.get();
+    m_wire_out_start = out;
+    size_t len = m_obuffer->buf2dev_contiguous();
+    if (len == 0)
+      len = m_obuffer->buf2dev_contiguous_forced();
+    char const* in = m_obuffer->buf2dev_ptr();
+    if (len > 0)
+    {
+      m_output_stage.transform(in, in + len, out, out + wire_buffer_size, false);
+      m_obuffer->buf2dev_bump(in - m_obuffer->buf2dev_ptr());
+      m_output_unflushed = true;
+    }
+    else if (m_output_unflushed)
+    {
+      // The buffer ran empty; get everything out of the output stage.
+      m_output_stage.transform(in, in, out, out + wire_buffer_size, true);
+      m_output_unflushed = m_output_stage.has_pending_output();
+    }
+    else
+    {
+      stop_output_device(allow_deletion_count);
+      // If data was added after we found the buffer empty, then start_output_device() might have been a no-op.
+      if (m_obuffer->buf2dev_contiguous_forced() > 0)
+        start_output_device();
+      return;
+    }
+    m_wire_out_end = out;
+  }
+}
+
+template<class OutputStage, class InputStage>
+void FilterSocket<OutputStage, InputStage>::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::evio, "FilterSocket::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  std::lock_guard<std::mutex> lock(m_input_mutex);
+  for (;;)
+  {
+    // Pass on what we have first.
+    input_result_type result = process_input(allow_deletion_count);
+    if (result == input_closed)
+      return;
+    if (result == input_buffer_full)
+    {
+      wait_for_input_space();
+      return;
+    }
+    ssize_t rlen = ::read(fd, m_wire_in.get(), wire_buffer_size);
+    if (rlen == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        read_error(allow_deletion_count, errno);
+      return;
+    }
+    if (rlen == 0)
+    {
+      read_returned_zero(allow_deletion_count);
+      return;
+    }
+    m_wire_in_start = m_wire_in.get();
+    m_wire_in_end = m_wire_in_start + rlen;
+    m_wire_bytes_read += rlen;
+  }
+}
+
+// Pass the data in m_wire_in, and whatever the input stage still holds, through the input stage into the InputBuffer.
+// Must be called with m_input_mutex locked.
+template<class OutputStage, class InputStage>
+typename FilterSocket<OutputStage, InputStage>::input_result_type FilterSocket<OutputStage, InputStage>::process_input(int& allow_deletion_count)
+{
+  while (m_wire_in_start < m_wire_in_end || m_input_stage.has_pending_output())
+  {
+    size_t space = m_ibuffer->dev2buf_contiguous();
+    if (space == 0 && (space = m_ibuffer->dev2buf_contiguous_forced()) == 0)
+      return input_buffer_full;
+    char* const new_data = m_ibuffer->dev2buf_ptr();
+    char* out = new_data;
+    char const* const in_before = m_wire_in_start;
+    m_input_stage.transform(m_wire_in_start, m_wire_in_end, out, out + space, false);
+    if (char const* error = m_input_stage.error())
+    {
+      // The peer sent something that the input stage can't decode.
+      Dout(dc::warning, "FilterSocket: " << error);
+      read_error(allow_deletion_count, EPROTO);
+      return input_closed;
+    }
+    size_t const rlen = out - new_data;
+    if (rlen > 0)
+    {
+      m_ibuffer->dev2buf_bump(rlen);
+      data_received(allow_deletion_count, new_data, rlen);
+      // Stop when the decoder closed this device.
+      if (!state_t::wat(m_state)->m_flags.is_r_open())
+        return input_closed;
+    }
+    else if (m_wire_in_start == in_before && (m_wire_in_start < m_wire_in_end || m_input_stage.has_pending_output()))
+    {
+      // The stage neither consumed nor produced anything, while it had input (or claims to have output):
+      // calling it again won't change that.
+      Dout(dc::warning, "FilterSocket: the input stage doesn't make progress.");
+      read_error(allow_deletion_count, EPROTO);
+      return input_closed;
+    }
+  }
+  return need_more_input;
+}
+
+// The InputBuffer is full while there is still input to pass on. Must be called with m_input_mutex locked.
+template<class OutputStage, class InputStage>
+void FilterSocket<OutputStage, InputStage>::wait_for_input_space()
+{
+  // Don't read more from the fd until the input that we have was passed on.
+  stop_input_device();
+  if (m_input_retry_pending)
+    return;
+  m_input_retry_pending = true;
+  // Keep this device alive until the timer fired.
+  boost::intrusive_ptr<FilterSocket> self(this);
+  m_input_retry_timer.start(input_retry_interval(), [self]() mutable {
+      // release_callback destroys this lambda, including self; keep the reference alive until retry_input() returned.
+      boost::intrusive_ptr<FilterSocket> socket(std::move(self));
+      socket->m_input_retry_timer.release_callback();
+      socket->retry_input();
+  });
+}
+
+// Called by m_input_retry_timer.
+template<class OutputStage, class InputStage>
+void FilterSocket<OutputStage, InputStage>::retry_input()
+{
+  int allow_deletion_count = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_input_mutex);
+    m_input_retry_pending = false;
+    if (!state_t::wat(m_state)->m_flags.is_r_open())
+      return;
+    input_result_type const result = process_input(allow_deletion_count);
+    if (result == input_buffer_full)
+      wait_for_input_space();
+    else if (result == need_more_input)
+      start_input_device();     // Resume reading from the fd.
+  }
+  if (allow_deletion_count > 0)
+    allow_deletion(allow_deletion_count);
+}
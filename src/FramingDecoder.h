@@ -0,0 +1,260 @@
+// A decoder for length-prefixed frames.
+//
+// framing::Decoder<LengthPrefix> splits a byte stream into frames that consist of a
+// length header followed by that many bytes of payload. The header is parsed once, as
+// it arrives (it may be split over several reads); after that end_of_msg_finder only
+// counts bytes: the payload is never looked at before decode_frame gets it, and
+// decode_frame gets a pointer to the payload directly (the header is skipped without
+// being parsed again).
+//
+// bytes_needed() returns the number of bytes that are still missing of the current
+// frame, as far as known; a device can use this to size its reads.
+//
+// LengthPrefix is one of
+//
+//   framing::Fixed<N>     - an N byte (1, 2, 4 or 8) big-endian unsigned integer,
+//   framing::Varint       - a base 128 varint (as used by protocol buffers); the low
+//                           seven bits come first and the high bit is set on all
+//                           bytes but the last.
+//
+// Frames larger than max_frame_size, or a varint of more than ten bytes, call on_error
+// after which the rest of the stream is ignored; the default on_error closes the input
+// device.
+//
+// framing::write_frame<LengthPrefix>(os, data, len) writes a frame; it returns false
+// (and writes nothing) if len is larger than LengthPrefix::max_length.
+
+#pragma once
+
+#include "evio/protocol/Decoder.h"
+#include <cstdint>
+#include <ostream>
+
+namespace framing {
+
+template<int N>
+class Fixed
+{
+  static_assert(N == 1 || N == 2 || N == 4 || N == 8, "Fixed<N>: N must be 1, 2, 4 or 8.");
+
+ private:
+  uint64_t m_length;
+  int m_bytes;                  // The number of header bytes received so far.
+
+ public:
+  static constexpr size_t max_header_size = N;
+  static constexpr uint64_t max_length = N == 8 ? UINT64_MAX : (uint64_t{1} << (8 * N)) - 1;
+
+  Fixed() : m_length(0), m_bytes(0) { }
+
+  void reset() { m_length = 0; m_bytes = 0; }
+
+  // Feed the next byte of the header. Returns true when the header is complete.
+  bool feed(unsigned char c)
+  {
+    m_length = (m_length << 8) | c;
+    return ++m_bytes == N;
+  }
+
+  bool error() const { return false; }
+  uint64_t length() const { return m_length; }
+  size_t header_size() const { return m_bytes; }
+
+  // Parse a whole header from in, which must have max_header_size bytes available.
+  // Returns the size of the header, or zero if it is invalid.
+  static size_t decode(char const* in, uint64_t& length)
+  {
+    length = 0;
+    for (int i = 0; i < N; ++i)
+      length = (length << 8) | static_cast<unsigned char>(in[i]);
+    return N;
+  }
+
+  // Write the header for a frame of length bytes to out; return its size.
+  // length may not be larger than max_length.
+  static size_t encode(uint64_t length, char* out)
+  {
+    ASSERT(length <= max_length);
+    for (int i = 0; i < N; ++i)
+      out[i] = static_cast<char>(length >> (8 * (N - 1 - i)));
+    return N;
+  }
+};
+
+class Varint
+{
+ private:
+  uint64_t m_length;
+  int m_bytes;
+  bool m_error;
+
+ public:
+  static constexpr size_t max_header_size = 10;
+  static constexpr uint64_t max_length = UINT64_MAX;
+
+  Varint() : m_length(0), m_bytes(0), m_error(false) { }
+
+  void reset() { m_length = 0; m_bytes = 0; m_error = false; }
+
+  bool feed(unsigned char c)
+  {
+    if (m_bytes == 9 && c > 1)
+    {
+      // More than 64 bits.
+      m_error = true;
+      return true;
+    }
+    m_length |= static_cast<uint64_t>(c & 0x7f) << (7 * m_bytes);
+    ++m_bytes;
+    return !(c & 0x80);
+  }
+
+  bool error() const { return m_error; }
+  uint64_t length() const { return m_length; }
+  size_t header_size() const { return m_bytes; }
+
+  static size_t decode(char const* in, uint64_t& length)
+  {
+    length = 0;
+    for (size_t n = 0; n < max_header_size; ++n)
+    {
+      unsigned char const c = in[n];
+      if (n == 9 && c > 1)
+        return 0;
+      length |= static_cast<uint64_t>(c & 0x7f) << (7 * n);
+      if (!(c & 0x80))
+        return n + 1;
+    }
+    return 0;   // Not reached.
+  }
+
+  static size_t encode(uint64_t length, char* out)
+  {
+    size_t n = 0;
+    while (length >= 0x80)
+    {
+      out[n++] = static_cast<char>(length | 0x80);
+      length >>= 7;
+    }
+    out[n++] = static_cast<char>(length);
+    return n;
+  }
+};
+
+// Write a frame with len bytes of payload. Returns false, without writing anything, if
+// len doesn't fit in the header.
+template<class LengthPrefix>
+bool write_frame(std::ostream& os, char const* data, size_t len)
+{
+  if (len > LengthPrefix::max_length)
+    return false;
+  char header[LengthPrefix::max_header_size];
+  os.write(header, LengthPrefix::encode(len, header));
+  os.write(data, len);
+  return true;
+}
+
+template<class LengthPrefix>
+class Decoder : public evio::protocol::Decoder
+{
+ public:
+  static constexpr uint64_t max_frame_size = 64 * 1024 * 1024;
+
+ private:
+  LengthPrefix m_prefix;
+  bool m_in_header;             // Set while the header of the current frame is being received.
+  uint64_t m_remaining;         // The number of payload bytes of the current frame that weren't received yet.
+  size_t m_header_size;         // The size of the header of the frame that is passed to the next decode.
+  char const* m_error;
+
+ public:
+  Decoder() : m_in_header(true), m_remaining(0), m_header_size(0), m_error(nullptr) { }
+
+  // The number of bytes that are still missing of the current frame; if the header isn't
+  // complete yet then this is the minimum.
+  uint64_t bytes_needed() const { return m_in_header ? 1 : m_remaining; }
+
+ protected:
+  // A complete frame. The payload is only valid during the call.
+  virtual void decode_frame(int& allow_deletion_count, char const* payload, size_t len) = 0;
+  virtual void on_error(int& allow_deletion_count, char const* CWDEBUG_ONLY(what))
+  {
+    Dout(dc::warning, "framing::Decoder: " << what);
+    close_input_device(allow_deletion_count);
+  }
+
+  size_t end_of_msg_finder(char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& result) override;
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    if (m_error)
+    {
+      char const* const what = m_error;
+      m_error = "";             // Only report the first error.
+      if (*what)
+        on_error(allow_deletion_count, what);
+      return;
+    }
+    decode_frame(allow_deletion_count, msg.get_start() + m_header_size, msg.get_size() - m_header_size);
+  }
+};
+
+template<class LengthPrefix>
+size_t Decoder<LengthPrefix>::end_of_msg_finder(char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result))
+{
+  if (m_error)
+    return rlen;                // Pass everything to decode, which ignores it.
+  size_t i = 0;
+  if (m_in_header)
+  {
+    uint64_t length;
+    if (m_prefix.header_size() == 0 && rlen >= LengthPrefix::max_header_size)     // No header bytes were received yet.
+    {
+      // Fast path: the whole header is available.
+      i = LengthPrefix::decode(new_data, length);
+      m_header_size = i;
+      if (i == 0)
+      {
+        m_error = "Invalid length header.";
+        return rlen;
+      }
+    }
+    else
+    {
+      for (;;)
+      {
+        if (i == rlen)
+          return 0;
+        if (m_prefix.feed(static_cast<unsigned char>(new_data[i++])))
+          break;
+      }
+      if (m_prefix.error())
+      {
+        m_error = "Invalid length header.";
+        return rlen;
+      }
+      length = m_prefix.length();
+      m_header_size = m_prefix.header_size();
+      m_prefix.reset();
+    }
+    if (length > max_frame_size)
+    {
+      m_error = "Frame too large.";
+      return rlen;
+    }
+    m_in_header = false;
+    m_remaining = length;
+  }
+  // Skip the payload without looking at it.
+  if (rlen - i < m_remaining)
+  {
+    m_remaining -= rlen - i;
+    return 0;
+  }
+  i += m_remaining;
+  m_in_header = true;
+  m_remaining = 0;
+  return i;
+}
+
+} // namespace framing
@@ -0,0 +1,183 @@
+// Group commit: coalescing concurrent durable appends into one fdatasync.
+//
+// GroupCommitLog is an append-only file where every append(data, callback) calls its
+// callback once the data is on disk. A single committer thread takes everything that
+// was appended since the previous commit, writes it with one pwrite(2) and makes it
+// durable with one fdatasync(2), and then calls all the callbacks of that group. While
+// the committer waits for the disk, new appends accumulate for the next group, so the
+// number of fdatasync calls adapts to the load without any tuning. Optionally the
+// committer waits commit_delay before taking a group, to let it grow larger.
+//
+// With O_DIRECT all writes must be aligned to (and a multiple of) the logical block
+// size. The last, partial, block is then padded with zeroes and written again, with
+// more data, by the next commit; the file is truncated to its real size on close.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+class GroupCommitLog
+{
+ public:
+  using callback_type = std::function<void()>;
+  static constexpr size_t direct_alignment = 4096;
+
+ private:
+  int m_fd;
+  bool m_direct;                                // Set if the file was opened with O_DIRECT.
+  std::chrono::microseconds m_commit_delay;
+  off_t m_file_size;                            // The number of bytes that are on disk (excluding padding).
+
+  std::mutex m_mutex;
+  std::condition_variable m_appended;
+  std::vector<char> m_pending;                  // Data appended since the last group was taken.
+  std::vector<callback_type> m_callbacks;       // The callbacks that belong to m_pending.
+  bool m_stop;
+
+  char* m_write_buffer;                         // Only used by the committer when O_DIRECT is used.
+  size_t m_write_buffer_size;
+
+  std::atomic<size_t> m_commits;                // The number of fdatasync calls; read by other threads while the committer runs.
+  std::thread m_committer;
+
+ public:
+  GroupCommitLog(char const* path, bool direct, std::chrono::microseconds commit_delay = std::chrono::microseconds(0));
+  ~GroupCommitLog();
+
+  // Append len bytes at data; callback is called from the committer thread once they are on disk.
+  void append(char const* data, size_t len, callback_type callback)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.insert(m_pending.end(), data, data + len);
+    m_callbacks.push_back(std::move(callback));
+    m_appended.notify_one();
+  }
+
+  size_t commits() const { return m_commits.load(std::memory_order_relaxed); }
+
+ private:
+  void committer();
+  void write_group(std::vector<char> const& group);
+};
+
+inline GroupCommitLog::GroupCommitLog(char const* path, bool direct, std::chrono::microseconds commit_delay) :
+  m_direct(direct), m_commit_delay(commit_delay), m_file_size(0), m_stop(false), m_write_buffer(nullptr), m_write_buffer_size(0), m_commits(0)
+{
+  m_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (direct ? O_DIRECT : 0), 0644);
+  if (m_fd == -1)
+    throw std::system_error(errno, std::generic_category(), path);
+  m_committer = std::thread(&GroupCommitLog::committer, this);
+}
+
+inline GroupCommitLog::~GroupCommitLog()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_appended.notify_one();
+  }
+  m_committer.join();
+  // Remove the padding of the last block.
+  if (m_direct && ftruncate(m_fd, m_file_size) == -1)
+    perror("ftruncate");
+  close(m_fd);
+  free(m_write_buffer);
+}
+
+inline void GroupCommitLog::committer()
+{
+  std::vector<char> group;
+  std::vector<callback_type> callbacks;
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_appended.wait(lock, [this]{ return !m_pending.empty() || m_stop; });
+      if (m_pending.empty())
+        return;                 // m_stop is set and everything was committed.
+      if (m_commit_delay.count() > 0)
+      {
+        // Give other writers the chance to join this group.
+        lock.unlock();
+        std::this_thread::sleep_for(m_commit_delay);
+        lock.lock();
+      }
+      group.swap(m_pending);
+      callbacks.swap(m_callbacks);
+    }
+    write_group(group);
+    if (fdatasync(m_fd) == -1)
+    {
+      perror("fdatasync");
+      exit(1);
+    }
+    m_commits.fetch_add(1, std::memory_order_relaxed);
+    for (auto& callback : callbacks)
+      callback();
+    group.clear();
+    callbacks.clear();
+  }
+}
+
+inline void GroupCommitLog::write_group(std::vector<char> const& group)
+{
+  char const* data = group.data();
+  size_t len = group.size();
+  off_t offset = m_file_size;
+  size_t const tail = m_file_size % direct_alignment;
+  if (m_direct)
+  {
+    // Start at the beginning of the last (partial) block, which is still at the start of m_write_buffer.
+    size_t const needed = (tail + len + direct_alignment - 1) & ~(direct_alignment - 1);
+    if (needed > m_write_buffer_size)
+    {
+      char* buffer;
+      if (posix_memalign(reinterpret_cast<void**>(&buffer), direct_alignment, needed) != 0)
+        throw std::bad_alloc();
+      if (m_write_buffer)
+        std::memcpy(buffer, m_write_buffer, tail);
+      free(m_write_buffer);
+      m_write_buffer = buffer;
+      m_write_buffer_size = needed;
+    }
+    std::memcpy(m_write_buffer + tail, data, len);
+    std::memset(m_write_buffer + tail + len, 0, needed - tail - len);
+    data = m_write_buffer;
+    offset = m_file_size - tail;
+    len = needed;
+  }
+  while (len > 0)
+  {
+    ssize_t wlen = pwrite(m_fd, data, len, offset);
+    if (wlen == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("pwrite");
+      exit(1);
+    }
+    data += wlen;
+    len -= wlen;
+    offset += wlen;
+  }
+  m_file_size += group.size();
+  if (m_direct)
+  {
+    // Move the new last partial block to the start of the buffer.
+    size_t const new_tail = m_file_size % direct_alignment;
+    std::memmove(m_write_buffer, m_write_buffer + tail + group.size() - new_tail, new_tail);
+  }
+}
@@ -0,0 +1,552 @@
+// An HTTP/1.1 protocol decoder.
+//
+// http::Decoder splits a byte stream into HTTP/1.1 requests or responses (it detects
+// which from the start line) and hands them to the user as
+//
+//   on_head(allow_deletion_count, head)           - once per message,
+//   on_body(allow_deletion_count, data, len)      - zero or more times, and
+//   on_message_complete(allow_deletion_count)     - once per message,
+//
+// in that order. Any number of messages may be pipelined on the same stream.
+//
+// The end of the header section is found by end_of_msg_finder, which compares sixteen
+// positions at a time against "\r\n\r\n" (SSE2, when available). The header section is
+// then parsed in place: the MessageHead that is passed to on_head only contains
+// std::string_view's into the MsgBlock, so nothing is copied. Those views are only valid
+// for the duration of the on_head call.
+//
+// The body is delimited by Content-Length or by chunked transfer coding. The body is
+// passed to on_body as it arrives, without the chunk framing and also without copying.
+// A response without either (and that is not a 1xx, 204 or 304) lasts until the peer
+// closes the connection; the device must call end_of_input when that happens, which
+// calls on_message_complete for it.
+//
+// Errors (malformed start line or header field, header section larger than
+// max_head_size, invalid chunk size, chunk data not followed by CRLF) call on_error,
+// after which the rest of the stream is ignored. The default on_error closes the input
+// device.
+
+#pragma once
+
+#include "evio/protocol/Decoder.h"
+#include "utils/AIAlert.h"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace http {
+
+namespace simd {
+
+// Return a pointer to the first c in [begin, end), or end if there is none.
+inline char const* find(char const* begin, char const* end, char c)
+{
+  char const* p = static_cast<char const*>(std::memchr(begin, c, end - begin));
+  return p ? p : end;
+}
+
+// Return a pointer to the first c1 or c2 in [begin, end), or end if there is none.
+inline char const* find_either(char const* begin, char const* end, char c1, char c2)
+{
+  char const* p = begin;
+#ifdef __SSE2__
+  __m128i const v1 = _mm_set1_epi8(c1);
+  __m128i const v2 = _mm_set1_epi8(c2);
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+    unsigned int const mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p < end; ++p)
+    if (*p == c1 || *p == c2)
+      break;
+  return p;
+}
+
+// Return a pointer to the first "\r\n\r\n" in [begin, end), or end if there is none.
+inline char const* find_crlfcrlf(char const* begin, char const* end)
+{
+  char const* p = begin;
+#ifdef __SSE2__
+  __m128i const cr = _mm_set1_epi8('\r');
+  __m128i const lf = _mm_set1_epi8('\n');
+  // Compare the sixteen positions p...p+15 at once; each load is shifted by one byte.
+  for (; end - p >= 19; p += 16)
+  {
+    __m128i const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+    __m128i const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 1));
+    __m128i const v2 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 2));
+    __m128i const v3 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 3));
+    __m128i const match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(v0, cr), _mm_cmpeq_epi8(v1, lf)),
+                                        _mm_and_si128(_mm_cmpeq_epi8(v2, cr), _mm_cmpeq_epi8(v3, lf)));
+    unsigned int const mask = _mm_movemask_epi8(match);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; end - p >= 4; ++p)
+    if (p[3] == '\n' && p[2] == '\r' && p[1] == '\n' && p[0] == '\r')
+      return p;
+  return end;
+}
+
+} // namespace simd
+
+// Case-insensitive comparison of a header field name (or token) with a lower case literal.
+inline bool iequals(std::string_view s, std::string_view lower_case)
+{
+  if (s.size() != lower_case.size())
+    return false;
+  for (size_t i = 0; i < s.size(); ++i)
+    if ((s[i] | 0x20) != lower_case[i])
+      return false;
+  return true;
+}
+
+struct Header
+{
+  std::string_view m_name;
+  std::string_view m_value;
+};
+
+// The start line and header fields of one message.
+class MessageHead
+{
+ private:
+  bool m_is_response;
+  int m_http_minor;                     // The x of HTTP/1.x.
+  std::string_view m_method;            // Requests only.
+  std::string_view m_target;            // Requests only.
+  int m_status;                         // Responses only.
+  std::string_view m_reason;            // Responses only.
+  bool m_keep_alive;
+  std::vector<Header> m_headers;
+
+  friend class Decoder;
+
+ public:
+  bool is_response() const { return m_is_response; }
+  int http_minor() const { return m_http_minor; }
+  std::string_view method() const { return m_method; }
+  std::string_view target() const { return m_target; }
+  int status() const { return m_status; }
+  std::string_view reason() const { return m_reason; }
+  bool keep_alive() const { return m_keep_alive; }
+  std::vector<Header> const& headers() const { return m_headers; }
+
+  // Return the value of the first header field named name (which must be lower case), or an empty view.
+  std::string_view operator[](std::string_view name) const
+  {
+    for (Header const& header : m_headers)
+      if (iequals(header.m_name, name))
+        return header.m_value;
+    return {};
+  }
+};
+
+class Decoder : public evio::protocol::Decoder
+{
+ public:
+  static constexpr size_t max_head_size = 65536;
+
+ private:
+  enum state_type
+  {
+    s_head,             // Looking for the end of the header section.
+    s_body,             // Content-Length body; m_remaining bytes left.
+    s_body_until_close, // Body without length.
+    s_chunk_size,       // Parsing the chunk-size line.
+    s_chunk_data,       // Chunk data; m_remaining bytes left.
+    s_chunk_data_end,   // Looking for the CRLF after the chunk data.
+    s_trailer,          // Looking for the end of the trailer section.
+    s_error             // Ignoring everything.
+  };
+
+  // What the block is that end_of_msg_finder returned last; that is the block that is
+  // passed to the next call to decode.
+  enum block_type
+  {
+    b_head,
+    b_body,
+    b_last_body,        // Body, after which the message is complete.
+    b_framing,          // Chunk framing.
+    b_last_framing,     // End of the trailer section; the message is complete.
+    b_error,
+    b_ignore
+  };
+
+  state_type m_state;
+  block_type m_block;
+  uint32_t m_window;                    // The last four bytes of the current header or trailer section seen so far.
+  size_t m_head_size;                   // The number of bytes of the header section seen so far.
+  uint64_t m_remaining;                 // Remaining body bytes (s_body, s_chunk_data) or the chunk size being parsed (s_chunk_size).
+  bool m_chunk_extension;               // Set while skipping a chunk extension (s_chunk_size).
+  bool m_chunk_size_seen;               // Set when at least one hex digit was parsed (s_chunk_size).
+  bool m_chunk_cr_seen;                 // Set when the CR of the CRLF after the chunk data was seen (s_chunk_data_end).
+  MessageHead m_message_head;           // Reused for each message, to avoid reallocating m_headers.
+  char const* m_error;
+
+ public:
+  Decoder() : m_state(s_head), m_block(b_ignore), m_window(0), m_head_size(0), m_remaining(0),
+      m_chunk_extension(false), m_chunk_size_seen(false), m_chunk_cr_seen(false), m_error(nullptr) { m_message_head.m_headers.reserve(16); }
+
+  // The peer closed the connection. Completes a message whose body lasts until the connection is closed.
+  void end_of_input(int& allow_deletion_count)
+  {
+    if (m_state != s_body_until_close)
+      return;
+    m_state = s_head;
+    on_message_complete(allow_deletion_count);
+  }
+
+ protected:
+  virtual void on_head(int& allow_deletion_count, MessageHead const& head) = 0;
+  virtual void on_body(int& UNUSED_ARG(allow_deletion_count), char const* UNUSED_ARG(data), size_t UNUSED_ARG(len)) { }
+  virtual void on_message_complete(int& allow_deletion_count) = 0;
+  virtual void on_error(int& allow_deletion_count, char const* CWDEBUG_ONLY(what))
+  {
+    Dout(dc::warning, "http::Decoder: " << what);
+    close_input_device(allow_deletion_count);
+  }
+
+  size_t end_of_msg_finder(char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& result) override;
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override;
+
+ private:
+  size_t find_end_of_section(char const* new_data, size_t rlen);
+  static constexpr size_t invalid_chunk_size = std::numeric_limits<size_t>::max();
+  size_t find_chunk_size(char const* new_data, size_t rlen);
+  bool parse_head(char const* start, char const* end);
+  size_t error(size_t rlen, char const* what) { m_error = what; m_state = s_error; m_block = b_error; return rlen; }
+};
+
+// Return the length of the header (or trailer) section up to and including the first
+// "\r\n\r\n", or zero if it isn't complete yet. The first three bytes may complete a
+// "\r\n\r\n" that started in a previous call, which is what m_window is for.
+inline size_t Decoder::find_end_of_section(char const* new_data, size_t rlen)
+{
+  size_t const head = std::min(rlen, size_t{3});
+  for (size_t i = 0; i < head; ++i)
+  {
+    m_window = (m_window << 8) | static_cast<unsigned char>(new_data[i]);
+    if (m_window == 0x0d0a0d0a)
+      return i + 1;
+  }
+  char const* const end = new_data + rlen;
+  char const* const crlfcrlf = simd::find_crlfcrlf(new_data, end);
+  if (crlfcrlf != end)
+    return crlfcrlf - new_data + 4;
+  if (rlen >= 4)
+  {
+    uint32_t last4;
+    std::memcpy(&last4, end - 4, 4);
+    m_window = __builtin_bswap32(last4);
+  }
+  return 0;
+}
+
+// Parse (the rest of) a chunk-size line; return its length including the LF, zero if
+// it isn't complete yet, or invalid_chunk_size if it isn't a valid chunk-size line.
+inline size_t Decoder::find_chunk_size(char const* new_data, size_t rlen)
+{
+  char const* const end = new_data + rlen;
+  char const* const lf = simd::find(new_data, end, '\n');
+  for (char const* p = new_data; p < lf && !m_chunk_extension; ++p)
+  {
+    char const c = *p;
+    unsigned int digit;
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+      digit = (c | 0x20) - 'a' + 10;
+    else if (m_chunk_size_seen && (c == ';' || c == ' ' || c == '\t' || c == '\r'))
+    {
+      m_chunk_extension = true;
+      break;
+    }
+    else
+      return invalid_chunk_size;
+    if (m_remaining > (std::numeric_limits<uint64_t>::max() >> 4))
+      return invalid_chunk_size;
+    m_remaining = (m_remaining << 4) | digit;
+    m_chunk_size_seen = true;
+  }
+  if (lf == end)
+    return 0;
+  return m_chunk_size_seen ? lf - new_data + 1 : invalid_chunk_size;
+}
+
+inline size_t Decoder::end_of_msg_finder(char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result))
+{
+  if (rlen == 0)
+    return 0;
+  switch (m_state)
+  {
+    case s_head:
+    {
+      size_t const len = find_end_of_section(new_data, rlen);
+      if (len == 0)
+      {
+        if ((m_head_size += rlen) > max_head_size)
+          return error(rlen, "Header section too large.");
+        return 0;
+      }
+      if (m_head_size + len > max_head_size)
+        return error(rlen, "Header section too large.");
+      m_head_size = 0;
+      m_window = 0;
+      m_block = b_head;
+      return len;
+    }
+    case s_body:
+    {
+      size_t const len = std::min(rlen, static_cast<size_t>(std::min(m_remaining, uint64_t{std::numeric_limits<size_t>::max()})));
+      m_remaining -= len;
+      m_block = m_remaining == 0 ? b_last_body : b_body;
+      if (m_remaining == 0)
+        m_state = s_head;
+      return len;
+    }
+    case s_body_until_close:
+      m_block = b_body;
+      return rlen;
+    case s_chunk_size:
+    {
+      size_t const len = find_chunk_size(new_data, rlen);
+      if (len == invalid_chunk_size)
+        return error(rlen, "Invalid chunk size.");
+      if (len == 0)
+        return 0;
+      m_chunk_extension = false;
+      m_chunk_size_seen = false;
+      m_block = b_framing;
+      if (m_remaining == 0)
+      {
+        // The last chunk; the LF of the chunk-size line may also end an empty trailer section.
+        m_window = 0x0d0a;
+        m_state = s_trailer;
+      }
+      else
+        m_state = s_chunk_data;
+      return len;
+    }
+    case s_chunk_data:
+    {
+      size_t const len = std::min(rlen, static_cast<size_t>(std::min(m_remaining, uint64_t{std::numeric_limits<size_t>::max()})));
+      m_remaining -= len;
+      m_block = b_body;
+      if (m_remaining == 0)
+        m_state = s_chunk_data_end;
+      return len;
+    }
+    case s_chunk_data_end:
+    {
+      // Only "\r\n" (or a bare "\n") may follow the chunk data; skipping anything else
+      // would frame the body differently than a proxy in front of us might (smuggling).
+      size_t i = 0;
+      if (!m_chunk_cr_seen && new_data[0] == '\r')
+      {
+        m_chunk_cr_seen = true;
+        if (rlen == 1)
+          return 0;
+        i = 1;
+      }
+      if (new_data[i] != '\n')
+        return error(rlen, "Chunk data not followed by CRLF.");
+      m_chunk_cr_seen = false;
+      m_block = b_framing;
+      m_state = s_chunk_size;
+      return i + 1;
+    }
+    case s_trailer:
+    {
+      size_t const len = find_end_of_section(new_data, rlen);
+      if (len == 0)
+      {
+        if ((m_head_size += rlen) > max_head_size)
+          return error(rlen, "Trailer section too large.");
+        return 0;
+      }
+      if (m_head_size + len > max_head_size)
+        return error(rlen, "Trailer section too large.");
+      m_head_size = 0;
+      m_window = 0;
+      m_block = b_last_framing;
+      m_state = s_head;
+      return len;
+    }
+    case s_error:
+      m_block = b_ignore;
+      return rlen;
+  }
+  return 0;
+}
+
+// Parse the header section in [start, end), which ends on "\r\n\r\n".
+inline bool Decoder::parse_head(char const* start, char const* end)
+{
+  MessageHead& head = m_message_head;
+  head.m_headers.clear();
+  head.m_method = head.m_target = head.m_reason = {};
+  head.m_status = 0;
+
+  // Ignore empty lines before the start line.
+  char const* p = start;
+  while (p < end && (*p == '\r' || *p == '\n'))
+    ++p;
+
+  // The start line.
+  char const* const eol = simd::find(p, end, '\n');
+  std::string_view line(p, eol - p);
+  if (!line.empty() && line.back() == '\r')
+    line.remove_suffix(1);
+  head.m_is_response = line.substr(0, 5) == "HTTP/";
+  if (head.m_is_response)
+  {
+    // HTTP/1.x SP 3DIGIT SP reason-phrase
+    if (line.size() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' ' ||
+        line[9] < '1' || line[9] > '9' || line[10] < '0' || line[10] > '9' || line[11] < '0' || line[11] > '9' ||
+        (line.size() > 12 && line[12] != ' '))
+      return false;
+    head.m_http_minor = line[7] - '0';
+    head.m_status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    if (line.size() > 13)
+      head.m_reason = line.substr(13);
+  }
+  else
+  {
+    // method SP request-target SP HTTP/1.x
+    size_t const sp1 = line.find(' ');
+    size_t const sp2 = line.rfind(' ');
+    if (sp1 == 0 || sp1 == std::string_view::npos || sp2 == sp1 || line.size() - sp2 != 9 || line.substr(sp2 + 1, 7) != "HTTP/1.")
+      return false;
+    head.m_method = line.substr(0, sp1);
+    head.m_target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    head.m_http_minor = line[sp2 + 8] - '0';
+  }
+  if (head.m_http_minor < 0 || head.m_http_minor > 9)
+    return false;
+  head.m_keep_alive = head.m_http_minor >= 1;
+
+  // The header fields.
+  bool chunked = false;
+  bool has_content_length = false;
+  uint64_t content_length = 0;
+  for (p = eol + 1; p < end;)
+  {
+    if (*p == '\r' || *p == '\n')
+      break;                                            // The empty line at the end.
+    if (*p == ' ' || *p == '\t')
+      return false;                                     // Obsolete line folding.
+    char const* const colon = simd::find_either(p, end, ':', '\n');
+    if (colon == end || *colon != ':' || colon == p || colon[-1] == ' ' || colon[-1] == '\t')
+      return false;
+    char const* const lf = simd::find(colon, end, '\n');
+    char const* value_begin = colon + 1;
+    char const* value_end = lf;
+    while (value_begin < value_end && (*value_begin == ' ' || *value_begin == '\t'))
+      ++value_begin;
+    while (value_end > value_begin && (value_end[-1] == '\r' || value_end[-1] == ' ' || value_end[-1] == '\t'))
+      --value_end;
+    Header const& header = head.m_headers.emplace_back(Header{{p, static_cast<size_t>(colon - p)}, {value_begin, static_cast<size_t>(value_end - value_begin)}});
+    p = lf + 1;
+
+    if (iequals(header.m_name, "content-length"))
+    {
+      if (header.m_value.empty())
+        return false;
+      uint64_t value = 0;
+      for (char c : header.m_value)
+      {
+        if (c < '0' || c > '9' || value > (std::numeric_limits<uint64_t>::max() - 9) / 10)
+          return false;
+        value = value * 10 + (c - '0');
+      }
+      if (has_content_length && value != content_length)
+        return false;
+      has_content_length = true;
+      content_length = value;
+    }
+    else if (iequals(header.m_name, "transfer-encoding"))
+    {
+      // Chunked must be the last transfer coding.
+      std::string_view value = header.m_value;
+      size_t const comma = value.rfind(',');
+      if (comma != std::string_view::npos)
+        value.remove_prefix(comma + 1);
+      while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        value.remove_prefix(1);
+      chunked = iequals(value, "chunked");
+    }
+    else if (iequals(header.m_name, "connection"))
+    {
+      if (iequals(header.m_value, "close"))
+        head.m_keep_alive = false;
+      else if (iequals(header.m_value, "keep-alive"))
+        head.m_keep_alive = true;
+    }
+  }
+
+  // Determine the length of the body. Transfer-Encoding overrides Content-Length.
+  bool const no_body = head.m_is_response && (head.m_status < 200 || head.m_status == 204 || head.m_status == 304);
+  if (no_body)
+    m_state = s_head;
+  else if (chunked)
+  {
+    m_remaining = 0;
+    m_state = s_chunk_size;
+  }
+  else if (has_content_length)
+  {
+    m_remaining = content_length;
+    m_state = content_length > 0 ? s_body : s_head;
+  }
+  else
+    m_state = head.m_is_response ? s_body_until_close : s_head;
+  return true;
+}
+
+inline void Decoder::decode(int& allow_deletion_count, evio::MsgBlock&& msg)
+{
+  switch (m_block)
+  {
+    case b_head:
+      if (!parse_head(msg.get_start(), msg.get_start() + msg.get_size()))
+      {
+        m_state = s_error;
+        on_error(allow_deletion_count, "Malformed header section.");
+        break;
+      }
+      on_head(allow_deletion_count, m_message_head);
+      if (m_state == s_head)
+        on_message_complete(allow_deletion_count);
+      break;
+    case b_body:
+      on_body(allow_deletion_count, msg.get_start(), msg.get_size());
+      break;
+    case b_last_body:
+      on_body(allow_deletion_count, msg.get_start(), msg.get_size());
+      on_message_complete(allow_deletion_count);
+      break;
+    case b_framing:
+      break;
+    case b_last_framing:
+      on_message_complete(allow_deletion_count);
+      break;
+    case b_error:
+      on_error(allow_deletion_count, m_error);
+      break;
+    case b_ignore:
+      break;
+  }
+}
+
+} // namespace http
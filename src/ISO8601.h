@@ -0,0 +1,262 @@
+// Fixed-format ISO 8601 date-time parsing and formatting.
+//
+// iso8601::parse accepts the two forms that occur in XML-RPC,
+//
+//   2021-01-29T15:37:23Z        (extended)
+//   20210129T15:37:23           (compact date, as in the XML-RPC specification)
+//
+// optionally followed by a fraction of a second (ignored) and a time zone: "Z", or an
+// offset "+hh:mm", "-hh:mm", "+hhmm" or "-hhmm". Without time zone UTC is assumed.
+// The digits at the fixed positions are validated and converted eight at a time in a
+// 64-bit word, and the date is converted to days with the days_from_civil algorithm of
+// Howard Hinnant; no locale, strptime or timegm is involved.
+//
+// iso8601::format writes the extended form in UTC (always twenty characters).
+// iso8601::Formatter does the same but caches the last formatted second: formatting the
+// same second again is a copy, and another second of the same day only rewrites the
+// time. A Formatter is not thread-safe; use one per thread.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+
+namespace iso8601 {
+
+// The number of characters that format writes.
+size_t constexpr formatted_size = 20;
+
+namespace detail {
+
+// The number of days since 1970-01-01 of the proleptic Gregorian date y-m-d.
+inline int64_t days_from_civil(int64_t y, unsigned int m, unsigned int d)
+{
+  y -= m <= 2;
+  int64_t const era = (y >= 0 ? y : y - 399) / 400;
+  unsigned int const yoe = static_cast<unsigned int>(y - era * 400);
+  unsigned int const doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  unsigned int const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// The inverse of days_from_civil.
+inline void civil_from_days(int64_t z, int64_t& y, unsigned int& m, unsigned int& d)
+{
+  z += 719468;
+  int64_t const era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned int const doe = static_cast<unsigned int>(z - era * 146097);
+  unsigned int const yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned int const doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned int const mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = static_cast<int64_t>(yoe) + era * 400 + (m <= 2);
+}
+
+// "00" "01" ... "99".
+struct TwoDigits
+{
+  char m_digits[200];
+
+  constexpr TwoDigits() : m_digits()
+  {
+    for (int i = 0; i < 100; ++i)
+    {
+      m_digits[2 * i] = '0' + i / 10;
+      m_digits[2 * i + 1] = '0' + i % 10;
+    }
+  }
+};
+
+inline constexpr TwoDigits two_digits;
+
+inline void write2(char* out, unsigned int value)
+{
+  std::memcpy(out, &two_digits.m_digits[2 * value], 2);
+}
+
+// Write "YYYY-MM-DD" (ten characters).
+inline void write_date(char* out, int64_t days)
+{
+  int64_t y;
+  unsigned int m, d;
+  civil_from_days(days, y, m, d);
+  // Years outside 0000...9999 can't be represented in this format; clamp them.
+  unsigned int const year = y < 0 ? 0 : y > 9999 ? 9999 : static_cast<unsigned int>(y);
+  write2(out, year / 100);
+  write2(out + 2, year % 100);
+  out[4] = '-';
+  write2(out + 5, m);
+  out[7] = '-';
+  write2(out + 8, d);
+}
+
+// Write "HH:MM:SS" (eight characters) for the given second of the day.
+inline void write_time(char* out, unsigned int seconds)
+{
+  write2(out, seconds / 3600);
+  out[2] = ':';
+  write2(out + 3, seconds / 60 % 60);
+  out[5] = ':';
+  write2(out + 6, seconds % 60);
+}
+
+inline int64_t floor_div(int64_t a, int64_t b)
+{
+  int64_t const q = a / b;
+  return q - ((a % b) < 0);
+}
+
+} // namespace detail
+
+// Parse str into the number of seconds since the epoch (1970-01-01T00:00:00Z).
+// Returns false if str is not a date-time in one of the supported forms.
+inline bool parse(std::string_view str, std::time_t& seconds)
+{
+  char const* p = str.data();
+  size_t len = str.size();
+  if (len < 17)
+    return false;
+  bool const extended = p[4] == '-';
+  if (extended && len < 19)
+    return false;
+
+  // Load the date as eight digits "YYYYMMDD" in one 64-bit word (little endian: the first character in the lowest byte).
+  uint64_t date;
+  if (extended)
+  {
+    uint64_t ymd;                       // "YYYY-MM-"
+    uint16_t dd;
+    std::memcpy(&ymd, p, 8);
+    std::memcpy(&dd, p + 8, 2);
+    if (((ymd >> 56) & 0xff) != '-')
+      return false;
+    date = (ymd & 0xffffffff) | (((ymd >> 40) & 0xffff) << 32) | (static_cast<uint64_t>(dd) << 48);
+    p += 10;
+    len -= 10;
+  }
+  else
+  {
+    std::memcpy(&date, p, 8);
+    p += 8;
+    len -= 8;
+  }
+  // p now points to "THH:MM:SS". Load "HH:MM:SS" and turn the colons into zeroes.
+  uint64_t time;
+  std::memcpy(&time, p + 1, 8);
+  uint64_t constexpr colons = 0x0000ff0000ff0000;               // The bytes at index 2 and 5.
+  uint64_t constexpr ascii_colons = 0x00003a00003a0000;
+  if (p[0] != 'T' || (time & colons) != ascii_colons)
+    return false;
+  time ^= ascii_colons ^ 0x0000300000300000;
+
+  // Every byte must be in '0'...'9': its high nibble is 3 and adding six doesn't change that.
+  uint64_t constexpr high_nibbles = 0xf0f0f0f0f0f0f0f0;
+  uint64_t constexpr zeroes = 0x3030303030303030;
+  uint64_t constexpr sixes = 0x0606060606060606;
+  if ((((date & high_nibbles) ^ zeroes) | (((date + sixes) & high_nibbles) ^ zeroes) |
+       ((time & high_nibbles) ^ zeroes) | (((time + sixes) & high_nibbles) ^ zeroes)) != 0)
+    return false;
+  date -= zeroes;
+  time -= zeroes;
+  // Combine pairs of digits: byte 2i becomes 10 * digit 2i + digit 2i+1.
+  uint64_t const date_pairs = (date * 10) + (date >> 8);
+  uint64_t const time_pairs = (time * 10) + (time >> 8);
+
+  unsigned int const year = (date_pairs & 0xff) * 100 + ((date_pairs >> 16) & 0xff);
+  unsigned int const month = (date_pairs >> 32) & 0xff;
+  unsigned int const day = (date_pairs >> 48) & 0xff;
+  unsigned int const hour = time_pairs & 0xff;
+  unsigned int const minute = (time_pairs >> 24) & 0xff;
+  unsigned int const second = (time_pairs >> 48) & 0xff;
+  static constexpr unsigned char days_in_month[13] = { 0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  bool const leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  unsigned int const max_day = days_in_month[month > 12 ? 0 : month] - (month == 2 && !leap);
+  if ((month - 1) > 11 || (day - 1) >= max_day || hour > 23 || minute > 59 || second > 60)
+    return false;
+  p += 9;
+  len -= 9;
+
+  // Optional fraction, of at least one digit.
+  if (len > 0 && (*p == '.' || *p == ','))
+  {
+    ++p;
+    --len;
+    if (len == 0 || static_cast<unsigned char>(*p - '0') > 9)
+      return false;
+    do
+    {
+      ++p;
+      --len;
+    }
+    while (len > 0 && static_cast<unsigned char>(*p - '0') <= 9);
+  }
+
+  // Optional time zone.
+  int offset = 0;
+  if (len == 1 && *p == 'Z')
+    len = 0;
+  else if (len > 0)
+  {
+    if ((*p != '+' && *p != '-') || (len != 6 && len != 5) || (len == 6 && p[3] != ':'))
+      return false;
+    char const* const mm = p + len - 2;
+    unsigned int const oh1 = static_cast<unsigned char>(p[1]) - '0', oh2 = static_cast<unsigned char>(p[2]) - '0';
+    unsigned int const om1 = static_cast<unsigned char>(mm[0]) - '0', om2 = static_cast<unsigned char>(mm[1]) - '0';
+    if ((oh1 | oh2 | om1 | om2) > 9 || om1 > 5)
+      return false;
+    offset = ((oh1 * 10 + oh2) * 60 + om1 * 10 + om2) * 60;
+    if (*p == '-')
+      offset = -offset;
+  }
+
+  seconds = static_cast<std::time_t>(detail::days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset);
+  return true;
+}
+
+// Write t as "YYYY-MM-DDTHH:MM:SSZ" (formatted_size characters) to out.
+inline void format(std::time_t t, char* out)
+{
+  int64_t const days = detail::floor_div(t, 86400);
+  detail::write_date(out, days);
+  out[10] = 'T';
+  detail::write_time(out + 11, static_cast<unsigned int>(t - days * 86400));
+  out[19] = 'Z';
+}
+
+// format, with a cache of the last second and day.
+class Formatter
+{
+ private:
+  int64_t m_day;                // The day in m_buffer.
+  std::time_t m_second;         // The second in m_buffer.
+  char m_buffer[formatted_size];
+
+ public:
+  Formatter() : m_day(INT64_MIN), m_second(0)
+  {
+    m_buffer[10] = 'T';
+    m_buffer[19] = 'Z';
+  }
+
+  // Returns a view of formatted_size characters that is valid until the next call.
+  std::string_view operator()(std::time_t t)
+  {
+    if (t != m_second || m_day == INT64_MIN)
+    {
+      int64_t const days = detail::floor_div(t, 86400);
+      if (days != m_day)
+      {
+        detail::write_date(m_buffer, days);
+        m_day = days;
+      }
+      detail::write_time(m_buffer + 11, static_cast<unsigned int>(t - days * 86400));
+      m_second = t;
+    }
+    return { m_buffer, formatted_size };
+  }
+};
+
+} // namespace iso8601
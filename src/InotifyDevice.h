@@ -0,0 +1,308 @@
+// Event driven tailing of many files with a single inotify fd.
+//
+// Regular files are always readable, so they can't be added to an epoll set; a 'tail -f'
+// must therefore find out in some other way that a file grew. InotifyDevice is an
+// InputDevice around one inotify(7) fd that is shared by all TailedFile's. Each
+// TailedFile is an InputDevice for its file, with its own protocol decoder, that is
+// only started by the InotifyDevice: every tailed file has a watch on itself (IN_MODIFY,
+// IN_ATTRIB, IN_MOVE_SELF, IN_DELETE_SELF) and read_from_fd routes the events by watch
+// descriptor to the right TailedFile:
+//
+//   IN_MODIFY                     : the file grew; start the device, which reads the new data.
+//   IN_MOVE_SELF / IN_DELETE_SELF : the file was rotated; the device reads what is left and reopens the path.
+//   IN_ATTRIB                     : if the file was unlinked, treat it as rotated.
+//
+// A file that was truncated in place (copytruncate) is read again from the start.
+//
+// If the path doesn't exist (yet) after a rotation, the file is reopened when it is
+// created: the directories that contain tailed files are watched for IN_CREATE and
+// IN_MOVED_TO, routed by name.
+//
+// Hence, an idle tailed file costs nothing.
+
+#pragma once
+
+#include "evio/InputDevice.h"
+#include "utils/AIAlert.h"
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class InotifyDevice;
+
+// A file that is read as it grows. TailedFile is an ordinary InputDevice: give it a
+// protocol decoder with set_protocol_decoder before adding it to an InotifyDevice.
+// A regular file is always readable, so it is not started by epoll: the InotifyDevice
+// starts it when the file was appended to or rotated, and read_from_fd stops it again
+// at the end of the file.
+class TailedFile : public evio::InputDevice
+{
+ private:
+  std::string m_path;
+  InotifyDevice* m_inotify_device;      // The device that this file was added to.
+  int m_wd;                             // The inotify watch descriptor of the opened file. Protected by InotifyDevice::m_watches_mutex.
+  std::atomic<bool> m_rotated;          // Set when the file at m_path must be (re)opened after reading what is left.
+  std::mutex m_read_mutex;              // Serializes read_from_fd.
+
+ public:
+  TailedFile(std::string const& path) : m_path(path), m_inotify_device(nullptr), m_wd(-1), m_rotated(false) { }
+
+  std::string const& path() const { return m_path; }
+
+ private:
+  friend class InotifyDevice;
+  // Open the path and add a watch for it. Returns 0 on success, or an errno value (ENOENT if the path doesn't exist).
+  // After a rotation the new file replaces the old one under the same fd.
+  int open(int inotify_fd, bool from_start);
+  // Return true if the file was unlinked.
+  bool unlinked() const;
+  // Called by the InotifyDevice.
+  void appended() { start_input_device(); }
+  void rotated() { m_rotated = true; start_input_device(); }
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline int TailedFile::open(int inotify_fd, bool from_start)
+{
+  int fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return errno;
+  // Add the watch before seeking to the end, so that no appended data can be missed.
+  m_wd = inotify_add_watch(inotify_fd, m_path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  if (m_wd == -1)
+  {
+    int const error = errno;
+    ::close(fd);
+    return error;
+  }
+  if (!from_start)
+    lseek(fd, 0, SEEK_END);
+  if (!is_open())
+  {
+    fd_init(fd, false);
+    state_t::wat(m_state)->m_flags.set_regular_file();
+  }
+  else
+  {
+    // Regular files aren't in the epoll set; just let the fd of this device refer to the new file.
+    dup2(fd, get_fd());
+    ::close(fd);
+  }
+  return 0;
+}
+
+inline bool TailedFile::unlinked() const
+{
+  struct stat sb;
+  return fstat(get_fd(), &sb) == 0 && sb.st_nlink == 0;
+}
+
+class InotifyDevice : public evio::InputDevice
+{
+ private:
+  int m_inotify_fd;                                     // A copy of the fd, for inotify_add_watch.
+  std::mutex m_watches_mutex;
+  std::map<int, TailedFile*> m_files;                   // The tailed files, by watch descriptor.
+  std::map<int, std::string> m_directories;             // The watched directories, by watch descriptor.
+  std::multimap<std::string, TailedFile*> m_waiting;    // Tailed files that wait for their path to be created, by path.
+
+ public:
+  InotifyDevice() : m_inotify_fd(-1) { }
+
+  void init()
+  {
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd == -1)
+      THROW_ALERTE("inotify_init1");
+    fd_init(m_inotify_fd, false);       // Already non-blocking.
+  }
+
+  void start()
+  {
+    start_input_device(state_t::wat(m_state));
+  }
+
+  // Start tailing file, from its current end (file must stay alive while this device exists).
+  void add(TailedFile& file);
+
+  // Called by file after it read the rest of a rotated file. Returns the result of TailedFile::open.
+  int reopen(TailedFile& file);
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+
+ private:
+  void watch_directory_of(std::string const& path);
+};
+
+inline void TailedFile::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "TailedFile::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  std::lock_guard<std::mutex> lock(m_read_mutex);
+  for (;;)
+  {
+    size_t space = m_ibuffer->dev2buf_contiguous();
+    if (space == 0 && (space = m_ibuffer->dev2buf_contiguous_forced()) == 0)
+    {
+      // The input buffer is full. The rest is still in the file; the GetThread restarts us when it made space.
+      stop_input_device();
+      return;
+    }
+    char* new_data = m_ibuffer->dev2buf_ptr();
+    ssize_t rlen = ::read(fd, new_data, space);
+    if (rlen == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      read_error(allow_deletion_count, errno);
+      return;
+    }
+    if (rlen > 0)
+    {
+      m_ibuffer->dev2buf_bump(rlen);
+      data_received(allow_deletion_count, new_data, rlen);
+      // Stop when the decoder closed this device.
+      if (!state_t::wat(m_state)->m_flags.is_r_open())
+        return;
+      continue;
+    }
+    // End of file. If the file was truncated, start reading from the beginning again.
+    struct stat sb;
+    off_t const offset = lseek(fd, 0, SEEK_CUR);
+    if (fstat(fd, &sb) == 0 && sb.st_size < offset)
+    {
+      lseek(fd, 0, SEEK_SET);
+      continue;
+    }
+    if (m_rotated.exchange(false))
+    {
+      // We read everything that was written to the old file; continue with the new one.
+      int error = m_inotify_device->reopen(*this);
+      if (error == 0)
+        continue;
+      if (error != ENOENT)
+      {
+        read_error(allow_deletion_count, error);
+        return;
+      }
+      // The InotifyDevice calls rotated() again when the path is created.
+    }
+    // Wait for the InotifyDevice to start us again.
+    stop_input_device();
+    // If the file was appended to or rotated after we read the end of the file, then start_input_device() might have been a no-op.
+    if (m_rotated || (fstat(fd, &sb) == 0 && sb.st_size > lseek(fd, 0, SEEK_CUR)))
+      continue;
+    return;
+  }
+}
+
+inline void InotifyDevice::watch_directory_of(std::string const& path)
+{
+  std::string::size_type slash = path.rfind('/');
+  std::string const directory = slash == std::string::npos ? "." : path.substr(0, slash);
+  int wd = inotify_add_watch(m_inotify_fd, directory.c_str(), IN_CREATE | IN_MOVED_TO);
+  if (wd == -1)
+    THROW_ALERTE("inotify_add_watch");
+  // Adding a watch for the same directory twice returns the same watch descriptor.
+  m_directories[wd] = directory;
+}
+
+inline void InotifyDevice::add(TailedFile& file)
+{
+  std::lock_guard<std::mutex> lock(m_watches_mutex);
+  file.m_inotify_device = this;
+  watch_directory_of(file.path());
+  int error = file.open(m_inotify_fd, false);
+  if (error == 0)
+    m_files[file.m_wd] = &file;
+  else if (error == ENOENT)
+    m_waiting.emplace(file.path(), &file);
+  else
+  {
+    errno = error;
+    THROW_ALERTE("TailedFile::open(\"[PATH]\")", AIArgs("[PATH]", file.path()));
+  }
+}
+
+inline int InotifyDevice::reopen(TailedFile& file)
+{
+  std::lock_guard<std::mutex> lock(m_watches_mutex);
+  // The file was created after the rotation; read it from the start.
+  int error = file.open(m_inotify_fd, true);
+  if (error == 0)
+    m_files[file.m_wd] = &file;
+  else if (error == ENOENT)
+    m_waiting.emplace(file.path(), &file);
+  return error;
+}
+
+inline void InotifyDevice::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "InotifyDevice::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  alignas(struct inotify_event) char buf[65536];
+  for (;;)
+  {
+    ssize_t len = ::read(fd, buf, sizeof(buf));
+    if (len == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        read_error(allow_deletion_count, errno);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(m_watches_mutex);
+    for (char const* ptr = buf; ptr < buf + len;)
+    {
+      struct inotify_event const* event = reinterpret_cast<struct inotify_event const*>(ptr);
+      ptr += sizeof(struct inotify_event) + event->len;
+      if ((event->mask & IN_Q_OVERFLOW))
+      {
+        // Events were lost; read every file, and try to open the ones that are waiting.
+        Dout(dc::warning, "inotify event queue overflowed.");
+        for (auto& file : m_files)
+          file.second->appended();
+        std::multimap<std::string, TailedFile*> waiting;
+        waiting.swap(m_waiting);
+        for (auto& file : waiting)
+          file.second->rotated();
+        continue;
+      }
+      auto directory = m_directories.find(event->wd);
+      if (directory != m_directories.end())
+      {
+        // A file was created in, or moved into, a directory that we watch.
+        if (event->len == 0)
+          continue;
+        auto waiting = m_waiting.equal_range(directory->second + '/' + event->name);
+        for (auto w = waiting.first; w != waiting.second; ++w)
+          w->second->rotated();
+        m_waiting.erase(waiting.first, waiting.second);
+        continue;
+      }
+      auto file_iter = m_files.find(event->wd);
+      if (file_iter == m_files.end())
+        continue;                       // For example, IN_IGNORED of a watch that we removed already.
+      TailedFile* file = file_iter->second;
+      if ((event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) || ((event->mask & IN_ATTRIB) && file->unlinked()))
+      {
+        m_files.erase(file_iter);
+        // This causes an IN_IGNORED event for the old watch descriptor, unless the kernel already removed it.
+        inotify_rm_watch(m_inotify_fd, file->m_wd);
+        file->m_wd = -1;
+        // The file reads what is left of the old file and then calls reopen.
+        file->rotated();
+      }
+      else if ((event->mask & IN_MODIFY))
+        file->appended();
+    }
+  }
+}
@@ -0,0 +1,359 @@
+// Longest prefix match of IPv4 and IPv6 addresses against many prefixes.
+//
+// evio::SocketNetmask::matches tests one netmask; checking the peer of every accepted
+// connection against thousands of CIDR rules that way costs thousands of comparisons.
+// lpm::Trie<T> maps prefixes ("192.0.2.0/24", "2001:db8::/32", in the notation of
+// SocketNetmask) to a value of type T, and find returns the value of the longest
+// prefix that contains the address, or nullptr if there is none. find takes the
+// sockaddr that accept(2) returns, so that a listen socket can reject a connection
+// before anything is created for it. IPv4-mapped IPv6 addresses (::ffff:a.b.c.d, as
+// returned by dual-stack sockets) are looked up as IPv4 addresses, and mapped prefixes
+// (::ffff:a.b.c.d/96 and longer) are inserted as the corresponding IPv4 prefix. A shorter
+// IPv6 prefix, like ::/0, therefore never matches an IPv4-mapped address.
+//
+// The prefixes are kept in a binary trie, from which build() compiles the structure
+// that find uses: a Poptrie (Asai and Ohara, SIGCOMM 2015). The first 16 bits of the
+// address index a direct table; below that every node consumes 6 bits of the address
+// and has two 64-bit bitmaps: one for the slots that have a child node and one that
+// marks where a run of equal leaf values begins. The children of a node, and its leaves,
+// are stored contiguously, so the index of a child or leaf is a base plus the popcount
+// of the bitmap below the slot. An IPv4 lookup touches the direct table and at most
+// three nodes of 24 bytes.
+//
+// Prefixes that are inserted are not seen by find until build() is called again. find
+// is const and may be called concurrently from any number of threads, but not concurrently
+// with insert or build: to change the rules at runtime, build a new Trie and swap it in.
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace lpm {
+
+template<typename T>
+class Trie
+{
+ private:
+  // A node of the binary trie that holds the prefixes.
+  struct RibNode
+  {
+    uint32_t m_child[2];        // Zero when there is no child.
+    uint32_t m_value;           // One plus the index into m_values, or zero if this is not a prefix.
+  };
+
+  // A node of the Poptrie.
+  struct Node
+  {
+    uint64_t m_vector;          // The slots that have a child node.
+    uint64_t m_leafvec;         // The slots where a run of equal leaves begins.
+    uint32_t m_base0;           // The index into m_leaves of the first leaf.
+    uint32_t m_base1;           // The index into m_nodes of the first child.
+  };
+
+  // A slot of a node, while building.
+  struct Slot
+  {
+    uint32_t m_rib;             // The RibNode at this slot, if any.
+    uint32_t m_value;           // The value of the longest prefix that contains the slot.
+  };
+
+  static constexpr int direct_bits = 16;
+  static constexpr int stride = 6;
+  static constexpr uint32_t leaf_flag = 0x80000000;     // An entry of the direct table that is a leaf (value) rather than a node.
+  static constexpr uint32_t ipv4_root = 1;
+  static constexpr uint32_t ipv6_root = 2;
+
+  std::vector<T> m_values;
+  std::vector<RibNode> m_rib;                   // Element 0 is unused, so that zero can mean 'no child'.
+  std::vector<uint32_t> m_direct4;              // Indexed by the first 16 bits of an IPv4 address.
+  std::vector<uint32_t> m_direct6;              // Indexed by the first 16 bits of an IPv6 address.
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_leaves;               // Values, as in RibNode::m_value.
+  bool m_popcnt;                                // Set if the CPU has the popcnt instruction.
+
+ public:
+  Trie() : m_rib(3, RibNode{{0, 0}, 0}), m_popcnt(__builtin_cpu_supports("popcnt")) { build(); }
+
+  // Map the prefix of prefix_length bits of address (four or sixteen bytes, in network order) to value.
+  // The bits beyond the prefix are ignored. A prefix that was inserted before gets the new value.
+  // An IPv4-mapped IPv6 prefix of at least 96 bits is inserted as IPv4 prefix.
+  void insert(int family, unsigned char const* address, int prefix_length, T const& value);
+
+  // Map the prefix address/prefix_length to value; address must be an AF_INET or AF_INET6 address.
+  // Returns false if it is neither, or if prefix_length is out of range.
+  bool insert(struct sockaddr const* address, int prefix_length, T const& value);
+
+  // Map cidr ("192.0.2.0/24", "2001:db8::/32", or a single address) to value.
+  // Returns false if cidr can't be parsed.
+  bool insert(std::string_view cidr, T const& value);
+
+  // Compile the inserted prefixes for find.
+  void build();
+
+  // Return the value of the longest prefix that contains address, or nullptr if there is none.
+  T const* find(struct sockaddr const* address) const;
+  T const* find_ipv4(uint32_t address) const;                   // address is in host byte order.
+  T const* find_ipv6(unsigned char const* address) const;       // address is sixteen bytes in network order.
+
+  // The number of prefixes.
+  size_t size() const { return m_values.size(); }
+
+  // The number of bytes used by the structure that find uses.
+  size_t memory_size() const
+  {
+    return (m_direct4.size() + m_direct6.size() + m_leaves.size()) * sizeof(uint32_t) + m_nodes.size() * sizeof(Node);
+  }
+
+  // Return the value of the longest prefix that contains address, by walking the binary trie bit by bit.
+  // This doesn't need build() and is only meant for testing.
+  T const* find_slow(int family, unsigned char const* address) const;
+
+ private:
+  T const* value(uint32_t leaf) const { return leaf == 0 ? nullptr : &m_values[leaf - 1]; }
+  bool has_children(uint32_t rib) const { return rib != 0 && (m_rib[rib].m_child[0] | m_rib[rib].m_child[1]) != 0; }
+  void expand(uint32_t rib, int depth, uint32_t value, Slot* out) const;
+  void build_direct(uint32_t root, std::vector<uint32_t>& direct);
+  void build_node(uint32_t index, uint32_t rib, uint32_t value);
+
+  static unsigned int chunk(uint64_t key, unsigned int offset) { return (key >> (64 - stride - offset)) & 63; }
+  static unsigned int chunk(unsigned __int128 key, unsigned int offset)
+  {
+    // The last chunk of an IPv6 address starts at offset 124 and has only four bits; the other two are padding.
+    return (offset <= 128 - stride ? key >> (128 - stride - offset) : key << (offset - (128 - stride))) & 63;
+  }
+
+  template<typename Key>
+  uint32_t lookup(uint32_t entry, Key key) const;
+  template<typename Key>
+  __attribute__((always_inline)) inline uint32_t lookup_nodes(Node const* node, Key key) const;
+  template<typename Key>
+  __attribute__((target("popcnt"))) uint32_t lookup_nodes_popcnt(Node const* node, Key key) const { return lookup_nodes(node, key); }
+};
+
+template<typename T>
+void Trie<T>::insert(int family, unsigned char const* address, int prefix_length, T const& value)
+{
+  static unsigned char const v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+  if (family == AF_INET6 && prefix_length >= 96 && std::memcmp(address, v4mapped, sizeof(v4mapped)) == 0)
+  {
+    // find looks these addresses up as IPv4.
+    family = AF_INET;
+    address += 12;
+    prefix_length -= 96;
+  }
+  uint32_t rib = family == AF_INET ? ipv4_root : ipv6_root;
+  for (int bit = 0; bit < prefix_length; ++bit)
+  {
+    int const b = (address[bit / 8] >> (7 - bit % 8)) & 1;
+    if (m_rib[rib].m_child[b] == 0)
+    {
+      m_rib[rib].m_child[b] = m_rib.size();
+      m_rib.push_back(RibNode{{0, 0}, 0});
+    }
+    rib = m_rib[rib].m_child[b];
+  }
+  if (m_rib[rib].m_value != 0)
+    m_values[m_rib[rib].m_value - 1] = value;
+  else
+  {
+    m_values.push_back(value);
+    m_rib[rib].m_value = m_values.size();
+  }
+}
+
+template<typename T>
+bool Trie<T>::insert(struct sockaddr const* address, int prefix_length, T const& value)
+{
+  if (address->sa_family == AF_INET && prefix_length >= 0 && prefix_length <= 32)
+    insert(AF_INET, reinterpret_cast<unsigned char const*>(&reinterpret_cast<struct sockaddr_in const*>(address)->sin_addr), prefix_length, value);
+  else if (address->sa_family == AF_INET6 && prefix_length >= 0 && prefix_length <= 128)
+    insert(AF_INET6, reinterpret_cast<struct sockaddr_in6 const*>(address)->sin6_addr.s6_addr, prefix_length, value);
+  else
+    return false;
+  return true;
+}
+
+template<typename T>
+bool Trie<T>::insert(std::string_view cidr, T const& value)
+{
+  size_t const slash = cidr.find('/');
+  std::string const address_str(cidr.substr(0, slash));
+  unsigned char address[16];
+  int const family = address_str.find(':') == std::string::npos ? AF_INET : AF_INET6;
+  if (inet_pton(family, address_str.c_str(), address) != 1)
+    return false;
+  int const max_length = family == AF_INET ? 32 : 128;
+  int prefix_length = max_length;
+  if (slash != std::string_view::npos)
+  {
+    char const* const begin = cidr.data() + slash + 1;
+    char const* const end = cidr.data() + cidr.size();
+    auto const [ptr, ec] = std::from_chars(begin, end, prefix_length);
+    if (ec != std::errc() || ptr != end || begin == end || prefix_length < 0 || prefix_length > max_length)
+      return false;
+  }
+  insert(family, address, prefix_length, value);
+  return true;
+}
+
+// Fill the 2^depth slots below rib (which may be zero) in out; value is the value of the longest prefix at rib.
+template<typename T>
+void Trie<T>::expand(uint32_t rib, int depth, uint32_t value, Slot* out) const
+{
+  if (depth == 0)
+  {
+    *out = Slot{rib, value};
+    return;
+  }
+  size_t const half = size_t{1} << (depth - 1);
+  for (int b = 0; b < 2; ++b)
+  {
+    uint32_t const child = rib == 0 ? 0 : m_rib[rib].m_child[b];
+    if (child == 0)
+      std::fill(out + b * half, out + (b + 1) * half, Slot{0, value});
+    else
+      expand(child, depth - 1, m_rib[child].m_value != 0 ? m_rib[child].m_value : value, out + b * half);
+  }
+}
+
+template<typename T>
+void Trie<T>::build_direct(uint32_t root, std::vector<uint32_t>& direct)
+{
+  std::vector<Slot> slots(size_t{1} << direct_bits);
+  expand(root, direct_bits, m_rib[root].m_value, slots.data());
+  direct.resize(slots.size());
+  for (size_t i = 0; i < slots.size(); ++i)
+  {
+    if (!has_children(slots[i].m_rib))
+      direct[i] = leaf_flag | slots[i].m_value;
+    else
+    {
+      direct[i] = m_nodes.size();
+      m_nodes.emplace_back();
+      build_node(direct[i], slots[i].m_rib, slots[i].m_value);
+    }
+  }
+}
+
+// Build the node at index for the stride bits below rib.
+template<typename T>
+void Trie<T>::build_node(uint32_t index, uint32_t rib, uint32_t value)
+{
+  Slot slots[1 << stride];
+  expand(rib, stride, value, slots);
+  Node node{0, 0, static_cast<uint32_t>(m_leaves.size()), static_cast<uint32_t>(m_nodes.size())};
+  bool first_leaf = true;
+  for (int i = 0; i < (1 << stride); ++i)
+  {
+    if (has_children(slots[i].m_rib))
+      node.m_vector |= uint64_t{1} << i;
+    else if (first_leaf || slots[i].m_value != m_leaves.back())
+    {
+      node.m_leafvec |= uint64_t{1} << i;
+      m_leaves.push_back(slots[i].m_value);
+      first_leaf = false;
+    }
+  }
+  // Reserve the children first, so that they are contiguous.
+  m_nodes.resize(m_nodes.size() + __builtin_popcountll(node.m_vector));
+  m_nodes[index] = node;
+  uint32_t child = node.m_base1;
+  for (int i = 0; i < (1 << stride); ++i)
+    if ((node.m_vector >> i) & 1)
+      build_node(child++, slots[i].m_rib, slots[i].m_value);
+}
+
+template<typename T>
+void Trie<T>::build()
+{
+  m_nodes.clear();
+  m_leaves.clear();
+  build_direct(ipv4_root, m_direct4);
+  build_direct(ipv6_root, m_direct6);
+  m_nodes.shrink_to_fit();
+  m_leaves.shrink_to_fit();
+}
+
+// Return the leaf for key (left aligned), starting at the entry of the direct table.
+template<typename T>
+template<typename Key>
+uint32_t Trie<T>::lookup(uint32_t entry, Key key) const
+{
+  if ((entry & leaf_flag))
+    return entry & ~leaf_flag;
+  // Without -mpopcnt, __builtin_popcountll is a library call; use the instruction when the CPU has it.
+  return m_popcnt ? lookup_nodes_popcnt(&m_nodes[entry], key) : lookup_nodes(&m_nodes[entry], key);
+}
+
+template<typename T>
+template<typename Key>
+uint32_t Trie<T>::lookup_nodes(Node const* node, Key key) const
+{
+  for (unsigned int offset = direct_bits;; offset += stride)
+  {
+    uint64_t const bit = uint64_t{1} << chunk(key, offset);
+    if (!(node->m_vector & bit))
+      return m_leaves[node->m_base0 + __builtin_popcountll(node->m_leafvec & ((bit << 1) - 1)) - 1];
+    node = &m_nodes[node->m_base1 + __builtin_popcountll(node->m_vector & (bit - 1))];
+  }
+}
+
+template<typename T>
+T const* Trie<T>::find_ipv4(uint32_t address) const
+{
+  return value(lookup(m_direct4[address >> 16], static_cast<uint64_t>(address) << 32));
+}
+
+template<typename T>
+T const* Trie<T>::find_ipv6(unsigned char const* address) const
+{
+  unsigned __int128 key = 0;
+  for (int i = 0; i < 16; ++i)
+    key = (key << 8) | address[i];
+  return value(lookup(m_direct6[address[0] << 8 | address[1]], key));
+}
+
+template<typename T>
+T const* Trie<T>::find(struct sockaddr const* address) const
+{
+  if (address->sa_family == AF_INET)
+    return find_ipv4(ntohl(reinterpret_cast<struct sockaddr_in const*>(address)->sin_addr.s_addr));
+  if (address->sa_family != AF_INET6)
+    return nullptr;
+  struct in6_addr const& addr = reinterpret_cast<struct sockaddr_in6 const*>(address)->sin6_addr;
+  if (IN6_IS_ADDR_V4MAPPED(&addr))
+  {
+    uint32_t address4;
+    std::memcpy(&address4, addr.s6_addr + 12, 4);
+    return find_ipv4(ntohl(address4));
+  }
+  return find_ipv6(addr.s6_addr);
+}
+
+template<typename T>
+T const* Trie<T>::find_slow(int family, unsigned char const* address) const
+{
+  int const bits = family == AF_INET ? 32 : 128;
+  uint32_t rib = family == AF_INET ? ipv4_root : ipv6_root;
+  uint32_t best = m_rib[rib].m_value;
+  for (int bit = 0; bit < bits; ++bit)
+  {
+    rib = m_rib[rib].m_child[(address[bit / 8] >> (7 - bit % 8)) & 1];
+    if (rib == 0)
+      break;
+    if (m_rib[rib].m_value != 0)
+      best = m_rib[rib].m_value;
+  }
+  return value(best);
+}
+
+} // namespace lpm
@@ -0,0 +1,151 @@
+// Replaying a large file through a protocol decoder without copying.
+//
+// Reading a file with evio::File copies every byte into the MemoryBlocks of an
+// InputBuffer before the decoder sees it. MappedInputFile instead maps (a window of)
+// the file and passes pointers into the mapping directly to end_of_msg_finder and
+// decode. Hence decoders keep working unchanged: they get the same calls, just with
+// MsgBlock's that point into the mapping (and aren't backed by a MemoryBlock).
+//
+// Files larger than the address budget are mapped through a sliding window: when
+// end_of_msg_finder doesn't find the end of a message before the end of the window,
+// the window is moved so that it starts at the page containing the start of that
+// message. A message larger than the window grows the window. As with an InputBuffer,
+// end_of_msg_finder is only passed bytes that it didn't see before: after moving the
+// window it gets the bytes from the end of the previous window onwards. The mapping uses
+// madvise(MADV_SEQUENTIAL), so the kernel reads ahead aggressively and drops pages
+// behind us early.
+//
+// The device is never added to epoll (regular files are always readable); replay()
+// runs the decoder in the calling thread until the end of the file, after which the
+// device is closed, or until the decoder closes the input device.
+
+#pragma once
+
+#include "DecoderReplay.h"
+#include "evio/InputDevice.h"
+#include "utils/AIAlert.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedInputFile : public evio::InputDevice
+{
+ private:
+  evio::protocol::Decoder* m_decoder;
+  size_t m_window_size;         // The address budget; a multiple of the page size.
+  off_t m_file_size;
+  char const* m_window;         // The current mapping, or nullptr.
+  off_t m_window_offset;        // The offset in the file of m_window.
+  size_t m_window_len;          // The size of the current mapping.
+
+ public:
+  MappedInputFile(size_t window_size) : m_decoder(nullptr), m_file_size(0), m_window(nullptr), m_window_offset(0), m_window_len(0)
+  {
+    size_t const page_size = sysconf(_SC_PAGESIZE);
+    m_window_size = (window_size + page_size - 1) & ~(page_size - 1);
+  }
+
+  ~MappedInputFile() { unmap(); }
+
+  void open(char const* path);
+
+  void set_protocol_decoder(evio::protocol::Decoder& decoder)
+  {
+    // This also makes close_input_device() work from the decoder.
+    evio::InputDevice::set_protocol_decoder(decoder);
+    m_decoder = &decoder;
+  }
+
+  // Pass the whole file to the decoder.
+  void replay();
+
+ private:
+  void map(off_t offset, size_t minimum_len);
+  void unmap()
+  {
+    if (m_window)
+      munmap(const_cast<char*>(m_window), m_window_len);
+    m_window = nullptr;
+  }
+};
+
+inline void MappedInputFile::open(char const* path)
+{
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    THROW_ALERTE("open");
+  struct stat sb;
+  if (fstat(fd, &sb) == -1)
+  {
+    int const saved_errno = errno;
+    ::close(fd);
+    errno = saved_errno;
+    THROW_ALERTE("fstat");
+  }
+  m_file_size = sb.st_size;
+  fd_init(fd, false);
+  state_t::wat(m_state)->m_flags.set_regular_file();
+}
+
+// Map at least minimum_len bytes (or till the end of the file) starting at the page that contains offset.
+inline void MappedInputFile::map(off_t offset, size_t minimum_len)
+{
+  unmap();
+  size_t const page_size = sysconf(_SC_PAGESIZE);
+  m_window_offset = offset & ~static_cast<off_t>(page_size - 1);
+  minimum_len += offset - m_window_offset;
+  if (minimum_len > m_window_size)
+    m_window_size = (minimum_len + page_size - 1) & ~(page_size - 1);
+  m_window_len = std::min<size_t>(m_window_size, m_file_size - m_window_offset);
+  void* window = mmap(nullptr, m_window_len, PROT_READ, MAP_PRIVATE, get_fd(), m_window_offset);
+  if (window == MAP_FAILED)
+    THROW_ALERTE("mmap");
+  madvise(window, m_window_len, MADV_SEQUENTIAL);
+  m_window = static_cast<char const*>(window);
+}
+
+inline void MappedInputFile::replay()
+{
+  ASSERT(m_decoder);
+  int allow_deletion_count = 0;
+  off_t pos = 0;                        // The offset in the file of the start of the next message.
+  size_t scanned = 0;                   // The number of bytes from pos onwards that were already passed to end_of_msg_finder.
+  while (pos < m_file_size)
+  {
+    if (!m_window || pos >= m_window_offset + static_cast<off_t>(m_window_len))
+      map(pos, 0);
+    off_t const window_end = m_window_offset + m_window_len;
+    char const* start = m_window + (pos - m_window_offset);
+    // Only pass the bytes that end_of_msg_finder didn't see yet.
+    size_t const new_len = window_end - (pos + scanned);
+    evio::EndOfMsgFinderResult result;
+    size_t len = DecoderAccess::call_end_of_msg_finder(*m_decoder, start + scanned, new_len, result);
+    if (len == 0)
+    {
+      scanned += new_len;
+      if (window_end == m_file_size)
+      {
+        Dout(dc::warning, "MappedInputFile: the file ends with an incomplete message of " << scanned << " bytes.");
+        break;
+      }
+      // The message doesn't fit in the window; remap, starting at this message, with a window that is at least twice as large as the part that we have.
+      map(pos, 2 * scanned);
+      continue;
+    }
+    size_t const msg_len = scanned + len;
+    scanned = 0;
+    DecoderAccess::call_decode(*m_decoder, allow_deletion_count, evio::MsgBlock(start, msg_len, nullptr));
+    pos += msg_len;
+    // Stop when the decoder closed this device.
+    if (!state_t::wat(m_state)->m_flags.is_r_open())
+      break;
+  }
+  unmap();
+  // Like File, close the device at the end of the file.
+  if (state_t::wat(m_state)->m_flags.is_r_open())
+    close_input_device(allow_deletion_count);
+  if (allow_deletion_count > 0)
+    allow_deletion(allow_deletion_count);
+}
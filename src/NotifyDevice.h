@@ -0,0 +1,100 @@
+// Cross-thread notifications through the event loop.
+//
+// NotifyDevice is an InputDevice around an eventfd(2). Any thread can call notify(n),
+// which adds n to the counter of the eventfd. The EventLoopThread sees the fd become
+// readable and read_from_fd, running in the thread pool, reads (and thereby resets)
+// the counter and passes it to the handler. All notifications that happened since
+// the previous wake up are therefore coalesced into a single call of the handler.
+//
+// This allows any queue to be drained from the thread pool: push to the queue,
+// then call notify(); the handler empties the queue.
+//
+// notify() writes to a duplicate of the eventfd that is only closed by the destructor,
+// so that it never writes to a closed (or reused) fd, even when it races with close().
+// notify() after close() does nothing.
+
+#pragma once
+
+#include "evio/InputDevice.h"
+#include "utils/AIAlert.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+class NotifyDevice : public evio::InputDevice
+{
+ public:
+  using handler_type = std::function<void(int& allow_deletion_count, uint64_t count)>;
+
+ private:
+  handler_type m_handler;
+  int m_eventfd;                        // A dup of the fd, for use by notify().
+  size_t m_wakeups;                     // The number of calls to the handler.
+  std::atomic<bool> m_closed;           // Set when the handler called close().
+
+ public:
+  NotifyDevice(handler_type handler) : m_handler(std::move(handler)), m_eventfd(-1), m_wakeups(0), m_closed(false) { }
+  ~NotifyDevice() { if (m_eventfd != -1) ::close(m_eventfd); }
+
+  void init()
+  {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1)
+      THROW_ALERTE("eventfd");
+    m_eventfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (m_eventfd == -1)
+    {
+      int const saved_errno = errno;
+      ::close(fd);
+      errno = saved_errno;
+      THROW_ALERTE("fcntl(F_DUPFD_CLOEXEC)");
+    }
+    fd_init(fd, false);         // Already non-blocking.
+  }
+
+  void start()
+  {
+    start_input_device(state_t::wat(m_state));
+  }
+
+  // Wake up the handler. Thread-safe; may be called by any thread, also after close().
+  void notify(uint64_t count = 1)
+  {
+    if (m_closed.load(std::memory_order_relaxed))
+      return;
+    // This only fails when the counter would overflow (EAGAIN), in which case the handler didn't run for a very long time.
+    [[maybe_unused]] ssize_t len = ::write(m_eventfd, &count, sizeof(count));
+    ASSERT(len == sizeof(count));
+  }
+
+  // Close the device from the handler.
+  void close(int& allow_deletion_count)
+  {
+    m_closed.store(true, std::memory_order_relaxed);
+    close_input_device(allow_deletion_count);
+  }
+
+  size_t wakeups() const { return m_wakeups; }
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline void NotifyDevice::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "NotifyDevice::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  uint64_t count;
+  ssize_t len = ::read(fd, &count, sizeof(count));
+  if (len == -1)
+  {
+    // EAGAIN: another thread read the counter already.
+    if (errno != EAGAIN && errno != EINTR)
+      read_error(allow_deletion_count, errno);
+    return;
+  }
+  ++m_wakeups;
+  m_handler(allow_deletion_count, count);
+}
@@ -0,0 +1,90 @@
+// Sending a file over a socket with sendfile(2).
+//
+// Linking an evio::File input device to a socket with set_source(file_device) copies
+// every byte twice: read(2) into the MemoryBlocks of the buffer and then write(2) to
+// the socket. SendFileSocket instead lets the kernel copy the data from the page cache
+// directly to the socket: once connected, send_file(path) makes write_to_fd call
+// sendfile(2), keeping track of the file offset and returning to the event loop on
+// EAGAIN, after which EPOLLOUT resumes it at the same offset. After the file was sent
+// the output device is closed.
+
+#pragma once
+
+#include "evio/Socket.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class SendFileSocket : public evio::Socket
+{
+ private:
+  int m_file_fd;        // The file being sent, or -1.
+  off_t m_offset;       // The offset in the file of the next byte to send.
+  off_t m_end;          // The size of the file.
+
+ public:
+  SendFileSocket() : m_file_fd(-1), m_offset(0), m_end(0) { }
+
+  ~SendFileSocket()
+  {
+    if (m_file_fd != -1)
+      ::close(m_file_fd);
+  }
+
+  // Send the contents of the file path. The socket must be connected.
+  // This is called from a callback of the socket (on_connected); failure to open the file
+  // is therefore reported like any other error of the socket: through write_error.
+  void send_file(int& allow_deletion_count, char const* path)
+  {
+    m_file_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (m_file_fd == -1 || fstat(m_file_fd, &sb) == -1)
+    {
+      int const error = errno;
+      Dout(dc::warning, "SendFileSocket::send_file: " << path << ": " << std::strerror(error));
+      if (m_file_fd != -1)
+        ::close(m_file_fd);
+      m_file_fd = -1;
+      write_error(allow_deletion_count, error);
+      return;
+    }
+    m_offset = 0;
+    m_end = sb.st_size;
+    start_output_device();
+  }
+
+ protected:
+  void write_to_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline void SendFileSocket::write_to_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "SendFileSocket::write_to_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  if (m_file_fd == -1)
+  {
+    // Not sending a file (this also handles the completion of connect()).
+    evio::Socket::write_to_fd(allow_deletion_count, fd);
+    return;
+  }
+  while (m_offset < m_end)
+  {
+    // Linux transfers at most 0x7ffff000 bytes per call.
+    ssize_t wlen = sendfile(fd, m_file_fd, &m_offset, m_end - m_offset);
+    if (wlen == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      // On EAGAIN we'll be called again when the socket is writable; m_offset was not changed.
+      if (errno != EAGAIN)
+        write_error(allow_deletion_count, errno);
+      return;
+    }
+    if (wlen == 0)
+      break;            // The file was truncated while we were sending it.
+  }
+  ::close(m_file_fd);
+  m_file_fd = -1;
+  close_output_device(allow_deletion_count);
+}
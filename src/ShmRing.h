@@ -0,0 +1,336 @@
+// Shared memory ring buffer device pair.
+//
+// ShmRing is a single-producer single-consumer ring buffer in a memfd(2) backed shared
+// memory mapping, plus two eventfd(2) doorbells. To use it between two processes, pass
+// memfd(), data_doorbell() and space_doorbell() to the other process (inherited over
+// fork(2), or sent with SCM_RIGHTS, see FdPassing.h) and attach to the ring there by
+// constructing a ShmRing from those three fds. Each process then takes one end.
+//
+// ShmRingWriteEnd is an OutputDevice (use set_source) that copies the data from its
+// OutputBuffer directly into the ring, and ShmRingReadEnd is an InputDevice (use
+// set_protocol_decoder) that copies data from the ring into its InputBuffer, from where
+// the usual end_of_msg_finder / decode take over. Hence the data is copied between the
+// buffers of the two devices without passing through the kernel.
+//
+// The data doorbell is only rung when the ring goes from empty to non-empty; the
+// space doorbell only when the writer found the ring full and is waiting for space.
+// The head (written by the writer) and tail (written by the reader) are sequentially
+// consistent, so that when both sides conclude concurrently that the other side is
+// not going to look anymore, at least one of them sees the update of the other.
+
+#pragma once
+
+#include "evio/InputDevice.h"
+#include "evio/OutputDevice.h"
+#include "utils/AIAlert.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class ShmRing
+{
+ public:
+  struct Header
+  {
+    alignas(64) std::atomic<uint64_t> m_head;           // Total number of bytes written; only written by the writer.
+    alignas(64) std::atomic<uint64_t> m_tail;           // Total number of bytes read; only written by the reader.
+    alignas(64) std::atomic<bool> m_writer_waiting;     // Set by the writer when the ring is full.
+    std::atomic<bool> m_closed;                         // Set by the writer when it closed.
+  };
+
+  static constexpr size_t header_size = 4096;           // The data starts at the next page.
+  // The header is shared between processes.
+  static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<bool>::is_always_lock_free);
+
+ private:
+  int m_memfd;
+  size_t m_capacity;            // The size of the ring; a power of two.
+  char* m_mapping;
+  int m_data_doorbell;          // Rung by the writer when the ring becomes non-empty.
+  int m_space_doorbell;         // Rung by the reader when the ring becomes non-full while the writer is waiting.
+
+ public:
+  // Create a new ring of capacity bytes (a power of two).
+  ShmRing(size_t capacity);
+  // Attach to an existing ring, for example one that was created by another process, from its
+  // memfd and doorbells (as returned by memfd(), data_doorbell() and space_doorbell() of that ring).
+  // Takes ownership of the three fds.
+  ShmRing(int memfd, int data_doorbell, int space_doorbell);
+  ~ShmRing();
+
+  ShmRing(ShmRing const&) = delete;
+  ShmRing& operator=(ShmRing const&) = delete;
+
+  Header* header() const { return reinterpret_cast<Header*>(m_mapping); }
+  size_t capacity() const { return m_capacity; }
+
+  // The fds that another process needs to attach to this ring.
+  int memfd() const { return m_memfd; }
+  int data_doorbell() const { return m_data_doorbell; }
+  int space_doorbell() const { return m_space_doorbell; }
+
+  // Copy len bytes from src into the ring at position pos (which might wrap around).
+  void copy_to(uint64_t pos, char const* src, size_t len) const;
+  // Copy len bytes from the ring at position pos (which might wrap around) into dst.
+  void copy_from(uint64_t pos, char* dst, size_t len) const;
+
+  static void ring(int doorbell)
+  {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t len = ::write(doorbell, &one, sizeof(one));
+  }
+};
+
+inline ShmRing::ShmRing(size_t capacity) : m_capacity(capacity)
+{
+  ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+  m_memfd = memfd_create("evio_shm_ring", MFD_CLOEXEC);
+  if (m_memfd == -1)
+    THROW_ALERTE("memfd_create");
+  if (ftruncate(m_memfd, header_size + m_capacity) == -1)
+    THROW_ALERTE("ftruncate");
+  void* mapping = mmap(nullptr, header_size + m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+  if (mapping == MAP_FAILED)
+    THROW_ALERTE("mmap");
+  m_mapping = static_cast<char*>(mapping);
+  new (m_mapping) Header{};
+  m_data_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  m_space_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_data_doorbell == -1 || m_space_doorbell == -1)
+    THROW_ALERTE("eventfd");
+}
+
+inline ShmRing::ShmRing(int memfd, int data_doorbell, int space_doorbell) :
+  m_memfd(memfd), m_capacity(0), m_mapping(nullptr), m_data_doorbell(data_doorbell), m_space_doorbell(space_doorbell)
+{
+  struct stat sb;
+  if (fstat(m_memfd, &sb) == -1)
+    THROW_ALERTE("fstat");
+  size_t const capacity = sb.st_size > static_cast<off_t>(header_size) ? sb.st_size - header_size : 0;
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    THROW_ALERT("The size of the memfd ([SIZE]) is not the size of a ShmRing.", AIArgs("[SIZE]", sb.st_size));
+  void* mapping = mmap(nullptr, header_size + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+  if (mapping == MAP_FAILED)
+    THROW_ALERTE("mmap");
+  m_capacity = capacity;
+  m_mapping = static_cast<char*>(mapping);
+}
+
+inline ShmRing::~ShmRing()
+{
+  if (m_mapping)
+    munmap(m_mapping, header_size + m_capacity);
+  ::close(m_memfd);
+  ::close(m_data_doorbell);
+  ::close(m_space_doorbell);
+}
+
+inline void ShmRing::copy_to(uint64_t pos, char const* src, size_t len) const
+{
+  size_t const offset = pos & (m_capacity - 1);
+  size_t const first = std::min(len, m_capacity - offset);
+  std::memcpy(m_mapping + header_size + offset, src, first);
+  std::memcpy(m_mapping + header_size, src + first, len - first);
+}
+
+inline void ShmRing::copy_from(uint64_t pos, char* dst, size_t len) const
+{
+  size_t const offset = pos & (m_capacity - 1);
+  size_t const first = std::min(len, m_capacity - offset);
+  std::memcpy(dst, m_mapping + header_size + offset, first);
+  std::memcpy(dst + first, m_mapping + header_size, len - first);
+}
+
+class ShmRingWriteEnd;
+
+// Wakes up the ShmRingWriteEnd when the reader made space in a full ring.
+// Only active while the writer is waiting.
+class ShmRingSpaceDoorbell : public evio::InputDevice
+{
+ private:
+  ShmRingWriteEnd* m_write_end;
+
+ public:
+  ShmRingSpaceDoorbell(ShmRingWriteEnd* write_end) : m_write_end(write_end) { }
+
+  void init(int fd) { fd_init(fd, false); }
+  void start() { start_input_device(); }
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+};
+
+class ShmRingWriteEnd : public evio::OutputDevice
+{
+ private:
+  std::shared_ptr<ShmRing> m_ring;
+  boost::intrusive_ptr<ShmRingSpaceDoorbell> m_space_doorbell;
+
+ public:
+  ShmRingWriteEnd(std::shared_ptr<ShmRing> const& ring) : m_ring(ring)
+  {
+    // The device itself uses a duplicate of the data doorbell: writing to it is what rings the bell.
+    fd_init(dup(ring->data_doorbell()), false);
+    m_space_doorbell = evio::create<ShmRingSpaceDoorbell>(this);
+    m_space_doorbell->init(dup(ring->space_doorbell()));
+  }
+
+  ~ShmRingWriteEnd() { writer_closed(); }
+
+  // Called by the space doorbell.
+  void space_available() { start_output_device(); }
+
+ private:
+  // Tell the reader that no more data will be written, and close the space doorbell.
+  void writer_closed()
+  {
+    ShmRing::Header* header = m_ring->header();
+    if (!header->m_closed.exchange(true, std::memory_order_seq_cst))
+    {
+      ShmRing::ring(m_ring->data_doorbell());
+      m_space_doorbell->close();
+    }
+  }
+
+ protected:
+  void write_to_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline void ShmRingSpaceDoorbell::read_from_fd(int& CWDEBUG_ONLY(allow_deletion_count), int fd)
+{
+  DoutEntering(dc::notice, "ShmRingSpaceDoorbell::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  uint64_t count;
+  if (::read(fd, &count, sizeof(count)) == -1)
+    return;
+  stop_input_device();
+  m_write_end->space_available();
+}
+
+inline void ShmRingWriteEnd::write_to_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "ShmRingWriteEnd::write_to_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  ShmRing::Header* header = m_ring->header();
+  uint64_t const old_head = header->m_head.load(std::memory_order_relaxed);
+  uint64_t head = old_head;
+  uint64_t tail = header->m_tail.load(std::memory_order_acquire);
+  bool full = false;
+  for (;;)
+  {
+    size_t len = m_obuffer->buf2dev_contiguous();
+    if (len == 0 && (len = m_obuffer->buf2dev_contiguous_forced()) == 0)
+      break;                                            // The buffer is empty.
+    size_t space = m_ring->capacity() - (head - tail);
+    if (space == 0)
+    {
+      tail = header->m_tail.load(std::memory_order_acquire);
+      space = m_ring->capacity() - (head - tail);
+      if (space == 0)
+      {
+        // Ask the reader to ring the space doorbell, then check again in case it just made space.
+        header->m_writer_waiting.store(true, std::memory_order_seq_cst);
+        tail = header->m_tail.load(std::memory_order_seq_cst);
+        space = m_ring->capacity() - (head - tail);
+        if (space == 0)
+        {
+          full = true;
+          break;
+        }
+        header->m_writer_waiting.store(false, std::memory_order_relaxed);
+      }
+    }
+    size_t const wlen = std::min(len, space);
+    m_ring->copy_to(head, m_obuffer->buf2dev_ptr(), wlen);
+    m_obuffer->buf2dev_bump(wlen);
+    head += wlen;
+  }
+  if (head != old_head)
+  {
+    header->m_head.store(head, std::memory_order_seq_cst);
+    // Only ring the data doorbell if the ring was empty, otherwise the reader is still reading.
+    if (header->m_tail.load(std::memory_order_seq_cst) == old_head)
+      ShmRing::ring(fd);
+  }
+  if (full)
+  {
+    stop_output_device(allow_deletion_count);
+    m_space_doorbell->start();
+    return;
+  }
+  // The buffer is empty. If flush_output_device() was called then stop_output_device() will close this device.
+  if (state_t::wat(m_state)->m_flags.is_w_flushing())
+    writer_closed();
+  stop_output_device(allow_deletion_count);
+  // If the PutThread added data after we found the buffer empty, then its start_output_device() might have been a no-op.
+  if (m_obuffer->buf2dev_contiguous_forced() > 0)
+    start_output_device();
+}
+
+class ShmRingReadEnd : public evio::InputDevice
+{
+ private:
+  std::shared_ptr<ShmRing> m_ring;
+
+ public:
+  ShmRingReadEnd(std::shared_ptr<ShmRing> const& ring) : m_ring(ring)
+  {
+    fd_init(dup(ring->data_doorbell()), false);
+  }
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline void ShmRingReadEnd::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "ShmRingReadEnd::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  uint64_t count;
+  [[maybe_unused]] ssize_t unused = ::read(fd, &count, sizeof(count));        // Reset the doorbell.
+  ShmRing::Header* header = m_ring->header();
+  uint64_t tail = header->m_tail.load(std::memory_order_relaxed);
+  for (;;)
+  {
+    uint64_t head = header->m_head.load(std::memory_order_acquire);
+    while (tail != head)
+    {
+      size_t space = m_ibuffer->dev2buf_contiguous();
+      if (space == 0 && (space = m_ibuffer->dev2buf_contiguous_forced()) == 0)
+      {
+        // The input buffer is full. Ring our own doorbell so that we'll be called again when the input device is restarted.
+        header->m_tail.store(tail, std::memory_order_seq_cst);
+        ShmRing::ring(fd);
+        stop_input_device();
+        return;
+      }
+      size_t const rlen = std::min<size_t>(head - tail, space);
+      char* new_data = m_ibuffer->dev2buf_ptr();
+      m_ring->copy_from(tail, new_data, rlen);
+      m_ibuffer->dev2buf_bump(rlen);
+      tail += rlen;
+      data_received(allow_deletion_count, new_data, rlen);
+      // Stop when the decoder closed this device.
+      if (!state_t::wat(m_state)->m_flags.is_r_open())
+      {
+        header->m_tail.store(tail, std::memory_order_seq_cst);
+        return;
+      }
+    }
+    header->m_tail.store(tail, std::memory_order_seq_cst);
+    if (header->m_writer_waiting.load(std::memory_order_seq_cst))
+    {
+      header->m_writer_waiting.store(false, std::memory_order_relaxed);
+      ShmRing::ring(m_ring->space_doorbell());
+    }
+    // Make sure the writer didn't add data after we read m_head, while not ringing the bell because it saw the old m_tail.
+    if (header->m_head.load(std::memory_order_seq_cst) == tail)
+      break;
+  }
+  if (header->m_closed.load(std::memory_order_acquire) && header->m_head.load(std::memory_order_acquire) == tail)
+    read_returned_zero(allow_deletion_count);
+}
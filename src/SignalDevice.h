@@ -0,0 +1,106 @@
+// Signals as first-class events of the event loop.
+//
+// SignalDevice is an InputDevice around a signalfd(2). The signals that it handles are
+// blocked by init(), which must be called in main() before any other thread is created,
+// so that every thread inherits that signal mask and the signals stay pending until they
+// are read from the signalfd. The EventLoopThread then treats them like any other
+// readable fd and read_from_fd, running in the thread pool, calls the registered handlers.
+//
+// Each wake up reads as many signalfd_siginfo records as are available (up to
+// max_records_per_read per read(2) call) before returning to the event loop.
+
+#pragma once
+
+#include "evio/InputDevice.h"
+#include "utils/AIAlert.h"
+#include <array>
+#include <csignal>
+#include <functional>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+class SignalDevice : public evio::InputDevice
+{
+ public:
+  using handler_type = std::function<void(int& allow_deletion_count, signalfd_siginfo const& info)>;
+  static constexpr size_t max_records_per_read = 32;
+
+ private:
+  sigset_t m_mask;                              // The signals handled by this device.
+  std::array<handler_type, NSIG> m_handlers;    // The handler to call, per signal number.
+  size_t m_wakeups;                             // The number of calls to read_from_fd.
+  size_t m_records;                             // The total number of signalfd_siginfo records read.
+  bool m_closed;                                // Set when a handler called close().
+
+ public:
+  SignalDevice() : m_wakeups(0), m_records(0), m_closed(false) { sigemptyset(&m_mask); }
+
+  // Register a handler for signum. Must be called before init().
+  void add_signal(int signum, handler_type handler)
+  {
+    sigaddset(&m_mask, signum);
+    m_handlers[signum] = std::move(handler);
+  }
+
+  // Block the registered signals for the calling thread and create the signalfd.
+  // Must be called before any other thread is created, because those should inherit the signal mask.
+  void init()
+  {
+    pthread_sigmask(SIG_BLOCK, &m_mask, nullptr);
+    int fd = signalfd(-1, &m_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+      THROW_ALERTE("signalfd");
+    fd_init(fd, false);   // Already non-blocking.
+  }
+
+  void start()
+  {
+    start_input_device(state_t::wat(m_state));
+  }
+
+  // Close the device from a handler.
+  void close(int& allow_deletion_count)
+  {
+    m_closed = true;
+    close_input_device(allow_deletion_count);
+  }
+
+  size_t wakeups() const { return m_wakeups; }
+  size_t records() const { return m_records; }
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+};
+
+inline void SignalDevice::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "SignalDevice::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  ++m_wakeups;
+  std::array<signalfd_siginfo, max_records_per_read> records;
+  for (;;)
+  {
+    ssize_t len = ::read(fd, records.data(), sizeof(records));
+    if (len == -1)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        read_error(allow_deletion_count, errno);
+      return;
+    }
+    size_t const number_of_records = len / sizeof(signalfd_siginfo);
+    m_records += number_of_records;
+    for (size_t r = 0; r < number_of_records; ++r)
+    {
+      handler_type const& handler = m_handlers[records[r].ssi_signo];
+      if (handler)
+      {
+        handler(allow_deletion_count, records[r]);
+        if (m_closed)
+          return;
+      }
+    }
+    // A short read means that no more signals are pending.
+    if (number_of_records < max_records_per_read)
+      return;
+  }
+}
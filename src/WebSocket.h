@@ -0,0 +1,407 @@
+// WebSocket (RFC 6455) framing.
+//
+// After the HTTP Upgrade handshake a socket switches to websocket::Decoder with
+// switch_protocol_decoder. The decoder passes complete messages to on_message:
+//
+//   - A message that consists of a single frame is unmasked in place, in the input
+//     buffer, and passed to on_message without being copied.
+//   - The payload of a fragmented message is collected (and unmasked) in one buffer,
+//     which is passed to on_message when the last fragment arrives. Control frames
+//     may be interleaved with the fragments.
+//   - Ping frames are answered with a pong, and a close frame with a close frame, on
+//     the reply stream; neither reaches the user. A close frame also closes the input
+//     device (see close_input), after calling on_close.
+//
+// Unmasking XORs sixteen bytes at a time (SSE2, when available).
+//
+// FrameWriter writes frames to any std::ostream; websocket::OutputStream is an
+// evio::OutputStream with a FrameWriter. Frames sent by a client are masked with a key
+// from a xorshift generator that is seeded from std::random_device.
+//
+// The reply stream is written to from decode; if other threads write to the same
+// stream then the user must serialize that.
+
+#pragma once
+
+#include "evio/protocol/Decoder.h"
+#include "evio/OutputStream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <random>
+#include <string>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace websocket {
+
+enum opcode_type : uint8_t
+{
+  op_continuation = 0x0,
+  op_text = 0x1,
+  op_binary = 0x2,
+  op_close = 0x8,
+  op_ping = 0x9,
+  op_pong = 0xa
+};
+
+enum role_type
+{
+  server,               // Receives masked frames and sends unmasked frames.
+  client                // Receives unmasked frames and sends masked frames.
+};
+
+// Close status codes.
+uint16_t constexpr close_normal = 1000;
+uint16_t constexpr close_protocol_error = 1002;
+uint16_t constexpr close_too_big = 1009;
+uint16_t constexpr close_no_status = 1005;
+
+namespace simd {
+
+// XOR [src, src + len) with the four byte masking key (in network order, as it appears in
+// the frame) and write the result to dst, which may be equal to src.
+inline void unmask(char* dst, char const* src, size_t len, char const key[4])
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  int32_t key32;
+  std::memcpy(&key32, key, 4);
+  __m128i const vkey = _mm_set1_epi32(key32);
+  for (; len - i >= 16; i += 16)
+  {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(v, vkey));
+  }
+#else
+  uint64_t key64;
+  std::memcpy(&key64, key, 4);
+  std::memcpy(reinterpret_cast<char*>(&key64) + 4, key, 4);
+  for (; len - i >= 8; i += 8)
+  {
+    uint64_t v;
+    std::memcpy(&v, src + i, 8);
+    v ^= key64;
+    std::memcpy(dst + i, &v, 8);
+  }
+#endif
+  // i is a multiple of four here.
+  for (; i < len; ++i)
+    dst[i] = src[i] ^ key[i & 3];
+}
+
+} // namespace simd
+
+class FrameWriter
+{
+ private:
+  bool m_mask;
+  uint64_t m_state;     // xorshift64 state, for the masking keys.
+
+  uint32_t next_key()
+  {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 7;
+    m_state ^= m_state << 17;
+    return static_cast<uint32_t>(m_state);
+  }
+
+ public:
+  FrameWriter(role_type role) : m_mask(role == client), m_state(0)
+  {
+    if (m_mask)
+    {
+      std::random_device rd;
+      m_state = (static_cast<uint64_t>(rd()) << 32) | rd() | 1;
+    }
+  }
+
+  void write(std::ostream& os, opcode_type opcode, char const* data, size_t len, bool fin = true);
+};
+
+inline void FrameWriter::write(std::ostream& os, opcode_type opcode, char const* data, size_t len, bool fin)
+{
+  char header[14];
+  size_t header_len = 2;
+  header[0] = (fin ? 0x80 : 0) | opcode;
+  char const mask_bit = m_mask ? 0x80 : 0;
+  if (len < 126)
+    header[1] = mask_bit | len;
+  else if (len < 65536)
+  {
+    header[1] = mask_bit | 126;
+    header[2] = len >> 8;
+    header[3] = len;
+    header_len = 4;
+  }
+  else
+  {
+    header[1] = mask_bit | 127;
+    for (int i = 0; i < 8; ++i)
+      header[2 + i] = static_cast<uint64_t>(len) >> (56 - 8 * i);
+    header_len = 10;
+  }
+  if (!m_mask)
+  {
+    os.write(header, header_len);
+    os.write(data, len);
+    return;
+  }
+  uint32_t const key32 = next_key();
+  char* const key = header + header_len;
+  std::memcpy(key, &key32, 4);
+  os.write(header, header_len + 4);
+  // Mask through a small buffer; its size is a multiple of four so the key stays aligned.
+  char buf[4096];
+  for (size_t done = 0; done < len; done += sizeof(buf))
+  {
+    size_t const chunk = std::min(sizeof(buf), len - done);
+    simd::unmask(buf, data + done, chunk, key);
+    os.write(buf, chunk);
+  }
+}
+
+// An OutputStream that writes WebSocket frames.
+class OutputStream : public evio::OutputStream
+{
+ private:
+  FrameWriter m_writer;
+
+ public:
+  OutputStream(role_type role = server) : m_writer(role) { }
+
+  void send(opcode_type opcode, std::string_view payload, bool fin = true) { m_writer.write(*this, opcode, payload.data(), payload.size(), fin); }
+  void send_text(std::string_view text) { send(op_text, text); }
+  void send_binary(std::string_view data) { send(op_binary, data); }
+  void ping(std::string_view payload = {}) { send(op_ping, payload); }
+};
+
+class Decoder : public evio::protocol::Decoder
+{
+ public:
+  static constexpr uint64_t max_frame_size = 16 * 1024 * 1024;
+
+ private:
+  role_type m_role;
+  FrameWriter m_reply_writer;
+  std::ostream* m_replies;              // Where to write pongs and the close reply, or nullptr.
+
+  // end_of_msg_finder state.
+  unsigned char m_header[14];
+  size_t m_header_len;                  // The number of header bytes received so far.
+  size_t m_header_needed;               // The size of the header, once the first two bytes are known.
+  uint64_t m_remaining;                 // The number of payload bytes still to come.
+  bool m_error;                         // Set when the stream can't be decoded anymore.
+
+  // decode state.
+  std::string m_fragments;              // The payload of the fragmented message so far.
+  opcode_type m_fragmented_opcode;      // The opcode of the fragmented message, or op_continuation if there is none.
+  bool m_closed;                        // Set after a close frame was received or an error occurred.
+  bool m_close_sent;
+
+ public:
+  Decoder(role_type role = server) : m_role(role), m_reply_writer(role), m_replies(nullptr),
+      m_header_len(0), m_header_needed(2), m_remaining(0), m_error(false),
+      m_fragmented_opcode(op_continuation), m_closed(false), m_close_sent(false) { }
+
+  // Set the stream that pings and close frames are answered on.
+  void set_reply_stream(std::ostream& replies) { m_replies = &replies; }
+
+  // Send a close frame, unless one was already sent.
+  void send_close(uint16_t code = close_normal);
+
+ protected:
+  // A complete text or binary message. The data is only valid during the call.
+  virtual void on_message(int& allow_deletion_count, opcode_type opcode, char const* data, size_t len) = 0;
+  // The peer sent a close frame (with status code close_no_status if it didn't contain one).
+  virtual void on_close(int& UNUSED_ARG(allow_deletion_count), uint16_t UNUSED_ARG(code)) { }
+  virtual void on_error(int& UNUSED_ARG(allow_deletion_count), char const* CWDEBUG_ONLY(what))
+  {
+    Dout(dc::warning, "websocket::Decoder: " << what);
+  }
+  // Stop reading; called once, after on_close or on_error. The default closes the input device.
+  virtual void close_input(int& allow_deletion_count) { close_input_device(allow_deletion_count); }
+
+  size_t end_of_msg_finder(char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& result) override;
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override;
+
+ private:
+  void protocol_error(int& allow_deletion_count, char const* what, uint16_t code = close_protocol_error);
+  void reply(opcode_type opcode, char const* data, size_t len)
+  {
+    if (!m_replies)
+      return;
+    m_reply_writer.write(*m_replies, opcode, data, len);
+    *m_replies << std::flush;
+  }
+};
+
+// Return the length of the frame that ends in [new_data, new_data + rlen), or zero if the
+// frame isn't complete yet. Only the header bytes are looked at.
+inline size_t Decoder::end_of_msg_finder(char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result))
+{
+  if (m_error)
+    return rlen;                        // Pass everything to decode, which ignores it.
+  size_t i = 0;
+  while (i < rlen)
+  {
+    if (m_header_len < m_header_needed)
+    {
+      m_header[m_header_len++] = new_data[i++];
+      if (m_header_len == 2)
+      {
+        unsigned int const len7 = m_header[1] & 0x7f;
+        m_header_needed = 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) + ((m_header[1] & 0x80) ? 4 : 0);
+      }
+      if (m_header_len < m_header_needed)
+        continue;
+      unsigned int const len7 = m_header[1] & 0x7f;
+      if (len7 < 126)
+        m_remaining = len7;
+      else
+      {
+        m_remaining = 0;
+        for (size_t b = 2; b < (len7 == 126 ? 4u : 10u); ++b)
+          m_remaining = (m_remaining << 8) | m_header[b];
+      }
+      if (m_remaining > max_frame_size)
+      {
+        // Let decode report it.
+        m_error = true;
+        return rlen;
+      }
+    }
+    else
+    {
+      size_t const len = std::min(static_cast<uint64_t>(rlen - i), m_remaining);
+      i += len;
+      m_remaining -= len;
+    }
+    if (m_remaining == 0)
+    {
+      m_header_len = 0;
+      m_header_needed = 2;
+      return i;
+    }
+  }
+  return 0;
+}
+
+inline void Decoder::send_close(uint16_t code)
+{
+  if (m_close_sent)
+    return;
+  m_close_sent = true;
+  char const payload[2] = { static_cast<char>(code >> 8), static_cast<char>(code) };
+  reply(op_close, payload, sizeof(payload));
+}
+
+inline void Decoder::protocol_error(int& allow_deletion_count, char const* what, uint16_t code)
+{
+  m_error = true;
+  m_closed = true;
+  send_close(code);
+  on_error(allow_deletion_count, what);
+  close_input(allow_deletion_count);
+}
+
+inline void Decoder::decode(int& allow_deletion_count, evio::MsgBlock&& msg)
+{
+  if (m_closed)
+    return;
+  if (m_error)
+  {
+    protocol_error(allow_deletion_count, "Frame too large.", close_too_big);
+    return;
+  }
+
+  // The frame is contiguous; the header was already validated for length by end_of_msg_finder.
+  unsigned char const* const header = reinterpret_cast<unsigned char const*>(msg.get_start());
+  bool const fin = header[0] & 0x80;
+  opcode_type const opcode = static_cast<opcode_type>(header[0] & 0x0f);
+  bool const masked = header[1] & 0x80;
+  unsigned int const len7 = header[1] & 0x7f;
+  size_t header_len = 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0);
+  char const* key = nullptr;
+  if (masked)
+  {
+    key = msg.get_start() + header_len;
+    header_len += 4;
+  }
+  // The input buffer is ours and is not read again after this call, so the payload can be unmasked in place.
+  char* const payload = const_cast<char*>(msg.get_start()) + header_len;
+  size_t const len = msg.get_size() - header_len;
+
+  if ((header[0] & 0x70))
+    return protocol_error(allow_deletion_count, "Reserved bits set.");
+  if (masked != (m_role == server))
+    return protocol_error(allow_deletion_count, masked ? "Masked frame from server." : "Unmasked frame from client.");
+  if (masked)
+    simd::unmask(payload, payload, len, key);
+
+  if ((opcode & 0x8))
+  {
+    // Control frames.
+    if (!fin || len > 125)
+      return protocol_error(allow_deletion_count, "Fragmented or too long control frame.");
+    switch (opcode)
+    {
+      case op_ping:
+        reply(op_pong, payload, len);
+        break;
+      case op_pong:
+        break;
+      case op_close:
+      {
+        uint16_t const code = len >= 2 ? (static_cast<unsigned char>(payload[0]) << 8) | static_cast<unsigned char>(payload[1]) : close_no_status;
+        m_closed = true;
+        send_close(code == close_no_status ? close_normal : code);
+        on_close(allow_deletion_count, code);
+        close_input(allow_deletion_count);
+        break;
+      }
+      default:
+        protocol_error(allow_deletion_count, "Unknown control opcode.");
+        break;
+    }
+    return;
+  }
+
+  switch (opcode)
+  {
+    case op_continuation:
+      if (m_fragmented_opcode == op_continuation)
+        return protocol_error(allow_deletion_count, "Continuation frame without a message.");
+      if (m_fragments.size() + len > max_frame_size)
+        return protocol_error(allow_deletion_count, "Message too large.", close_too_big);
+      m_fragments.append(payload, len);
+      if (fin)
+      {
+        opcode_type const message_opcode = m_fragmented_opcode;
+        m_fragmented_opcode = op_continuation;
+        on_message(allow_deletion_count, message_opcode, m_fragments.data(), m_fragments.size());
+        m_fragments.clear();
+      }
+      break;
+    case op_text:
+    case op_binary:
+      if (m_fragmented_opcode != op_continuation)
+        return protocol_error(allow_deletion_count, "New message before the last fragment.");
+      if (fin)
+        on_message(allow_deletion_count, opcode, payload, len);       // Not copied.
+      else
+      {
+        m_fragmented_opcode = opcode;
+        m_fragments.assign(payload, len);
+      }
+      break;
+    default:
+      protocol_error(allow_deletion_count, "Unknown data opcode.");
+      break;
+  }
+}
+
+} // namespace websocket
@@ -0,0 +1,404 @@
+// An XML-RPC client over HTTP/1.1 keep-alive, with request pipelining.
+//
+// xmlrpc::Client is an evio::Socket. Every call is serialized straight into the socket's
+// OutputStream: the arguments are written twice, once to a sink that only counts the
+// bytes (for the Content-Length header) and then to the stream itself, so that no
+// request is ever built in an intermediate string. Calls don't wait for the response
+// of the previous call; they are all sent on the same connection, and since an HTTP/1.1
+// server answers pipelined requests in order, the responses are correlated with the
+// calls by keeping the pending calls in a FIFO.
+//
+// Responses are decoded by an http::Decoder whose body is fed to an xmlrpc::Parser, so
+// the result is written directly into the T of the callback (see XMLRPCDecoder.h for
+// the supported types). Arguments can be of the same types (except unsigned 64-bit
+// integers, which don't fit in an <i8>), plus anything that converts to
+// std::string_view. For example,
+//
+//   auto client = evio::create<xmlrpc::Client>("localhost:8080");
+//   client->connect(evio::SocketAddress("127.0.0.1:8080"));
+//   client->call<Result>("search", [](Result& result, xmlrpc::Fault const* fault){ ... }, "query", 10);
+//
+// The callback is called from the thread that decodes the input, with fault nullptr on
+// success. On a fault response it points to the fault, while local failures use the
+// codes of the XML-RPC fault code interoperability specification: parse_error when
+// the response can't be decoded and transport_error when the HTTP response is not 200
+// or the connection is lost. A response without Content-Length (and not chunked) ends
+// when the server closes the connection; its call is completed before the calls that
+// are still pending fail. Calls may be made from any thread, but not concurrently.
+
+#pragma once
+
+#include "HTTPDecoder.h"
+#include "XMLRPCDecoder.h"
+#include "evio/Socket.h"
+#include "evio/OutputStream.h"
+#include <charconv>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace xmlrpc {
+
+// Fault codes for failures that are detected by the client itself.
+int32_t constexpr parse_error = -32700;
+int32_t constexpr transport_error = -32300;
+
+template<typename T>
+using Callback = std::function<void(T& result, Fault const* fault)>;
+
+namespace detail {
+
+// Counts the bytes that would be written.
+class CountingSink
+{
+ private:
+  size_t m_size = 0;
+
+ public:
+  void write(char const* UNUSED_ARG(data), size_t len) { m_size += len; }
+  size_t size() const { return m_size; }
+};
+
+class StreamSink
+{
+ private:
+  std::ostream& m_os;
+
+ public:
+  StreamSink(std::ostream& os) : m_os(os) { }
+  void write(char const* data, size_t len) { m_os.write(data, len); }
+};
+
+template<typename T>
+struct is_vector : std::false_type { };
+
+template<typename T>
+struct is_vector<std::vector<T>> : std::true_type { };
+
+template<typename Sink>
+class Writer
+{
+ private:
+  Sink& m_sink;
+
+ public:
+  Writer(Sink& sink) : m_sink(sink) { }
+
+  void literal(std::string_view str) { m_sink.write(str.data(), str.size()); }
+
+  // Write str with '<', '>', '&' and '\r' escaped.
+  void escaped(std::string_view str)
+  {
+    char const* run = str.data();
+    char const* const end = run + str.size();
+    for (char const* p = run; p < end; ++p)
+    {
+      char const* entity;
+      switch (*p)
+      {
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '&': entity = "&amp;"; break;
+        case '\r': entity = "&#13;"; break;
+        default: continue;
+      }
+      m_sink.write(run, p - run);
+      literal(entity);
+      run = p + 1;
+    }
+    m_sink.write(run, end - run);
+  }
+
+  template<typename T>
+  void value(T const& value);
+};
+
+template<typename Sink>
+template<typename T>
+void Writer<Sink>::value(T const& value)
+{
+  literal("<value>");
+  if constexpr (std::is_same_v<T, bool>)
+    literal(value ? "<boolean>1</boolean>" : "<boolean>0</boolean>");
+  else if constexpr (std::is_integral_v<T>)
+  {
+    static_assert(sizeof(T) <= sizeof(int64_t), "Integer type too large.");
+    // <i8> is signed; an unsigned 64-bit value could be out of range.
+    static_assert(std::is_signed_v<T> || sizeof(T) < sizeof(int64_t), "Unsigned 64-bit integers can't be represented; use int64_t.");
+    char buf[24];
+    char* const end = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+    // Prefer <int>, which every server understands, when the value fits.
+    bool const is_int = static_cast<int64_t>(value) >= std::numeric_limits<int32_t>::min() && static_cast<int64_t>(value) <= std::numeric_limits<int32_t>::max();
+    literal(is_int ? "<int>" : "<i8>");
+    m_sink.write(buf, end - buf);
+    literal(is_int ? "</int>" : "</i8>");
+  }
+  else if constexpr (std::is_floating_point_v<T>)
+  {
+    char buf[32];
+    char* const end = std::to_chars(buf, buf + sizeof(buf), static_cast<double>(value)).ptr;
+    literal("<double>");
+    m_sink.write(buf, end - buf);
+    literal("</double>");
+  }
+  else if constexpr (std::is_same_v<T, Timestamp>)
+  {
+    // The compact form of the XML-RPC specification: 20210129T15:37:23.
+    char buf[iso8601::formatted_size];
+    iso8601::format(value.m_seconds, buf);
+    literal("<dateTime.iso8601>");
+    m_sink.write(buf, 4);
+    m_sink.write(buf + 5, 2);
+    m_sink.write(buf + 8, 11);
+    literal("</dateTime.iso8601>");
+  }
+  else if constexpr (std::is_same_v<T, Binary>)
+  {
+    // Encode in blocks, on the stack.
+    literal("<base64>");
+    char buf[4096];
+    size_t constexpr block_size = sizeof(buf) / 4 * 3;
+    for (size_t pos = 0; pos < value.m_data.size(); pos += block_size)
+    {
+      size_t const len = std::min(block_size, value.m_data.size() - pos);
+      m_sink.write(buf, ::base64::encode(value.m_data.data() + pos, len, buf) - buf);
+    }
+    literal("</base64>");
+  }
+  else if constexpr (std::is_convertible_v<T const&, std::string_view>)
+  {
+    literal("<string>");
+    escaped(value);
+    literal("</string>");
+  }
+  else if constexpr (is_vector<T>::value)
+  {
+    literal("<array><data>");
+    for (auto const& element : value)
+      this->value(element);
+    literal("</data></array>");
+  }
+  else
+  {
+    literal("<struct>");
+    std::apply([&](auto const&... members){
+        ((literal("<member><name>"), escaped(members.m_name), literal("</name>"), this->value(value.*members.m_pointer), literal("</member>")), ...);
+      }, Members<T>::value);
+    literal("</struct>");
+  }
+  literal("</value>");
+}
+
+template<typename Sink, typename... Args>
+void write_call(Sink& sink, std::string_view method, Args const&... args)
+{
+  Writer<Sink> writer(sink);
+  writer.literal("<?xml version=\"1.0\"?>\r\n<methodCall><methodName>");
+  writer.escaped(method);
+  writer.literal("</methodName><params>");
+  ((writer.literal("<param>"), writer.value(args), writer.literal("</param>")), ...);
+  writer.literal("</params></methodCall>\r\n");
+}
+
+} // namespace detail
+
+// Write a complete HTTP/1.1 request for the call method(args...) to os.
+template<typename... Args>
+void write_request(std::ostream& os, std::string_view host, std::string_view path, std::string_view method, Args const&... args)
+{
+  detail::CountingSink counter;
+  detail::write_call(counter, method, args...);
+  os << "POST " << path << " HTTP/1.1\r\n"
+        "Host: " << host << "\r\n"
+        "Content-Type: text/xml\r\n"
+        "Content-Length: " << counter.size() << "\r\n"
+        "\r\n";
+  detail::StreamSink sink(os);
+  detail::write_call(sink, method, args...);
+}
+
+// A call whose response is still expected.
+class PendingCall
+{
+ public:
+  virtual ~PendingCall() = default;
+  virtual Target target() = 0;
+  virtual void complete(Fault const* fault) = 0;
+};
+
+template<typename T>
+class PendingCallT : public PendingCall
+{
+ private:
+  T m_result;
+  Callback<T> m_callback;
+
+ public:
+  PendingCallT(Callback<T>&& callback) : m_result(), m_callback(std::move(callback)) { }
+
+  Target target() override { return xmlrpc::target(m_result); }
+  void complete(Fault const* fault) override { m_callback(m_result, fault); }
+};
+
+// Decodes the HTTP responses to pipelined calls, and completes the calls in order.
+class ResponseDecoder : public http::Decoder
+{
+ private:
+  mutable std::mutex m_mutex;
+  std::deque<std::unique_ptr<PendingCall>> m_pending;   // Protected by m_mutex.
+  Parser m_parser;
+  int m_status;                                         // The HTTP status of the current response.
+  bool m_interim;                                       // Set while decoding a 1xx response.
+
+ public:
+  ResponseDecoder() : m_status(0), m_interim(false) { }
+
+  // Add call to the end of the FIFO; this must be done before its request is sent.
+  void expect(std::unique_ptr<PendingCall>&& call)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.push_back(std::move(call));
+  }
+
+  size_t pending() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending.size();
+  }
+
+  // Complete all pending calls with a transport error.
+  void fail_all(char const* what)
+  {
+    std::deque<std::unique_ptr<PendingCall>> pending;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      pending.swap(m_pending);
+    }
+    Fault const fault{ transport_error, what };
+    for (auto& call : pending)
+      call->complete(&fault);
+  }
+
+ protected:
+  void on_head(int& allow_deletion_count, http::MessageHead const& head) override
+  {
+    PendingCall* call;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      call = m_pending.empty() ? nullptr : m_pending.front().get();
+    }
+    if (!call)
+    {
+      on_error(allow_deletion_count, "Response without call.");
+      return;
+    }
+    // An interim response (like 100 Continue) is followed by the final response to the same call.
+    m_interim = head.status() < 200;
+    if (m_interim)
+      return;
+    m_status = head.status();
+    m_parser.reset(call->target());
+  }
+
+  void on_body(int& UNUSED_ARG(allow_deletion_count), char const* data, size_t len) override
+  {
+    if (m_status == 200 && m_parser.status() == Parser::busy)
+      m_parser.feed(data, len);
+  }
+
+  void on_message_complete(int& UNUSED_ARG(allow_deletion_count)) override
+  {
+    if (m_interim)
+    {
+      m_interim = false;
+      return;
+    }
+    std::unique_ptr<PendingCall> call;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_pending.empty())
+        return;
+      call = std::move(m_pending.front());
+      m_pending.pop_front();
+    }
+    if (m_status != 200)
+    {
+      Fault const fault{ transport_error, "HTTP status " + std::to_string(m_status) + "." };
+      call->complete(&fault);
+    }
+    else if (m_parser.status() != Parser::done)
+    {
+      Fault const fault{ parse_error, m_parser.status() == Parser::failed ? m_parser.error() : "Incomplete response." };
+      call->complete(&fault);
+    }
+    else
+      call->complete(m_parser.is_fault() ? &m_parser.fault() : nullptr);
+  }
+
+  void on_error(int& allow_deletion_count, char const* what) override
+  {
+    fail_all(what);
+    http::Decoder::on_error(allow_deletion_count, what);
+  }
+};
+
+class Client : public evio::Socket
+{
+ private:
+  ResponseDecoder m_decoder;
+  evio::OutputStream m_output;
+  std::string m_host;           // The value of the Host header.
+  std::string m_path;           // The request target.
+
+ public:
+  Client(std::string host, std::string path = "/RPC2") : m_host(std::move(host)), m_path(std::move(path))
+  {
+    set_protocol_decoder(m_decoder);
+    set_source(m_output);
+  }
+
+  // Call method(args...); callback is called with the result once the response was received.
+  template<typename T, typename... Args>
+  void call(std::string_view method, Callback<T> callback, Args const&... args)
+  {
+    m_decoder.expect(std::make_unique<PendingCallT<T>>(std::move(callback)));
+    write_request(m_output, m_host, m_path, method, args...);
+    m_output << std::flush;
+  }
+
+  // The number of calls whose response wasn't received yet.
+  size_t pending() const { return m_decoder.pending(); }
+
+ protected:
+  void read_returned_zero(int& allow_deletion_count) override
+  {
+    // A response without Content-Length ends here; complete its call before failing the rest.
+    m_decoder.end_of_input(allow_deletion_count);
+    m_decoder.fail_all("Connection closed by peer.");
+    evio::Socket::read_returned_zero(allow_deletion_count);
+  }
+
+  void read_error(int& allow_deletion_count, int err) override
+  {
+    m_decoder.fail_all("Read error.");
+    evio::Socket::read_error(allow_deletion_count, err);
+  }
+
+  void write_error(int& allow_deletion_count, int err) override
+  {
+    m_decoder.fail_all("Write error.");
+    evio::Socket::write_error(allow_deletion_count, err);
+  }
+
+  // Called when the fd was closed, for whatever reason (including a call to close()): no response will arrive anymore.
+  void closed(int& allow_deletion_count) override
+  {
+    m_decoder.fail_all("Connection closed.");
+    evio::Socket::closed(allow_deletion_count);
+  }
+};
+
+} // namespace xmlrpc
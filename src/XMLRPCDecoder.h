@@ -0,0 +1,1021 @@
+// A streaming XML-RPC response decoder.
+//
+// xmlrpc::Parser parses a <methodResponse> incrementally, in chunks of any size as they
+// arrive, and writes the values directly into user-declared C++ objects. No DOM and no
+// intermediate strings are built: string contents are unescaped straight into the
+// destination std::string, base64 is decoded (with the kernels of Base64.h) straight
+// into the destination buffer, and the remaining scalars are collected in a small fixed
+// buffer and converted when their end tag is seen. The memory that the parser itself
+// uses is fixed (see max_depth, max_tag_size and max_scalar_size), no matter how large
+// the response is.
+//
+// The C++ types that can be decoded into, and the XML-RPC types that they accept, are
+//
+//   int32_t, int64_t     <i4>, <int>, <i8> (range checked)
+//   bool                 <boolean>
+//   double               <double>, <i4>, <int>, <i8>
+//   std::string          <string>, or a value without type element
+//   xmlrpc::Timestamp    <dateTime.iso8601>
+//   xmlrpc::Binary       <base64>
+//   std::vector<T>       <array>
+//   structs              <struct>, through a compile-time member map:
+//
+//     template<>
+//     struct xmlrpc::Members<Item>
+//     {
+//       static constexpr auto value = std::make_tuple(
+//           xmlrpc::member("id", &Item::m_id),
+//           xmlrpc::member("name", &Item::m_name));
+//     };
+//
+// Members that are not in the map, and params after the first, are parsed but ignored.
+// Members that are missing keep their value, and so does any object for which <nil/> is
+// received. A value of the wrong type is an error.
+//
+// xmlrpc::Decoder<T> is an evio protocol decoder that feeds everything it receives to
+// a Parser and calls on_response with the T for every complete <methodResponse>, or
+// on_fault for a fault response. Errors call on_error, after which the rest of the
+// stream is ignored. The default on_error closes the input device.
+
+#pragma once
+
+#include "Base64.h"
+#include "ISO8601.h"
+#include "evio/protocol/Decoder.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace xmlrpc {
+
+namespace simd {
+
+// Return a pointer to the first '<' or '&' in [begin, end), or end if there is none.
+inline char const* find_markup(char const* begin, char const* end)
+{
+  char const* p = begin;
+#ifdef __SSE2__
+  __m128i const lt = _mm_set1_epi8('<');
+  __m128i const amp = _mm_set1_epi8('&');
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+    unsigned int const mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, amp)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p < end; ++p)
+    if (*p == '<' || *p == '&')
+      break;
+  return p;
+}
+
+} // namespace simd
+
+// The XML-RPC value types, as bits so that a set of them fits in an unsigned int.
+enum value_type : unsigned int
+{
+  t_none = 0,
+  t_int = 1 << 0,               // <i4> or <int>.
+  t_i8 = 1 << 1,
+  t_boolean = 1 << 2,
+  t_double = 1 << 3,
+  t_string = 1 << 4,            // <string>, or a value without type element.
+  t_datetime = 1 << 5,
+  t_base64 = 1 << 6,
+  t_struct = 1 << 7,
+  t_array = 1 << 8,
+  t_nil = 1 << 9
+};
+
+// A <dateTime.iso8601>, in seconds since the epoch.
+struct Timestamp
+{
+  std::time_t m_seconds;
+};
+
+// The decoded contents of a <base64>.
+struct Binary
+{
+  std::string m_data;
+};
+
+struct Ops;
+
+// An object that a value is decoded into. A Target without ops ignores the value.
+struct Target
+{
+  void* m_object;
+  Ops const* m_ops;
+};
+
+// What the parser can do with an object of a given type; there is one for every Binding.
+struct Ops
+{
+  unsigned int m_accepts;                                               // The value_type's that can be decoded into the object.
+  bool (*m_assign)(void* object, std::string_view text);                // Assign a scalar from its text, which is followed by a '\0'.
+  void (*m_clear)(void* object);                                        // Called at the start of a string, base64 or array value.
+  void (*m_append)(void* object, char const* data, size_t len);         // Append string data.
+  char* (*m_grow)(void* object, size_t len);                            // Append len bytes of base64 data; return where to write them.
+  void (*m_shrink)(void* object, size_t len);                           // Remove the last len bytes again.
+  Target (*m_member)(void* object, std::string_view name);              // Return the member called name of a struct.
+  Target (*m_element)(void* object);                                    // Append an element to an array and return it.
+};
+
+// Specializations provide a `static constexpr Ops ops` for T.
+template<typename T, typename = void>
+struct Binding;
+
+template<typename T>
+Target target(T& object)
+{
+  return { &object, &Binding<T>::ops };
+}
+
+template<typename C, typename M>
+struct Member
+{
+  std::string_view m_name;
+  M C::* m_pointer;
+};
+
+template<typename C, typename M>
+constexpr Member<C, M> member(std::string_view name, M C::* pointer)
+{
+  return { name, pointer };
+}
+
+// Specialize this with `static constexpr auto value = std::make_tuple(xmlrpc::member(...), ...);`
+// to decode a <struct> into C.
+template<typename C>
+struct Members
+{
+};
+
+// The contents of a fault response.
+struct Fault
+{
+  int32_t m_code = 0;
+  std::string m_string;
+};
+
+template<>
+struct Members<Fault>
+{
+  static constexpr auto value = std::make_tuple(member("faultCode", &Fault::m_code), member("faultString", &Fault::m_string));
+};
+
+namespace detail {
+
+inline bool is_space(char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+inline bool parse_integer(std::string_view text, int64_t& value)
+{
+  bool const negative = !text.empty() && text[0] == '-';
+  if (!text.empty() && (text[0] == '-' || text[0] == '+'))
+    text.remove_prefix(1);
+  if (text.empty())
+    return false;
+  uint64_t magnitude = 0;
+  for (char c : text)
+  {
+    unsigned int const digit = static_cast<unsigned char>(c) - '0';
+    if (digit > 9 || magnitude > (uint64_t{1} << 63) / 10)
+      return false;
+    magnitude = magnitude * 10 + digit;
+  }
+  if (magnitude > (uint64_t{1} << 63) - !negative)
+    return false;
+  value = negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+  return true;
+}
+
+template<typename I>
+bool assign_integer(void* object, std::string_view text)
+{
+  int64_t value;
+  if (!parse_integer(text, value) || value < std::numeric_limits<I>::min() || value > std::numeric_limits<I>::max())
+    return false;
+  *static_cast<I*>(object) = static_cast<I>(value);
+  return true;
+}
+
+template<typename S>
+void clear(void* object)
+{
+  static_cast<S*>(object)->clear();
+}
+
+template<typename S>
+void append(void* object, char const* data, size_t len)
+{
+  static_cast<S*>(object)->append(data, len);
+}
+
+} // namespace detail
+
+template<>
+struct Binding<int32_t>
+{
+  static constexpr Ops ops = { t_int | t_i8, &detail::assign_integer<int32_t>, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+};
+
+template<>
+struct Binding<int64_t>
+{
+  static constexpr Ops ops = { t_int | t_i8, &detail::assign_integer<int64_t>, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+};
+
+template<>
+struct Binding<bool>
+{
+  static bool assign(void* object, std::string_view text)
+  {
+    if (text != "0" && text != "1")
+      return false;
+    *static_cast<bool*>(object) = text[0] == '1';
+    return true;
+  }
+
+  static constexpr Ops ops = { t_boolean, &assign, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+};
+
+template<>
+struct Binding<double>
+{
+  static bool assign(void* object, std::string_view text)
+  {
+    char* end;
+    double const value = std::strtod(text.data(), &end);
+    if (text.empty() || end != text.data() + text.size())
+      return false;
+    *static_cast<double*>(object) = value;
+    return true;
+  }
+
+  static constexpr Ops ops = { t_double | t_int | t_i8, &assign, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+};
+
+template<>
+struct Binding<Timestamp>
+{
+  static bool assign(void* object, std::string_view text)
+  {
+    return iso8601::parse(text, static_cast<Timestamp*>(object)->m_seconds);
+  }
+
+  static constexpr Ops ops = { t_datetime, &assign, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+};
+
+template<>
+struct Binding<std::string>
+{
+  static constexpr Ops ops = { t_string, nullptr, &detail::clear<std::string>, &detail::append<std::string>, nullptr, nullptr, nullptr, nullptr };
+};
+
+template<>
+struct Binding<Binary>
+{
+  static void clear(void* object) { static_cast<Binary*>(object)->m_data.clear(); }
+
+  static char* grow(void* object, size_t len)
+  {
+    std::string& data = static_cast<Binary*>(object)->m_data;
+    size_t const size = data.size();
+    data.resize(size + len);
+    return data.data() + size;
+  }
+
+  static void shrink(void* object, size_t len)
+  {
+    std::string& data = static_cast<Binary*>(object)->m_data;
+    data.resize(data.size() - len);
+  }
+
+  static constexpr Ops ops = { t_base64, nullptr, &clear, nullptr, &grow, &shrink, nullptr, nullptr };
+};
+
+template<typename T>
+struct Binding<std::vector<T>>
+{
+  static_assert(!std::is_same_v<T, bool>, "Use std::vector<char> or similar instead of std::vector<bool>.");
+
+  static Target element(void* object)
+  {
+    return target(static_cast<std::vector<T>*>(object)->emplace_back());
+  }
+
+  static constexpr Ops ops = { t_array, nullptr, &detail::clear<std::vector<T>>, nullptr, nullptr, nullptr, nullptr, &element };
+};
+
+template<typename C>
+struct Binding<C, std::void_t<decltype(Members<C>::value)>>
+{
+  static Target find_member(void* object, std::string_view name)
+  {
+    C& obj = *static_cast<C*>(object);
+    Target result{ nullptr, nullptr };
+    std::apply([&](auto const&... members){ (void)((members.m_name == name && (result = target(obj.*members.m_pointer), true)) || ...); }, Members<C>::value);
+    return result;
+  }
+
+  static constexpr Ops ops = { t_struct, nullptr, nullptr, nullptr, nullptr, nullptr, &find_member, nullptr };
+};
+
+class Parser
+{
+ public:
+  static constexpr int max_depth = 32;                  // The maximum nesting depth of elements.
+  static constexpr size_t max_tag_size = 64;            // The maximum length of a tag, without the '<' and '>'.
+  static constexpr size_t max_scalar_size = 256;        // The maximum length of a member name, a scalar other than string
+                                                        // or base64, or the white space before a type element.
+
+  enum status_type
+  {
+    busy,               // The response isn't complete yet.
+    done,               // The end tag of the <methodResponse> was parsed.
+    failed              // The input is not a valid XML-RPC response; see error().
+  };
+
+ private:
+  enum state_type
+  {
+    s_text,             // Character data, up to the next '<' or '&'.
+    s_tag,              // Collecting a tag in m_tag.
+    s_entity,           // Collecting an entity reference in m_entity.
+    s_comment,          // Skipping a comment, up to "-->".
+    s_declaration,      // Skipping a processing instruction (like <?xml ...?>), up to "?>".
+    s_done,
+    s_error
+  };
+
+  enum element_type
+  {
+    e_document,         // The (virtual) parent of <methodResponse>.
+    e_methodResponse,
+    e_params,
+    e_param,
+    e_fault,
+    e_value,
+    e_struct,
+    e_member,
+    e_name,
+    e_array,
+    e_data,
+    e_scalar,           // Any of the other type elements.
+    e_unknown
+  };
+
+  // What to do with character data directly inside an element.
+  enum text_type
+  {
+    x_space,            // Only white space is allowed.
+    x_ignore,           // The value is ignored.
+    x_pending,          // Inside <value> before a type element: keep white space in m_scalar; anything else makes it a string.
+    x_string,           // Append to the target.
+    x_base64,           // Decode and append to the target.
+    x_scalar            // Collect in m_scalar.
+  };
+
+  struct Frame
+  {
+    element_type m_element;
+    value_type m_type;          // Type elements: their type. <value>: the type of its type element, or t_none if none was seen yet.
+    text_type m_text;
+    Target m_target;            // The object that the value inside this element is decoded into.
+    unsigned int m_children;    // The number of child elements so far.
+  };
+
+  state_type m_state;
+  int m_depth;
+  Frame m_stack[max_depth + 1];
+  uint32_t m_window;            // The last bytes seen while looking for the end of a comment or processing instruction.
+  size_t m_tag_len;
+  size_t m_entity_len;
+  size_t m_scalar_len;
+  size_t m_carry_len;
+  char m_tag[max_tag_size];
+  char m_entity[12];
+  char m_scalar[max_scalar_size + 1];
+  char m_carry[4];              // The base64 characters of an incomplete group of four.
+  bool m_is_fault;
+  Fault m_fault;
+  char const* m_error;
+
+ public:
+  Parser() : m_state(s_error), m_depth(0), m_error("Parser was not reset.") { }
+
+  // Prepare to parse a new response, whose (first) param is decoded into root.
+  void reset(Target root)
+  {
+    m_state = s_text;
+    m_depth = 0;
+    m_stack[0] = { e_document, t_none, x_space, root, 0 };
+    m_is_fault = false;
+    m_fault = Fault{};
+    m_error = nullptr;
+  }
+
+  // Parse [data, data + len). Returns the number of bytes consumed, which is less than len
+  // only when the response was completed (or found to be invalid) before the end of the data.
+  size_t feed(char const* data, size_t len);
+
+  status_type status() const { return m_state == s_done ? done : m_state == s_error ? failed : busy; }
+  bool is_fault() const { return m_is_fault; }
+  Fault const& fault() const { return m_fault; }
+  char const* error() const { return m_error; }
+
+ private:
+  void error(char const* what) { m_error = what; m_state = s_error; }
+  static element_type lookup(std::string_view name, value_type& type);
+  void tag(char const* name, size_t len);
+  void start_element(element_type element, value_type type);
+  void end_element(element_type element, value_type type);
+  void text(char const* data, size_t len);
+  void base64(Target const& target, char const* data, size_t len);
+  bool decode_base64(Target const& target, char const* data, size_t len);
+  size_t decode_entity(char* out) const;
+};
+
+inline Parser::element_type Parser::lookup(std::string_view name, value_type& type)
+{
+  type = t_none;
+  switch (name.size())
+  {
+    case 2:
+      if (name == "i4")
+        return type = t_int, e_scalar;
+      if (name == "i8")
+        return type = t_i8, e_scalar;
+      break;
+    case 3:
+      if (name == "int")
+        return type = t_int, e_scalar;
+      if (name == "nil")
+        return type = t_nil, e_scalar;
+      break;
+    case 4:
+      if (name == "name")
+        return e_name;
+      if (name == "data")
+        return e_data;
+      break;
+    case 5:
+      if (name == "value")
+        return e_value;
+      if (name == "array")
+        return type = t_array, e_array;
+      if (name == "param")
+        return e_param;
+      if (name == "fault")
+        return e_fault;
+      if (name == "ex:i8")
+        return type = t_i8, e_scalar;
+      break;
+    case 6:
+      if (name == "member")
+        return e_member;
+      if (name == "string")
+        return type = t_string, e_scalar;
+      if (name == "struct")
+        return type = t_struct, e_struct;
+      if (name == "double")
+        return type = t_double, e_scalar;
+      if (name == "base64")
+        return type = t_base64, e_scalar;
+      if (name == "params")
+        return e_params;
+      if (name == "ex:nil")
+        return type = t_nil, e_scalar;
+      break;
+    case 7:
+      if (name == "boolean")
+        return type = t_boolean, e_scalar;
+      break;
+    case 14:
+      if (name == "methodResponse")
+        return e_methodResponse;
+      break;
+    case 16:
+      if (name == "dateTime.iso8601")
+        return type = t_datetime, e_scalar;
+      break;
+  }
+  return e_unknown;
+}
+
+// Handle the tag [name, name + len), without the '<' and '>'.
+inline void Parser::tag(char const* name, size_t len)
+{
+  bool const is_end = len > 0 && name[0] == '/';
+  bool const is_empty = !is_end && len > 0 && name[len - 1] == '/';
+  if (is_end)
+  {
+    ++name;
+    --len;
+  }
+  else if (is_empty)
+    --len;
+  // Attributes are ignored.
+  size_t name_len = 0;
+  while (name_len < len && !detail::is_space(name[name_len]))
+    ++name_len;
+  value_type type;
+  element_type const element = lookup({ name, name_len }, type);
+  if (element == e_unknown)
+    return error("Unknown element.");
+  if (!is_end)
+    start_element(element, type);
+  if ((is_end || is_empty) && m_state != s_error)
+    end_element(element, type);
+}
+
+inline void Parser::start_element(element_type element, value_type type)
+{
+  if (m_depth == max_depth)
+    return error("Elements nested too deep.");
+  Frame& parent = m_stack[m_depth];
+  Target target = parent.m_target;
+  text_type text = x_space;
+  bool valid = false;
+  switch (parent.m_element)
+  {
+    case e_document:
+      valid = element == e_methodResponse && parent.m_children == 0;
+      break;
+    case e_methodResponse:
+      valid = (element == e_params || element == e_fault) && parent.m_children == 0;
+      if (element == e_fault)
+      {
+        m_is_fault = true;
+        target = xmlrpc::target(m_fault);
+      }
+      break;
+    case e_params:
+      valid = element == e_param;
+      if (parent.m_children > 0)
+        target = Target{ nullptr, nullptr };
+      break;
+    case e_param:
+    case e_fault:
+      valid = element == e_value && parent.m_children == 0;
+      text = x_pending;
+      m_scalar_len = 0;
+      break;
+    case e_value:
+      valid = (element == e_scalar || element == e_struct || element == e_array) && parent.m_type == t_none;
+      if (!valid)
+        break;
+      if (target.m_ops && type != t_nil && !(target.m_ops->m_accepts & type))
+        return error("Type mismatch.");
+      // The white space before the type element isn't part of the value.
+      parent.m_type = type;
+      parent.m_text = x_space;
+      if (!target.m_ops)
+        text = type == t_struct || type == t_array ? x_space : x_ignore;
+      else if (type == t_string)
+      {
+        target.m_ops->m_clear(target.m_object);
+        text = x_string;
+      }
+      else if (type == t_base64)
+      {
+        target.m_ops->m_clear(target.m_object);
+        m_carry_len = 0;
+        text = x_base64;
+      }
+      else if (type == t_array)
+        target.m_ops->m_clear(target.m_object);
+      else if (type != t_struct && type != t_nil)
+      {
+        m_scalar_len = 0;
+        text = x_scalar;
+      }
+      break;
+    case e_struct:
+      valid = element == e_member;
+      break;
+    case e_member:
+      // The target of the member frame is set when its name is known.
+      valid = (element == e_name && parent.m_children == 0) || (element == e_value && parent.m_children == 1);
+      m_scalar_len = 0;
+      text = element == e_name ? x_scalar : x_pending;
+      break;
+    case e_array:
+      valid = element == e_data && parent.m_children == 0;
+      break;
+    case e_data:
+      valid = element == e_value;
+      if (target.m_ops)
+        target = target.m_ops->m_element(target.m_object);
+      m_scalar_len = 0;
+      text = x_pending;
+      break;
+    default:
+      break;
+  }
+  if (!valid)
+    return error("Unexpected element.");
+  ++parent.m_children;
+  m_stack[++m_depth] = { element, element == e_value ? t_none : type, text, target, 0 };
+}
+
+inline void Parser::end_element(element_type element, value_type type)
+{
+  Frame& frame = m_stack[m_depth];
+  if (m_depth == 0 || frame.m_element != element || (element == e_scalar && frame.m_type != type))
+    return error("Mismatched end tag.");
+  Target const& target = frame.m_target;
+  switch (element)
+  {
+    case e_value:
+      if (frame.m_text == x_pending && target.m_ops)
+      {
+        // A value without type element that only contains white space (if anything); it is a string.
+        if (!(target.m_ops->m_accepts & t_string))
+          return error("Type mismatch.");
+        target.m_ops->m_clear(target.m_object);
+        target.m_ops->m_append(target.m_object, m_scalar, m_scalar_len);
+      }
+      break;
+    case e_scalar:
+      if (frame.m_text == x_scalar)
+      {
+        char* begin = m_scalar;
+        char* end = m_scalar + m_scalar_len;
+        while (begin < end && detail::is_space(*begin))
+          ++begin;
+        while (end > begin && detail::is_space(end[-1]))
+          --end;
+        *end = '\0';
+        if (!target.m_ops->m_assign(target.m_object, { begin, static_cast<size_t>(end - begin) }))
+          return error("Invalid value.");
+      }
+      else if (frame.m_text == x_base64 && m_carry_len > 0 && !decode_base64(target, m_carry, m_carry_len))
+        return error("Invalid base64.");
+      break;
+    case e_name:
+    {
+      Target const& parent = m_stack[m_depth - 2].m_target;
+      m_stack[m_depth - 1].m_target = parent.m_ops ? parent.m_ops->m_member(parent.m_object, { m_scalar, m_scalar_len }) : Target{ nullptr, nullptr };
+      break;
+    }
+    case e_member:
+      if (frame.m_children != 2)
+        return error("Member without value.");
+      break;
+    case e_param:
+    case e_fault:
+    case e_array:
+      if (frame.m_children != 1)
+        return error("Missing value.");
+      break;
+    case e_methodResponse:
+      if (frame.m_children != 1)
+        return error("Empty methodResponse.");
+      m_state = s_done;
+      break;
+    default:
+      break;
+  }
+  --m_depth;
+}
+
+// Handle character data directly inside the current element.
+inline void Parser::text(char const* data, size_t len)
+{
+  Frame& frame = m_stack[m_depth];
+  switch (frame.m_text)
+  {
+    case x_space:
+      for (size_t i = 0; i < len; ++i)
+        if (!detail::is_space(data[i]))
+          return error("Unexpected character data.");
+      break;
+    case x_ignore:
+      break;
+    case x_pending:
+    {
+      size_t i = 0;
+      while (i < len && detail::is_space(data[i]))
+        ++i;
+      if (i == len)
+      {
+        if (m_scalar_len + len > max_scalar_size)
+          return error("Too much white space.");
+        std::memcpy(m_scalar + m_scalar_len, data, len);
+        m_scalar_len += len;
+        break;
+      }
+      // Character data directly inside <value>: it is a string.
+      frame.m_type = t_string;
+      frame.m_text = x_ignore;
+      if (!frame.m_target.m_ops)
+        break;
+      if (!(frame.m_target.m_ops->m_accepts & t_string))
+        return error("Type mismatch.");
+      frame.m_text = x_string;
+      frame.m_target.m_ops->m_clear(frame.m_target.m_object);
+      frame.m_target.m_ops->m_append(frame.m_target.m_object, m_scalar, m_scalar_len);
+      frame.m_target.m_ops->m_append(frame.m_target.m_object, data, len);
+      break;
+    }
+    case x_string:
+      frame.m_target.m_ops->m_append(frame.m_target.m_object, data, len);
+      break;
+    case x_base64:
+      base64(frame.m_target, data, len);
+      break;
+    case x_scalar:
+      if (m_scalar_len + len > max_scalar_size)
+        return error("Value too long.");
+      std::memcpy(m_scalar + m_scalar_len, data, len);
+      m_scalar_len += len;
+      break;
+  }
+}
+
+inline bool Parser::decode_base64(Target const& target, char const* data, size_t len)
+{
+  size_t const max_len = ::base64::decoded_size_upper_bound(len);
+  char* const out = target.m_ops->m_grow(target.m_object, max_len);
+  char* const out_end = ::base64::decode(data, len, out);
+  if (!out_end)
+    return false;
+  target.m_ops->m_shrink(target.m_object, max_len - (out_end - out));
+  return true;
+}
+
+// Decode the base64 in [data, data + len), which may start and end anywhere in a group of
+// four characters. An incomplete group at the end is kept in m_carry.
+inline void Parser::base64(Target const& target, char const* data, size_t len)
+{
+  // Complete the group in m_carry first.
+  while (m_carry_len > 0 && len > 0)
+  {
+    char const c = *data++;
+    --len;
+    if (detail::is_space(c))
+      continue;
+    m_carry[m_carry_len++] = c;
+    if (m_carry_len == 4)
+    {
+      if (!decode_base64(target, m_carry, 4))
+        return error("Invalid base64.");
+      m_carry_len = 0;
+    }
+  }
+  // Keep back the characters after the last whole group.
+  size_t count = 0;
+  for (size_t i = 0; i < len; ++i)
+    count += !detail::is_space(data[i]);
+  size_t keep = count % 4;
+  size_t split = len;
+  for (; keep > 0; --split)
+    keep -= !detail::is_space(data[split - 1]);
+  for (size_t i = split; i < len; ++i)
+    if (!detail::is_space(data[i]))
+      m_carry[m_carry_len++] = data[i];
+  if (split > 0 && !decode_base64(target, data, split))
+    error("Invalid base64.");
+}
+
+// Decode the entity reference in m_entity (without the '&' and ';') as UTF-8 to out.
+// Returns the number of bytes written, or zero if the entity is not valid.
+inline size_t Parser::decode_entity(char* out) const
+{
+  std::string_view const name(m_entity, m_entity_len);
+  if (name == "lt") { *out = '<'; return 1; }
+  if (name == "gt") { *out = '>'; return 1; }
+  if (name == "amp") { *out = '&'; return 1; }
+  if (name == "quot") { *out = '"'; return 1; }
+  if (name == "apos") { *out = '\''; return 1; }
+  if (name.size() < 2 || name[0] != '#')
+    return 0;
+  bool const hex = name[1] == 'x';
+  std::string_view const digits = name.substr(hex ? 2 : 1);
+  if (digits.empty())
+    return 0;
+  uint32_t code_point = 0;
+  for (char c : digits)
+  {
+    unsigned int digit;
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if (hex && (c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+      digit = (c | 0x20) - 'a' + 10;
+    else
+      return 0;
+    code_point = code_point * (hex ? 16 : 10) + digit;
+    if (code_point > 0x10ffff)
+      return 0;
+  }
+  if (code_point == 0 || (code_point >= 0xd800 && code_point <= 0xdfff))
+    return 0;
+  if (code_point < 0x80)
+  {
+    out[0] = static_cast<char>(code_point);
+    return 1;
+  }
+  if (code_point < 0x800)
+  {
+    out[0] = static_cast<char>(0xc0 | (code_point >> 6));
+    out[1] = static_cast<char>(0x80 | (code_point & 0x3f));
+    return 2;
+  }
+  if (code_point < 0x10000)
+  {
+    out[0] = static_cast<char>(0xe0 | (code_point >> 12));
+    out[1] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+    out[2] = static_cast<char>(0x80 | (code_point & 0x3f));
+    return 3;
+  }
+  out[0] = static_cast<char>(0xf0 | (code_point >> 18));
+  out[1] = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+  out[2] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+  out[3] = static_cast<char>(0x80 | (code_point & 0x3f));
+  return 4;
+}
+
+inline size_t Parser::feed(char const* data, size_t len)
+{
+  char const* p = data;
+  char const* const end = data + len;
+  while (p < end && m_state != s_done && m_state != s_error)
+  {
+    switch (m_state)
+    {
+      case s_text:
+      {
+        char const* const markup = simd::find_markup(p, end);
+        if (markup != p)
+          text(p, markup - p);
+        p = markup;
+        if (p < end && m_state == s_text)
+        {
+          m_state = *p == '<' ? s_tag : s_entity;
+          m_tag_len = 0;
+          m_entity_len = 0;
+          ++p;
+        }
+        break;
+      }
+      case s_tag:
+      {
+        if (m_tag_len == 0 && *p == '?')
+        {
+          m_state = s_declaration;
+          m_window = 0;
+          ++p;
+          break;
+        }
+        if ((m_tag_len == 0 && *p == '!') || (m_tag_len > 0 && m_tag[0] == '!'))
+        {
+          // Only comments are supported; DTDs and CDATA sections are not used by XML-RPC.
+          m_tag[m_tag_len++] = *p++;
+          if (m_tag_len == 3)
+          {
+            if (m_tag[1] != '-' || m_tag[2] != '-')
+              error("Unsupported markup.");
+            else
+            {
+              m_state = s_comment;
+              m_window = 0;
+            }
+          }
+          break;
+        }
+        char const* gt = static_cast<char const*>(std::memchr(p, '>', std::min(static_cast<size_t>(end - p), max_tag_size - m_tag_len + 1)));
+        if (!gt)
+        {
+          size_t const n = std::min(static_cast<size_t>(end - p), max_tag_size - m_tag_len + 1);
+          if (n > max_tag_size - m_tag_len)
+          {
+            error("Tag too long.");
+            break;
+          }
+          // The tag continues in the next chunk.
+          std::memcpy(m_tag + m_tag_len, p, n);
+          m_tag_len += n;
+          p += n;
+          break;
+        }
+        m_state = s_text;
+        if (m_tag_len == 0)
+          tag(p, gt - p);                               // Usually the whole tag is in this chunk; use it in place.
+        else
+        {
+          std::memcpy(m_tag + m_tag_len, p, gt - p);
+          m_tag_len += gt - p;
+          tag(m_tag, m_tag_len);
+        }
+        p = gt + 1;
+        break;
+      }
+      case s_entity:
+      {
+        char const c = *p++;
+        if (c != ';')
+        {
+          if (m_entity_len == sizeof(m_entity))
+            error("Invalid entity reference.");
+          else
+            m_entity[m_entity_len++] = c;
+          break;
+        }
+        char utf8[4];
+        size_t const n = decode_entity(utf8);
+        if (n == 0)
+        {
+          error("Invalid entity reference.");
+          break;
+        }
+        m_state = s_text;
+        text(utf8, n);
+        break;
+      }
+      case s_comment:
+        while (p < end && m_window != 0x2d2d3e)         // "-->"
+          m_window = ((m_window << 8) | static_cast<unsigned char>(*p++)) & 0xffffff;
+        if (m_window == 0x2d2d3e)
+          m_state = s_text;
+        break;
+      case s_declaration:
+        while (p < end && m_window != 0x3f3e)           // "?>"
+          m_window = ((m_window << 8) | static_cast<unsigned char>(*p++)) & 0xffff;
+        if (m_window == 0x3f3e)
+          m_state = s_text;
+        break;
+      case s_done:
+      case s_error:
+        break;
+    }
+  }
+  return p - data;
+}
+
+template<typename T>
+class Decoder : public evio::protocol::Decoder
+{
+ private:
+  T m_result;
+  Parser m_parser;
+
+ public:
+  Decoder() : m_result() { m_parser.reset(target(m_result)); }
+
+ protected:
+  // Called for every response. The result may be moved from; it is reset to T{} afterwards.
+  virtual void on_response(int& allow_deletion_count, T& result) = 0;
+  virtual void on_fault(int& allow_deletion_count, Fault const& fault) = 0;
+  virtual void on_error(int& allow_deletion_count, char const* CWDEBUG_ONLY(what))
+  {
+    Dout(dc::warning, "xmlrpc::Decoder: " << what);
+    close_input_device(allow_deletion_count);
+  }
+
+  // The parser keeps its own state, so every byte can be passed on as soon as it is received.
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override
+  {
+    return rlen;
+  }
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    char const* data = msg.get_start();
+    size_t len = msg.get_size();
+    while (len > 0 && m_parser.status() != Parser::failed)
+    {
+      size_t const n = m_parser.feed(data, len);
+      data += n;
+      len -= n;
+      if (m_parser.status() == Parser::done)
+      {
+        if (m_parser.is_fault())
+          on_fault(allow_deletion_count, m_parser.fault());
+        else
+          on_response(allow_deletion_count, m_result);
+        m_result = T{};
+        m_parser.reset(target(m_result));
+      }
+      else if (m_parser.status() == Parser::failed)
+        on_error(allow_deletion_count, m_parser.error());
+    }
+  }
+};
+
+} // namespace xmlrpc
@@ -0,0 +1,147 @@
+// Connection churn benchmark.
+//
+// Open and close a large number (default one million) of short-lived connections to a
+// listen socket. Every client closes its socket as soon as it is connected, which causes
+// the corresponding AcceptedSocket to read EOF and close as well. At most `window`
+// connections are in flight at any moment; a new one is only created after a previous
+// client socket was destroyed. Hence this measures the full life cycle of devices,
+// including their garbage collection and deletion.
+//
+// A UNIX socket is used, so that the test doesn't run out of ephemeral ports
+// because of the TIME_WAIT state of closed TCP connections.
+//
+// Usage: accept_churn [<connections> [<window>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "evio/EventLoop.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <unistd.h>
+
+using evio::OutputStream;
+using evio::SocketAddress;
+
+namespace {
+
+size_t number_of_connections = 1000000;
+size_t window = 256;
+
+// The main thread sleeps on client_sockets_in_flight_condition while the window is full,
+// so that it doesn't take a core away from the event loop and the thread pool.
+std::mutex client_sockets_in_flight_mutex;
+std::condition_variable client_sockets_in_flight_condition;
+size_t client_sockets_in_flight = 0;
+std::atomic<size_t> accepted_sockets_destructed{0};
+
+} // namespace
+
+class MyDecoder : public evio::protocol::Decoder
+{
+ protected:
+  void decode(int& UNUSED_ARG(allow_deletion_count), evio::MsgBlock&& UNUSED_ARG(msg)) override { }
+};
+
+class MyAcceptedSocket : public evio::AcceptedSocket<MyDecoder, OutputStream>
+{
+ public:
+  ~MyAcceptedSocket() { accepted_sockets_destructed.fetch_add(1, std::memory_order_relaxed); }
+};
+
+class MyListenSocket : public evio::ListenSocket<MyAcceptedSocket>
+{
+ private:
+  size_t m_accepted;
+
+ public:
+  MyListenSocket() : m_accepted(0) { }
+
+  void new_connection(accepted_socket_type& UNUSED_ARG(accepted_socket)) override
+  {
+    if (++m_accepted == number_of_connections)
+      close();
+  }
+};
+
+// A socket that closes itself as soon as it is connected.
+class ShortLivedSocket : public evio::Socket
+{
+ public:
+  ShortLivedSocket()
+  {
+    std::lock_guard<std::mutex> lock(client_sockets_in_flight_mutex);
+    ++client_sockets_in_flight;
+    on_connected([this](int& allow_deletion_count, bool UNUSED_ARG(success)){ close(allow_deletion_count); });
+  }
+
+  ~ShortLivedSocket()
+  {
+    bool was_full;
+    {
+      std::lock_guard<std::mutex> lock(client_sockets_in_flight_mutex);
+      was_full = client_sockets_in_flight-- == window;
+    }
+    if (was_full)
+      client_sockets_in_flight_condition.notify_one();
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  if (argc > 1)
+    number_of_connections = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    window = std::strtoul(argv[2], nullptr, 10);
+  if (number_of_connections == 0 || window == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<connections> [<window>]]" << std::endl;
+    return 1;
+  }
+
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(256);
+
+  static char const* const socket_path = "/tmp/accept_churn";
+  unlink(socket_path);
+  SocketAddress const endpoint(socket_path);
+
+  std::chrono::steady_clock::time_point start_time;
+  try
+  {
+    evio::EventLoop event_loop(handler);
+
+    auto listen_socket = evio::create<MyListenSocket>();
+    listen_socket->listen(endpoint);
+    listen_socket.reset();
+
+    start_time = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < number_of_connections; ++n)
+    {
+      {
+        std::unique_lock<std::mutex> lock(client_sockets_in_flight_mutex);
+        client_sockets_in_flight_condition.wait(lock, []{ return client_sockets_in_flight < window; });
+      }
+      evio::create<ShortLivedSocket>()->connect(endpoint);
+    }
+
+    event_loop.join();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  std::cout << number_of_connections << " connections opened and closed in " << total_s << " s (" <<
+    (number_of_connections / total_s) << " connections/s); " << accepted_sockets_destructed << " accepted sockets were destructed." << std::endl;
+  unlink(socket_path);
+}
@@ -0,0 +1,78 @@
+// Base64 encoding and decoding speed.
+//
+// For blobs of 1 kB up to 16 MB, encodes random data with each kernel of Base64.h, and
+// decodes the result with each kernel straight into a preallocated buffer, and with the
+// current implementation: evio::protocol::xmlrpc::initialize(BinaryData&, std::string).
+//
+// Usage: base64
+
+#include "sys.h"
+#include "debug.h"
+#include "Base64.h"
+#include "evio/protocol/xmlrpc/initialize.h"
+#include "utils/AIAlert.h"
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+size_t constexpr total_size = 256 * 1024 * 1024;        // Process this many bytes per measurement.
+
+char const* const kernel_names[] = { "scalar", "sse41", "avx2" };
+
+// Call f as often as needed to process total_size bytes of size bytes each; return the speed in MB/s.
+template<typename F>
+double measure(size_t size, F f)
+{
+  size_t const rounds = std::max(total_size / size, size_t{1});
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; ++round)
+    f();
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return rounds * size / total_s / 1e6;
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::mt19937_64 rng(1);
+  int const kernels = static_cast<int>(base64::best_kernel()) + 1;
+  for (size_t size = 1024; size <= 16 * 1024 * 1024; size *= 4)
+  {
+    std::string data(size, '\0');
+    for (char& c : data)
+      c = static_cast<char>(rng());
+    std::string encoded(base64::encoded_size(size), '\0');
+    std::vector<char> decoded(base64::decoded_size_upper_bound(encoded.size()));
+
+    std::cout << size << " bytes (MB/s of binary data):" << std::endl;
+    std::cout << "  encode:";
+    for (int k = 0; k < kernels; ++k)
+    {
+      base64::Kernel const kernel = static_cast<base64::Kernel>(k);
+      std::cout << ' ' << kernel_names[k] << ' ' << measure(size, [&](){ base64::encode(data.data(), size, encoded.data(), kernel); });
+    }
+    std::cout << std::endl << "  decode:";
+    for (int k = 0; k < kernels; ++k)
+    {
+      base64::Kernel const kernel = static_cast<base64::Kernel>(k);
+      std::cout << ' ' << kernel_names[k] << ' ' << measure(size, [&](){ base64::decode(encoded.data(), encoded.size(), decoded.data(), kernel); });
+      ASSERT(std::equal(data.begin(), data.end(), decoded.begin()));
+    }
+    try
+    {
+      evio::BinaryData binary_data;
+      std::cout << " xmlrpc::initialize " << measure(size, [&](){ evio::protocol::xmlrpc::initialize(binary_data, encoded); });
+    }
+    catch (AIAlert::Error const& error)
+    {
+      Dout(dc::warning, error);
+    }
+    std::cout << std::endl;
+  }
+}
@@ -0,0 +1,162 @@
+// The overhead of a chain of filter stages on a socket.
+//
+// Sends the payload of test_Socket.h (one million lines of 100 bytes) from an accepted
+// socket to a client socket through
+//
+//   - a plain evio::Socket,
+//   - a FilterSocket with filter::Identity stages,
+//   - a FilterSocket with Chain<ChecksumEncoder, FrameEncoder> stages, and
+//   - a FilterSocket with Chain<ChecksumEncoder, ZlibCompressor, FrameEncoder> stages,
+//
+// (and the reverse chains on the input side) and prints the throughput of each, relative
+// to the plain socket. Because the stages are composed at compile time there is no
+// virtual call per block; the remaining overhead is that of the wire buffers and the
+// transformations themselves.
+//
+// Usage: chain_socket
+
+#include "sys.h"
+#include "debug.h"
+#include "FilterSocket.h"
+#include "evio/EventLoop.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/Signals.h"
+#include "utils/debug_ostream_operators.h"
+#include <chrono>
+
+namespace {
+
+size_t constexpr burst_size = 1000000;     // Write this many times 100 bytes.
+size_t constexpr total_size = 100 * burst_size;
+
+std::chrono::steady_clock::time_point end_time;
+
+} // namespace
+
+class CountingDecoder : public evio::protocol::Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  CountingDecoder() : m_received(0) { }
+
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override { return rlen; }
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    m_received += msg.get_size();
+    if (m_received == total_size)
+    {
+      end_time = std::chrono::steady_clock::now();
+      close_input_device(allow_deletion_count);
+    }
+  }
+
+  size_t minimum_block_size_estimate() const override { return 65536; }
+};
+
+class MyOutputStream4096 : public evio::OutputStream
+{
+ protected:
+  size_t minimum_block_size_estimate() const override { return 4096; }
+};
+
+// An accepted socket with filter stages.
+template<class OutputStage, class InputStage>
+class FilterAcceptedSocket : public FilterSocket<OutputStage, InputStage>
+{
+ private:
+  CountingDecoder m_decoder;
+  MyOutputStream4096 m_output;
+
+ public:
+  FilterAcceptedSocket()
+  {
+    this->set_protocol_decoder(m_decoder);
+    this->set_source(m_output);
+  }
+
+  MyOutputStream4096& operator()() { return m_output; }
+};
+
+template<class AcceptedSocket>
+class MyListenSocket : public evio::ListenSocket<AcceptedSocket>
+{
+ public:
+  using accepted_socket_type = AcceptedSocket;
+
+  void new_connection(accepted_socket_type& accepted_socket) override
+  {
+    for (size_t n = 0; n < burst_size; ++n)
+      accepted_socket() << "START012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789END.\n";
+    accepted_socket() << std::flush;
+    accepted_socket.flush_output_device();
+    this->close();
+  }
+};
+
+// Returns the number of seconds that it took to transfer the payload.
+template<class AcceptedSocket, class ClientSocket>
+double run(char const* name, double reference_s)
+{
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+
+  std::chrono::steady_clock::time_point start_time;
+  try
+  {
+    CountingDecoder decoder;
+    evio::EventLoop event_loop(handler);
+
+    static evio::SocketAddress const listen_address("127.0.0.1:9008");
+    auto listen_socket = evio::create<MyListenSocket<AcceptedSocket>>();
+    listen_socket->listen(listen_address);
+    listen_socket.reset();
+
+    // Dumb way to wait until the listen socket is up.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    start_time = std::chrono::steady_clock::now();
+    auto socket = evio::create<ClientSocket>();
+    socket->set_protocol_decoder(decoder);
+    socket->connect(listen_address);
+
+    event_loop.join();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  double const total_s = std::chrono::duration<double>(end_time - start_time).count();
+  std::cout << name << ": " << (total_size / 1000000) << " MB in " << total_s << " s (" << (total_size / total_s / 1000000) << " MB/s)";
+  if (reference_s > 0)
+    std::cout << "; " << (100.0 * (total_s - reference_s) / reference_s) << "% slower than evio::Socket";
+  std::cout << '.' << std::endl;
+  return total_s;
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  // SIGPIPE must be ignored or write() won't return EPIPE when peer closed the connection.
+  utils::Signals signals({SIGPIPE});
+
+  using namespace filter;
+  using ChecksumFramedOut = Chain<ChecksumEncoder, FrameEncoder>;
+  using ChecksumFramedIn = Chain<FrameDecoder, ChecksumDecoder>;
+  using ChecksumCompressedFramedOut = Chain<ChecksumEncoder, ZlibCompressor, FrameEncoder>;
+  using ChecksumCompressedFramedIn = Chain<FrameDecoder, ZlibDecompressor, ChecksumDecoder>;
+
+  double const reference_s = run<evio::AcceptedSocket<CountingDecoder, MyOutputStream4096>, evio::Socket>("evio::Socket", 0.0);
+  run<FilterAcceptedSocket<Identity, Identity>, FilterSocket<Identity, Identity>>("Identity", reference_s);
+  run<FilterAcceptedSocket<ChecksumFramedOut, ChecksumFramedIn>, FilterSocket<ChecksumFramedOut, ChecksumFramedIn>>(
+      "Checksum, framing", reference_s);
+  run<FilterAcceptedSocket<ChecksumCompressedFramedOut, ChecksumCompressedFramedIn>, FilterSocket<ChecksumCompressedFramedOut, ChecksumCompressedFramedIn>>(
+      "Checksum, zlib, framing", reference_s);
+}
@@ -0,0 +1,171 @@
+// Streaming compression between the buffers of a socket and its fd.
+//
+// A listen socket sends the same payload as test_Socket.h (one million lines of 100
+// bytes) to a client socket, through a FilterSocket with a streaming compressor on the
+// output and a decompressor on the input. The OutputStream user writes plain text and
+// the decoder receives plain text; only the wire carries compressed data.
+//
+// Prints the throughput (in MB of plain text per second) and the compression ratio, for
+// an unfiltered socket, zlib and (if available) zstd.
+//
+// Usage: compress_socket [<zlib level>]
+
+#include "sys.h"
+#include "debug.h"
+#include "FilterSocket.h"
+#include "evio/EventLoop.h"
+#include "evio/ListenSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/Signals.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+
+namespace {
+
+size_t constexpr burst_size = 1000000;     // Write this many times 100 bytes.
+size_t constexpr total_size = 100 * burst_size;
+int zlib_level = Z_DEFAULT_COMPRESSION;
+
+std::chrono::steady_clock::time_point end_time;
+std::atomic<size_t> wire_bytes;
+
+} // namespace
+
+class CountingDecoder : public evio::protocol::Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  CountingDecoder() : m_received(0) { }
+
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override { return rlen; }
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    m_received += msg.get_size();
+    if (m_received == total_size)
+    {
+      end_time = std::chrono::steady_clock::now();
+      close_input_device(allow_deletion_count);
+    }
+  }
+
+  size_t minimum_block_size_estimate() const override { return 65536; }
+};
+
+class MyOutputStream4096 : public evio::OutputStream
+{
+ protected:
+  size_t minimum_block_size_estimate() const override { return 4096; }
+};
+
+// The sending side: an accepted socket that compresses its output.
+template<class OutputStage>
+class CompressingAcceptedSocket : public FilterSocket<OutputStage, filter::Identity>
+{
+ private:
+  CountingDecoder m_decoder;
+  MyOutputStream4096 m_output;
+
+ public:
+  CompressingAcceptedSocket()
+  {
+    this->set_protocol_decoder(m_decoder);
+    this->set_source(m_output);
+  }
+
+  ~CompressingAcceptedSocket() { wire_bytes += this->wire_bytes_written(); }
+
+  MyOutputStream4096& operator()() { return m_output; }
+};
+
+// A zlib compressor with the compression level from the command line.
+class MyZlibCompressor : public filter::ZlibCompressor
+{
+ public:
+  MyZlibCompressor() : filter::ZlibCompressor(zlib_level) { }
+};
+
+template<class OutputStage>
+class MyListenSocket : public evio::ListenSocket<CompressingAcceptedSocket<OutputStage>>
+{
+ public:
+  using accepted_socket_type = CompressingAcceptedSocket<OutputStage>;
+
+  void new_connection(accepted_socket_type& accepted_socket) override
+  {
+    for (size_t n = 0; n < burst_size; ++n)
+      accepted_socket() << "START012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789END.\n";
+    accepted_socket() << std::flush;
+    accepted_socket.flush_output_device();
+    this->close();
+  }
+};
+
+// The receiving side: a client socket that decompresses its input.
+template<class InputStage>
+using DecompressingSocket = FilterSocket<filter::Identity, InputStage>;
+
+template<class OutputStage, class InputStage>
+void run(char const* name)
+{
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+  wire_bytes = 0;
+
+  std::chrono::steady_clock::time_point start_time;
+  try
+  {
+    CountingDecoder decoder;
+    evio::EventLoop event_loop(handler);
+
+    static evio::SocketAddress const listen_address("127.0.0.1:9007");
+    auto listen_socket = evio::create<MyListenSocket<OutputStage>>();
+    listen_socket->listen(listen_address);
+    listen_socket.reset();
+
+    // Dumb way to wait until the listen socket is up.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    start_time = std::chrono::steady_clock::now();
+    auto socket = evio::create<DecompressingSocket<InputStage>>();
+    socket->set_protocol_decoder(decoder);
+    socket->connect(listen_address);
+
+    event_loop.join();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  double const total_s = std::chrono::duration<double>(end_time - start_time).count();
+  std::cout << name << ": " << (total_size / 1000000) << " MB in " << total_s << " s (" << (total_size / total_s / 1000000) <<
+    " MB/s); " << wire_bytes << " bytes on the wire (ratio " << (static_cast<double>(total_size) / wire_bytes) << ")." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  if (argc > 1)
+    zlib_level = std::atoi(argv[1]);
+  if (zlib_level < Z_DEFAULT_COMPRESSION || zlib_level > Z_BEST_COMPRESSION)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<zlib level>]" << std::endl;
+    return 1;
+  }
+
+  // SIGPIPE must be ignored or write() won't return EPIPE when peer closed the connection.
+  utils::Signals signals({SIGPIPE});
+
+  run<filter::Identity, filter::Identity>("Identity");
+  run<MyZlibCompressor, filter::ZlibDecompressor>("zlib");
+#ifdef HAVE_ZSTD
+  run<filter::ZstdCompressor, filter::ZstdDecompressor>("zstd");
+#endif
+}
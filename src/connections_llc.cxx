@@ -0,0 +1,245 @@
+// Cache-locality benchmark for many concurrent connections.
+//
+// Opens a large number of connections to a local listen socket and lets every
+// client do a number of ping-pong round trips with its accepted socket, all at
+// the same time. The last level cache misses of the whole process (all threads,
+// user space only) are counted with perf_event_open(2) while the round trips
+// are being done.
+//
+// Consecutive readiness events for one device land on whatever AIThreadPool
+// thread is free at that moment, causing the StreamBuf, decoder and MemoryBlocks
+// of that device to move between the caches of different cores; the number of
+// LLC misses per round trip printed by this program is the figure that a sticky
+// (per device) dispatch of thread pool work should lower.
+//
+// Usage: connections_llc [<connections> [<round trips per connection> [<number of threads>]]]
+//
+// Reading hardware counters might require: echo 1 > /proc/sys/kernel/perf_event_paranoid
+
+#include "sys.h"
+#include "debug.h"
+#include "evio/EventLoop.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef CWDEBUG
+#include <libcwd/buf2str.h>
+#endif
+
+using evio::protocol::Decoder;
+using evio::MsgBlock;
+using evio::OutputStream;
+using evio::SocketAddress;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+size_t number_of_connections = 10000;
+size_t round_trips = 100;
+std::atomic<size_t> finished_connections{0};
+clock_type::time_point end_time;
+
+char const message[] = "012345678901234567890123456789012345678901234567890123456789012\n";     // 64 bytes.
+
+// Open a (disabled) counter for last level cache misses of this process and all threads that it creates after this call.
+int open_llc_misses_counter()
+{
+  struct perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;     // Last level cache misses on most architectures.
+  attr.disabled = 1;
+  attr.inherit = 1;                             // Count threads that are created later (the thread pool and the EventLoopThread).
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+} // namespace
+
+class EchoDecoder : public Decoder
+{
+ protected:
+  void decode(int& allow_deletion_count, MsgBlock&& msg) override;
+};
+
+class EchoSocket : public evio::AcceptedSocket<EchoDecoder, OutputStream>
+{
+ public:
+  void read_returned_zero(int& allow_deletion_count) override
+  {
+    flush_output_device();
+    evio::InputDevice::read_returned_zero(allow_deletion_count);
+  }
+};
+
+class EchoListenSocket : public evio::ListenSocket<EchoSocket>
+{
+ private:
+  size_t m_accepted;
+
+ public:
+  EchoListenSocket() : m_accepted(0) { }
+
+  void new_connection(accepted_socket_type& UNUSED_ARG(accepted_socket)) override
+  {
+    if (++m_accepted == number_of_connections)
+      close();
+  }
+};
+
+class PongDecoder : public Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  PongDecoder() : m_received(0) { }
+
+ protected:
+  void decode(int& allow_deletion_count, MsgBlock&& msg) override;
+};
+
+class PingSocket : public evio::Socket
+{
+ private:
+  PongDecoder m_decoder;
+  OutputStream m_output;
+
+ public:
+  PingSocket()
+  {
+    set_protocol_decoder(m_decoder);
+    set_source(m_output);
+  }
+
+  void ping()
+  {
+    m_output.write(message, sizeof(message) - 1);
+    m_output << std::flush;
+  }
+
+  void finished(int& allow_deletion_count)
+  {
+    if (++finished_connections == number_of_connections)
+      end_time = clock_type::now();
+    close_input_device(allow_deletion_count);
+    flush_output_device();
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int number_of_threads = std::thread::hardware_concurrency();
+  if (argc > 1)
+    number_of_connections = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    round_trips = std::strtoul(argv[2], nullptr, 10);
+  if (argc > 3)
+    number_of_threads = std::atoi(argv[3]);
+  if (number_of_connections == 0 || round_trips == 0 || number_of_threads <= 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<connections> [<round trips per connection> [<number of threads>]]]" << std::endl;
+    return 1;
+  }
+
+  // Every connection uses two file descriptors.
+  struct rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, 2 * number_of_connections + 64);
+  if (setrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur < 2 * number_of_connections + 64)
+    std::cerr << "Warning: could not raise RLIMIT_NOFILE to " << (2 * number_of_connections + 64) << std::endl;
+
+  // This must be done before any thread is created.
+  int llc_fd = open_llc_misses_counter();
+  if (llc_fd == -1)
+    std::cerr << "Warning: perf_event_open: " << std::strerror(errno) << "; LLC misses will not be reported." << std::endl;
+
+  clock_type::time_point start_time;
+  try
+  {
+    AIThreadPool thread_pool(number_of_threads);
+    AIQueueHandle handler = thread_pool.new_queue(256);
+
+    {
+      evio::EventLoop event_loop(handler);
+
+      static SocketAddress const listen_address("127.0.0.1:9004");
+      auto listen_socket = evio::create<EchoListenSocket>();
+      listen_socket->listen(listen_address);
+
+      // Dumb way to wait until the listen socket is up.
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+      {
+        std::vector<boost::intrusive_ptr<PingSocket>> sockets(number_of_connections);
+        for (size_t s = 0; s < sockets.size(); ++s)
+        {
+          sockets[s] = evio::create<PingSocket>();
+          sockets[s]->connect(listen_address);
+          // Don't overflow the backlog of the listen socket.
+          if (s % 64 == 63)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        // Dumb way to wait until all connections are established.
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        if (llc_fd != -1)
+          ioctl(llc_fd, PERF_EVENT_IOC_ENABLE, 0);
+        start_time = clock_type::now();
+        for (auto& socket : sockets)
+          socket->ping();
+      }
+
+      event_loop.join();
+    }
+    // Disable the counter before the threads of the thread pool are terminated.
+    if (llc_fd != -1)
+      ioctl(llc_fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  // The counts of the threads are only added to llc_fd after those threads exited.
+  size_t const total_round_trips = number_of_connections * round_trips;
+  double const total_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+  std::cout << number_of_connections << " connections, " << total_round_trips << " round trips in " << total_ms << " ms (" <<
+    (1000.0 * total_round_trips / total_ms) << " round trips/s)." << std::endl;
+  uint64_t llc_misses;
+  if (llc_fd != -1 && read(llc_fd, &llc_misses, sizeof(llc_misses)) == sizeof(llc_misses))
+    std::cout << "LLC misses: " << llc_misses << " (" << (static_cast<double>(llc_misses) / total_round_trips) << " per round trip)." << std::endl;
+}
+
+void EchoDecoder::decode(int& CWDEBUG_ONLY(allow_deletion_count), MsgBlock&& msg)
+{
+  DoutEntering(dc::notice, "EchoDecoder::decode({" << allow_deletion_count << "}, \"" << buf2str(msg.get_start(), msg.get_size()) << "\") [" << this << ']');
+  EchoSocket* echo_socket = static_cast<EchoSocket*>(m_input_device);
+  (*echo_socket)().write(msg.get_start(), msg.get_size());
+  (*echo_socket)() << std::flush;
+}
+
+void PongDecoder::decode(int& allow_deletion_count, MsgBlock&& CWDEBUG_ONLY(msg))
+{
+  DoutEntering(dc::notice, "PongDecoder::decode({" << allow_deletion_count << "}, \"" << buf2str(msg.get_start(), msg.get_size()) << "\") [" << this << ']');
+  PingSocket* ping_socket = static_cast<PingSocket*>(m_input_device);
+  if (++m_received == round_trips)
+    ping_socket->finished(allow_deletion_count);
+  else
+    ping_socket->ping();
+}
@@ -0,0 +1,117 @@
+// Non-blocking name resolution with dns::Resolver.
+//
+// Looks up the A and AAAA records of every name given on the command line, all at the
+// same time, using the first nameserver of /etc/resolv.conf (or the given nameserver).
+// An IP number is looked up as PTR instead. Every lookup is done twice: the second time
+// is answered from the cache. The results are printed together with the time that it
+// took from the call to lookup until the callback was called.
+//
+// Usage: dns_resolver [-s <nameserver>] <name>...
+
+#include "sys.h"
+#include "debug.h"
+#include "DNSResolver.h"
+#include "evio/EventLoop.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+std::mutex cout_mutex;
+std::atomic<int> completed;
+
+// Start a lookup that prints its result.
+void lookup(dns::Resolver& resolver, std::string const& name, uint16_t type, char const* type_str)
+{
+  auto const start = std::chrono::steady_clock::now();
+  auto print = [=](dns::Result const& result){
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    {
+      std::lock_guard<std::mutex> lock(cout_mutex);
+      std::cout << name << ' ' << type_str << " (" << elapsed << " us):";
+      if (result.m_error != dns::no_error)
+        std::cout << ' ' << dns::error_str(result.m_error);
+      for (auto const& value : result.m_values)
+        std::cout << ' ' << value;
+      std::cout << " [TTL " << result.m_ttl << ']' << std::endl;
+    }
+    ++completed;
+  };
+  if (type == dns::t_ptr)
+    resolver.lookup_ptr(evio::SocketAddress(name.c_str(), 0), print);
+  else
+    resolver.lookup(name, type, print);
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int first_name = 1;
+  evio::SocketAddress nameserver;
+  if (argc > 2 && std::strcmp(argv[1], "-s") == 0)
+  {
+    nameserver = evio::SocketAddress(argv[2], 53);
+    first_name = 3;
+  }
+  else
+    nameserver = dns::system_nameserver();
+  if (first_name >= argc)
+  {
+    std::cerr << "Usage: " << argv[0] << " [-s <nameserver>] <name>..." << std::endl;
+    return 1;
+  }
+
+  AIThreadPool thread_pool;
+  [[maybe_unused]] AIQueueHandle high_priority_handler = thread_pool.new_queue(32);
+  [[maybe_unused]] AIQueueHandle medium_priority_handler = thread_pool.new_queue(32);
+  AIQueueHandle low_priority_handler = thread_pool.new_queue(16);
+
+  try
+  {
+    evio::EventLoop event_loop(low_priority_handler);
+
+    auto resolver = evio::create<dns::Resolver>();
+    resolver->init(nameserver);
+    std::cout << "Using nameserver " << nameserver << '.' << std::endl;
+
+    int lookups = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+      for (int i = first_name; i < argc; ++i)
+      {
+        std::string const name = argv[i];
+        struct in6_addr addr;
+        if (inet_pton(AF_INET, argv[i], &addr) == 1 || inet_pton(AF_INET6, argv[i], &addr) == 1)
+        {
+          lookup(*resolver, name, dns::t_ptr, "PTR");
+          ++lookups;
+        }
+        else
+        {
+          lookup(*resolver, name, dns::t_a, "A");
+          lookup(*resolver, name, dns::t_aaaa, "AAAA");
+          lookups += 2;
+        }
+      }
+      // Wait until all lookups of this pass completed (they time out after three seconds at most).
+      while (completed < lookups)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    resolver->close();
+    event_loop.join();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  Dout(dc::notice, "Leaving main()...");
+}
@@ -0,0 +1,286 @@
+// Passing accepted connections to worker processes.
+//
+// See FdPassing.h.
+//
+// The supervisor accepts connections on a UNIX socket and passes them round-robin to
+// a number of worker processes, each through its own HandoffSender.
+//
+// In this test the adopted socket writes one byte to the client and closes once the
+// client closed its end. The client threads (in the supervisor process) connect,
+// wait for that byte and close again. The number of handoffs per second is printed.
+//
+// Usage: fd_passing [<connections> [<worker processes>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "FdPassing.h"
+#include "evio/EventLoop.h"
+#include "evio/Socket.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//=============================================================================
+// Supervisor side.
+//
+
+// Accepts connections and passes them round-robin to the HandoffSender's.
+class HandoffListenDevice : public evio::InputDevice
+{
+ private:
+  std::vector<boost::intrusive_ptr<HandoffSender>> const& m_senders;
+  size_t m_accepted;
+  size_t m_max_accepted;
+
+ public:
+  HandoffListenDevice(std::vector<boost::intrusive_ptr<HandoffSender>> const& senders, size_t max_accepted) :
+    m_senders(senders), m_accepted(0), m_max_accepted(max_accepted) { }
+
+  void listen(char const* socket_path);
+
+ protected:
+  void read_from_fd(int& allow_deletion_count, int fd) override;
+};
+
+void HandoffListenDevice::listen(char const* socket_path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    THROW_ALERTE("socket");
+  struct sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1)
+    THROW_ALERTE("bind");
+  if (::listen(fd, SOMAXCONN) == -1)
+    THROW_ALERTE("listen");
+  fd_init(fd);
+  start_input_device(state_t::wat(m_state));
+}
+
+void HandoffListenDevice::read_from_fd(int& allow_deletion_count, int fd)
+{
+  DoutEntering(dc::notice, "HandoffListenDevice::read_from_fd({" << allow_deletion_count << "}, " << fd << ") [" << this << "]");
+  for (;;)
+  {
+    int accepted_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (accepted_fd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN)
+        Dout(dc::warning, "accept4: " << std::strerror(errno));
+      return;
+    }
+    m_senders[m_accepted % m_senders.size()]->send_fd(accepted_fd);
+    if (++m_accepted == m_max_accepted)
+    {
+      close_input_device(allow_deletion_count);
+      return;
+    }
+  }
+}
+
+//=============================================================================
+// Worker side.
+//
+
+class NullDecoder : public evio::protocol::Decoder
+{
+ protected:
+  void decode(int& UNUSED_ARG(allow_deletion_count), evio::MsgBlock&& UNUSED_ARG(msg)) override { }
+};
+
+std::atomic<size_t> worker_sockets_destructed{0};
+
+// The socket that a worker creates for an adopted fd.
+class WorkerSocket : public evio::Socket
+{
+ private:
+  NullDecoder m_decoder;
+  evio::OutputStream m_output;
+
+ public:
+  WorkerSocket()
+  {
+    set_protocol_decoder(m_decoder);
+    set_source(m_output);
+  }
+
+  ~WorkerSocket() { worker_sockets_destructed.fetch_add(1, std::memory_order_relaxed); }
+
+  void greet()
+  {
+    m_output << 'x' << std::flush;
+    flush_output_device();
+  }
+};
+
+class HandoffDecoder : public FdDecoder
+{
+ private:
+  size_t m_adopted;
+  size_t m_max_adopted;
+
+ public:
+  HandoffDecoder(size_t max_adopted) : m_adopted(0), m_max_adopted(max_adopted) { }
+
+ protected:
+  void fd_received(int& allow_deletion_count, int fd) override
+  {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    std::memset(&addr, 0, sizeof(addr));
+    getpeername(fd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen);
+    auto socket = evio::create<WorkerSocket>();
+    socket->init(fd, evio::SocketAddress(reinterpret_cast<struct sockaddr const*>(&addr)));
+    socket->greet();
+    if (++m_adopted == m_max_adopted)
+      close_input_device(allow_deletion_count);
+  }
+};
+
+void run_worker(int fd, size_t share)
+{
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+
+  try
+  {
+    evio::EventLoop event_loop(handler);
+    HandoffDecoder decoder(share);
+    auto receiver = evio::create<FdReceiver>();
+    receiver->init(fd);
+    receiver->set_protocol_decoder(decoder);
+    event_loop.join();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+  Dout(dc::notice, "Worker " << getpid() << " adopted " << worker_sockets_destructed << " sockets.");
+}
+
+//=============================================================================
+// Benchmark.
+//
+
+void run_client(char const* socket_path, size_t number_of_connections)
+{
+  Debug(NAMESPACE_DEBUG::init_thread());
+  struct sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  for (size_t n = 0; n < number_of_connections; ++n)
+  {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1)
+    {
+      Dout(dc::warning, "connect: " << std::strerror(errno));
+      ::close(fd);
+      return;
+    }
+    // Wait till a worker adopted the connection.
+    char c;
+    [[maybe_unused]] ssize_t len = ::read(fd, &c, 1);
+    ::close(fd);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t number_of_connections = 100000;
+  size_t number_of_workers = 4;
+  if (argc > 1)
+    number_of_connections = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    number_of_workers = std::strtoul(argv[2], nullptr, 10);
+  if (number_of_connections == 0 || number_of_workers == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<connections> [<worker processes>]]" << std::endl;
+    return 1;
+  }
+  size_t const number_of_clients = 8;
+
+  // Fork the workers before any thread is created.
+  std::vector<int> supervisor_fds;
+  std::vector<pid_t> workers;
+  for (size_t w = 0; w < number_of_workers; ++w)
+  {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+      perror("socketpair");
+      return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      for (int fd : supervisor_fds)
+        ::close(fd);
+      ::close(sv[0]);
+      run_worker(sv[1], number_of_connections / number_of_workers + (w < number_of_connections % number_of_workers ? 1 : 0));
+      _exit(0);
+    }
+    ::close(sv[1]);
+    supervisor_fds.push_back(sv[0]);
+    workers.push_back(pid);
+  }
+
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(256);
+
+  static char const* const socket_path = "/tmp/fd_passing";
+  unlink(socket_path);
+
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point end_time;
+  try
+  {
+    evio::EventLoop event_loop(handler);
+
+    std::vector<boost::intrusive_ptr<HandoffSender>> senders;
+    for (int fd : supervisor_fds)
+    {
+      senders.push_back(evio::create<HandoffSender>());
+      senders.back()->init(fd);
+    }
+    auto listen_device = evio::create<HandoffListenDevice>(senders, number_of_connections);
+    listen_device->listen(socket_path);
+
+    start_time = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < number_of_clients; ++c)
+      clients.emplace_back(run_client, socket_path,
+          number_of_connections / number_of_clients + (c < number_of_connections % number_of_clients ? 1 : 0));
+    for (auto& client : clients)
+      client.join();
+    end_time = std::chrono::steady_clock::now();
+
+    event_loop.join();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  for (pid_t pid : workers)
+    waitpid(pid, nullptr, 0);
+  unlink(socket_path);
+
+  double const total_s = std::chrono::duration<double>(end_time - start_time).count();
+  std::cout << number_of_connections << " connections handed off to " << number_of_workers << " workers in " << total_s << " s (" <<
+    (number_of_connections / total_s) << " handoffs/s)." << std::endl;
+}
@@ -0,0 +1,88 @@
+// Decoding speed of framing::Decoder versus the default (newline) decoder.
+//
+// Replays frames of 16 bytes up to 1 MB from memory through end_of_msg_finder and
+// decode, the way an InputDevice would after reading 64 kB at a time. The newline
+// decoder has to look at every byte to find the end of a message; framing::Decoder only
+// parses the length header and then counts bytes.
+//
+// Data that was just read from a socket is in the cache, so the same stream of (at least)
+// 4 MB is replayed as many times as necessary, rather than replaying one huge stream.
+//
+// Usage: framing_decoder [<megabytes per frame size>]
+
+#include "sys.h"
+#include "debug.h"
+#include "FramingDecoder.h"
+#include "DecoderReplay.h"
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace {
+
+size_t received_frames;
+
+} // namespace
+
+// Uses the default end_of_msg_finder, which looks for a newline.
+class NewlineDecoder : public evio::protocol::Decoder
+{
+ protected:
+  void decode(int& UNUSED_ARG(allow_deletion_count), evio::MsgBlock&& UNUSED_ARG(msg)) override { ++received_frames; }
+};
+
+template<class LengthPrefix>
+class MyFramingDecoder : public framing::Decoder<LengthPrefix>
+{
+ protected:
+  void decode_frame(int& UNUSED_ARG(allow_deletion_count), char const* UNUSED_ARG(payload), size_t UNUSED_ARG(len)) override { ++received_frames; }
+};
+
+double run(char const* name, evio::protocol::Decoder& decoder, std::string const& stream, size_t frames, size_t rounds)
+{
+  received_frames = 0;
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; ++round)
+    replay(decoder, stream, 65536);
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  ASSERT(received_frames == frames * rounds);
+  std::cout << "  " << name << ": " << (frames * rounds / total_s / 1e6) << " million frames/s (" <<
+    (stream.size() * rounds / total_s / 1e6) << " MB/s)." << std::endl;
+  return total_s;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t const megabytes = argc > 1 ? std::atol(argv[1]) : 256;
+  if (megabytes == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<megabytes per frame size>]" << std::endl;
+    return 1;
+  }
+
+  for (size_t frame_size = 16; frame_size <= 1024 * 1024; frame_size *= 16)
+  {
+    size_t const frames = std::max(size_t{4000000} / frame_size, size_t{4});
+    size_t const rounds = std::max(megabytes * 1000000 / (frames * frame_size), size_t{1});
+    std::string const payload(frame_size - 1, 'x');
+    std::ostringstream lines, fixed, varint;
+    for (size_t n = 0; n < frames; ++n)
+    {
+      lines << payload << '\n';
+      framing::write_frame<framing::Fixed<4>>(fixed, payload.data(), payload.size());
+      framing::write_frame<framing::Varint>(varint, payload.data(), payload.size());
+    }
+
+    std::cout << (frames * rounds) << " frames of " << frame_size << " bytes:" << std::endl;
+    NewlineDecoder newline_decoder;
+    double const newline_s = run("newline", newline_decoder, lines.str(), frames, rounds);
+    MyFramingDecoder<framing::Fixed<4>> fixed_decoder;
+    double const fixed_s = run("Fixed<4>", fixed_decoder, fixed.str(), frames, rounds);
+    MyFramingDecoder<framing::Varint> varint_decoder;
+    double const varint_s = run("Varint", varint_decoder, varint.str(), frames, rounds);
+    std::cout << "  Speed up: " << (newline_s / fixed_s) << " (Fixed<4>), " << (newline_s / varint_s) << " (Varint)." << std::endl;
+  }
+}
@@ -0,0 +1,150 @@
+// Install https://github.com/MPI-SWS/genmc
+//
+// Then test with:
+//
+// genmc -unroll 5 -- genmc_chase_lev_deque.c
+//
+// Model of a Chase-Lev work-stealing deque, using the C11 memory orderings from
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê, Pop, Cohen and Zappa Nardelli, 2013).
+//
+// The owner thread pushes and takes at the bottom of the deque, while the thief threads
+// steal from the top. Every item must be obtained at most once, and no item may get lost.
+// The buffer is large enough for all items, so resizing is not part of this model.
+
+// These header files are replaced by genmc (see /usr/local/include/genmc):
+#include <pthread.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define THIEF_THREADS 2
+#define NUMBER_OF_ITEMS 3
+#define BUFFER_SIZE 4           // Must be a power of two, larger or equal NUMBER_OF_ITEMS.
+
+#define EMPTY -1
+#define ABORT -2
+
+struct Deque
+{
+  atomic_long top;
+  atomic_long bottom;
+  atomic_int buffer[BUFFER_SIZE];
+};
+
+struct Deque deque;
+atomic_int taken[NUMBER_OF_ITEMS];       // The number of times that each item was obtained.
+
+// Called by the owner thread only.
+void push(struct Deque* q, int x)
+{
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  assert(b - t < BUFFER_SIZE);
+  atomic_store_explicit(&q->buffer[b % BUFFER_SIZE], x, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+}
+
+// Called by the owner thread only.
+int take(struct Deque* q)
+{
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+  int x;
+  if (t <= b)
+  {
+    // Non-empty deque.
+    x = atomic_load_explicit(&q->buffer[b % BUFFER_SIZE], memory_order_relaxed);
+    if (t == b)
+    {
+      // Single last element; race against the thieves.
+      if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        x = EMPTY;      // Lost the race.
+      atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+  }
+  else
+  {
+    // Empty deque.
+    x = EMPTY;
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  }
+  return x;
+}
+
+// Called by any thread.
+int steal(struct Deque* q)
+{
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+  int x = EMPTY;
+  if (t < b)
+  {
+    // Non-empty deque.
+    x = atomic_load_explicit(&q->buffer[t % BUFFER_SIZE], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+      return ABORT;     // Lost the race against another thief or the owner.
+  }
+  return x;
+}
+
+void obtained(int x)
+{
+  if (x >= 0)
+    atomic_fetch_add_explicit(&taken[x], 1, memory_order_relaxed);
+}
+
+void* owner_thread(void* param)
+{
+  // Push all items, taking one back in between.
+  for (int i = 0; i < NUMBER_OF_ITEMS; ++i)
+  {
+    push(&deque, i);
+    if (i == 1)
+      obtained(take(&deque));
+  }
+  // Take everything that is left.
+  for (int i = 0; i < NUMBER_OF_ITEMS; ++i)
+    obtained(take(&deque));
+
+  return NULL;
+}
+
+void* thief_thread(void* param)
+{
+  obtained(steal(&deque));
+  return NULL;
+}
+
+pthread_t t[1 + THIEF_THREADS];
+
+int main()
+{
+  // Start the owner thread.
+  if (pthread_create(&t[0], NULL, owner_thread, NULL))
+    abort();
+
+  // Start THIEF_THREADS threads that each try to steal one item.
+  for (int i = 0; i < THIEF_THREADS; ++i)
+    if (pthread_create(&t[1 + i], NULL, thief_thread, NULL))
+      abort();
+
+  // Wait till all threads finished.
+  for (int i = 0; i < 1 + THIEF_THREADS; ++i)
+    if (pthread_join(t[i], NULL))
+      abort();
+
+  // The owner takes everything that is left, so every item must have been obtained exactly once.
+  for (int i = 0; i < NUMBER_OF_ITEMS; ++i)
+    assert(taken[i] == 1);
+
+  // The deque must be empty.
+  assert(deque.top == deque.bottom);
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+// Install https://github.com/MPI-SWS/genmc
+//
+// Then test with:
+//
+// genmc -unroll 5 -- genmc_device_state.c
+//
+// Model of the state of an OutputDevice packed into a single atomic word, instead of
+// a mutex protected state_t, where every transition is a single atomic read-modify-write.
+//
+// The transitions modelled are:
+//
+//   start_output_device  (PutThread)       : inactive --> active, unless closed or disabled.
+//   flush_output_device  (PutThread)       : mark flushing; close immediately when inactive (the buffer is empty).
+//   buffer_empty         (EventLoopThread) : active --> inactive; close when flushing.
+//   close_output_device  (AnyThread)       : set closed and make inactive.
+//
+// Being active implies a call to inhibit_deletion() (modelled by ref_count) that must
+// be undone exactly once, by the transition that makes the device inactive again.
+// The first start also adds the fd to the epoll set (modelled by added_count).
+
+// These header files are replaced by genmc (see /usr/local/include/genmc):
+#include <pthread.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define WITH_CLOSE_THREAD 1
+
+// Bits of the state word.
+#define ACTIVE   1
+#define ADDED    2
+#define FLUSHING 4
+#define CLOSED   8
+#define DISABLED 16
+
+atomic_int state;
+atomic_int ref_count;           // The number of inhibit_deletion() calls that weren't undone yet.
+atomic_int added_count;         // The number of times that the fd was added to the epoll set.
+atomic_int closed_count;        // The number of times that the fd was closed.
+
+void close_output_device()
+{
+  int s = atomic_load_explicit(&state, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&state, &s, (s | CLOSED) & ~ACTIVE, memory_order_acq_rel, memory_order_relaxed))
+    ;
+  if (s & CLOSED)
+    return;                     // Already closed.
+  atomic_fetch_add_explicit(&closed_count, 1, memory_order_relaxed);
+  if (s & ACTIVE)
+  {
+    int prev = atomic_fetch_sub_explicit(&ref_count, 1, memory_order_relaxed);     // allow_deletion().
+    assert(prev > 0);
+  }
+}
+
+// Called by the PutThread.
+void start_output_device()
+{
+  // Call inhibit_deletion() before the device can be observed as being active.
+  atomic_fetch_add_explicit(&ref_count, 1, memory_order_relaxed);
+  int s = atomic_load_explicit(&state, memory_order_relaxed);
+  do
+  {
+    if ((s & (ACTIVE | CLOSED | DISABLED)))
+    {
+      // Nothing to do; undo the inhibit_deletion().
+      atomic_fetch_sub_explicit(&ref_count, 1, memory_order_relaxed);
+      return;
+    }
+  }
+  while (!atomic_compare_exchange_weak_explicit(&state, &s, s | ACTIVE | ADDED, memory_order_acq_rel, memory_order_relaxed));
+  if (!(s & ADDED))
+    atomic_fetch_add_explicit(&added_count, 1, memory_order_relaxed);   // epoll_ctl(EPOLL_CTL_ADD).
+}
+
+// Called by the PutThread.
+void flush_output_device()
+{
+  int s = atomic_fetch_or_explicit(&state, FLUSHING, memory_order_acq_rel);
+  // If the device isn't active then the buffer is empty and we can close the device right away.
+  // Otherwise the EventLoopThread will close it as soon as the buffer runs empty.
+  if (!(s & ACTIVE))
+    close_output_device();
+}
+
+// Called by the EventLoopThread when write_to_fd emptied the buffer.
+void buffer_empty()
+{
+  int s = atomic_fetch_and_explicit(&state, ~ACTIVE, memory_order_acq_rel);
+  if (!(s & ACTIVE))
+    return;                     // Another thread made the device inactive already.
+  int prev = atomic_fetch_sub_explicit(&ref_count, 1, memory_order_relaxed);       // allow_deletion().
+  assert(prev > 0);
+  if ((s & FLUSHING))
+    close_output_device();
+}
+
+void* put_thread(void* param)
+{
+  start_output_device();
+  flush_output_device();
+  return NULL;
+}
+
+void* event_loop_thread(void* param)
+{
+  if ((atomic_load_explicit(&state, memory_order_acquire) & ACTIVE))
+    buffer_empty();
+  return NULL;
+}
+
+void* any_thread(void* param)
+{
+  close_output_device();
+  return NULL;
+}
+
+pthread_t t[3];
+
+int main()
+{
+  if (pthread_create(&t[0], NULL, put_thread, NULL))
+    abort();
+  if (pthread_create(&t[1], NULL, event_loop_thread, NULL))
+    abort();
+#if WITH_CLOSE_THREAD
+  if (pthread_create(&t[2], NULL, any_thread, NULL))
+    abort();
+#endif
+
+  // Wait till all threads finished.
+  for (int i = 0; i < 2 + WITH_CLOSE_THREAD; ++i)
+    if (pthread_join(t[i], NULL))
+      abort();
+
+  // If the device is still active then the EventLoopThread will empty the buffer later.
+  if ((state & ACTIVE))
+    buffer_empty();
+
+  // Because the device was flushed it must be closed now; exactly once.
+  assert((state & CLOSED));
+  assert(closed_count == 1);
+  // Every inhibit_deletion() must have been undone.
+  assert(ref_count == 0);
+  // The fd was added to the epoll set at most once.
+  assert(added_count <= 1);
+
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Group commit: coalescing concurrent durable appends into one fdatasync.
+//
+// See GroupCommitLog.h.
+//
+// This program lets 1, 8 and 64 writer threads each append a 100 byte record and wait
+// for its commit, in a loop, and prints the number of commits per second and the
+// average number of records per fdatasync.
+//
+// Usage: group_commit [<seconds per run> [<path> [direct]]]
+
+#include "GroupCommitLog.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <cstdlib>
+#include <unistd.h>
+
+//----------------------------------------------------------------------------
+// Benchmark.
+//
+
+void run(char const* path, bool direct, size_t number_of_writers, std::chrono::seconds duration)
+{
+  GroupCommitLog log(path, direct);
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> total_commits{0};
+  std::vector<std::thread> writers;
+  auto const start_time = std::chrono::steady_clock::now();
+  for (size_t w = 0; w < number_of_writers; ++w)
+    writers.emplace_back([&, w]()
+        {
+          std::string record = "Record of writer " + std::to_string(w) + ' ';
+          record.resize(99, '.');
+          record += '\n';
+          std::mutex mutex;
+          std::condition_variable committed_cv;
+          bool committed;
+          size_t commits = 0;
+          while (!stop)
+          {
+            committed = false;
+            log.append(record.data(), record.size(), [&]()
+                {
+                  std::lock_guard<std::mutex> lock(mutex);
+                  committed = true;
+                  committed_cv.notify_one();
+                });
+            std::unique_lock<std::mutex> lock(mutex);
+            committed_cv.wait(lock, [&]{ return committed; });
+            ++commits;
+          }
+          total_commits += commits;
+        });
+  std::this_thread::sleep_for(duration);
+  stop = true;
+  for (auto& writer : writers)
+    writer.join();
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  std::cout << number_of_writers << " writer" << (number_of_writers == 1 ? ": " : "s: ") << (total_commits / total_s) << " commits/s; " <<
+    (static_cast<double>(total_commits) / log.commits()) << " records per fdatasync." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  std::chrono::seconds duration(2);
+  char const* path = "group_commit.log";
+  bool direct = false;
+  if (argc > 1)
+    duration = std::chrono::seconds(std::strtoul(argv[1], nullptr, 10));
+  if (argc > 2)
+    path = argv[2];
+  if (argc > 3)
+    direct = std::strcmp(argv[3], "direct") == 0;
+  if (duration.count() == 0 || (argc > 3 && !direct))
+  {
+    std::cerr << "Usage: " << argv[0] << " [<seconds per run> [<path> [direct]]]" << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    for (size_t number_of_writers : { 1, 8, 64 })
+      run(path, direct, number_of_writers, duration);
+  }
+  catch (std::system_error const& error)
+  {
+    // For example, O_DIRECT is not supported by tmpfs.
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+  unlink(path);
+}
@@ -0,0 +1,132 @@
+// Decoding speed of http::Decoder.
+//
+// Replays pipelined requests, as generated by HtmlPipeLineServerFixture::generate_request,
+// from memory through end_of_msg_finder and decode, the way an InputDevice would after
+// reading read_size bytes at a time. This is done once with a decoder that looks at one
+// character at a time (the way the test server of HtmlPipeLineServerFixture parses its
+// input) and once with http::Decoder; both extract the X-Request header of every request.
+//
+// Usage: http_decoder [<number of requests> [<read size>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "HTTPDecoder.h"
+#include "DecoderReplay.h"
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+unsigned long request_sum;      // The sum of all X-Request values, to check that the decoders agree.
+
+} // namespace
+
+// Recognizes the end of a request and its header fields one character at a time.
+class ByteAtATimeDecoder : public evio::protocol::Decoder
+{
+ private:
+  int m_matched;                // The number of characters of "\r\n\r\n" that were matched.
+
+ public:
+  ByteAtATimeDecoder() : m_matched(0) { }
+
+ protected:
+  size_t end_of_msg_finder(char const* new_data, size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override
+  {
+    static char const eom[] = "\r\n\r\n";
+    for (size_t i = 0; i < rlen; ++i)
+    {
+      if (new_data[i] == eom[m_matched])
+      {
+        if (++m_matched == 4)
+        {
+          m_matched = 0;
+          return i + 1;
+        }
+      }
+      else
+        m_matched = new_data[i] == '\r' ? 1 : 0;
+    }
+    return 0;
+  }
+
+  void decode(int& UNUSED_ARG(allow_deletion_count), evio::MsgBlock&& msg) override
+  {
+    std::string key;
+    std::string value;
+    bool in_value = false;
+    for (char const* p = msg.get_start(); p < msg.get_start() + msg.get_size(); ++p)
+    {
+      if (*p == '\n')
+      {
+        if (key == "X-Request")
+          request_sum += std::strtoul(value.c_str(), nullptr, 10);
+        key.clear();
+        value.clear();
+        in_value = false;
+      }
+      else if (*p == '\r')
+        ;
+      else if (in_value)
+        value += *p;
+      else if (*p == ':')
+        in_value = true;
+      else
+        key += *p;
+    }
+  }
+};
+
+class MyHTTPDecoder : public http::Decoder
+{
+ protected:
+  void on_head(int& UNUSED_ARG(allow_deletion_count), http::MessageHead const& head) override
+  {
+    request_sum += std::strtoul(head["x-request"].data(), nullptr, 10);
+  }
+
+  void on_message_complete(int& UNUSED_ARG(allow_deletion_count)) override { }
+};
+
+std::string generate_request(int request, int sleep)
+{
+  return "GET / HTTP/1.1\r\n"
+         "Host: localhost:9001\r\n"
+         "Accept: */*\r\n"
+         "X-Request: " + std::to_string(request) + "\r\n"
+         "X-Sleep: " + std::to_string(sleep) + "\r\n"
+         "\r\n";
+}
+
+void run(char const* name, evio::protocol::Decoder& decoder, std::string const& stream, int requests, size_t read_size)
+{
+  request_sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  replay(decoder, stream, read_size);
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << name << ": " << requests << " requests in " << total_s << " s (" << (requests / total_s / 1000000) << " million requests/s, " <<
+    (stream.size() / total_s / 1000000) << " MB/s); X-Request sum " << request_sum << '.' << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int const requests = argc > 1 ? std::atoi(argv[1]) : 10000000;
+  size_t const read_size = argc > 2 ? std::atol(argv[2]) : 65536;
+  if (requests <= 0 || read_size == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<number of requests> [<read size>]]" << std::endl;
+    return 1;
+  }
+
+  std::string stream;
+  for (int request = 0; request < requests; ++request)
+    stream += generate_request(request, request % 100);
+
+  ByteAtATimeDecoder byte_at_a_time_decoder;
+  run("Byte at a time", byte_at_a_time_decoder, stream, requests, read_size);
+  MyHTTPDecoder http_decoder;
+  run("http::Decoder", http_decoder, stream, requests, read_size);
+}
@@ -0,0 +1,128 @@
+// Event driven tailing of many files with a single inotify fd.
+//
+// See InotifyDevice.h.
+//
+// This program tails 1000 idle files (by default), prints the CPU time used while idle,
+// then appends a line to every file and rotates one of them, and checks that all lines
+// were received.
+//
+// Usage: inotify_tail [<number of files> [<idle seconds>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "InotifyDevice.h"
+#include "evio/EventLoop.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//=============================================================================
+// Benchmark.
+//
+
+std::atomic<size_t> lines_received{0};
+
+// Counts the lines of a tailed file.
+class LineCounter : public evio::protocol::Decoder
+{
+ protected:
+  // Use the default end_of_msg_finder, which finds the next newline.
+  void decode(int& UNUSED_ARG(allow_deletion_count), evio::MsgBlock&& UNUSED_ARG(msg)) override
+  {
+    ++lines_received;
+  }
+};
+
+double process_cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t number_of_files = 1000;
+  unsigned int idle_seconds = 10;
+  if (argc > 1)
+    number_of_files = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    idle_seconds = std::strtoul(argv[2], nullptr, 10);
+  if (number_of_files == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<number of files> [<idle seconds>]]" << std::endl;
+    return 1;
+  }
+
+  static char const* const directory = "/tmp/inotify_tail";
+  mkdir(directory, 0700);
+  std::vector<std::string> paths;
+  for (size_t n = 0; n < number_of_files; ++n)
+  {
+    paths.push_back(std::string(directory) + "/file" + std::to_string(n) + ".log");
+    std::ofstream(paths.back(), std::ios_base::trunc) << "Old data that is skipped.\n";
+  }
+
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+
+  try
+  {
+    evio::EventLoop event_loop(handler);
+
+    std::vector<LineCounter> decoders(number_of_files);
+    std::vector<boost::intrusive_ptr<TailedFile>> files;
+    auto inotify_device = evio::create<InotifyDevice>();
+    inotify_device->init();
+    for (size_t n = 0; n < number_of_files; ++n)
+    {
+      files.push_back(evio::create<TailedFile>(paths[n]));
+      files.back()->set_protocol_decoder(decoders[n]);
+      inotify_device->add(*files.back());
+    }
+    inotify_device->start();
+
+    double const start_cpu = process_cpu_seconds();
+    std::this_thread::sleep_for(std::chrono::seconds(idle_seconds));
+    double const idle_cpu = process_cpu_seconds() - start_cpu;
+    std::cout << "Tailing " << number_of_files << " idle files for " << idle_seconds << " s used " << (idle_cpu * 1000) << " ms of CPU time." << std::endl;
+
+    // Append a line to every file.
+    for (auto const& path : paths)
+      std::ofstream(path, std::ios_base::app) << "New line.\n";
+    // Rotate the first file and write one line to the new file.
+    std::string const rotated_path = paths[0] + ".1";
+    rename(paths[0].c_str(), rotated_path.c_str());
+    std::ofstream(paths[0], std::ios_base::trunc) << "Line after rotation.\n";
+
+    // Wait for the event loop to process everything.
+    for (int i = 0; i < 100 && lines_received < number_of_files + 1; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::cout << "Received " << lines_received << " of " << (number_of_files + 1) << " new lines." << std::endl;
+
+    for (auto& file : files)
+      file->close();
+    inotify_device->close();
+    event_loop.join();
+    unlink(rotated_path.c_str());
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  for (auto const& path : paths)
+    unlink(path.c_str());
+  rmdir(directory);
+}
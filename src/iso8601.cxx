@@ -0,0 +1,94 @@
+// ISO 8601 date-time parsing and formatting speed.
+//
+// Parses one million timestamps, as they might occur in an XML-RPC response (in order,
+// a few per second), with strptime + timegm, with the current implementation
+// evio::protocol::xmlrpc::initialize(DateTime&, std::string), and with iso8601::parse.
+// Then formats them again with gmtime_r + strftime, iso8601::format and
+// iso8601::Formatter (which caches the current second and day).
+//
+// Usage: iso8601
+
+#include "sys.h"
+#include "debug.h"
+#include "ISO8601.h"
+#include "evio/protocol/xmlrpc/initialize.h"
+#include "utils/AIAlert.h"
+#include <chrono>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+size_t constexpr count = 1000000;
+
+// Call f(i) for every timestamp; return the number of nanoseconds per call.
+template<typename F>
+double measure(F f)
+{
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; ++i)
+    f(i);
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  // Generate the timestamps.
+  std::mt19937 rng(1);
+  std::vector<std::time_t> times(count);
+  std::vector<std::string> strings(count);
+  std::time_t t = 1611934643;
+  for (size_t i = 0; i < count; ++i)
+  {
+    t += rng() % 4 == 0;
+    times[i] = t;
+    char buf[iso8601::formatted_size];
+    iso8601::format(t, buf);
+    strings[i].assign(buf, sizeof(buf));
+  }
+
+  std::time_t sum = 0;          // Prevents the results from being optimized away.
+  std::cout << "Parsing (ns per timestamp):" << std::endl;
+  std::cout << "  strptime + timegm: " << measure([&](size_t i){
+        std::tm tm{};
+        strptime(strings[i].c_str(), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        sum += timegm(&tm);
+      }) << std::endl;
+  try
+  {
+    evio::DateTime date_time;
+    std::cout << "  xmlrpc::initialize: " << measure([&](size_t i){ evio::protocol::xmlrpc::initialize(date_time, strings[i]); }) << std::endl;
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+  std::cout << "  iso8601::parse: " << measure([&](size_t i){
+        std::time_t parsed = 0;
+        iso8601::parse(strings[i], parsed);
+        sum += parsed;
+      }) << std::endl;
+
+  std::string out(count * iso8601::formatted_size, '\0');
+  std::cout << "Formatting (ns per timestamp):" << std::endl;
+  std::cout << "  gmtime_r + strftime: " << measure([&](size_t i){
+        std::tm tm;
+        gmtime_r(&times[i], &tm);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        std::memcpy(&out[i * iso8601::formatted_size], buf, iso8601::formatted_size);
+      }) << std::endl;
+  std::cout << "  iso8601::format: " << measure([&](size_t i){ iso8601::format(times[i], &out[i * iso8601::formatted_size]); }) << std::endl;
+  iso8601::Formatter formatter;
+  std::cout << "  iso8601::Formatter: " << measure([&](size_t i){
+        std::memcpy(&out[i * iso8601::formatted_size], formatter(times[i]).data(), iso8601::formatted_size);
+      }) << std::endl;
+
+  std::cout << "Checksum: " << sum << "; last timestamp: " << out.substr(out.size() - iso8601::formatted_size) << std::endl;
+}
@@ -0,0 +1,187 @@
+// Stress test for the thread pool queues, derived from listen_socket.cxx.
+//
+// Connect a (large) number of sockets to a listen socket; every accepted socket
+// immediately writes 10 kB to its client, while every client writes a number of
+// bursts back as fast as it can, without the sleeps that listen_socket.cxx uses.
+// All connections are therefore busy at the same time, filling the queue of the
+// thread pool. The program prints how long it took until all data was received.
+//
+// Usage: listen_socket_burst [<clients> [<bursts per client> [<number of threads>]]]
+
+#include "sys.h"
+#include "debug.h"
+#include "evio/EventLoop.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#ifdef CWDEBUG
+#include <libcwd/buf2str.h>
+#endif
+
+using evio::protocol::Decoder;
+using evio::MsgBlock;
+using evio::OutputStream;
+using evio::SocketAddress;
+
+namespace {
+
+size_t number_of_clients = 100;
+size_t bursts = 1000;
+
+char const burst_data[] = "Burst data!\n";
+size_t constexpr burst_data_size = sizeof(burst_data) - 1;
+size_t constexpr reply_size = 10000;
+
+} // namespace
+
+class MyAcceptedSocketDecoder : public Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  MyAcceptedSocketDecoder() : m_received(0) { }
+
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override { return rlen; }
+  void decode(int& allow_deletion_count, MsgBlock&& msg) override;
+};
+
+using MyAcceptedSocket = evio::AcceptedSocket<MyAcceptedSocketDecoder, OutputStream>;
+
+class MyListenSocket : public evio::ListenSocket<MyAcceptedSocket>
+{
+ private:
+  size_t m_accepted;
+
+ public:
+  MyListenSocket() : m_accepted(0) { }
+
+  void new_connection(accepted_socket_type& accepted_socket) override
+  {
+    // Write 10 kbyte of data.
+    for (int n = 0; n < 100; ++n)
+      accepted_socket() << "START012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789END." << std::endl;
+    // We're done with writing to this socket.
+    accepted_socket.flush_output_device();
+    if (++m_accepted == number_of_clients)
+      close();
+  }
+};
+
+class MyDecoder : public Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  MyDecoder() : m_received(0) { }
+
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override { return rlen; }
+  void decode(int& allow_deletion_count, MsgBlock&& msg) override;
+};
+
+class BurstSocket : public evio::Socket
+{
+ private:
+  MyDecoder m_decoder;
+  OutputStream m_output;
+
+ public:
+  BurstSocket()
+  {
+    set_protocol_decoder(m_decoder);
+    set_source(m_output);
+  }
+
+  void write_burst()
+  {
+    m_output.write(burst_data, burst_data_size);
+    m_output << std::flush;
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int number_of_threads = std::thread::hardware_concurrency();
+  if (argc > 1)
+    number_of_clients = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    bursts = std::strtoul(argv[2], nullptr, 10);
+  if (argc > 3)
+    number_of_threads = std::atoi(argv[3]);
+  if (number_of_clients == 0 || bursts == 0 || number_of_threads <= 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<clients> [<bursts per client> [<number of threads>]]]" << std::endl;
+    return 1;
+  }
+
+  AIThreadPool thread_pool(number_of_threads);
+  [[maybe_unused]] AIQueueHandle high_priority_handler = thread_pool.new_queue(32);
+  [[maybe_unused]] AIQueueHandle medium_priority_handler = thread_pool.new_queue(32);
+  AIQueueHandle low_priority_handler = thread_pool.new_queue(16);
+
+  static SocketAddress const listen_address("0.0.0.0:9005");
+
+  std::chrono::steady_clock::time_point start_time;
+  try
+  {
+    // Initialize the IO event loop thread.
+    evio::EventLoop event_loop(low_priority_handler);
+
+    auto listen_sock = evio::create<MyListenSocket>();
+    listen_sock->listen(listen_address);
+
+    // Dumb way to wait until the listen socket is up.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    start_time = std::chrono::steady_clock::now();
+    {
+      std::vector<boost::intrusive_ptr<BurstSocket>> sockets(number_of_clients);
+      for (size_t s = 0; s < sockets.size(); ++s)
+      {
+        sockets[s] = evio::create<BurstSocket>();
+        sockets[s]->connect(listen_address);
+      }
+      for (size_t b = 0; b < bursts; ++b)
+        for (size_t s = 0; s < sockets.size(); ++s)
+          sockets[s]->write_burst();
+      for (size_t s = 0; s < sockets.size(); ++s)
+        sockets[s]->flush_output_device();
+    }
+
+    event_loop.join();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  double const total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+  std::cout << number_of_clients << " clients, " << bursts << " bursts per client: " << total_ms << " ms." << std::endl;
+}
+
+void MyAcceptedSocketDecoder::decode(int& allow_deletion_count, MsgBlock&& msg)
+{
+  DoutEntering(dc::notice, "MyAcceptedSocketDecoder::decode({" << allow_deletion_count << "}, \"" << buf2str(msg.get_start(), msg.get_size()) << "\") [" << this << ']');
+  m_received += msg.get_size();
+  // Close the socket when the last burst was received.
+  if (m_received == bursts * burst_data_size)
+    close_input_device(allow_deletion_count);
+}
+
+void MyDecoder::decode(int& allow_deletion_count, MsgBlock&& msg)
+{
+  DoutEntering(dc::notice, "MyDecoder::decode({" << allow_deletion_count << "}, \"" << buf2str(msg.get_start(), msg.get_size()) << "\") [" << this << ']');
+  m_received += msg.get_size();
+  // Stop when the last message was received.
+  if (m_received == reply_size)
+    close_input_device(allow_deletion_count);
+}
@@ -0,0 +1,130 @@
+// Longest prefix match speed.
+//
+// Inserts random prefixes into an lpm::Trie (nine out of ten IPv4, mostly /24 and /16../23,
+// the rest IPv6, mostly /32../48), builds it and then looks up one million IPv4 and one
+// million IPv6 addresses, most of which fall inside one of the prefixes. Prints the time
+// that build() took, the size of the lookup structure and the number of lookups per second
+// of find(sockaddr const*) and of a bit by bit walk over the binary trie (find_slow), after
+// checking that both return the same values.
+//
+// Usage: lpm_trie [<prefixes>]
+
+#include "sys.h"
+#include "debug.h"
+#include "LPMTrie.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+size_t constexpr lookups = 1000000;
+
+// Return a random prefix length with roughly the distribution of a routing table.
+int prefix_length(std::mt19937& rng, bool ipv4)
+{
+  unsigned int const r = rng() % 100;
+  if (ipv4)
+    return r < 60 ? 24 : r < 90 ? 16 + rng() % 8 : r < 95 ? 8 + rng() % 8 : 25 + rng() % 8;
+  return r < 50 ? 48 : r < 80 ? 32 + rng() % 16 : r < 90 ? 16 + rng() % 16 : 49 + rng() % 80;
+}
+
+// Call f for every address; return the number of lookups per second.
+template<typename F>
+double measure(std::vector<struct sockaddr_storage> const& addresses, F f)
+{
+  auto const start = std::chrono::steady_clock::now();
+  for (auto const& address : addresses)
+    f(address);
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return addresses.size() / total_s;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t const number_of_prefixes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+  std::mt19937 rng(1);
+  lpm::Trie<uint32_t> trie;
+  std::vector<std::vector<unsigned char>> prefixes[2];
+  for (uint32_t i = 0; i < number_of_prefixes; ++i)
+  {
+    bool const ipv4 = i % 10 != 0;
+    std::vector<unsigned char> address(ipv4 ? 4 : 16);
+    for (auto& byte : address)
+      byte = rng();
+    if (!ipv4)
+    {
+      // Global unicast, 2000::/3.
+      address[0] = 0x20 | (address[0] & 0x1f);
+    }
+    trie.insert(ipv4 ? AF_INET : AF_INET6, address.data(), prefix_length(rng, ipv4), i);
+    prefixes[ipv4].push_back(address);
+  }
+
+  auto const start = std::chrono::steady_clock::now();
+  trie.build();
+  double const build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  std::cout << trie.size() << " prefixes; build: " << build_ms << " ms; " << trie.memory_size() / 1024 << " kB." << std::endl;
+
+  for (int ipv4 = 1; ipv4 >= 0; --ipv4)
+  {
+    // Nine out of ten addresses are inside a random prefix (or at least share its first 16 bits).
+    std::vector<struct sockaddr_storage> addresses(lookups);
+    for (size_t i = 0; i < lookups; ++i)
+    {
+      std::vector<unsigned char> address = prefixes[ipv4][rng() % prefixes[ipv4].size()];
+      for (size_t byte = i % 10 == 0 ? 0 : 2; byte < address.size(); ++byte)
+        if (rng() % 4 == 0)
+          address[byte] = rng();
+      struct sockaddr_storage& ss = addresses[i];
+      std::memset(&ss, 0, sizeof(ss));
+      if (ipv4)
+      {
+        reinterpret_cast<struct sockaddr_in&>(ss).sin_family = AF_INET;
+        std::memcpy(&reinterpret_cast<struct sockaddr_in&>(ss).sin_addr, address.data(), 4);
+      }
+      else
+      {
+        reinterpret_cast<struct sockaddr_in6&>(ss).sin6_family = AF_INET6;
+        std::memcpy(&reinterpret_cast<struct sockaddr_in6&>(ss).sin6_addr, address.data(), 16);
+      }
+    }
+
+    size_t found = 0;
+    for (auto const& ss : addresses)
+    {
+      struct sockaddr const* sa = reinterpret_cast<struct sockaddr const*>(&ss);
+      unsigned char const* bytes = ipv4 ? reinterpret_cast<unsigned char const*>(&reinterpret_cast<struct sockaddr_in const&>(ss).sin_addr)
+                                        : reinterpret_cast<unsigned char const*>(&reinterpret_cast<struct sockaddr_in6 const&>(ss).sin6_addr);
+      uint32_t const* value = trie.find(sa);
+      if (value != trie.find_slow(sa->sa_family, bytes))
+      {
+        std::cerr << "find and find_slow disagree!" << std::endl;
+        return 1;
+      }
+      found += value != nullptr;
+    }
+
+    uint32_t sum = 0;           // Use the results, so that the lookups can't be optimized away.
+    double const fast = measure(addresses, [&](struct sockaddr_storage const& ss){
+        uint32_t const* value = trie.find(reinterpret_cast<struct sockaddr const*>(&ss));
+        sum += value ? *value : 0;
+    });
+    double const slow = measure(addresses, [&](struct sockaddr_storage const& ss){
+        struct sockaddr const* sa = reinterpret_cast<struct sockaddr const*>(&ss);
+        unsigned char const* bytes = ipv4 ? reinterpret_cast<unsigned char const*>(&reinterpret_cast<struct sockaddr_in const&>(ss).sin_addr)
+                                          : reinterpret_cast<unsigned char const*>(&reinterpret_cast<struct sockaddr_in6 const&>(ss).sin6_addr);
+        uint32_t const* value = trie.find_slow(sa->sa_family, bytes);
+        sum += value ? *value : 0;
+    });
+    std::cout << (ipv4 ? "IPv4" : "IPv6") << " (" << found * 100 / lookups << "% matched, checksum " << sum << "): find: " <<
+      fast / 1e6 << " M/s; find_slow: " << slow / 1e6 << " M/s." << std::endl;
+  }
+}
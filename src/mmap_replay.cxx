@@ -0,0 +1,127 @@
+// Replaying a large file through a protocol decoder without copying.
+//
+// See MappedInputFile.h.
+//
+// This program writes a log file of 1 GB (by default) and counts its lines, once with
+// evio::File and once with MappedInputFile.
+//
+// Usage: mmap_replay [<megabytes> [<window megabytes>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "MappedInputFile.h"
+#include "evio/EventLoop.h"
+#include "evio/File.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+//=============================================================================
+// Benchmark.
+//
+
+namespace {
+
+size_t total_size = 1024 * 1024 * 1024;
+
+} // namespace
+
+class LineCounter : public evio::protocol::Decoder
+{
+ private:
+  size_t m_lines;
+  size_t m_bytes;
+
+ public:
+  LineCounter() : m_lines(0), m_bytes(0) { }
+
+  size_t lines() const { return m_lines; }
+  size_t bytes() const { return m_bytes; }
+
+ protected:
+  // Use the default end_of_msg_finder, which finds the next newline.
+  void decode(int& UNUSED_ARG(allow_deletion_count), evio::MsgBlock&& msg) override
+  {
+    ++m_lines;
+    m_bytes += msg.get_size();
+  }
+
+  size_t minimum_block_size_estimate() const override { return 65536; }
+};
+
+void report(char const* name, LineCounter const& counter, std::chrono::steady_clock::time_point start_time)
+{
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  std::cout << name << ": " << counter.lines() << " lines (" << (counter.bytes() >> 20) << " MB) in " << total_s << " s (" <<
+    ((counter.bytes() >> 20) / total_s) << " MB/s)." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t window_size = 256 * 1024 * 1024;
+  if (argc > 1)
+    total_size = std::strtoul(argv[1], nullptr, 10) << 20;
+  if (argc > 2)
+    window_size = std::strtoul(argv[2], nullptr, 10) << 20;
+  if (total_size == 0 || window_size == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<megabytes> [<window megabytes>]]" << std::endl;
+    return 1;
+  }
+
+  // Write a log file with lines of varying length.
+  static char const* const path = "/tmp/mmap_replay.log";
+  {
+    std::ofstream file(path, std::ios_base::trunc);
+    size_t written = 0;
+    for (size_t n = 0; written < total_size; ++n)
+    {
+      std::string const line = "2020-01-01T00:00:00Z INFO request " + std::to_string(n) + " served in " +
+        std::to_string(n % 1000) + " us " + std::string(n % 97, '.') + '\n';
+      file << line;
+      written += line.size();
+    }
+  }
+
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+
+  try
+  {
+    // Through an InputBuffer.
+    {
+      LineCounter counter;
+      auto start_time = std::chrono::steady_clock::now();
+      {
+        evio::EventLoop event_loop(handler);
+        auto file = evio::create<evio::File>();
+        file->set_protocol_decoder(counter);
+        file->open(path, std::ios_base::in);
+        event_loop.join();
+      }
+      report("File", counter, start_time);
+    }
+
+    // From the mapping.
+    {
+      LineCounter counter;
+      auto start_time = std::chrono::steady_clock::now();
+      auto file = evio::create<MappedInputFile>(window_size);
+      file->open(path);
+      file->set_protocol_decoder(counter);
+      file->replay();
+      report("MappedInputFile", counter, start_time);
+    }
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  unlink(path);
+}
@@ -0,0 +1,89 @@
+// Cross-thread notification speed of NotifyDevice.
+//
+// See NotifyDevice.h.
+//
+// This test lets a number of producer threads (default 16) call notify() as fast as
+// they can, and prints the number of notifications per second and per wake up.
+//
+// Usage: notify_device [<producer threads> [<notifications per producer>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "NotifyDevice.h"
+#include "evio/EventLoop.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t number_of_producers = 16;
+  size_t notifications_per_producer = 1000000;
+  if (argc > 1)
+    number_of_producers = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    notifications_per_producer = std::strtoul(argv[2], nullptr, 10);
+  if (number_of_producers == 0 || notifications_per_producer == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<producer threads> [<notifications per producer>]]" << std::endl;
+    return 1;
+  }
+  uint64_t const total_notifications = number_of_producers * notifications_per_producer;
+
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+
+  try
+  {
+    uint64_t received = 0;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point end_time;
+    boost::intrusive_ptr<NotifyDevice> notify_device;
+
+    {
+      evio::EventLoop event_loop(handler);
+
+      notify_device = evio::create<NotifyDevice>(
+          [&](int& allow_deletion_count, uint64_t count)
+          {
+            received += count;
+            if (received == total_notifications)
+            {
+              end_time = std::chrono::steady_clock::now();
+              notify_device->close(allow_deletion_count);
+            }
+          });
+      notify_device->init();
+      notify_device->start();
+
+      start_time = std::chrono::steady_clock::now();
+      std::vector<std::thread> producers;
+      for (size_t p = 0; p < number_of_producers; ++p)
+        producers.emplace_back([&]()
+            {
+              Debug(NAMESPACE_DEBUG::init_thread());
+              for (size_t n = 0; n < notifications_per_producer; ++n)
+                notify_device->notify();
+            });
+      for (auto& producer : producers)
+        producer.join();
+
+      event_loop.join();
+    }
+
+    double const total_s = std::chrono::duration<double>(end_time - start_time).count();
+    std::cout << number_of_producers << " producers: " << received << " notifications in " << total_s << " s (" <<
+      (received / total_s) << " notifications/s); " << notify_device->wakeups() << " wake ups (" <<
+      (static_cast<double>(received) / notify_device->wakeups()) << " notifications per wake up)." << std::endl;
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+}
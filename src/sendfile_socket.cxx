@@ -0,0 +1,144 @@
+// Sending a file over a socket with sendfile(2).
+//
+// See SendFileSocket.h.
+//
+// This program sends a file of 1 GB (by default) to a listen socket, once through the
+// buffered path and once with SendFileSocket, and prints the throughput of both.
+//
+// Usage: sendfile_socket [<megabytes>]
+
+#include "sys.h"
+#include "debug.h"
+#include "SendFileSocket.h"
+#include "evio/EventLoop.h"
+#include "evio/File.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+//=============================================================================
+// Benchmark.
+//
+
+namespace {
+
+size_t total_size = 1024 * 1024 * 1024;
+std::chrono::steady_clock::time_point end_time;
+
+} // namespace
+
+// Counts the received bytes and closes the input device when everything was received.
+class CountingDecoder : public evio::protocol::Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  CountingDecoder() : m_received(0) { }
+
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override { return rlen; }
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    m_received += msg.get_size();
+    if (m_received == total_size)
+    {
+      end_time = std::chrono::steady_clock::now();
+      close_input_device(allow_deletion_count);
+    }
+  }
+
+  size_t minimum_block_size_estimate() const override { return 65536; }
+};
+
+using MyAcceptedSocket = evio::AcceptedSocket<CountingDecoder, evio::OutputStream>;
+
+class MyListenSocket : public evio::ListenSocket<MyAcceptedSocket>
+{
+  void new_connection(accepted_socket_type& UNUSED_ARG(accepted_socket)) override { close(); }
+};
+
+void report(char const* name, std::chrono::steady_clock::time_point start_time)
+{
+  double const total_s = std::chrono::duration<double>(end_time - start_time).count();
+  std::cout << name << ": " << (total_size >> 20) << " MB in " << total_s << " s (" << ((total_size >> 20) / total_s) << " MB/s)." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  if (argc > 1)
+    total_size = std::strtoul(argv[1], nullptr, 10) << 20;
+  if (total_size == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<megabytes>]" << std::endl;
+    return 1;
+  }
+
+  // Create the file that will be sent; writing it leaves it in the page cache for both tests.
+  static char const* const path = "/tmp/sendfile_socket.dat";
+  {
+    std::ofstream file(path, std::ios_base::trunc);
+    std::string const chunk(1 << 20, 'x');
+    for (size_t written = 0; written < total_size; written += chunk.size())
+      file.write(chunk.data(), std::min(chunk.size(), total_size - written));
+  }
+
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+
+  static evio::SocketAddress const listen_address("127.0.0.1:9006");
+
+  try
+  {
+    // Buffered: File --> OutputBuffer --> Socket.
+    {
+      evio::EventLoop event_loop(handler);
+
+      auto listen_socket = evio::create<MyListenSocket>();
+      listen_socket->listen(listen_address);
+      // Dumb way to wait until the listen socket is up.
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+      auto start_time = std::chrono::steady_clock::now();
+      auto file = evio::create<evio::File>();
+      auto socket = evio::create<evio::Socket>();
+      socket->set_source(file, 65536 - evio::block_overhead_c, 1024 * 1024, 16 * 1024 * 1024);
+      socket->connect(listen_address);
+      file->open(path, std::ios_base::in);
+
+      event_loop.join();
+      report("File --> Socket", start_time);
+    }
+
+    // sendfile(2).
+    {
+      evio::EventLoop event_loop(handler);
+
+      auto listen_socket = evio::create<MyListenSocket>();
+      listen_socket->listen(listen_address);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+      auto start_time = std::chrono::steady_clock::now();
+      auto socket = evio::create<SendFileSocket>();
+      socket->on_connected([&socket](int& allow_deletion_count, bool success){ if (success) socket->send_file(allow_deletion_count, path); });
+      socket->connect(listen_address);
+
+      event_loop.join();
+      report("SendFileSocket", start_time);
+    }
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+
+  unlink(path);
+}
@@ -0,0 +1,242 @@
+// Throughput of ShmRing.
+//
+// See ShmRing.h.
+//
+// This program compares the throughput of ShmRing, with both ends in the same process
+// and with the read end in a forked child process, with that of an evio::Pipe and of
+// a UNIX socket.
+//
+// Usage: shm_ring [<megabytes> [<message size>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "ShmRing.h"
+#include "evio/EventLoop.h"
+#include "evio/Pipe.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+size_t total_size = 100 * 1000000;
+size_t message_size = 100;
+std::chrono::steady_clock::time_point end_time;
+
+} // namespace
+
+// Counts the received bytes and closes the input device when everything was received.
+class CountingDecoder : public evio::protocol::Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  CountingDecoder() : m_received(0) { }
+
+  size_t received() const { return m_received; }
+
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override { return rlen; }
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    m_received += msg.get_size();
+    if (m_received == total_size)
+    {
+      end_time = std::chrono::steady_clock::now();
+      close_input_device(allow_deletion_count);
+    }
+  }
+};
+
+using MyAcceptedSocket = evio::AcceptedSocket<CountingDecoder, evio::OutputStream>;
+
+class MyListenSocket : public evio::ListenSocket<MyAcceptedSocket>
+{
+  void new_connection(accepted_socket_type& UNUSED_ARG(accepted_socket)) override { close(); }
+};
+
+// Write total_size bytes to output in messages of message_size bytes.
+void write_data(evio::OutputStream& output)
+{
+  std::string const message(message_size, 'x');
+  for (size_t written = 0; written < total_size; written += message_size)
+  {
+    output.write(message.data(), std::min(message_size, total_size - written));
+    output << std::flush;
+  }
+}
+
+// The child process: attach to the ring from (duplicates of) its fds, like a process that received them
+// with SCM_RIGHTS would, and read until everything was received.
+[[noreturn]] void run_reader(std::shared_ptr<ShmRing>&& inherited_ring)
+{
+  int exit_code = 1;
+  try
+  {
+    auto ring = std::make_shared<ShmRing>(dup(inherited_ring->memfd()), dup(inherited_ring->data_doorbell()), dup(inherited_ring->space_doorbell()));
+    inherited_ring.reset();
+
+    AIThreadPool thread_pool;
+    AIQueueHandle handler = thread_pool.new_queue(32);
+    {
+      CountingDecoder decoder;
+      evio::EventLoop event_loop(handler);
+
+      auto read_end = evio::create<ShmRingReadEnd>(ring);
+      read_end->set_protocol_decoder(decoder);
+      event_loop.join();
+      if (decoder.received() == total_size)
+        exit_code = 0;
+    }
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+  _exit(exit_code);
+}
+
+void report(char const* name, std::chrono::steady_clock::time_point start_time)
+{
+  double const total_s = std::chrono::duration<double>(end_time - start_time).count();
+  std::cout << name << ": " << (total_size / 1000000) << " MB in " << total_s << " s (" << (total_size / total_s / 1000000) << " MB/s)." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  if (argc > 1)
+    total_size = std::strtoul(argv[1], nullptr, 10) * 1000000;
+  if (argc > 2)
+    message_size = std::strtoul(argv[2], nullptr, 10);
+  if (total_size == 0 || message_size == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<megabytes> [<message size>]]" << std::endl;
+    return 1;
+  }
+
+  // The read end of the cross-process run lives in a child process that must be forked before any threads are created.
+  std::shared_ptr<ShmRing> shared_ring;
+  pid_t child;
+  try
+  {
+    shared_ring = std::make_shared<ShmRing>(1 << 20);
+    child = fork();
+    if (child == -1)
+      THROW_ALERTE("fork");
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+    return 1;
+  }
+  if (child == 0)
+    run_reader(std::move(shared_ring));
+
+  AIThreadPool thread_pool;
+  AIQueueHandle handler = thread_pool.new_queue(32);
+
+  try
+  {
+    // Shared memory ring, read by the child process.
+    {
+      evio::OutputStream source;
+      evio::EventLoop event_loop(handler);
+
+      auto write_end = evio::create<ShmRingWriteEnd>(shared_ring);
+      write_end->set_source(source);
+
+      auto start_time = std::chrono::steady_clock::now();
+      write_data(source);
+      write_end->flush_output_device();
+      event_loop.join();
+      int status;
+      waitpid(child, &status, 0);
+      child = 0;
+      end_time = std::chrono::steady_clock::now();
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        THROW_ALERT("The reading child process failed.");
+      report("ShmRing (two processes)", start_time);
+    }
+
+    // Shared memory ring.
+    {
+      evio::OutputStream source;
+      CountingDecoder decoder;
+      evio::EventLoop event_loop(handler);
+
+      auto ring = std::make_shared<ShmRing>(1 << 20);
+      auto write_end = evio::create<ShmRingWriteEnd>(ring);
+      auto read_end = evio::create<ShmRingReadEnd>(ring);
+      write_end->set_source(source);
+      read_end->set_protocol_decoder(decoder);
+
+      auto start_time = std::chrono::steady_clock::now();
+      write_data(source);
+      write_end->flush_output_device();
+      event_loop.join();
+      report("ShmRing", start_time);
+    }
+
+    // Pipe.
+    {
+      evio::OutputStream source;
+      CountingDecoder decoder;
+      evio::EventLoop event_loop(handler);
+
+      evio::Pipe pipe;
+      auto write_end = pipe.take_write_end();
+      auto read_end = pipe.take_read_end();
+      write_end->set_source(source);
+      read_end->set_protocol_decoder(decoder);
+
+      auto start_time = std::chrono::steady_clock::now();
+      write_data(source);
+      write_end->flush_output_device();
+      event_loop.join();
+      report("Pipe", start_time);
+    }
+
+    // UNIX socket.
+    {
+      evio::OutputStream source;
+      evio::EventLoop event_loop(handler);
+
+      static char const* const socket_path = "/tmp/shm_ring_benchmark";
+      unlink(socket_path);
+      evio::SocketAddress const endpoint(socket_path);
+      auto listen_socket = evio::create<MyListenSocket>();
+      listen_socket->listen(endpoint);
+
+      auto socket = evio::create<evio::Socket>();
+      socket->set_source(source);
+      socket->connect(endpoint);
+
+      auto start_time = std::chrono::steady_clock::now();
+      write_data(source);
+      socket->flush_output_device();
+      event_loop.join();
+      report("UNIX socket", start_time);
+      unlink(socket_path);
+    }
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+  if (child > 0)
+  {
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+  }
+}
@@ -0,0 +1,94 @@
+// Signal delivery speed of SignalDevice.
+//
+// See SignalDevice.h.
+//
+// This test sends a number of real-time signals from a separate thread, each carrying
+// its sequence number, and prints how many were received per second and per wake up.
+//
+// Usage: signal_device [<number of signals>]
+
+#include "sys.h"
+#include "debug.h"
+#include "SignalDevice.h"
+#include "evio/EventLoop.h"
+#include "utils/AIAlert.h"
+#include "utils/Signals.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t number_of_signals = 100000;
+  if (argc > 1)
+    number_of_signals = std::strtoul(argv[1], nullptr, 10);
+  if (number_of_signals == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<number of signals>]" << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    int const signum = utils::Signal::next_rt_signum();
+    size_t received = 0;
+    size_t out_of_order = 0;
+    std::chrono::steady_clock::time_point end_time;
+
+    // This must be done before the thread pool and the event loop thread are created.
+    auto signal_device = evio::create<SignalDevice>();
+    signal_device->add_signal(signum,
+        [&](int& allow_deletion_count, signalfd_siginfo const& info)
+        {
+          if (static_cast<size_t>(info.ssi_int) != received)
+            ++out_of_order;
+          if (++received == number_of_signals)
+          {
+            end_time = std::chrono::steady_clock::now();
+            signal_device->close(allow_deletion_count);
+          }
+        });
+    signal_device->init();
+
+    AIThreadPool thread_pool;
+    AIQueueHandle handler = thread_pool.new_queue(32);
+
+    std::chrono::steady_clock::time_point start_time;
+    {
+      evio::EventLoop event_loop(handler);
+
+      signal_device->start();
+
+      start_time = std::chrono::steady_clock::now();
+      std::thread sender([=]()
+          {
+            Debug(NAMESPACE_DEBUG::init_thread());
+            pid_t const pid = getpid();
+            for (size_t n = 0; n < number_of_signals; ++n)
+            {
+              union sigval value;
+              value.sival_int = n;
+              // Retry while the queue of pending signals is full (see RLIMIT_SIGPENDING).
+              while (sigqueue(pid, signum, value) == -1 && errno == EAGAIN)
+                std::this_thread::yield();
+            }
+          });
+      sender.join();
+
+      event_loop.join();
+    }
+
+    double const total_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    std::cout << received << " signals received in " << total_ms << " ms (" << (1000.0 * received / total_ms) << " signals/s); " <<
+      signal_device->wakeups() << " wake ups (" << (static_cast<double>(signal_device->records()) / signal_device->wakeups()) <<
+      " signals per wake up); " << out_of_order << " out of order." << std::endl;
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+}
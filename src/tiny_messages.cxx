@@ -0,0 +1,198 @@
+// Ping-pong benchmark for tiny (sub-100 byte) request/response traffic.
+//
+// A client socket sends a message of message_size bytes (including the terminating newline)
+// to an accepted socket that echos it back; as soon as the echo is decoded the next message
+// is sent. Every round trip therefore passes twice through the complete chain
+//
+//   EventLoopThread (readiness event) --> AIThreadPool --> read_from_fd --> end_of_msg_finder --> decode
+//
+// while the work done in decode() itself is negligible. The time spent inside decode() is
+// measured separately, so that the output shows how much of a round trip is hand-off overhead.
+//
+// Usage: tiny_messages [<round trips> [<message size>]]
+
+#include "sys.h"
+#include "debug.h"
+#include "evio/EventLoop.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include "utils/AIAlert.h"
+#include "utils/debug_ostream_operators.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#ifdef CWDEBUG
+#include <libcwd/buf2str.h>
+#endif
+
+using evio::protocol::Decoder;
+using evio::MsgBlock;
+using evio::OutputStream;
+using evio::SocketAddress;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+size_t round_trips = 100000;
+size_t message_size = 64;                               // Including the newline.
+std::atomic<clock_type::rep> time_in_decode{0};          // Sum of the time spent in both decode() functions.
+clock_type::time_point start_time;                      // Time at which the first message was written.
+clock_type::time_point end_time;                        // Time at which the last echo was decoded.
+
+// Measure the time spent in the scope of this object and add it to time_in_decode.
+class DecodeTimer
+{
+ private:
+  clock_type::time_point m_start;
+
+ public:
+  DecodeTimer() : m_start(clock_type::now()) { }
+  ~DecodeTimer() { time_in_decode.fetch_add((clock_type::now() - m_start).count(), std::memory_order_relaxed); }
+};
+
+} // namespace
+
+// Decoder of the accepted socket: echo every message back.
+class EchoDecoder : public Decoder
+{
+ protected:
+  void decode(int& allow_deletion_count, MsgBlock&& msg) override;
+};
+
+class EchoSocket : public evio::AcceptedSocket<EchoDecoder, OutputStream>
+{
+ public:
+  void read_returned_zero(int& allow_deletion_count) override
+  {
+    // The client closed the connection; close our output too once everything was written.
+    flush_output_device();
+    evio::InputDevice::read_returned_zero(allow_deletion_count);
+  }
+};
+
+class EchoListenSocket : public evio::ListenSocket<EchoSocket>
+{
+ public:
+  // This benchmark uses a single connection.
+  void new_connection(accepted_socket_type& UNUSED_ARG(accepted_socket)) override { close(); }
+};
+
+// Decoder of the client socket: send the next message as soon as the echo was received.
+class PongDecoder : public Decoder
+{
+ private:
+  size_t m_received;
+
+ public:
+  PongDecoder() : m_received(0) { }
+
+ protected:
+  void decode(int& allow_deletion_count, MsgBlock&& msg) override;
+};
+
+class PingSocket : public evio::Socket
+{
+ private:
+  PongDecoder m_decoder;
+  OutputStream m_output;
+  std::string m_message;
+
+ public:
+  PingSocket() : m_message(message_size - 1, 'x')
+  {
+    m_message += '\n';
+    set_protocol_decoder(m_decoder);
+    set_source(m_output);
+  }
+
+  void ping()
+  {
+    m_output.write(m_message.data(), m_message.size());
+    m_output << std::flush;
+  }
+
+  void start()
+  {
+    start_time = clock_type::now();
+    ping();
+  }
+
+  void finished(int& allow_deletion_count)
+  {
+    end_time = clock_type::now();
+    close_input_device(allow_deletion_count);
+    flush_output_device();
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  if (argc > 1)
+    round_trips = std::strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    message_size = std::strtoul(argv[2], nullptr, 10);
+  if (round_trips == 0 || message_size == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<round trips> [<message size>]]" << std::endl;
+    return 1;
+  }
+
+  AIThreadPool thread_pool;
+  AIQueueHandle low_priority_handler = thread_pool.new_queue(16);
+
+  static SocketAddress const listen_address("127.0.0.1:9003");
+
+  try
+  {
+    {
+      evio::EventLoop event_loop(low_priority_handler);
+
+      auto listen_socket = evio::create<EchoListenSocket>();
+      listen_socket->listen(listen_address);
+
+      // Dumb way to wait until the listen socket is up.
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+      {
+        auto ping_socket = evio::create<PingSocket>();
+        ping_socket->connect(listen_address);
+        ping_socket->start();
+      }
+
+      event_loop.join();
+    }
+
+    using namespace std::chrono;
+    double const total_us = duration_cast<duration<double, std::micro>>(end_time - start_time).count();
+    double const decode_us = duration_cast<duration<double, std::micro>>(clock_type::duration{time_in_decode.load()}).count();
+    std::cout << round_trips << " round trips of " << message_size << " bytes in " << (total_us / 1000) << " ms.\n";
+    std::cout << "  " << (total_us / round_trips) << " us per round trip, of which " << (decode_us / round_trips) <<
+      " us was spent in decode() (" << (100.0 * decode_us / total_us) << "%)." << std::endl;
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+}
+
+void EchoDecoder::decode(int& CWDEBUG_ONLY(allow_deletion_count), MsgBlock&& msg)
+{
+  DecodeTimer timer;
+  DoutEntering(dc::notice, "EchoDecoder::decode({" << allow_deletion_count << "}, \"" << buf2str(msg.get_start(), msg.get_size()) << "\") [" << this << ']');
+  EchoSocket* echo_socket = static_cast<EchoSocket*>(m_input_device);
+  (*echo_socket)().write(msg.get_start(), msg.get_size());
+  (*echo_socket)() << std::flush;
+}
+
+void PongDecoder::decode(int& allow_deletion_count, MsgBlock&& CWDEBUG_ONLY(msg))
+{
+  DecodeTimer timer;
+  DoutEntering(dc::notice, "PongDecoder::decode({" << allow_deletion_count << "}, \"" << buf2str(msg.get_start(), msg.get_size()) << "\") [" << this << ']');
+  PingSocket* ping_socket = static_cast<PingSocket*>(m_input_device);
+  if (++m_received == round_trips)
+    ping_socket->finished(allow_deletion_count);
+  else
+    ping_socket->ping();
+}
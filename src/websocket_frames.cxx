@@ -0,0 +1,94 @@
+// Throughput of websocket::FrameWriter and websocket::Decoder.
+//
+// Encodes masked frames (as a client sends them) of 64 bytes and of 64 kB into memory,
+// and then replays them from memory through the end_of_msg_finder and decode of a
+// server side websocket::Decoder, the way an InputDevice would after reading 64 kB at a
+// time. Unfragmented frames are unmasked in place, so the only pass over the payload is
+// the XOR. For reference, also prints the speed of unmasking one byte at a time.
+//
+// Usage: websocket_frames [<megabytes per frame size>]
+
+#include "sys.h"
+#include "debug.h"
+#include "WebSocket.h"
+#include "DecoderReplay.h"
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace {
+
+size_t received_bytes;
+
+} // namespace
+
+class MyWebSocketDecoder : public websocket::Decoder
+{
+ protected:
+  void on_message(int& UNUSED_ARG(allow_deletion_count), websocket::opcode_type UNUSED_ARG(opcode), char const* data, size_t len) override
+  {
+    // Touch the data, so that unmasking can't be optimized away.
+    received_bytes += len + (data[len - 1] == 'x');
+  }
+};
+
+void run(size_t frame_size, size_t megabytes)
+{
+  size_t const frames = megabytes * 1000000 / frame_size;
+  std::string const payload(frame_size, 'x');
+
+  // Encode.
+  std::ostringstream oss;
+  websocket::FrameWriter writer(websocket::client);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t n = 0; n < frames; ++n)
+    writer.write(oss, websocket::op_binary, payload.data(), payload.size());
+  double const encode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::string stream = oss.str();
+
+  // Decode.
+  MyWebSocketDecoder decoder;
+  received_bytes = 0;
+  start = std::chrono::steady_clock::now();
+  replay(decoder, stream, 65536);
+  double const decode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double const mb = frames * frame_size / 1e6;
+  std::cout << frame_size << " byte frames: encoded " << (frames / encode_s / 1e6) << " million frames/s (" << (mb / encode_s) << " MB/s); decoded " <<
+    (frames / decode_s / 1e6) << " million frames/s (" << (mb / decode_s) << " MB/s); received " << (received_bytes - frames) / 1000000 << " MB." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t const megabytes = argc > 1 ? std::atol(argv[1]) : 1000;
+  if (megabytes == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<megabytes per frame size>]" << std::endl;
+    return 1;
+  }
+
+  run(64, megabytes / 10);
+  run(65536, megabytes);
+
+  // For reference: unmasking one byte at a time, versus simd::unmask.
+  char const key[4] = { 1, 2, 3, 4 };
+  std::string buf(65536, 'x');
+  size_t const rounds = megabytes * 1000000 / buf.size();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t n = 0; n < rounds; ++n)
+  {
+    char* volatile p = buf.data();    // Prevent the loop from being vectorized across rounds.
+    for (size_t i = 0; i < buf.size(); ++i)
+      p[i] ^= key[i & 3];
+  }
+  double const bytewise_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  for (size_t n = 0; n < rounds; ++n)
+    websocket::simd::unmask(buf.data(), buf.data(), buf.size(), key);
+  double const simd_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Unmasking: " << (rounds * buf.size() / bytewise_s / 1e6) << " MB/s one byte at a time, " <<
+    (rounds * buf.size() / simd_s / 1e6) << " MB/s with simd::unmask." << std::endl;
+}
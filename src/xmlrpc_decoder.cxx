@@ -0,0 +1,125 @@
+// Decoding speed of xmlrpc::Decoder on a large response.
+//
+// Generates a <methodResponse> of (by default) 100 MB that contains an array of records
+// with all scalar types, and replays it from memory through end_of_msg_finder and decode,
+// the way an InputDevice would after reading 64 kB at a time. It is decoded once into
+// structs that map every member, and once into structs that only map the id (the rest
+// is parsed but ignored). The memory that the parser needs does not depend on the size
+// of the response; only the decoded result grows.
+//
+// Usage: xmlrpc_decoder [<megabytes>]
+
+#include "sys.h"
+#include "debug.h"
+#include "XMLRPCDecoder.h"
+#include "DecoderReplay.h"
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace {
+
+struct Record
+{
+  int32_t m_id = 0;
+  std::string m_name;
+  double m_price = 0;
+  bool m_available = false;
+  xmlrpc::Timestamp m_modified{};
+  xmlrpc::Binary m_thumbnail;
+  std::vector<std::string> m_tags;
+};
+
+struct RecordId
+{
+  int32_t m_id = 0;
+};
+
+} // namespace
+
+template<>
+struct xmlrpc::Members<Record>
+{
+  static constexpr auto value = std::make_tuple(
+      xmlrpc::member("id", &Record::m_id),
+      xmlrpc::member("name", &Record::m_name),
+      xmlrpc::member("price", &Record::m_price),
+      xmlrpc::member("available", &Record::m_available),
+      xmlrpc::member("modified", &Record::m_modified),
+      xmlrpc::member("thumbnail", &Record::m_thumbnail),
+      xmlrpc::member("tags", &Record::m_tags));
+};
+
+template<>
+struct xmlrpc::Members<RecordId>
+{
+  static constexpr auto value = std::make_tuple(xmlrpc::member("id", &RecordId::m_id));
+};
+
+namespace {
+
+size_t received_records;
+
+template<typename T>
+class MyDecoder : public xmlrpc::Decoder<std::vector<T>>
+{
+ protected:
+  void on_response(int& UNUSED_ARG(allow_deletion_count), std::vector<T>& result) override { received_records += result.size(); }
+  void on_fault(int& UNUSED_ARG(allow_deletion_count), xmlrpc::Fault const& UNUSED_ARG(fault)) override { }
+};
+
+} // namespace
+
+void run(char const* name, evio::protocol::Decoder& decoder, std::string const& stream, size_t records)
+{
+  received_records = 0;
+  auto const start = std::chrono::steady_clock::now();
+  replay(decoder, stream, 65536);
+  double const total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  ASSERT(received_records == records);
+  std::cout << "  " << name << ": " << (stream.size() / total_s / 1e6) << " MB/s (" << (records / total_s / 1e6) << " million records/s)." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  size_t const megabytes = argc > 1 ? std::atol(argv[1]) : 100;
+  if (megabytes == 0)
+  {
+    std::cerr << "Usage: " << argv[0] << " [<megabytes>]" << std::endl;
+    return 1;
+  }
+
+  std::ostringstream response;
+  response << "<?xml version=\"1.0\"?>\r\n<methodResponse><params><param><value><array><data>\r\n";
+  size_t records = 0;
+  while (static_cast<size_t>(response.tellp()) < megabytes * 1000000)
+  {
+    response <<
+      "<value><struct>\r\n"
+      "  <member><name>id</name><value><int>" << records << "</int></value></member>\r\n"
+      "  <member><name>name</name><value><string>Record " << records << " &amp; friends</string></value></member>\r\n"
+      "  <member><name>price</name><value><double>" << (records % 10000) * 0.25 << "</double></value></member>\r\n"
+      "  <member><name>available</name><value><boolean>" << (records % 2) << "</boolean></value></member>\r\n"
+      "  <member><name>modified</name><value><dateTime.iso8601>2021-01-29T15:37:23Z</dateTime.iso8601></value></member>\r\n"
+      "  <member><name>thumbnail</name><value><base64>iVBORw0KGgoAAAANSUhEUgAAABAAAAAQCAYAAAAf8/9hAAAAGklEQVR42mNgGAWjYBSMglEwCkbBKBgFo2AUAA==</base64></value></member>\r\n"
+      "  <member><name>tags</name><value><array><data><value>red</value><value>green</value><value>blue</value></data></array></value></member>\r\n"
+      "</struct></value>\r\n";
+    ++records;
+  }
+  response << "</data></array></value></param></params></methodResponse>\r\n";
+  std::string const stream = response.str();
+
+  std::cout << "Decoding a response of " << stream.size() << " bytes with " << records << " records; sizeof(xmlrpc::Parser) = " <<
+    sizeof(xmlrpc::Parser) << " bytes:" << std::endl;
+  {
+    MyDecoder<Record> decoder;
+    run("all members", decoder, stream, records);
+  }
+  {
+    MyDecoder<RecordId> decoder;
+    run("only id", decoder, stream, records);
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "evio/protocol/Decoder.h"
+#include <string>
+
+// Feeds a decoder data the way an InputDevice does: end_of_msg_finder only sees the new
+// data, while decode gets the whole message.
+template<class DecoderBase>
+class DecoderFeeder : public DecoderBase
+{
+ private:
+  std::string m_buffer;         // Unprocessed data; begins with the start of the current message.
+  size_t m_scanned = 0;         // The number of bytes of m_buffer that were already passed to end_of_msg_finder.
+
+ public:
+  using DecoderBase::DecoderBase;
+
+  // Feed data as the result of a single read.
+  void feed(std::string const& data)
+  {
+    m_buffer += data;
+    int allow_deletion_count = 0;
+    evio::EndOfMsgFinderResult result;
+    size_t len;
+    while (m_scanned < m_buffer.size() && (len = this->end_of_msg_finder(m_buffer.data() + m_scanned, m_buffer.size() - m_scanned, result)) > 0)
+    {
+      this->decode(allow_deletion_count, evio::MsgBlock(m_buffer.data(), m_scanned + len, nullptr));
+      m_buffer.erase(0, m_scanned + len);
+      m_scanned = 0;
+    }
+    m_scanned = m_buffer.size();
+  }
+
+  // Feed data in reads of chunk_size bytes.
+  void feed(std::string const& data, size_t chunk_size)
+  {
+    for (size_t pos = 0; pos < data.size(); pos += chunk_size)
+      feed(data.substr(pos, chunk_size));
+  }
+};
@@ -0,0 +1,221 @@
+#include "debug.h"
+#include <thread>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/bind/bind.hpp>
+
+namespace test_dns_server {
+
+using boost::asio::ip::udp;
+
+// Building DNS messages.
+
+std::string u16(uint16_t value) { return { static_cast<char>(value >> 8), static_cast<char>(value & 0xff) }; }
+std::string u32(uint32_t value) { return u16(value >> 16) + u16(value & 0xffff); }
+
+// The uncompressed wire format of name.
+std::string encode_name(std::string_view name)
+{
+  std::string result;
+  while (!name.empty())
+  {
+    size_t const dot = std::min(name.find('.'), name.size());
+    result += static_cast<char>(dot);
+    result += name.substr(0, dot);
+    name.remove_prefix(std::min(dot + 1, name.size()));
+  }
+  return result + '\0';
+}
+
+// A pointer to the name of the question, which always starts at offset 12.
+std::string const question_name("\xc0\x0c", 2);
+
+std::string rr(std::string const& owner, uint16_t type, uint32_t ttl, std::string const& rdata)
+{
+  return owner + u16(type) + u16(1) + u32(ttl) + u16(rdata.size()) + rdata;
+}
+
+std::string a_rdata(unsigned char a, unsigned char b, unsigned char c, unsigned char d)
+{
+  return { static_cast<char>(a), static_cast<char>(b), static_cast<char>(c), static_cast<char>(d) };
+}
+
+std::string soa_rdata(uint32_t minimum)
+{
+  return encode_name("ns.example.com") + encode_name("hostmaster.example.com") + u32(1) + u32(3600) + u32(600) + u32(86400) + u32(minimum);
+}
+
+// A response to the query with the given id and question (in wire format).
+std::string response(uint16_t id, std::string const& question, int rcode, std::vector<std::string> const& answers, std::vector<std::string> const& authority = {})
+{
+  std::string result = u16(id) + u16(0x8180 | rcode) + u16(1) + u16(answers.size()) + u16(authority.size()) + u16(0) + question;
+  for (auto const& record : answers)
+    result += record;
+  for (auto const& record : authority)
+    result += record;
+  return result;
+}
+
+// A UDP server on localhost:9053 for the zone example.com and the reverse name of 192.0.2.1:
+//
+//   www.example.com            A 192.0.2.1, A 192.0.2.2 (TTL 300); the question is answered with compression pointers.
+//   alias.example.com          CNAME www.example.com, followed by the records of www.example.com.
+//   short.example.com          A 192.0.2.3 with a TTL of one second.
+//   1.2.0.192.in-addr.arpa     PTR www.example.com.
+//   slow.example.com           A 192.0.2.4, but only the second query is answered.
+//   spoofed.example.com        A 192.0.2.5, preceded by a response with the wrong id.
+//   silent.example.com         is never answered.
+//
+// All other names of example.com return NXDOMAIN with an SOA record whose minimum is 60.
+// Any other query is REFUSED.
+class udp_server
+{
+ public:
+  udp_server(boost::asio::io_context& io_context) : m_socket(io_context, udp::endpoint(boost::asio::ip::address_v4::loopback(), 9053)) { }
+
+  void start()
+  {
+    Dout(dc::notice, "Listening on UDP port 9053...");
+    start_receive();
+  }
+
+  void stop()
+  {
+    m_socket.close();
+  }
+
+  // The number of queries that were received for name.
+  int queries(std::string const& name)
+  {
+    std::lock_guard<std::mutex> lock(m_queries_mutex);
+    return m_queries[name];
+  }
+
+ private:
+  void start_receive()
+  {
+    m_socket.async_receive_from(boost::asio::buffer(m_buffer), m_remote_endpoint,
+        boost::bind(&udp_server::handle_receive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+  }
+
+  void handle_receive(boost::system::error_code const& error, std::size_t len)
+  {
+    if (error == boost::asio::error::operation_aborted)
+      return;
+    if (!error && len > 12)
+      handle_query(std::string(m_buffer.data(), len));
+    start_receive();
+  }
+
+  void handle_query(std::string const& query)
+  {
+    uint16_t const id = (static_cast<unsigned char>(query[0]) << 8) | static_cast<unsigned char>(query[1]);
+    std::string const question = query.substr(12);
+    std::string name;
+    for (size_t pos = 12; pos < query.size() && query[pos] != 0; pos += 1 + query[pos])
+    {
+      if (!name.empty())
+        name += '.';
+      name += query.substr(pos + 1, query[pos]);
+    }
+    int count;
+    {
+      std::lock_guard<std::mutex> lock(m_queries_mutex);
+      count = ++m_queries[name];
+    }
+    Dout(dc::notice, "Received query #" << count << " for \"" << name << "\".");
+
+    if (name == "www.example.com")
+      send(response(id, question, 0, {
+            rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 1)),
+            rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 2)) }));
+    else if (name == "alias.example.com")
+    {
+      // The A records are owned by the target of the CNAME, which is at offset 12 + question.size() + 12 (owner, type, class, ttl and rdlength).
+      std::string const target(std::string("\xc0", 1) + static_cast<char>(12 + question.size() + 12));
+      send(response(id, question, 0, {
+            rr(question_name, dns::t_cname, 600, encode_name("www.example.com")),
+            rr(target, dns::t_a, 300, a_rdata(192, 0, 2, 1)) }));
+    }
+    else if (name == "short.example.com")
+      send(response(id, question, 0, { rr(question_name, dns::t_a, 1, a_rdata(192, 0, 2, 3)) }));
+    else if (name == "1.2.0.192.in-addr.arpa")
+      send(response(id, question, 0, { rr(question_name, dns::t_ptr, 300, encode_name("www.example.com")) }));
+    else if (name == "slow.example.com")
+    {
+      if (count > 1)
+        send(response(id, question, 0, { rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 4)) }));
+    }
+    else if (name == "spoofed.example.com")
+    {
+      send(response(id ^ 1, question, 0, { rr(question_name, dns::t_a, 300, a_rdata(10, 0, 0, 1)) }));
+      send(response(id, question, 0, { rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 5)) }));
+    }
+    else if (name == "silent.example.com")
+      ;
+    else if (name.size() > 12 && name.compare(name.size() - 12, 12, ".example.com") == 0)
+      send(response(id, question, dns::name_error, {}, { rr(encode_name("example.com"), dns::t_soa, 3600, soa_rdata(60)) }));
+    else
+      send(response(id, question, dns::refused, {}));
+  }
+
+  void send(std::string const& msg)
+  {
+    // Responses are small; send them synchronously.
+    boost::system::error_code error;
+    m_socket.send_to(boost::asio::buffer(msg), m_remote_endpoint, 0, error);
+  }
+
+  udp::socket m_socket;
+  udp::endpoint m_remote_endpoint;
+  boost::array<char, 512> m_buffer;
+  std::mutex m_queries_mutex;
+  std::map<std::string, int> m_queries;
+};
+
+} // namespace test_dns_server
+
+// Run a stub DNS server on localhost:9053; see test_dns_server::udp_server.
+
+class DnsStubServerFixture : public testing::Test
+{
+ private:
+  std::thread m_thread;
+  boost::asio::io_context m_io_context;
+  test_dns_server::udp_server m_server;
+
+ protected:
+  DnsStubServerFixture() : m_server(m_io_context) { }
+
+  void SetUp()
+  {
+#ifdef CWDEBUG
+    Dout(dc::notice, "v DnsStubServerFixture::SetUp()");
+    debug::Mark setup;
+#endif
+    std::thread thr([this](){
+          Debug(debug::init_thread("DnsServer"));
+          m_io_context.restart();
+          m_server.start();
+          Dout(dc::notice|flush_cf, "Calling m_io_context.run()...");
+          m_io_context.run();
+          Dout(dc::notice|flush_cf, "Returned from m_io_context.run().");
+        });
+    m_thread = std::move(thr);
+  }
+
+  void TearDown()
+  {
+    Dout(dc::notice, "v DnsStubServerFixture::TearDown()");
+    m_io_context.stop();
+    m_server.stop();
+    m_thread.join();
+  }
+
+  int server_queries(std::string const& name) { return m_server.queries(name); }
+};
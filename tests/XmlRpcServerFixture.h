@@ -0,0 +1,285 @@
+#include "debug.h"
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/bind/bind.hpp>
+
+namespace test_xmlrpc_server {
+
+using boost::asio::ip::tcp;
+
+// The text between <tag> and </tag>, starting the search at pos (which is advanced past the end tag).
+// Returns false if there is no such element.
+bool next_element(std::string const& body, std::string const& tag, size_t& pos, std::string& text)
+{
+  std::string const open = "<" + tag + ">";
+  std::string const close = "</" + tag + ">";
+  size_t const begin = body.find(open, pos);
+  if (begin == std::string::npos)
+    return false;
+  size_t const end = body.find(close, begin + open.size());
+  if (end == std::string::npos)
+    return false;
+  text = body.substr(begin + open.size(), end - begin - open.size());
+  pos = end + close.size();
+  return true;
+}
+
+// Handles the calls that the tests make:
+//
+//   sum(int...)        returns the sum of all <int> and <i8> values.
+//   echo(string)       returns the (still escaped) string.
+//   fail()             returns a fault with code 4.
+//   close()            closes the connection without a response.
+//   last(string)       like echo, but the response has no Content-Length; the server
+//                      shuts down its side of the connection after it and ignores
+//                      all further requests.
+//
+// Anything else returns a fault with code 1.
+class tcp_connection : public boost::enable_shared_from_this<tcp_connection>
+{
+ public:
+  typedef boost::shared_ptr<tcp_connection> pointer;
+
+  static pointer create(boost::asio::io_context& io_context, int instance)
+  {
+    return pointer(new tcp_connection(io_context, instance));
+  }
+
+  tcp::socket& socket()
+  {
+    return m_socket;
+  }
+
+  void start()
+  {
+    Dout(dc::notice, "#" << m_instance << ": Accepted a new client.");
+    start_read();
+  }
+
+ private:
+  tcp_connection(boost::asio::io_context& io_context, int instance) : m_instance(instance), m_socket(io_context), m_ignore_input(false) { }
+
+  void start_read()
+  {
+    m_socket.async_read_some(boost::asio::buffer(m_buffer),
+        boost::bind(&tcp_connection::handle_read, shared_from_this(),
+          boost::asio::placeholders::error,
+          boost::asio::placeholders::bytes_transferred));
+  }
+
+  void handle_read(boost::system::error_code const& e, std::size_t bytes_transferred)
+  {
+    if (e)
+    {
+      if (e != boost::asio::error::operation_aborted)
+      {
+        Dout(dc::notice, "#" << m_instance << ": Error " << e << ". Closing connection.");
+        m_socket.close();
+      }
+      return;
+    }
+    if (m_ignore_input)
+    {
+      start_read();
+      return;
+    }
+    m_input.append(m_buffer.data(), bytes_transferred);
+    // Handle every complete request; requests may be pipelined.
+    for (;;)
+    {
+      size_t const end_of_head = m_input.find("\r\n\r\n");
+      if (end_of_head == std::string::npos)
+        break;
+      size_t const content_length_pos = m_input.find("Content-Length: ");
+      size_t const content_length = content_length_pos < end_of_head ? std::strtoul(m_input.data() + content_length_pos + 16, nullptr, 10) : 0;
+      size_t const request_size = end_of_head + 4 + content_length;
+      if (m_input.size() < request_size)
+        break;
+      std::string const body = m_input.substr(end_of_head + 4, content_length);
+      m_input.erase(0, request_size);
+      if (!handle_call(body))
+      {
+        Dout(dc::notice, "#" << m_instance << ": Closing connection.");
+        m_socket.close();
+        return;
+      }
+      if (m_ignore_input)
+        break;
+    }
+    start_read();
+  }
+
+  // Returns false if the connection must be closed.
+  bool handle_call(std::string const& body)
+  {
+    size_t pos = 0;
+    std::string method;
+    next_element(body, "methodName", pos, method);
+    Dout(dc::notice, "#" << m_instance << ": Received call to \"" << method << "\".");
+    std::string value;
+    if (method == "sum")
+    {
+      long long sum = 0;
+      std::string text;
+      for (size_t p = pos; next_element(body, "int", p, text);)
+        sum += std::strtoll(text.c_str(), nullptr, 10);
+      for (size_t p = pos; next_element(body, "i8", p, text);)
+        sum += std::strtoll(text.c_str(), nullptr, 10);
+      value = "<value><i8>" + std::to_string(sum) + "</i8></value>";
+    }
+    else if (method == "echo")
+    {
+      std::string text;
+      next_element(body, "string", pos, text);
+      value = "<value><string>" + text + "</string></value>";
+    }
+    else if (method == "last")
+    {
+      std::string text;
+      next_element(body, "string", pos, text);
+      write_response("<params><param><value><string>" + text + "</string></value></param></params>", true);
+      // Keep reading, so that the client's further requests don't cause a reset.
+      m_ignore_input = true;
+      return true;
+    }
+    else if (method == "close")
+      return false;
+    else
+    {
+      int const code = method == "fail" ? 4 : 1;
+      write_response("<fault><value><struct>"
+          "<member><name>faultCode</name><value><int>" + std::to_string(code) + "</int></value></member>"
+          "<member><name>faultString</name><value><string>" + (code == 4 ? "Requested fault." : "Unknown method.") + "</string></value></member>"
+          "</struct></value></fault>");
+      return true;
+    }
+    write_response("<params><param>" + value + "</param></params>");
+    return true;
+  }
+
+  // Write a response; if until_close is set then without Content-Length, followed by shutting down the sending side.
+  void write_response(std::string const& content, bool until_close = false)
+  {
+    std::string const body = "<?xml version=\"1.0\"?>\r\n<methodResponse>" + content + "</methodResponse>\r\n";
+    auto response = std::make_shared<std::string>(
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/xml\r\n" +
+        (until_close ? std::string("Connection: close\r\n") : "Content-Length: " + std::to_string(body.size()) + "\r\n") +
+        "\r\n" + body);
+    // Keep the string alive until the write finished.
+    boost::asio::async_write(m_socket, boost::asio::buffer(*response),
+        [self = shared_from_this(), response, until_close](boost::system::error_code const& e, size_t CWDEBUG_ONLY(bytes_transferred)){
+          if (!e)
+            Dout(dc::notice, "#" << self->m_instance << ": Wrote " << bytes_transferred << " bytes.");
+          else
+            Dout(dc::notice, "#" << self->m_instance << ": Error " << e << " writing data.");
+          if (until_close)
+          {
+            Dout(dc::notice, "#" << self->m_instance << ": Shutting down the sending side.");
+            boost::system::error_code ignored;
+            self->m_socket.shutdown(tcp::socket::shutdown_send, ignored);
+          }
+        });
+  }
+
+ private:
+  int m_instance;
+  tcp::socket m_socket;
+  boost::array<char, 8192> m_buffer;
+  std::string m_input;                  // Received data that wasn't handled yet.
+  bool m_ignore_input;                  // Set after the call to last().
+};
+
+class tcp_server
+{
+ public:
+  tcp_server(boost::asio::io_context& io_context) : m_io_context(io_context), m_acceptor(io_context, tcp::endpoint(tcp::v4(), 9003)), m_count(0)
+  {
+    m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  }
+
+  void start()
+  {
+    Dout(dc::notice, "Listening on port 9003...");
+    start_accept();
+  }
+
+  void stop()
+  {
+    m_acceptor.close();
+  }
+
+  // The number of accepted connections.
+  int connections() const { return m_count; }
+
+ private:
+  void start_accept()
+  {
+    tcp_connection::pointer new_connection = tcp_connection::create(m_io_context, m_count + 1);
+    m_acceptor.async_accept(new_connection->socket(), boost::bind(&tcp_server::handle_accept, this, new_connection, boost::asio::placeholders::error));
+  }
+
+  void handle_accept(tcp_connection::pointer new_connection, boost::system::error_code const& error)
+  {
+    if (!error)
+    {
+      ++m_count;
+      new_connection->start();
+    }
+    if (error != boost::asio::error::operation_aborted)
+      start_accept();
+  }
+
+  boost::asio::io_context& m_io_context;
+  tcp::acceptor m_acceptor;
+  std::atomic<int> m_count;
+};
+
+} // namespace test_xmlrpc_server
+
+// Create an XML-RPC server that listens on localhost:9003 and answers the calls
+// of test_xmlrpc_server::tcp_connection, in order, on keep-alive connections.
+
+class XmlRpcServerFixture : public testing::Test
+{
+ private:
+  std::thread m_thread;
+  boost::asio::io_context m_io_context;
+  test_xmlrpc_server::tcp_server m_server;
+
+ protected:
+  XmlRpcServerFixture() : m_server(m_io_context) { }
+
+  void SetUp()
+  {
+#ifdef CWDEBUG
+    Dout(dc::notice, "v XmlRpcServerFixture::SetUp()");
+    debug::Mark setup;
+#endif
+    std::thread thr([this](){
+          Debug(debug::init_thread("XmlRpcServer"));
+          m_io_context.restart();
+          m_server.start();
+          Dout(dc::notice|flush_cf, "Calling m_io_context.run()...");
+          m_io_context.run();
+          Dout(dc::notice|flush_cf, "Returned from m_io_context.run().");
+        });
+    m_thread = std::move(thr);
+  }
+
+  void TearDown()
+  {
+    Dout(dc::notice, "v XmlRpcServerFixture::TearDown()");
+    m_io_context.stop();
+    m_server.stop();
+    m_thread.join();
+  }
+
+  int server_connections() const { return m_server.connections(); }
+};
@@ -16,6 +16,23 @@
 #include "test_OutputStream.h"
 #include "test_StreamBuf.h"
 #include "test_Socket.h"
+#include "test_FilterStages.h"
+#include "test_HTTPDecoder.h"
+#include "test_WebSocket.h"
+#include "test_FramingDecoder.h"
+#include "test_Base64.h"
+#include "test_ISO8601.h"
+#include "test_XMLRPCDecoder.h"
+#include "test_XMLRPCClient.h"
+#include "test_DNSResolver.h"
+#include "test_LPMTrie.h"
+#include "test_SignalDevice.h"
+#include "test_FdPassing.h"
+#include "test_SendFileSocket.h"
+#include "test_InotifyDevice.h"
+#include "test_MappedInputFile.h"
+#include "test_GroupCommitLog.h"
+#include "test_ShmRing.h"
 #include "switch_protocol_decoder.h"
 
 using namespace boost::program_options;
@@ -0,0 +1,99 @@
+#include "src/Base64.h"
+#include <random>
+#include <string>
+
+namespace test_base64 {
+
+base64::Kernel const kernels[] = { base64::Kernel::scalar, base64::Kernel::sse41, base64::Kernel::avx2 };
+
+bool supported(base64::Kernel kernel)
+{
+  return static_cast<int>(kernel) <= static_cast<int>(base64::best_kernel());
+}
+
+std::string encode(std::string const& data, base64::Kernel kernel)
+{
+  std::string result(base64::encoded_size(data.size()), '\0');
+  char* end = base64::encode(data.data(), data.size(), result.data(), kernel);
+  EXPECT_EQ(end, result.data() + result.size());
+  return result;
+}
+
+} // namespace test_base64
+
+TEST(Base64, KnownValues)
+{
+  using namespace test_base64;
+  std::pair<char const*, char const*> const values[] = {
+    { "", "" }, { "f", "Zg==" }, { "fo", "Zm8=" }, { "foo", "Zm9v" }, { "foob", "Zm9vYg==" }, { "fooba", "Zm9vYmE=" }, { "foobar", "Zm9vYmFy" },
+    { "Hello world", "SGVsbG8gd29ybGQ=" }
+  };
+  for (base64::Kernel kernel : kernels)
+  {
+    if (!supported(kernel))
+      continue;
+    for (auto const& value : values)
+    {
+      EXPECT_EQ(encode(value.first, kernel), value.second);
+      std::string decoded;
+      EXPECT_TRUE(base64::decode_into(decoded, value.second, kernel));
+      EXPECT_EQ(decoded, value.first);
+    }
+  }
+}
+
+TEST(Base64, Roundtrip)
+{
+  using namespace test_base64;
+  std::mt19937 rng(1);
+  for (size_t len = 0; len < 300; ++len)
+  {
+    std::string data(len, '\0');
+    for (char& c : data)
+      c = static_cast<char>(rng());
+    std::string const expected = encode(data, base64::Kernel::scalar);
+    for (base64::Kernel kernel : kernels)
+    {
+      if (!supported(kernel))
+        continue;
+      std::string const encoded = encode(data, kernel);
+      ASSERT_EQ(encoded, expected);
+
+      std::string decoded;
+      ASSERT_TRUE(base64::decode_into(decoded, encoded, kernel));
+      ASSERT_EQ(decoded, data);
+
+      // With MIME line breaks.
+      std::string lines;
+      for (size_t pos = 0; pos < encoded.size(); pos += 76)
+        lines += encoded.substr(pos, 76) + "\r\n";
+      ASSERT_TRUE(base64::decode_into(decoded, lines, kernel));
+      ASSERT_EQ(decoded, data);
+    }
+  }
+}
+
+TEST(Base64, Invalid)
+{
+  using namespace test_base64;
+  std::string const valid = encode(std::string(100, 'x'), base64::Kernel::scalar);
+  char const* const invalid[] = { "Z", "Zg=", "Zg=a", "Z===", "Zm9v!", "Zm9vYmFy=", "Zm9v====", "====" };
+  for (base64::Kernel kernel : kernels)
+  {
+    if (!supported(kernel))
+      continue;
+    std::string decoded;
+    for (char const* str : invalid)
+      EXPECT_FALSE(base64::decode_into(decoded, str, kernel)) << str;
+    // An invalid character inside a block that the vector kernels would handle.
+    for (size_t pos = 0; pos < valid.size(); pos += 7)
+    {
+      std::string str = valid;
+      str[pos] = '-';
+      EXPECT_FALSE(base64::decode_into(decoded, str, kernel));
+    }
+    // Missing padding is accepted.
+    EXPECT_TRUE(base64::decode_into(decoded, "Zm8", kernel));
+    EXPECT_EQ(decoded, "fo");
+  }
+}
@@ -0,0 +1,466 @@
+#include "src/DNSResolver.h"
+#include "DnsStubServerFixture.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace test_dns_resolver {
+
+std::string to_string(dns::Result const& result)
+{
+  std::string str = result.m_error == dns::no_error ? "" : dns::error_str(result.m_error);
+  for (auto const& value : result.m_values)
+    str += (str.empty() ? "" : " ") + value;
+  return str;
+}
+
+// The question of a query for name and type, in wire format.
+std::string question(std::string const& name, uint16_t type)
+{
+  using namespace test_dns_server;
+  return encode_name(name) + u16(type) + u16(1);
+}
+
+// The id of a query.
+uint16_t id(std::string const& packet)
+{
+  return (static_cast<unsigned char>(packet[0]) << 8) | static_cast<unsigned char>(packet[1]);
+}
+
+// Drives a QueryTable the way Resolver does, with a fake clock; records the results by name.
+class QueryTableDriver
+{
+ public:
+  using clock_type = dns::QueryTable::clock_type;
+
+  dns::QueryTable m_table;
+  clock_type::time_point const m_start;
+  std::vector<std::string> m_log;
+
+  QueryTableDriver() : m_table(std::chrono::milliseconds(200), 2, 16, 1), m_start(clock_type::now()) { }
+
+  clock_type::time_point at(int ms) const { return m_start + std::chrono::milliseconds(ms); }
+
+  dns::Callback record(std::string const& name)
+  {
+    return [this, name](dns::Result const& result){ m_log.push_back(name + ": " + to_string(result)); };
+  }
+
+  // Look up name at time ms; packet is set when a query has to be sent.
+  dns::QueryTable::lookup_type lookup(std::string const& name, uint16_t type, int ms, std::string& packet)
+  {
+    dns::Callback callback = record(name);
+    dns::Result result;
+    packet.clear();
+    auto const lookup_result = m_table.lookup({ dns::canonical_name(name), type }, callback, at(ms), result, packet);
+    if (lookup_result == dns::QueryTable::l_answered)
+      callback(result);
+    return lookup_result;
+  }
+
+  // Receive response at time ms; returns false if it was ignored.
+  bool receive(std::string const& response, int ms)
+  {
+    dns::Result result;
+    std::vector<dns::Callback> callbacks;
+    if (!m_table.response(response.data(), response.size(), at(ms), result, callbacks))
+      return false;
+    for (auto const& callback : callbacks)
+      callback(result);
+    return true;
+  }
+
+  // Run the timer at time ms; returns the packets that have to be sent again.
+  std::vector<std::string> tick(int ms)
+  {
+    std::vector<std::string> packets;
+    std::vector<dns::Callback> timed_out;
+    m_table.tick(at(ms), packets, timed_out);
+    dns::Result result;
+    result.m_error = dns::timed_out;
+    for (auto const& callback : timed_out)
+      callback(result);
+    return packets;
+  }
+};
+
+} // namespace test_dns_resolver
+
+TEST(DNSResolver, EncodeQuery)
+{
+  char buf[dns::max_query_size];
+  size_t len = dns::encode_query(0x1234, "www.Example.com.", dns::t_aaaa, buf);
+  EXPECT_EQ(std::string(buf, len), std::string("\x12\x34\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+        "\x03www\x07" "Example\x03" "com\x00" "\x00\x1c\x00\x01", 33));
+
+  EXPECT_EQ(dns::encode_query(1, "", dns::t_a, buf), 0);
+  EXPECT_EQ(dns::encode_query(1, ".", dns::t_a, buf), 0);
+  EXPECT_EQ(dns::encode_query(1, "a..b", dns::t_a, buf), 0);
+  EXPECT_EQ(dns::encode_query(1, ".a", dns::t_a, buf), 0);
+  EXPECT_EQ(dns::encode_query(1, std::string(63, 'a') + ".com", dns::t_a, buf), 85);
+  EXPECT_EQ(dns::encode_query(1, std::string(64, 'a') + ".com", dns::t_a, buf), 0);
+  std::string name;
+  for (int i = 0; i < 4; ++i)
+    name += std::string(i == 3 ? 61 : 63, 'a') + (i == 3 ? "" : ".");
+  EXPECT_EQ(name.size(), dns::max_name_size);
+  EXPECT_EQ(dns::encode_query(1, name, dns::t_a, buf), dns::max_query_size);
+  EXPECT_EQ(dns::encode_query(1, name + "a", dns::t_a, buf), 0);
+}
+
+TEST(DNSResolver, ParseResponse)
+{
+  using namespace test_dns_server;
+  using test_dns_resolver::question;
+  using test_dns_resolver::to_string;
+
+  std::string const q = question("www.example.com", dns::t_a);
+  std::string const answer = response(7, q, 0, {
+      rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 1)),
+      rr(question_name, dns::t_aaaa, 300, std::string(16, '\0')),       // Not the requested type.
+      rr(question_name, dns::t_a, 200, a_rdata(192, 0, 2, 2)) });
+  dns::Result result;
+  ASSERT_TRUE(dns::parse_response(answer.data(), answer.size(), 7, "www.example.com", dns::t_a, result));
+  EXPECT_EQ(to_string(result), "192.0.2.1 192.0.2.2");
+  EXPECT_EQ(result.m_ttl, 200);
+
+  // Not a response to this query.
+  EXPECT_FALSE(dns::parse_response(answer.data(), answer.size(), 8, "www.example.com", dns::t_a, result));
+  EXPECT_FALSE(dns::parse_response(answer.data(), answer.size(), 7, "www.example.org", dns::t_a, result));
+  EXPECT_FALSE(dns::parse_response(answer.data(), answer.size(), 7, "www.example.com", dns::t_aaaa, result));
+  EXPECT_FALSE(dns::parse_response(answer.data(), 11, 7, "www.example.com", dns::t_a, result));
+  std::string query = answer;
+  query[2] &= 0x7f;
+  EXPECT_FALSE(dns::parse_response(query.data(), query.size(), 7, "www.example.com", dns::t_a, result));
+
+  // A CNAME chain; the name in the question is compared case insensitively.
+  std::string const cname = response(7, question("Alias.Example.com", dns::t_a), 0, {
+      rr(question_name, dns::t_cname, 100, encode_name("alias2.example.com")),
+      rr(encode_name("alias2.example.com"), dns::t_cname, 600, encode_name("www.example.com")),
+      rr(encode_name("www.example.com"), dns::t_a, 300, a_rdata(192, 0, 2, 1)),
+      rr(encode_name("other.example.com"), dns::t_a, 300, a_rdata(192, 0, 2, 9)) });
+  ASSERT_TRUE(dns::parse_response(cname.data(), cname.size(), 7, "alias.example.com", dns::t_a, result));
+  EXPECT_EQ(to_string(result), "192.0.2.1");
+  EXPECT_EQ(result.m_ttl, 100);
+
+  // NXDOMAIN, and no data; both are cached for the minimum of the SOA TTL and MINIMUM.
+  std::string const soa = rr(encode_name("example.com"), dns::t_soa, 30, soa_rdata(60));
+  std::string const nxdomain = response(7, q, dns::name_error, {}, { soa });
+  ASSERT_TRUE(dns::parse_response(nxdomain.data(), nxdomain.size(), 7, "www.example.com", dns::t_a, result));
+  EXPECT_EQ(result.m_error, dns::name_error);
+  EXPECT_EQ(result.m_ttl, 30);
+  std::string const no_data = response(7, q, 0, {}, { soa });
+  ASSERT_TRUE(dns::parse_response(no_data.data(), no_data.size(), 7, "www.example.com", dns::t_a, result));
+  EXPECT_EQ(result.m_error, dns::no_data);
+  EXPECT_EQ(result.m_ttl, 30);
+  std::string const servfail = response(7, q, dns::server_failure, {});
+  ASSERT_TRUE(dns::parse_response(servfail.data(), servfail.size(), 7, "www.example.com", dns::t_a, result));
+  EXPECT_EQ(result.m_error, dns::server_failure);
+  EXPECT_EQ(result.m_ttl, 0);
+
+  // PTR.
+  std::string const ptr = response(7, question("1.2.0.192.in-addr.arpa", dns::t_ptr), 0, {
+      rr(question_name, dns::t_ptr, 300, encode_name("www.example.com")) });
+  ASSERT_TRUE(dns::parse_response(ptr.data(), ptr.size(), 7, "1.2.0.192.in-addr.arpa", dns::t_ptr, result));
+  EXPECT_EQ(to_string(result), "www.example.com");
+
+  // Malformed responses.
+  std::string const loop = response(7, q, 0, { rr(std::string("\xc0\x21", 2), dns::t_a, 300, a_rdata(192, 0, 2, 1)) });
+  ASSERT_EQ(loop.substr(0x21, 2), std::string("\xc0\x21", 2));         // Points to itself.
+  ASSERT_TRUE(dns::parse_response(loop.data(), loop.size(), 7, "www.example.com", dns::t_a, result));
+  EXPECT_EQ(result.m_error, dns::malformed_response);
+  for (size_t len = 12 + q.size(); len < answer.size(); ++len)
+  {
+    ASSERT_TRUE(dns::parse_response(answer.data(), len, 7, "www.example.com", dns::t_a, result));
+    EXPECT_EQ(result.m_error, dns::malformed_response) << "len = " << len;
+    EXPECT_TRUE(result.m_values.empty());
+  }
+  std::string const bad_a = response(7, q, 0, { rr(question_name, dns::t_a, 300, "\x01\x02\x03") });
+  ASSERT_TRUE(dns::parse_response(bad_a.data(), bad_a.size(), 7, "www.example.com", dns::t_a, result));
+  EXPECT_EQ(result.m_error, dns::malformed_response);
+
+  // A truncated response uses the records that fit.
+  std::string truncated = answer.substr(0, 12 + q.size() + 16);
+  truncated[2] |= 0x02;
+  ASSERT_TRUE(dns::parse_response(truncated.data(), truncated.size(), 7, "www.example.com", dns::t_a, result));
+  EXPECT_EQ(to_string(result), "192.0.2.1");
+}
+
+TEST(DNSResolver, Cache)
+{
+  using clock_type = dns::Cache::clock_type;
+  dns::Cache cache(2);
+  auto const now = clock_type::now();
+  dns::Result result;
+  result.m_values = { "192.0.2.1" };
+  result.m_ttl = 10;
+  cache.insert({ "a", dns::t_a }, result, now);
+  result.m_ttl = 0;
+  cache.insert({ "b", dns::t_a }, result, now);         // Not cached.
+  EXPECT_EQ(cache.size(), 1);
+
+  dns::Result found;
+  ASSERT_TRUE(cache.find({ "a", dns::t_a }, now + std::chrono::milliseconds(3500), found));
+  EXPECT_EQ(found.m_values, result.m_values);
+  EXPECT_EQ(found.m_ttl, 6);
+  EXPECT_FALSE(cache.find({ "a", dns::t_aaaa }, now, found));
+  EXPECT_FALSE(cache.find({ "a", dns::t_a }, now + std::chrono::seconds(10), found));
+  EXPECT_EQ(cache.size(), 0);
+
+  // When full, expired entries are removed first, then the entry that expires first.
+  result.m_ttl = 10;
+  cache.insert({ "a", dns::t_a }, result, now);
+  result.m_ttl = 5;
+  cache.insert({ "b", dns::t_a }, result, now);
+  result.m_ttl = 20;
+  cache.insert({ "c", dns::t_a }, result, now);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_FALSE(cache.find({ "b", dns::t_a }, now, found));
+  cache.insert({ "d", dns::t_a }, result, now + std::chrono::seconds(15));
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_TRUE(cache.find({ "c", dns::t_a }, now + std::chrono::seconds(15), found));
+  EXPECT_TRUE(cache.find({ "d", dns::t_a }, now + std::chrono::seconds(15), found));
+}
+
+TEST(DNSResolver, QueryTableCoalescingAndCache)
+{
+  using namespace test_dns_server;
+  using test_dns_resolver::question;
+  using test_dns_resolver::id;
+  using dns::QueryTable;
+
+  test_dns_resolver::QueryTableDriver driver;
+  std::string www_a, packet, www_aaaa;
+
+  // Identical lookups that are in flight at the same time share one query.
+  EXPECT_EQ(driver.lookup("www.example.com", dns::t_a, 0, www_a), QueryTable::l_send);
+  EXPECT_EQ(driver.lookup("WWW.example.com.", dns::t_a, 10, packet), QueryTable::l_coalesced);
+  EXPECT_TRUE(packet.empty());
+  EXPECT_EQ(driver.lookup("www.example.com", dns::t_aaaa, 10, www_aaaa), QueryTable::l_send);
+  EXPECT_NE(id(www_a), id(www_aaaa));
+  EXPECT_EQ(www_a.substr(2), std::string("\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00", 10) + question("www.example.com", dns::t_a));
+  EXPECT_EQ(driver.lookup("bad..name", dns::t_a, 10, packet), QueryTable::l_answered);
+  EXPECT_EQ(driver.m_table.in_flight(), 2);
+
+  // Responses with the wrong id or question are ignored.
+  std::string const q = question("www.example.com", dns::t_a);
+  std::string const answer = response(id(www_a), q, 0, { rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 1)) });
+  EXPECT_FALSE(driver.receive(response(id(www_a) ^ 1, q, 0, { rr(question_name, dns::t_a, 300, a_rdata(10, 0, 0, 1)) }), 20));
+  EXPECT_FALSE(driver.receive(response(id(www_a), question("www.example.org", dns::t_a), 0, { rr(question_name, dns::t_a, 300, a_rdata(10, 0, 0, 1)) }), 20));
+  EXPECT_TRUE(driver.receive(answer, 20));
+  EXPECT_FALSE(driver.receive(answer, 30));                             // A late duplicate.
+  EXPECT_EQ(driver.m_table.in_flight(), 1);
+  std::vector<std::string> const expected = {
+    "bad..name: Invalid name.",
+    "www.example.com: 192.0.2.1",
+    "WWW.example.com.: 192.0.2.1"
+  };
+  EXPECT_EQ(driver.m_log, expected);
+
+  // Cached answers are returned immediately, with the remaining TTL, until the TTL expired.
+  EXPECT_EQ(driver.lookup("www.example.com", dns::t_a, 100020, packet), QueryTable::l_answered);
+  EXPECT_EQ(driver.m_log.back(), "www.example.com: 192.0.2.1");
+  EXPECT_EQ(driver.lookup("www.example.com", dns::t_a, 300020, packet), QueryTable::l_send);
+  EXPECT_NE(id(packet), id(www_aaaa));
+
+  // Negative answers are cached for the TTL of the SOA record; a server failure is not cached.
+  std::string nothing;
+  EXPECT_EQ(driver.lookup("nothing.example.com", dns::t_a, 0, nothing), QueryTable::l_send);
+  EXPECT_TRUE(driver.receive(response(id(nothing), question("nothing.example.com", dns::t_a), dns::name_error, {},
+      { rr(encode_name("example.com"), dns::t_soa, 30, soa_rdata(60)) }), 10));
+  EXPECT_EQ(driver.lookup("nothing.example.com", dns::t_a, 29000, packet), QueryTable::l_answered);
+  EXPECT_EQ(driver.m_log.back(), "nothing.example.com: No such name.");
+  EXPECT_EQ(driver.lookup("nothing.example.com", dns::t_a, 30010, packet), QueryTable::l_send);
+  EXPECT_TRUE(driver.receive(response(id(packet), question("nothing.example.com", dns::t_a), dns::server_failure, {}), 30020));
+  EXPECT_EQ(driver.m_log.back(), "nothing.example.com: Server failure.");
+  EXPECT_EQ(driver.lookup("nothing.example.com", dns::t_a, 30030, packet), QueryTable::l_send);
+}
+
+TEST(DNSResolver, QueryTableRetryAndTimeout)
+{
+  using namespace test_dns_server;
+  using test_dns_resolver::question;
+  using test_dns_resolver::id;
+  using dns::QueryTable;
+
+  // A timeout of 200 ms and two attempts.
+  test_dns_resolver::QueryTableDriver driver;
+  std::string silent, slow;
+  EXPECT_EQ(driver.lookup("silent.example.com", dns::t_a, 0, silent), QueryTable::l_send);
+  EXPECT_EQ(driver.lookup("slow.example.com", dns::t_a, 100, slow), QueryTable::l_send);
+  EXPECT_TRUE(driver.tick(100).empty());
+
+  // Queries are sent again, unchanged, after the timeout.
+  std::vector<std::string> packets = driver.tick(200);
+  ASSERT_EQ(packets.size(), 1UL);
+  EXPECT_EQ(packets[0], silent);
+  packets = driver.tick(300);
+  ASSERT_EQ(packets.size(), 1UL);
+  EXPECT_EQ(packets[0], slow);
+  EXPECT_TRUE(driver.m_log.empty());
+
+  // The second attempt is answered.
+  EXPECT_TRUE(driver.receive(response(id(slow), question("slow.example.com", dns::t_a), 0, { rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 4)) }), 350));
+
+  // And the query that isn't answered fails after the second attempt timed out.
+  EXPECT_TRUE(driver.tick(399).empty());
+  EXPECT_EQ(driver.m_table.in_flight(), 1);
+  EXPECT_TRUE(driver.tick(400).empty());
+  EXPECT_EQ(driver.m_table.in_flight(), 0);
+  std::vector<std::string> const expected = {
+    "slow.example.com: 192.0.2.4",
+    "silent.example.com: Timed out."
+  };
+  EXPECT_EQ(driver.m_log, expected);
+
+  // clear() returns the callbacks of all queries in flight; late responses are ignored.
+  std::string packet;
+  EXPECT_EQ(driver.lookup("silent.example.com", dns::t_a, 500, packet), QueryTable::l_send);
+  EXPECT_EQ(driver.lookup("silent.example.com", dns::t_a, 500, silent), QueryTable::l_coalesced);
+  EXPECT_EQ(driver.m_table.clear().size(), 2UL);
+  EXPECT_EQ(driver.m_table.in_flight(), 0);
+  EXPECT_FALSE(driver.receive(response(id(packet), question("silent.example.com", dns::t_a), 0, { rr(question_name, dns::t_a, 300, a_rdata(192, 0, 2, 6)) }), 600));
+  EXPECT_TRUE(driver.tick(1000).empty());
+}
+
+#include "EventLoopFixture.h"
+
+class DNSResolverFixture : public EventLoopFixture<DnsStubServerFixture>
+{
+ protected:
+  boost::intrusive_ptr<dns::Resolver> m_resolver;
+  std::mutex m_results_mutex;
+  std::map<std::string, std::vector<std::string>> m_results;    // The results of each lookup, by name.
+  std::atomic<int> m_completed;
+
+  void SetUp() override
+  {
+    EventLoopFixture<DnsStubServerFixture>::SetUp();
+    m_completed = 0;
+    m_resolver = evio::create<dns::Resolver>(std::chrono::milliseconds(200), 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));        // Dumb way to wait until the server is up.
+    m_resolver->init(evio::SocketAddress("127.0.0.1", 9053));
+  }
+
+  void TearDown() override
+  {
+    m_resolver->close();
+    m_resolver.reset();
+    EventLoopFixture<DnsStubServerFixture>::TearDown();
+  }
+
+  dns::Callback record(std::string const& name)
+  {
+    return [this, name](dns::Result const& result){
+      {
+        std::lock_guard<std::mutex> lock(m_results_mutex);
+        m_results[name].push_back(test_dns_resolver::to_string(result));
+      }
+      ++m_completed;
+    };
+  }
+
+  void lookup(std::string const& name, uint16_t type = dns::t_a)
+  {
+    m_resolver->lookup(name, type, record(name));
+  }
+
+  // Wait until count lookups completed.
+  void wait_for(int count)
+  {
+    for (int i = 0; i < 300 && m_completed < count; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(m_completed, count);
+  }
+
+  std::vector<std::string> results(std::string const& name)
+  {
+    std::lock_guard<std::mutex> lock(m_results_mutex);
+    return m_results[name];
+  }
+};
+
+TEST_F(DNSResolverFixture, CoalescingAndCache)
+{
+  // Identical lookups that are in flight at the same time share one query.
+  lookup("www.example.com");
+  lookup("WWW.example.com.");
+  lookup("www.example.com");
+  lookup("alias.example.com");
+  lookup("nothing.example.com");
+  wait_for(5);
+  EXPECT_EQ(results("www.example.com"), std::vector<std::string>(2, "192.0.2.1 192.0.2.2"));
+  EXPECT_EQ(results("WWW.example.com."), std::vector<std::string>(1, "192.0.2.1 192.0.2.2"));
+  EXPECT_EQ(results("alias.example.com"), std::vector<std::string>(1, "192.0.2.1"));
+  EXPECT_EQ(results("nothing.example.com"), std::vector<std::string>(1, "No such name."));
+  EXPECT_EQ(server_queries("www.example.com"), 1);
+  EXPECT_EQ(m_resolver->in_flight(), 0);
+
+  // Cached answers, positive and negative, are returned immediately.
+  lookup("www.example.com");
+  lookup("nothing.example.com");
+  EXPECT_EQ(m_completed, 7);
+  EXPECT_EQ(server_queries("www.example.com"), 1);
+  EXPECT_EQ(server_queries("nothing.example.com"), 1);
+
+  // Until the TTL expired.
+  lookup("short.example.com");
+  wait_for(8);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  lookup("short.example.com");
+  wait_for(9);
+  EXPECT_EQ(results("short.example.com"), std::vector<std::string>(2, "192.0.2.3"));
+  EXPECT_EQ(server_queries("short.example.com"), 2);
+}
+
+TEST_F(DNSResolverFixture, PtrRetryAndTimeout)
+{
+  m_resolver->lookup_ptr(evio::SocketAddress("192.0.2.1", 0), record("192.0.2.1"));
+  lookup("slow.example.com");                   // Answered after the query was sent again.
+  lookup("spoofed.example.com");                // The response with the wrong id is ignored.
+  lookup("silent.example.com");                 // Fails after two attempts.
+  lookup("www.example.org");                    // Refused.
+  lookup("bad..name");
+  wait_for(6);
+  EXPECT_EQ(results("192.0.2.1"), std::vector<std::string>(1, "www.example.com"));
+  EXPECT_EQ(results("slow.example.com"), std::vector<std::string>(1, "192.0.2.4"));
+  EXPECT_EQ(results("spoofed.example.com"), std::vector<std::string>(1, "192.0.2.5"));
+  EXPECT_EQ(results("silent.example.com"), std::vector<std::string>(1, "Timed out."));
+  EXPECT_EQ(results("www.example.org"), std::vector<std::string>(1, "Refused."));
+  EXPECT_EQ(results("bad..name"), std::vector<std::string>(1, "Invalid name."));
+  EXPECT_EQ(server_queries("slow.example.com"), 2);
+  EXPECT_EQ(server_queries("silent.example.com"), 2);
+  EXPECT_EQ(m_resolver->in_flight(), 0);
+}
+
+namespace test_dns_resolver {
+
+// A Resolver that sets a flag when it is destroyed.
+class ObservedResolver : public dns::Resolver
+{
+ private:
+  std::atomic<bool>& m_destroyed;
+
+ public:
+  ObservedResolver(std::atomic<bool>& destroyed) : dns::Resolver(std::chrono::milliseconds(200), 2), m_destroyed(destroyed) { }
+  ~ObservedResolver() { m_destroyed = true; }
+};
+
+} // namespace test_dns_resolver
+
+TEST_F(DNSResolverFixture, ReleasedWhileTickPending)
+{
+  std::atomic<bool> destroyed(false);
+  auto resolver = evio::create<test_dns_resolver::ObservedResolver>(destroyed);
+  resolver->init(evio::SocketAddress("127.0.0.1", 9053));
+  resolver->lookup("silent.example.com", dns::t_a, record("silent.example.com"));
+  resolver->close();
+  wait_for(1);
+  EXPECT_EQ(results("silent.example.com"), std::vector<std::string>(1, "Timed out."));
+
+  // The timer is still running and now holds the last reference; its next tick destroys the resolver.
+  resolver.reset();
+  for (int i = 0; i < 100 && !destroyed; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_TRUE(destroyed);
+}
@@ -0,0 +1,84 @@
+#include "src/FdPassing.h"
+#include <atomic>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace test_fd_passing {
+
+// Records the received fds.
+class RecordingFdDecoder : public FdDecoder
+{
+ private:
+  size_t m_expected;
+
+ public:
+  std::mutex m_mutex;
+  std::vector<int> m_fds;
+  std::atomic<size_t> m_received;
+
+  RecordingFdDecoder(size_t expected) : m_expected(expected), m_received(0) { }
+
+ protected:
+  void fd_received(int& allow_deletion_count, int fd) override
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_fds.push_back(fd);
+    }
+    if (++m_received == m_expected)
+      close_input_device(allow_deletion_count);
+  }
+};
+
+} // namespace test_fd_passing
+
+#include "EventLoopFixture.h"
+
+using FdPassingTest = EventLoopFixture<testing::Test>;
+
+TEST_F(FdPassingTest, PipesArriveInOrder)
+{
+  using namespace test_fd_passing;
+
+  // More fds than fit in one message.
+  size_t constexpr number_of_pipes = 3 * max_fds_per_message + 5;
+
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv), 0);
+  RecordingFdDecoder decoder(number_of_pipes);
+  auto sender = evio::create<HandoffSender>();
+  sender->init(sv[0]);
+  auto receiver = evio::create<FdReceiver>();
+  receiver->init(sv[1]);
+  receiver->set_protocol_decoder(decoder);
+
+  // Pass the write ends of the pipes; the sender closes them once they are sent.
+  std::vector<int> read_ends;
+  for (size_t p = 0; p < number_of_pipes; ++p)
+  {
+    int pipefd[2];
+    ASSERT_EQ(pipe2(pipefd, O_CLOEXEC), 0);
+    read_ends.push_back(pipefd[0]);
+    sender->send_fd(pipefd[1]);
+  }
+
+  for (int i = 0; i < 500 && decoder.m_received < number_of_pipes; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(decoder.m_received, number_of_pipes);
+
+  // The n-th received fd is the write end of the n-th pipe.
+  std::lock_guard<std::mutex> lock(decoder.m_mutex);
+  for (size_t p = 0; p < number_of_pipes; ++p)
+  {
+    char const c = 'a' + p % 26;
+    EXPECT_EQ(::write(decoder.m_fds[p], &c, 1), 1);
+    ::close(decoder.m_fds[p]);
+    char r = 0;
+    EXPECT_EQ(::read(read_ends[p], &r, 1), 1);
+    EXPECT_EQ(r, c);
+    ::close(read_ends[p]);
+  }
+  sender->close_output_device();
+}
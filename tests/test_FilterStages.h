@@ -0,0 +1,109 @@
+#include "src/FilterSocket.h"
+#include <random>
+#include <string>
+
+namespace test_filter_stages {
+
+// Pass plain through stage in chunks of random size, into output chunks of random size.
+template<class Stage>
+std::string transform_all(Stage& stage, std::string const& plain, std::mt19937& rng, bool flush_at_end)
+{
+  std::string result;
+  char buf[1000];
+  char const* in = plain.data();
+  char const* const end = in + plain.size();
+  while ((in < end || stage.has_pending_output()) && !stage.error())
+  {
+    char const* const chunk_end = std::min(end, in + rng() % 5000 + 1);
+    char* out = buf;
+    stage.transform(in, chunk_end, out, buf + rng() % sizeof(buf) + 1, false);
+    result.append(buf, out - buf);
+  }
+  if (flush_at_end)
+  {
+    do
+    {
+      char* out = buf;
+      stage.transform(in, in, out, buf + sizeof(buf), true);
+      result.append(buf, out - buf);
+    }
+    while (stage.has_pending_output());
+  }
+  return result;
+}
+
+std::string make_plain()
+{
+  std::string plain;
+  for (int i = 0; i < 20000; ++i)
+    plain += "START" + std::to_string(i) + "0123456789012345678901234567890123456789END.\n";
+  return plain;
+}
+
+} // namespace test_filter_stages
+
+TEST(FilterStages, Frame)
+{
+  using namespace test_filter_stages;
+  std::mt19937 rng(1);
+  std::string const plain = make_plain();
+  filter::FrameEncoder encoder;
+  filter::FrameDecoder decoder;
+  std::string const wire = transform_all(encoder, plain, rng, true);
+  EXPECT_GT(wire.size(), plain.size());
+  EXPECT_EQ(transform_all(decoder, wire, rng, false), plain);
+}
+
+TEST(FilterStages, ChecksumMismatch)
+{
+  using namespace test_filter_stages;
+  std::mt19937 rng(2);
+  std::string const plain = make_plain();
+  filter::ChecksumEncoder encoder;
+  filter::ChecksumDecoder decoder;
+  std::string wire = transform_all(encoder, plain, rng, true);
+  // Corrupt one byte of the payload of the first block (after the four byte header).
+  wire[100] ^= 1;
+  // The payload of the corrupt block is passed on, but nothing after it.
+  std::string const result = transform_all(decoder, wire, rng, false);
+  ASSERT_NE(decoder.error(), nullptr);
+  EXPECT_STREQ(decoder.error(), "BlockDecoder: checksum mismatch");
+  EXPECT_LE(result.size(), 16384u);
+}
+
+TEST(FilterStages, CorruptZlib)
+{
+  using namespace test_filter_stages;
+  std::mt19937 rng(4);
+  std::string const plain = make_plain();
+  filter::ZlibCompressor encoder;
+  filter::ZlibDecompressor decoder;
+  std::string wire = transform_all(encoder, plain, rng, true);
+  // Corrupt the zlib header.
+  wire[0] ^= 0x55;
+  EXPECT_EQ(transform_all(decoder, wire, rng, false), "");
+  EXPECT_NE(decoder.error(), nullptr);
+
+  // A complete stream followed by more data.
+  filter::ZlibDecompressor decoder2;
+  uLongf compressed_len = compressBound(plain.size());
+  std::string compressed(compressed_len, '\0');
+  ASSERT_EQ(compress(reinterpret_cast<Bytef*>(compressed.data()), &compressed_len, reinterpret_cast<Bytef const*>(plain.data()), plain.size()), Z_OK);
+  compressed.resize(compressed_len);
+  EXPECT_EQ(transform_all(decoder2, compressed + "garbage", rng, false), plain);
+  ASSERT_NE(decoder2.error(), nullptr);
+  EXPECT_STREQ(decoder2.error(), "inflate: data after the end of the stream");
+}
+
+TEST(FilterStages, Chain)
+{
+  using namespace test_filter_stages;
+  std::mt19937 rng(3);
+  std::string const plain = make_plain();
+  // Pipeline contains its intermediate buffer, so allocate these on the heap.
+  auto encoder = std::make_unique<filter::Chain<filter::ChecksumEncoder, filter::ZlibCompressor, filter::FrameEncoder>>();
+  auto decoder = std::make_unique<filter::Chain<filter::FrameDecoder, filter::ZlibDecompressor, filter::ChecksumDecoder>>();
+  std::string const wire = transform_all(*encoder, plain, rng, true);
+  EXPECT_LT(wire.size(), plain.size());
+  EXPECT_EQ(transform_all(*decoder, wire, rng, false), plain);
+}
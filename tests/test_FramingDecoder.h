@@ -0,0 +1,113 @@
+#include "src/FramingDecoder.h"
+#include "DecoderFeeder.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace test_framing_decoder {
+
+// Records the frames and errors.
+template<class LengthPrefix>
+class RecordingDecoder : public DecoderFeeder<framing::Decoder<LengthPrefix>>
+{
+ public:
+  std::vector<std::string> m_frames;
+  std::vector<std::string> m_errors;
+
+ protected:
+  void decode_frame(int& UNUSED_ARG(allow_deletion_count), char const* payload, size_t len) override
+  {
+    m_frames.emplace_back(payload, len);
+  }
+
+  void on_error(int& UNUSED_ARG(allow_deletion_count), char const* what) override
+  {
+    m_errors.emplace_back(what);
+  }
+};
+
+template<class LengthPrefix>
+void test_roundtrip(std::vector<size_t> const& sizes)
+{
+  std::vector<std::string> frames;
+  std::ostringstream wire;
+  for (size_t size : sizes)
+  {
+    std::string frame;
+    for (size_t i = 0; i < size; ++i)
+      frame += static_cast<char>('a' + (i + size) % 26);
+    framing::write_frame<LengthPrefix>(wire, frame.data(), frame.size());
+    frames.push_back(frame);
+  }
+  for (size_t chunk_size : { 1, 2, 3, 5, 64, 4096, 1000000 })
+  {
+    RecordingDecoder<LengthPrefix> decoder;
+    decoder.feed(wire.str(), chunk_size);
+    EXPECT_EQ(decoder.m_frames, frames);
+    EXPECT_TRUE(decoder.m_errors.empty());
+    EXPECT_EQ(decoder.bytes_needed(), 1UL);
+  }
+}
+
+} // namespace test_framing_decoder
+
+TEST(FramingDecoder, Roundtrip)
+{
+  using namespace test_framing_decoder;
+  test_roundtrip<framing::Fixed<1>>({ 0, 1, 16, 255, 0, 100 });
+  std::vector<size_t> const sizes = { 0, 1, 127, 128, 300, 16383, 16384, 65535, 70000, 3 };
+  test_roundtrip<framing::Fixed<2>>({ 0, 1, 127, 128, 300, 16383, 16384, 65535, 3 });
+  test_roundtrip<framing::Fixed<4>>(sizes);
+  test_roundtrip<framing::Fixed<8>>(sizes);
+  test_roundtrip<framing::Varint>(sizes);
+}
+
+TEST(FramingDecoder, Varint)
+{
+  char buf[framing::Varint::max_header_size];
+  EXPECT_EQ(framing::Varint::encode(0, buf), 1UL);
+  EXPECT_EQ(framing::Varint::encode(127, buf), 1UL);
+  EXPECT_EQ(framing::Varint::encode(128, buf), 2UL);
+  EXPECT_EQ(buf[0], '\x80');
+  EXPECT_EQ(buf[1], '\x01');
+  EXPECT_EQ(framing::Varint::encode(UINT64_MAX, buf), 10UL);
+
+  framing::Varint varint;
+  for (size_t i = 0; i < 10; ++i)
+    EXPECT_EQ(varint.feed(buf[i]), i == 9);
+  EXPECT_FALSE(varint.error());
+  EXPECT_EQ(varint.length(), UINT64_MAX);
+}
+
+TEST(FramingDecoder, Errors)
+{
+  using namespace test_framing_decoder;
+  {
+    // A varint whose tenth byte has more than the one bit that is left of 64 bits.
+    RecordingDecoder<framing::Varint> decoder;
+    decoder.feed(std::string(10, '\xff') + "\x01" "abc", 1);
+    EXPECT_TRUE(decoder.m_frames.empty());
+    ASSERT_EQ(decoder.m_errors.size(), 1UL);
+  }
+  {
+    // A frame larger than max_frame_size; the rest of the stream is ignored.
+    RecordingDecoder<framing::Fixed<4>> decoder;
+    std::ostringstream wire;
+    char header[4];
+    wire.write(header, framing::Fixed<4>::encode(framing::Decoder<framing::Fixed<4>>::max_frame_size + 1, header));
+    framing::write_frame<framing::Fixed<4>>(wire, "ignored", 7);
+    decoder.feed(wire.str(), 3);
+    EXPECT_TRUE(decoder.m_frames.empty());
+    ASSERT_EQ(decoder.m_errors.size(), 1UL);
+    EXPECT_EQ(decoder.m_errors[0], "Frame too large.");
+  }
+  {
+    // A frame that doesn't fit in the header isn't written.
+    std::ostringstream wire;
+    std::string const payload(256, 'x');
+    EXPECT_FALSE(framing::write_frame<framing::Fixed<1>>(wire, payload.data(), payload.size()));
+    EXPECT_TRUE(wire.str().empty());
+    EXPECT_TRUE(framing::write_frame<framing::Fixed<1>>(wire, payload.data(), 255));
+    EXPECT_EQ(wire.str().size(), 256UL);
+  }
+}
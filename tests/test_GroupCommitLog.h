@@ -0,0 +1,94 @@
+#include "src/GroupCommitLog.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace test_group_commit_log {
+
+// Let number_of_writers threads append records_per_writer records each, waiting for the commit of every record.
+// Returns the number of fdatasync calls; the contents of the file are returned in contents.
+size_t write_records(char const* path, bool direct, size_t number_of_writers, size_t records_per_writer, std::string& contents)
+{
+  size_t commits;
+  {
+    GroupCommitLog log(path, direct);
+    std::vector<std::thread> writers;
+    for (size_t w = 0; w < number_of_writers; ++w)
+      writers.emplace_back([&log, w, records_per_writer]()
+          {
+            std::mutex mutex;
+            std::condition_variable committed_cv;
+            bool committed;
+            for (size_t r = 0; r < records_per_writer; ++r)
+            {
+              std::string const record = std::to_string(w) + ' ' + std::to_string(r) + ' ' + std::string(r % 37, '.') + '\n';
+              committed = false;
+              log.append(record.data(), record.size(), [&]()
+                  {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    committed = true;
+                    committed_cv.notify_one();
+                  });
+              std::unique_lock<std::mutex> lock(mutex);
+              committed_cv.wait(lock, [&]{ return committed; });
+            }
+          });
+    for (auto& writer : writers)
+      writer.join();
+    commits = log.commits();
+  }
+  std::ifstream file(path);
+  std::ostringstream oss;
+  oss << file.rdbuf();
+  contents = oss.str();
+  return commits;
+}
+
+// Check that contents contains every record exactly once, and the records of each writer in order.
+void check_records(std::string const& contents, size_t number_of_writers, size_t records_per_writer)
+{
+  std::vector<size_t> next(number_of_writers, 0);
+  std::istringstream iss(contents);
+  std::string line;
+  size_t lines = 0;
+  while (std::getline(iss, line))
+  {
+    std::istringstream record(line);
+    size_t w, r;
+    record >> w >> r;
+    ASSERT_LT(w, number_of_writers) << line;
+    EXPECT_EQ(r, next[w]) << line;
+    EXPECT_EQ(line, std::to_string(w) + ' ' + std::to_string(r) + ' ' + std::string(r % 37, '.'));
+    next[w] = r + 1;
+    ++lines;
+  }
+  EXPECT_EQ(lines, number_of_writers * records_per_writer);
+}
+
+} // namespace test_group_commit_log
+
+TEST(GroupCommitLog, ConcurrentAppends)
+{
+  using namespace test_group_commit_log;
+
+  static char const* const path = "test_group_commit.log";
+  std::string contents;
+  size_t const commits = write_records(path, false, 8, 200, contents);
+  check_records(contents, 8, 200);
+  EXPECT_GE(commits, 1);
+  EXPECT_LE(commits, 8 * 200);
+
+  // With O_DIRECT the padding of the last block is removed again. Not every file system supports O_DIRECT (tmpfs doesn't).
+  try
+  {
+    write_records(path, true, 8, 200, contents);
+    check_records(contents, 8, 200);
+  }
+  catch (std::system_error const& error)
+  {
+    std::cout << "Skipping O_DIRECT: " << error.what() << std::endl;
+  }
+  unlink(path);
+}
@@ -0,0 +1,203 @@
+#include "src/HTTPDecoder.h"
+#include "DecoderFeeder.h"
+#include <string>
+#include <vector>
+
+namespace test_http_decoder {
+
+// Records what the decoder reports.
+class RecordingDecoder : public DecoderFeeder<http::Decoder>
+{
+ public:
+  std::vector<std::string> m_events;
+
+ protected:
+  void on_head(int& UNUSED_ARG(allow_deletion_count), http::MessageHead const& head) override
+  {
+    std::string event = "head ";
+    if (head.is_response())
+      event += std::to_string(head.status()) + " " + std::string(head.reason());
+    else
+      event += std::string(head.method()) + " " + std::string(head.target());
+    for (http::Header const& header : head.headers())
+      event += "|" + std::string(header.m_name) + "=" + std::string(header.m_value);
+    m_events.push_back(event);
+  }
+
+  void on_body(int& UNUSED_ARG(allow_deletion_count), char const* data, size_t len) override
+  {
+    // Merge consecutive body pieces, so that the result doesn't depend on the chunk size.
+    if (!m_events.empty() && m_events.back().compare(0, 5, "body ") == 0)
+      m_events.back().append(data, len);
+    else
+      m_events.push_back("body " + std::string(data, len));
+  }
+
+  void on_message_complete(int& UNUSED_ARG(allow_deletion_count)) override
+  {
+    m_events.push_back("complete");
+  }
+
+  void on_error(int& UNUSED_ARG(allow_deletion_count), char const* what) override
+  {
+    m_events.push_back(std::string("error ") + what);
+  }
+};
+
+std::string generate_request(int request, int sleep)
+{
+  return "GET / HTTP/1.1\r\n"
+         "Host: localhost:9001\r\n"
+         "Accept: */*\r\n"
+         "X-Request: " + std::to_string(request) + "\r\n"
+         "X-Sleep: " + std::to_string(sleep) + "\r\n"
+         "\r\n";
+}
+
+} // namespace test_http_decoder
+
+TEST(HTTPDecoder, PipelinedRequests)
+{
+  using namespace test_http_decoder;
+  std::string stream;
+  for (int request = 0; request < 10; ++request)
+    stream += generate_request(request, 10 * request);
+
+  for (size_t chunk_size = 1; chunk_size <= stream.size(); ++chunk_size)
+  {
+    RecordingDecoder decoder;
+    decoder.feed(stream, chunk_size);
+    ASSERT_EQ(decoder.m_events.size(), 20UL);
+    for (int request = 0; request < 10; ++request)
+    {
+      EXPECT_EQ(decoder.m_events[2 * request], "head GET /|Host=localhost:9001|Accept=*/*|X-Request=" +
+          std::to_string(request) + "|X-Sleep=" + std::to_string(10 * request));
+      EXPECT_EQ(decoder.m_events[2 * request + 1], "complete");
+    }
+  }
+}
+
+TEST(HTTPDecoder, ContentLengthAndChunked)
+{
+  using namespace test_http_decoder;
+  std::string const stream =
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 27\r\n"
+      "Content-Type: text/html\r\n"
+      "\r\n"
+      "<html><body></body></html>\n"
+      "HTTP/1.1 200 OK\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "\r\n"
+      "6\r\nHello \r\n"
+      "1a;name=value\r\nchunked world, in 3 chunks\r\n"
+      "1\r\n!\r\n"
+      "0\r\n"
+      "\r\n"
+      "HTTP/1.1 204 No Content\r\n"
+      "\r\n"
+      "HTTP/1.1 200 OK\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "\r\n"
+      "0\r\n"
+      "X-Trailer: yes\r\n"
+      "\r\n"
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/plain\r\n"
+      "\r\n"
+      "Until the connection is closed.";
+  std::vector<std::string> const expected = {
+    "head 200 OK|Content-Length=27|Content-Type=text/html",
+    "body <html><body></body></html>\n",
+    "complete",
+    "head 200 OK|Transfer-Encoding=chunked",
+    "body Hello chunked world, in 3 chunks!",
+    "complete",
+    "head 204 No Content",
+    "complete",
+    "head 200 OK|Transfer-Encoding=chunked",
+    "complete",
+    "head 200 OK|Content-Type=text/plain",
+    "body Until the connection is closed.",
+    "complete"
+  };
+
+  for (size_t chunk_size = 1; chunk_size <= stream.size(); ++chunk_size)
+  {
+    RecordingDecoder decoder;
+    decoder.feed(stream, chunk_size);
+    // The last response is only complete when the connection is closed.
+    int allow_deletion_count = 0;
+    decoder.end_of_input(allow_deletion_count);
+    decoder.end_of_input(allow_deletion_count);
+    EXPECT_EQ(decoder.m_events, expected);
+  }
+}
+
+TEST(HTTPDecoder, Errors)
+{
+  using namespace test_http_decoder;
+  char const* const malformed[] = {
+    "GET /\r\n\r\n",
+    "GET / HTTP/2.0\r\n\r\n",
+    "HTTP/1.1 2000 OK\r\n\r\n",
+    "GET / HTTP/1.1\r\nNo colon\r\n\r\n",
+    "GET / HTTP/1.1\r\nName : value\r\n\r\n",
+    "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+    "GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+    "GET / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nxyz\r\n"
+  };
+  for (char const* request : malformed)
+  {
+    RecordingDecoder decoder;
+    decoder.feed(request);
+    decoder.feed(generate_request(1, 0));       // Must be ignored.
+    ASSERT_FALSE(decoder.m_events.empty());
+    EXPECT_EQ(decoder.m_events.back().compare(0, 6, "error "), 0) << request;
+  }
+
+  // A header section that never ends.
+  RecordingDecoder decoder;
+  decoder.feed("GET / HTTP/1.1\r\n");
+  std::string const field = "X-Field: " + std::string(1000, 'x') + "\r\n";
+  for (size_t size = 0; size <= http::Decoder::max_head_size; size += field.size())
+    decoder.feed(field);
+  ASSERT_EQ(decoder.m_events.size(), 1UL);
+  EXPECT_EQ(decoder.m_events[0], "error Header section too large.");
+
+  // A header section that is too large but arrives, terminator included, in a single read.
+  std::string large_request = "GET / HTTP/1.1\r\n";
+  while (large_request.size() <= http::Decoder::max_head_size)
+    large_request += field;
+  large_request += "\r\n";
+  RecordingDecoder decoder2;
+  decoder2.feed(large_request);
+  ASSERT_EQ(decoder2.m_events.size(), 1UL);
+  EXPECT_EQ(decoder2.m_events[0], "error Header section too large.");
+}
+
+TEST(HTTPDecoder, ChunkDataEnd)
+{
+  using namespace test_http_decoder;
+  std::string const head = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+  for (size_t chunk_size : { 1000, 1 })
+  {
+    // The chunk data must be followed by CRLF (or a bare LF); anything in between is not skipped.
+    RecordingDecoder decoder;
+    decoder.feed(head + "5\r\nHello world\r\n0\r\n\r\n", chunk_size);
+    ASSERT_EQ(decoder.m_events.size(), 3UL);
+    EXPECT_EQ(decoder.m_events[1], "body Hello");
+    EXPECT_EQ(decoder.m_events[2], "error Chunk data not followed by CRLF.");
+
+    RecordingDecoder decoder2;
+    decoder2.feed(head + "5\r\nHello\r\r\n0\r\n\r\n", chunk_size);
+    ASSERT_EQ(decoder2.m_events.size(), 3UL);
+    EXPECT_EQ(decoder2.m_events[2], "error Chunk data not followed by CRLF.");
+
+    RecordingDecoder decoder3;
+    decoder3.feed(head + "5\r\nHello\n6\r\n world\r\n0\r\n\r\n", chunk_size);
+    ASSERT_EQ(decoder3.m_events.size(), 3UL);
+    EXPECT_EQ(decoder3.m_events[1], "body Hello world");
+    EXPECT_EQ(decoder3.m_events[2], "complete");
+  }
+}
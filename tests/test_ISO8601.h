@@ -0,0 +1,68 @@
+#include "src/ISO8601.h"
+#include <ctime>
+#include <random>
+#include <string>
+
+TEST(ISO8601, KnownValues)
+{
+  std::pair<char const*, std::time_t> const values[] = {
+    { "1970-01-01T00:00:00Z", 0 },
+    { "2021-01-29T15:37:23Z", 1611934643 },
+    { "20210129T15:37:23", 1611934643 },
+    { "2021-01-29T15:37:23.123456Z", 1611934643 },
+    { "2021-01-29T16:37:23+01:00", 1611934643 },
+    { "2021-01-29T10:07:23-0530", 1611934643 },
+    { "1969-12-31T23:59:59Z", -1 },
+    { "2000-02-29T12:00:00Z", 951825600 },
+    { "1900-03-01T00:00:00Z", -2203891200 }
+  };
+  for (auto const& value : values)
+  {
+    std::time_t t;
+    ASSERT_TRUE(iso8601::parse(value.first, t)) << value.first;
+    EXPECT_EQ(t, value.second) << value.first;
+  }
+}
+
+TEST(ISO8601, Invalid)
+{
+  char const* const invalid[] = {
+    "", "2021-01-29", "2021-01-29 15:37:23Z", "2021-01-29T15:37:23X", "2021-13-29T15:37:23Z", "2021-00-29T15:37:23Z",
+    "2021-02-29T15:37:23Z", "1900-02-29T15:37:23Z", "2021-04-31T15:37:23Z", "2021-01-29T24:00:00Z", "2021-01-29T15:60:23Z",
+    "2021-01-29T15:37:61Z", "2021-01-2aT15:37:23Z", "2021/01/29T15:37:23Z", "2021-01-29T15:37:23+1:00", "2021-01-29T15:37:23+01:60",
+    "2021-01-29T15237:23Z", "2021-01029T15:37:23Z", "2021-01-29T1:37:23Z", "2021-01-29T15:37:2Z",
+    "2021-01-29T15:37:23.Z", "2021-01-29T15:37:23,", "2021-01-29T15:37:23.+01:00"
+  };
+  for (char const* str : invalid)
+  {
+    std::time_t t;
+    EXPECT_FALSE(iso8601::parse(str, t)) << str;
+  }
+}
+
+TEST(ISO8601, FormatRoundtrip)
+{
+  std::mt19937_64 rng(1);
+  iso8601::Formatter formatter;
+  std::time_t t = -2208988800;                  // 1900-01-01.
+  while (t < 4102444800)                        // 2100-01-01.
+  {
+    // Compare with gmtime/strftime.
+    std::tm tm;
+    gmtime_r(&t, &tm);
+    char expected[32];
+    std::strftime(expected, sizeof(expected), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    char buf[iso8601::formatted_size];
+    iso8601::format(t, buf);
+    ASSERT_EQ(std::string_view(buf, sizeof(buf)), expected);
+    ASSERT_EQ(formatter(t), expected);
+    ASSERT_EQ(formatter(t), expected);          // From the cache.
+
+    std::time_t parsed;
+    ASSERT_TRUE(iso8601::parse(expected, parsed));
+    ASSERT_EQ(parsed, t);
+
+    t += rng() % 1000000;
+  }
+}
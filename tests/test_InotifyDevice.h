@@ -0,0 +1,100 @@
+#include "src/InotifyDevice.h"
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace test_inotify_device {
+
+// Records the lines of a tailed file.
+class LineRecorder : public evio::protocol::Decoder
+{
+ private:
+  mutable std::mutex m_mutex;
+  std::vector<std::string> m_lines;
+
+ public:
+  std::vector<std::string> lines() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lines;
+  }
+
+ protected:
+  // Use the default end_of_msg_finder, which finds the next newline.
+  void decode(int& UNUSED_ARG(allow_deletion_count), evio::MsgBlock&& msg) override
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lines.emplace_back(msg.get_start(), msg.get_size());
+  }
+};
+
+// Wait until recorder received count lines.
+void wait_for(LineRecorder const& recorder, size_t count)
+{
+  for (int i = 0; i < 200 && recorder.lines().size() < count; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+} // namespace test_inotify_device
+
+#include "EventLoopFixture.h"
+
+using InotifyDeviceTest = EventLoopFixture<testing::Test>;
+
+TEST_F(InotifyDeviceTest, AppendAndRotate)
+{
+  using namespace test_inotify_device;
+
+  static char const* const directory = "/tmp/test_inotify_device";
+  mkdir(directory, 0700);
+  std::string const path[2] = { std::string(directory) + "/a.log", std::string(directory) + "/b.log" };
+  for (auto const& p : path)
+    std::ofstream(p, std::ios_base::trunc) << "Old data that is skipped.\n";
+
+  LineRecorder recorder[2];
+  auto inotify_device = evio::create<InotifyDevice>();
+  inotify_device->init();
+  boost::intrusive_ptr<TailedFile> file[2];
+  for (int f = 0; f < 2; ++f)
+  {
+    file[f] = evio::create<TailedFile>(path[f]);
+    file[f]->set_protocol_decoder(recorder[f]);
+    inotify_device->add(*file[f]);
+  }
+  inotify_device->start();
+
+  // Appended lines are read, also when the last one is completed by a second write.
+  std::ofstream(path[0], std::ios_base::app) << "a1\na2";
+  std::ofstream(path[1], std::ios_base::app) << "b1\n";
+  wait_for(recorder[1], 1);
+  std::ofstream(path[0], std::ios_base::app) << " continued\n";
+  wait_for(recorder[0], 2);
+  EXPECT_EQ(recorder[0].lines(), (std::vector<std::string>{ "a1\n", "a2 continued\n" }));
+  EXPECT_EQ(recorder[1].lines(), (std::vector<std::string>{ "b1\n" }));
+
+  // Rotation: the rest of the old file is read, then the new file from its start.
+  std::string const rotated_path = path[1] + ".1";
+  std::ofstream(path[1], std::ios_base::app) << "b2\n";
+  rename(path[1].c_str(), rotated_path.c_str());
+  std::ofstream(path[1], std::ios_base::trunc) << "b3\n";
+  wait_for(recorder[1], 3);
+  EXPECT_EQ(recorder[1].lines(), (std::vector<std::string>{ "b1\n", "b2\n", "b3\n" }));
+
+  // Rotation where the new file only appears later.
+  unlink(path[0].c_str());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  std::ofstream(path[0], std::ios_base::trunc) << "a3\n";
+  wait_for(recorder[0], 3);
+  EXPECT_EQ(recorder[0].lines(), (std::vector<std::string>{ "a1\n", "a2 continued\n", "a3\n" }));
+
+  for (auto& f : file)
+    f->close();
+  inotify_device->close();
+  unlink(rotated_path.c_str());
+  for (auto const& p : path)
+    unlink(p.c_str());
+  rmdir(directory);
+}
@@ -0,0 +1,156 @@
+#include "src/LPMTrie.h"
+#include <random>
+#include <string>
+#include <vector>
+
+namespace test_lpm_trie {
+
+// Return the sockaddr for the IPv4 or IPv6 address str.
+struct sockaddr_storage address(char const* str)
+{
+  struct sockaddr_storage ss;
+  std::memset(&ss, 0, sizeof(ss));
+  if (std::strchr(str, ':'))
+  {
+    struct sockaddr_in6* sin6 = reinterpret_cast<struct sockaddr_in6*>(&ss);
+    sin6->sin6_family = AF_INET6;
+    EXPECT_EQ(inet_pton(AF_INET6, str, &sin6->sin6_addr), 1) << str;
+  }
+  else
+  {
+    struct sockaddr_in* sin = reinterpret_cast<struct sockaddr_in*>(&ss);
+    sin->sin_family = AF_INET;
+    EXPECT_EQ(inet_pton(AF_INET, str, &sin->sin_addr), 1) << str;
+  }
+  return ss;
+}
+
+// The value of the longest prefix that contains str, or "none".
+std::string find(lpm::Trie<std::string> const& trie, char const* str)
+{
+  struct sockaddr_storage const ss = address(str);
+  std::string const* value = trie.find(reinterpret_cast<struct sockaddr const*>(&ss));
+  return value ? *value : "none";
+}
+
+} // namespace test_lpm_trie
+
+TEST(LPMTrie, LongestMatch)
+{
+  using test_lpm_trie::find;
+
+  lpm::Trie<std::string> trie;
+  EXPECT_EQ(find(trie, "192.0.2.1"), "none");
+  EXPECT_EQ(find(trie, "2001:db8::1"), "none");
+
+  EXPECT_TRUE(trie.insert("10.0.0.0/8", "10/8"));
+  EXPECT_TRUE(trie.insert("10.1.0.0/16", "10.1/16"));
+  EXPECT_TRUE(trie.insert("10.1.2.0/23", "10.1.2/23"));
+  EXPECT_TRUE(trie.insert("10.1.2.3", "10.1.2.3/32"));
+  EXPECT_TRUE(trie.insert("10.1.2.255/30", "10.1.2.252/30"));          // The host bits are ignored.
+  EXPECT_TRUE(trie.insert("2001:db8::/32", "2001:db8/32"));
+  EXPECT_TRUE(trie.insert("2001:db8:0:1::/64", "2001:db8:0:1/64"));
+  EXPECT_TRUE(trie.insert("2001:db8::1/128", "2001:db8::1/128"));
+  EXPECT_EQ(trie.size(), 8);
+  EXPECT_EQ(find(trie, "10.1.2.3"), "none");                            // Not built yet.
+  trie.build();
+
+  EXPECT_EQ(find(trie, "10.1.2.3"), "10.1.2.3/32");
+  EXPECT_EQ(find(trie, "10.1.2.2"), "10.1.2/23");
+  EXPECT_EQ(find(trie, "10.1.1.255"), "10.1/16");
+  EXPECT_EQ(find(trie, "10.1.3.2"), "10.1.2/23");
+  EXPECT_EQ(find(trie, "10.1.2.4"), "10.1.2/23");
+  EXPECT_EQ(find(trie, "10.1.2.253"), "10.1.2.252/30");
+  EXPECT_EQ(find(trie, "10.1.4.0"), "10.1/16");
+  EXPECT_EQ(find(trie, "10.2.0.0"), "10/8");
+  EXPECT_EQ(find(trie, "11.0.0.0"), "none");
+  EXPECT_EQ(find(trie, "2001:db8::1"), "2001:db8::1/128");
+  EXPECT_EQ(find(trie, "2001:db8::2"), "2001:db8/32");
+  EXPECT_EQ(find(trie, "2001:db8:0:1:ffff::"), "2001:db8:0:1/64");
+  EXPECT_EQ(find(trie, "2001:db9::"), "none");
+  // IPv4-mapped IPv6 addresses are IPv4 addresses.
+  EXPECT_EQ(find(trie, "::ffff:10.1.2.3"), "10.1.2.3/32");
+  EXPECT_EQ(find(trie, "::ffff:11.0.0.0"), "none");
+
+  // Default routes, and replacing a value.
+  EXPECT_TRUE(trie.insert("0.0.0.0/0", "default4"));
+  EXPECT_TRUE(trie.insert("::/0", "default6"));
+  EXPECT_TRUE(trie.insert("10.0.0.0/8", "ten"));
+  trie.build();
+  EXPECT_EQ(trie.size(), 10);
+  EXPECT_EQ(find(trie, "11.0.0.0"), "default4");
+  EXPECT_EQ(find(trie, "2001:db9::"), "default6");
+  EXPECT_EQ(find(trie, "10.2.0.0"), "ten");
+  EXPECT_EQ(find(trie, "10.1.2.3"), "10.1.2.3/32");
+
+  // Invalid prefixes.
+  for (char const* cidr : { "", "10.0.0.0/", "10.0.0.0/33", "10.0.0.0/-1", "10.0.0.0/8x", "10.0.0/8", "2001:db8::/129", "2001:db8:::/32", "host/8" })
+    EXPECT_FALSE(trie.insert(cidr, "invalid")) << cidr;
+  EXPECT_EQ(trie.size(), 10);
+}
+
+TEST(LPMTrie, MappedPrefixes)
+{
+  using test_lpm_trie::find;
+
+  // IPv4-mapped prefixes are IPv4 prefixes.
+  lpm::Trie<std::string> trie;
+  EXPECT_TRUE(trie.insert("::/0", "default6"));
+  EXPECT_TRUE(trie.insert("::ffff:192.0.2.0/120", "mapped/120"));
+  EXPECT_TRUE(trie.insert("10.1.2.3", "10.1.2.3/32"));
+  EXPECT_TRUE(trie.insert("::ffff:10.1.2.3/128", "mapped/128"));       // Replaces 10.1.2.3/32.
+  EXPECT_TRUE(trie.insert("::ffff:0.0.0.0/96", "mapped/96"));
+  EXPECT_EQ(trie.size(), 4);
+  trie.build();
+
+  EXPECT_EQ(find(trie, "192.0.2.5"), "mapped/120");
+  EXPECT_EQ(find(trie, "::ffff:192.0.2.5"), "mapped/120");
+  EXPECT_EQ(find(trie, "10.1.2.3"), "mapped/128");
+  EXPECT_EQ(find(trie, "::ffff:10.1.2.3"), "mapped/128");
+  EXPECT_EQ(find(trie, "198.51.100.1"), "mapped/96");
+  EXPECT_EQ(find(trie, "::ffff:198.51.100.1"), "mapped/96");
+  EXPECT_EQ(find(trie, "2001:db8::1"), "default6");
+}
+
+TEST(LPMTrie, Random)
+{
+  // Compare find with a walk over the binary trie, for random prefixes of all lengths.
+  std::mt19937 rng(1);
+  lpm::Trie<uint32_t> trie;
+  std::vector<std::vector<unsigned char>> prefixes4;
+  std::vector<std::vector<unsigned char>> prefixes6;
+  for (uint32_t i = 0; i < 30000; ++i)
+  {
+    bool const ipv4 = i % 4 != 0;
+    std::vector<unsigned char> address(ipv4 ? 4 : 16);
+    for (auto& byte : address)
+      byte = rng();
+    // Most prefixes share the first bytes, so that the nodes below the direct table are deep and full.
+    address[0] = 10 + rng() % 2;
+    address[1] = rng() % 4;
+    int const length = rng() % ((ipv4 ? 32 : 128) + 1);
+    trie.insert(ipv4 ? AF_INET : AF_INET6, address.data(), length, i);
+    (ipv4 ? prefixes4 : prefixes6).push_back(address);
+  }
+  trie.build();
+
+  for (int i = 0; i < 200000; ++i)
+  {
+    bool const ipv4 = i % 2 == 0;
+    auto const& prefixes = ipv4 ? prefixes4 : prefixes6;
+    // Take an address of a prefix and change some random bits at the end.
+    std::vector<unsigned char> address = prefixes[rng() % prefixes.size()];
+    int const flip = rng() % (address.size() * 8);
+    for (int bit = flip; bit < static_cast<int>(address.size() * 8); ++bit)
+      if (rng() % 2)
+        address[bit / 8] ^= 0x80 >> (bit % 8);
+
+    uint32_t const* expected = trie.find_slow(ipv4 ? AF_INET : AF_INET6, address.data());
+    uint32_t const* found;
+    if (ipv4)
+      found = trie.find_ipv4((address[0] << 24) | (address[1] << 16) | (address[2] << 8) | address[3]);
+    else
+      found = trie.find_ipv6(address.data());
+    ASSERT_EQ(found, expected) << "i = " << i;
+  }
+}
@@ -0,0 +1,73 @@
+#include "src/MappedInputFile.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace test_mapped_input_file {
+
+// Records the lines of the file; closes the input device after max_lines lines.
+class LineRecorder : public evio::protocol::Decoder
+{
+ private:
+  size_t m_max_lines;
+
+ public:
+  std::vector<std::string> m_lines;
+
+  LineRecorder(size_t max_lines = SIZE_MAX) : m_max_lines(max_lines) { }
+
+ protected:
+  // Use the default end_of_msg_finder, which finds the next newline.
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    m_lines.emplace_back(msg.get_start(), msg.get_size());
+    if (m_lines.size() == m_max_lines)
+      close_input_device(allow_deletion_count);
+  }
+};
+
+} // namespace test_mapped_input_file
+
+#include "EventLoopFixture.h"
+
+using MappedInputFileTest = EventLoopFixture<testing::Test>;
+
+TEST_F(MappedInputFileTest, SlidingWindow)
+{
+  using namespace test_mapped_input_file;
+
+  // Lines of varying length, some longer than the window of one page, so that the window slides and grows.
+  static char const* const path = "/tmp/test_mapped_input_file.log";
+  size_t const page_size = sysconf(_SC_PAGESIZE);
+  std::vector<std::string> lines;
+  for (size_t n = 0; n < 2000; ++n)
+    lines.push_back("line " + std::to_string(n) + ' ' + std::string(n % 10 == 7 ? page_size * (1 + n % 3) : n % 97, '.') + '\n');
+  {
+    std::ofstream file(path, std::ios_base::trunc);
+    for (auto const& line : lines)
+      file << line;
+    file << "incomplete";
+  }
+
+  {
+    LineRecorder recorder;
+    auto file = evio::create<MappedInputFile>(page_size);
+    file->open(path);
+    file->set_protocol_decoder(recorder);
+    file->replay();
+    EXPECT_TRUE(recorder.m_lines == lines);
+  }
+
+  // The decoder can stop the replay.
+  {
+    LineRecorder recorder(100);
+    auto file = evio::create<MappedInputFile>(page_size);
+    file->open(path);
+    file->set_protocol_decoder(recorder);
+    file->replay();
+    ASSERT_EQ(recorder.m_lines.size(), 100);
+    EXPECT_TRUE(std::equal(recorder.m_lines.begin(), recorder.m_lines.end(), lines.begin()));
+  }
+
+  unlink(path);
+}
@@ -0,0 +1,83 @@
+#include "src/SendFileSocket.h"
+#include "evio/ListenSocket.h"
+#include "evio/AcceptedSocket.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace test_sendfile_socket {
+
+// The data that the accepted socket received.
+std::mutex received_mutex;
+std::string received;
+std::atomic<size_t> received_size;
+size_t expected_size;
+
+// Stores the received data and closes the input device when everything was received.
+class ReceivingDecoder : public evio::protocol::Decoder
+{
+ protected:
+  size_t end_of_msg_finder(char const* UNUSED_ARG(new_data), size_t rlen, evio::EndOfMsgFinderResult& UNUSED_ARG(result)) override { return rlen; }
+
+  void decode(int& allow_deletion_count, evio::MsgBlock&& msg) override
+  {
+    {
+      std::lock_guard<std::mutex> lock(received_mutex);
+      received.append(msg.get_start(), msg.get_size());
+    }
+    if ((received_size += msg.get_size()) == expected_size)
+      close_input_device(allow_deletion_count);
+  }
+};
+
+using ReceivingAcceptedSocket = evio::AcceptedSocket<ReceivingDecoder, evio::OutputStream>;
+
+class ReceivingListenSocket : public evio::ListenSocket<ReceivingAcceptedSocket>
+{
+  void new_connection(accepted_socket_type& UNUSED_ARG(accepted_socket)) override { close(); }
+};
+
+} // namespace test_sendfile_socket
+
+#include "EventLoopFixture.h"
+
+using SendFileSocketTest = EventLoopFixture<testing::Test>;
+
+TEST_F(SendFileSocketTest, SendsWholeFile)
+{
+  using namespace test_sendfile_socket;
+
+  // A file that is larger than the socket buffers, so that sendfile(2) returns EAGAIN at least once.
+  static char const* const path = "/tmp/test_sendfile_socket.dat";
+  std::string contents(8 * 1024 * 1024 + 12345, '\0');
+  for (size_t i = 0; i < contents.size(); ++i)
+    contents[i] = static_cast<char>(i * 31 + i / 4096);
+  {
+    std::ofstream file(path, std::ios_base::trunc | std::ios_base::binary);
+    file.write(contents.data(), contents.size());
+  }
+  received.clear();
+  received_size = 0;
+  expected_size = contents.size();
+
+  static evio::SocketAddress const listen_address("127.0.0.1:9007");
+  auto listen_socket = evio::create<ReceivingListenSocket>();
+  listen_socket->listen(listen_address);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));          // Dumb way to wait until the listen socket is up.
+
+  auto socket = evio::create<SendFileSocket>();
+  socket->on_connected([&socket](int& allow_deletion_count, bool success){ if (success) socket->send_file(allow_deletion_count, path); });
+  socket->connect(listen_address);
+
+  for (int i = 0; i < 500 && received_size < expected_size; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(received_size, expected_size);
+  {
+    std::lock_guard<std::mutex> lock(received_mutex);
+    EXPECT_TRUE(received == contents);
+  }
+  socket->close();
+  unlink(path);
+}
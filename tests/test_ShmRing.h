@@ -0,0 +1,91 @@
+#include "src/ShmRing.h"
+#include <algorithm>
+#include <poll.h>
+#include <sys/wait.h>
+#include <thread>
+
+namespace test_shm_ring {
+
+// The byte at position pos of the test stream.
+char pattern(uint64_t pos)
+{
+  return static_cast<char>(pos * 31 + pos / 4093);
+}
+
+// Runs in the forked child: attach to the ring and write size bytes of the pattern into it, in chunks
+// of varying size, using the ring protocol of ShmRingWriteEnd. Only uses the stack (no malloc after fork).
+[[noreturn]] void write_pattern(ShmRing const& inherited_ring, uint64_t size)
+{
+  ShmRing ring(dup(inherited_ring.memfd()), dup(inherited_ring.data_doorbell()), dup(inherited_ring.space_doorbell()));
+  ShmRing::Header* header = ring.header();
+  char chunk[1000];
+  uint64_t head = 0;
+  while (head < size)
+  {
+    size_t len = std::min<uint64_t>(1 + head % sizeof(chunk), size - head);
+    uint64_t tail;
+    while ((tail = header->m_tail.load(std::memory_order_seq_cst)) + ring.capacity() == head)
+      std::this_thread::yield();
+    len = std::min<uint64_t>(len, ring.capacity() - (head - tail));
+    for (size_t i = 0; i < len; ++i)
+      chunk[i] = pattern(head + i);
+    ring.copy_to(head, chunk, len);
+    header->m_head.store(head + len, std::memory_order_seq_cst);
+    if (header->m_tail.load(std::memory_order_seq_cst) == head)
+      ShmRing::ring(ring.data_doorbell());
+    head += len;
+  }
+  header->m_closed.store(true, std::memory_order_seq_cst);
+  ShmRing::ring(ring.data_doorbell());
+  _exit(0);
+}
+
+} // namespace test_shm_ring
+
+TEST(ShmRing, AcrossFork)
+{
+  using namespace test_shm_ring;
+
+  // Small, so that the ring wraps around and fills up many times.
+  ShmRing ring(4096);
+  EXPECT_EQ(ring.capacity(), 4096u);
+  uint64_t constexpr size = 1000000;
+
+  pid_t child = fork();
+  ASSERT_NE(child, -1);
+  if (child == 0)
+    write_pattern(ring, size);
+
+  // Read everything the child writes, waiting on the data doorbell while the ring is empty.
+  ShmRing::Header* header = ring.header();
+  char buf[4096];
+  uint64_t tail = 0;
+  bool match = true;
+  for (;;)
+  {
+    uint64_t const head = header->m_head.load(std::memory_order_seq_cst);
+    if (head == tail)
+    {
+      if (header->m_closed.load(std::memory_order_seq_cst) && header->m_head.load(std::memory_order_seq_cst) == tail)
+        break;
+      struct pollfd pfd = { ring.data_doorbell(), POLLIN, 0 };
+      if (poll(&pfd, 1, 10000) != 1)
+        break;
+      uint64_t count;
+      [[maybe_unused]] ssize_t unused = ::read(ring.data_doorbell(), &count, sizeof(count));
+      continue;
+    }
+    size_t const len = head - tail;
+    ring.copy_from(tail, buf, len);
+    for (size_t i = 0; i < len; ++i)
+      match = match && buf[i] == pattern(tail + i);
+    tail = head;
+    header->m_tail.store(tail, std::memory_order_seq_cst);
+  }
+  EXPECT_EQ(tail, size);
+  EXPECT_TRUE(match);
+
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
@@ -0,0 +1,75 @@
+#include "src/SignalDevice.h"
+#include "utils/Signals.h"
+#include <atomic>
+#include <thread>
+
+namespace test_signal_device {
+
+size_t constexpr number_of_signals = 1000;
+
+// Creates the SignalDevice, and blocks its signal, before EventLoopFixture creates the threads of the thread pool:
+// being a base class of EventLoopFixture, this is constructed before the AIThreadPool member.
+class SignalDeviceFixture : public testing::Test
+{
+ protected:
+  int m_signum;
+  boost::intrusive_ptr<SignalDevice> m_signal_device;
+  std::atomic<size_t> m_received;
+  std::atomic<size_t> m_out_of_order;
+
+  SignalDeviceFixture() : m_signum(utils::Signal::next_rt_signum()), m_received(0), m_out_of_order(0)
+  {
+    m_signal_device = evio::create<SignalDevice>();
+    m_signal_device->add_signal(m_signum,
+        [this](int& allow_deletion_count, signalfd_siginfo const& info)
+        {
+          if (static_cast<size_t>(info.ssi_int) != m_received)
+            ++m_out_of_order;
+          if (++m_received == number_of_signals)
+            m_signal_device->close(allow_deletion_count);
+        });
+    m_signal_device->init();
+  }
+
+  void TearDown() override
+  {
+    m_signal_device.reset();
+    // All threads that inherited the signal mask are gone.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, m_signum);
+    pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+  }
+};
+
+} // namespace test_signal_device
+
+#include "EventLoopFixture.h"
+
+using SignalDeviceTest = EventLoopFixture<test_signal_device::SignalDeviceFixture>;
+
+TEST_F(SignalDeviceTest, QueuedSignals)
+{
+  using test_signal_device::number_of_signals;
+
+  m_signal_device->start();
+  pid_t const pid = getpid();
+  for (size_t n = 0; n < number_of_signals; ++n)
+  {
+    union sigval value;
+    value.sival_int = n;
+    // Retry while the queue of pending signals is full (see RLIMIT_SIGPENDING).
+    while (sigqueue(pid, m_signum, value) == -1 && errno == EAGAIN)
+      std::this_thread::yield();
+  }
+
+  // Wait until all signals were received.
+  for (int i = 0; i < 500 && m_received < number_of_signals; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  EXPECT_EQ(m_received, number_of_signals);
+  EXPECT_EQ(m_out_of_order, 0);
+  EXPECT_EQ(m_signal_device->records(), number_of_signals);
+  EXPECT_GE(m_signal_device->wakeups(), 1);
+  EXPECT_LE(m_signal_device->wakeups(), number_of_signals);
+}
@@ -0,0 +1,128 @@
+#include "src/WebSocket.h"
+#include "DecoderFeeder.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace test_websocket {
+
+// Records what the decoder reports.
+class RecordingDecoder : public DecoderFeeder<websocket::Decoder>
+{
+ public:
+  std::vector<std::string> m_events;
+  int m_input_closed = 0;       // The number of calls to close_input.
+
+  RecordingDecoder(websocket::role_type role) : DecoderFeeder<websocket::Decoder>(role) { }
+
+ protected:
+  void on_message(int& UNUSED_ARG(allow_deletion_count), websocket::opcode_type opcode, char const* data, size_t len) override
+  {
+    m_events.push_back((opcode == websocket::op_text ? "text " : "binary ") + std::string(data, len));
+  }
+
+  void on_close(int& UNUSED_ARG(allow_deletion_count), uint16_t code) override
+  {
+    m_events.push_back("close " + std::to_string(code));
+  }
+
+  void on_error(int& UNUSED_ARG(allow_deletion_count), char const* what) override
+  {
+    m_events.push_back(std::string("error ") + what);
+  }
+
+  // There is no input device.
+  void close_input(int& UNUSED_ARG(allow_deletion_count)) override
+  {
+    ++m_input_closed;
+  }
+};
+
+} // namespace test_websocket
+
+TEST(WebSocket, unmask)
+{
+  char const key[4] = { '\x12', '\x34', '\x56', '\x78' };
+  std::string src;
+  for (int i = 0; i < 100; ++i)
+    src += static_cast<char>(i * 7);
+  for (size_t len = 0; len <= src.size(); ++len)
+  {
+    std::string dst(len, '\0');
+    websocket::simd::unmask(dst.data(), src.data(), len, key);
+    for (size_t i = 0; i < len; ++i)
+      ASSERT_EQ(dst[i], static_cast<char>(src[i] ^ key[i % 4]));
+  }
+}
+
+TEST(WebSocket, ClientToServer)
+{
+  using namespace test_websocket;
+
+  std::string const large(70000, 'x');          // Needs a 64-bit length.
+  std::ostringstream wire;
+  websocket::FrameWriter client_writer(websocket::client);
+  client_writer.write(wire, websocket::op_text, "Hello", 5);
+  client_writer.write(wire, websocket::op_binary, "frag", 4, false);
+  client_writer.write(wire, websocket::op_ping, "are you there?", 14);
+  client_writer.write(wire, websocket::op_continuation, "men", 3, false);
+  client_writer.write(wire, websocket::op_continuation, "ted", 3, true);
+  client_writer.write(wire, websocket::op_binary, large.data(), large.size());
+  char const close_payload[2] = { 0x03, static_cast<char>(0xe8) };   // 1000.
+  client_writer.write(wire, websocket::op_close, close_payload, 2);
+  client_writer.write(wire, websocket::op_text, "Ignored", 7);
+
+  std::vector<std::string> const expected = {
+    "text Hello",
+    "binary fragmented",
+    "binary " + large,
+    "close 1000"
+  };
+  std::ostringstream expected_replies;
+  websocket::FrameWriter server_writer(websocket::server);
+  server_writer.write(expected_replies, websocket::op_pong, "are you there?", 14);
+  server_writer.write(expected_replies, websocket::op_close, close_payload, 2);
+
+  for (size_t chunk_size : { 1, 2, 3, 7, 125, 4096, 1000000 })
+  {
+    std::ostringstream replies;
+    RecordingDecoder decoder(websocket::server);
+    decoder.set_reply_stream(replies);
+    decoder.feed(wire.str(), chunk_size);
+    EXPECT_EQ(decoder.m_events, expected);
+    EXPECT_EQ(replies.str(), expected_replies.str());
+    EXPECT_EQ(decoder.m_input_closed, 1);
+  }
+}
+
+TEST(WebSocket, Errors)
+{
+  using namespace test_websocket;
+
+  struct { websocket::role_type m_writer_role; websocket::opcode_type m_opcode; size_t m_len; bool m_fin; } const frames[] = {
+    { websocket::server, websocket::op_text, 5, true },                 // Unmasked frame sent to a server.
+    { websocket::client, websocket::op_continuation, 5, true },         // Continuation without a message.
+    { websocket::client, websocket::op_ping, 200, true },               // Too long control frame.
+    { websocket::client, websocket::op_ping, 5, false },                // Fragmented control frame.
+    { websocket::client, static_cast<websocket::opcode_type>(3), 5, true },
+    { websocket::client, websocket::op_binary, websocket::Decoder::max_frame_size + 1, true }
+  };
+  for (auto const& frame : frames)
+  {
+    std::string const payload(frame.m_len, 'p');
+    std::ostringstream wire;
+    websocket::FrameWriter writer(frame.m_writer_role);
+    writer.write(wire, frame.m_opcode, payload.data(), payload.size(), frame.m_fin);
+    writer.write(wire, websocket::op_text, "Ignored", 7);
+
+    std::ostringstream replies;
+    RecordingDecoder decoder(websocket::server);
+    decoder.set_reply_stream(replies);
+    decoder.feed(wire.str(), 65536);
+    ASSERT_EQ(decoder.m_events.size(), 1UL);
+    EXPECT_EQ(decoder.m_events[0].compare(0, 6, "error "), 0);
+    EXPECT_EQ(decoder.m_input_closed, 1);
+    // A close frame with a status code was sent.
+    EXPECT_EQ(replies.str().size(), 4UL);
+  }
+}
@@ -0,0 +1,302 @@
+#include "src/XMLRPCClient.h"
+#include "XmlRpcServerFixture.h"
+#include "DecoderFeeder.h"
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace test_xmlrpc_client {
+
+struct Point
+{
+  int32_t m_x = 0;
+  int32_t m_y = 0;
+};
+
+} // namespace test_xmlrpc_client
+
+template<>
+struct xmlrpc::Members<test_xmlrpc_client::Point>
+{
+  static constexpr auto value = std::make_tuple(
+      xmlrpc::member("x", &test_xmlrpc_client::Point::m_x),
+      xmlrpc::member("y", &test_xmlrpc_client::Point::m_y));
+};
+
+namespace test_xmlrpc_client {
+
+using FeedingDecoder = DecoderFeeder<xmlrpc::ResponseDecoder>;
+
+std::string http_response(std::string const& body, int status = 200)
+{
+  return "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" : " Error") + "\r\n"
+         "Content-Type: text/xml\r\n"
+         "Content-Length: " + std::to_string(body.size()) + "\r\n"
+         "\r\n" + body;
+}
+
+std::string result(std::string const& value)
+{
+  return http_response("<?xml version=\"1.0\"?>\r\n<methodResponse><params><param><value>" + value + "</value></param></params></methodResponse>\r\n");
+}
+
+// Returns a callback that appends what it is called with to log.
+template<typename T>
+xmlrpc::Callback<T> log_to(std::vector<std::string>& log)
+{
+  return [&log](T& result, xmlrpc::Fault const* fault){
+    std::ostringstream oss;
+    if (fault)
+      oss << "fault " << fault->m_code << " " << fault->m_string;
+    else
+      oss << result;
+    log.push_back(oss.str());
+  };
+}
+
+} // namespace test_xmlrpc_client
+
+TEST(XMLRPCClient, WriteRequest)
+{
+  using namespace test_xmlrpc_client;
+
+  std::ostringstream oss;
+  xmlrpc::write_request(oss, "localhost:9003", "/RPC2", "a&b", 42, int64_t{-5000000000}, true, 2.5, "x < y & z\r\n",
+      xmlrpc::Timestamp{1611934643}, xmlrpc::Binary{"Hello world"}, std::vector<int>{1, 2}, Point{3, -4});
+  std::string const body =
+    "<?xml version=\"1.0\"?>\r\n<methodCall><methodName>a&amp;b</methodName><params>"
+    "<param><value><int>42</int></value></param>"
+    "<param><value><i8>-5000000000</i8></value></param>"
+    "<param><value><boolean>1</boolean></value></param>"
+    "<param><value><double>2.5</double></value></param>"
+    "<param><value><string>x &lt; y &amp; z&#13;\n</string></value></param>"
+    "<param><value><dateTime.iso8601>20210129T15:37:23</dateTime.iso8601></value></param>"
+    "<param><value><base64>SGVsbG8gd29ybGQ=</base64></value></param>"
+    "<param><value><array><data><value><int>1</int></value><value><int>2</int></value></data></array></value></param>"
+    "<param><value><struct><member><name>x</name><value><int>3</int></value></member>"
+      "<member><name>y</name><value><int>-4</int></value></member></struct></value></param>"
+    "</params></methodCall>\r\n";
+  EXPECT_EQ(oss.str(),
+    "POST /RPC2 HTTP/1.1\r\n"
+    "Host: localhost:9003\r\n"
+    "Content-Type: text/xml\r\n"
+    "Content-Length: " + std::to_string(body.size()) + "\r\n"
+    "\r\n" + body);
+
+  // A large Binary is encoded in several blocks.
+  std::string data(10000, '\0');
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<char>(i * 7);
+  std::ostringstream oss2;
+  xmlrpc::write_request(oss2, "h", "/", "m", xmlrpc::Binary{data});
+  std::string const request = oss2.str();
+  size_t const begin = request.find("<base64>") + 8;
+  std::string const encoded = request.substr(begin, request.find("</base64>") - begin);
+  std::string expected(base64::encoded_size(data.size()), '\0');
+  base64::encode(data.data(), data.size(), expected.data());
+  EXPECT_EQ(encoded, expected);
+}
+
+TEST(XMLRPCClient, PipelinedResponses)
+{
+  using namespace test_xmlrpc_client;
+
+  std::string const stream =
+    result("<int>3</int>") +
+    http_response("<?xml version=\"1.0\"?>\r\n<methodResponse><fault><value><struct>"
+        "<member><name>faultCode</name><value><int>4</int></value></member>"
+        "<member><name>faultString</name><value><string>Too many parameters.</string></value></member>"
+        "</struct></value></fault></methodResponse>\r\n") +
+    http_response("Internal error\r\n", 500) +
+    result("<string>three</string>") +
+    result("<string>not a number</string>") +
+    result("<string>Fish &amp; chips</string>");
+
+  for (size_t chunk_size : { 1UL, 7UL, 64UL, 4096UL })
+  {
+    FeedingDecoder decoder;
+    std::vector<std::string> log;
+    decoder.expect(std::make_unique<xmlrpc::PendingCallT<int32_t>>(log_to<int32_t>(log)));
+    decoder.expect(std::make_unique<xmlrpc::PendingCallT<int32_t>>(log_to<int32_t>(log)));
+    decoder.expect(std::make_unique<xmlrpc::PendingCallT<int32_t>>(log_to<int32_t>(log)));
+    decoder.expect(std::make_unique<xmlrpc::PendingCallT<std::string>>(log_to<std::string>(log)));
+    decoder.expect(std::make_unique<xmlrpc::PendingCallT<int32_t>>(log_to<int32_t>(log)));
+    decoder.expect(std::make_unique<xmlrpc::PendingCallT<std::string>>(log_to<std::string>(log)));
+    decoder.expect(std::make_unique<xmlrpc::PendingCallT<int32_t>>(log_to<int32_t>(log)));
+    EXPECT_EQ(decoder.pending(), 7);
+    decoder.feed(stream, chunk_size);
+    EXPECT_EQ(decoder.pending(), 1);
+    decoder.fail_all("Connection closed by peer.");
+    EXPECT_EQ(decoder.pending(), 0);
+
+    std::vector<std::string> const expected = {
+      "3",
+      "fault 4 Too many parameters.",
+      "fault -32300 HTTP status 500.",
+      "three",
+      "fault -32700 Type mismatch.",
+      "Fish & chips",
+      "fault -32300 Connection closed by peer."
+    };
+    EXPECT_EQ(log, expected) << "chunk_size = " << chunk_size;
+  }
+}
+
+TEST(XMLRPCClient, ResponseUntilClose)
+{
+  using namespace test_xmlrpc_client;
+
+  // A response without Content-Length ends when the server closes the connection.
+  std::string const stream =
+    result("<int>1</int>") +
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/xml\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "<?xml version=\"1.0\"?>\r\n<methodResponse><params><param><value><int>2</int></value></param></params></methodResponse>\r\n";
+
+  for (size_t chunk_size : { 1UL, 7UL, 4096UL })
+  {
+    FeedingDecoder decoder;
+    std::vector<std::string> log;
+    for (int i = 0; i < 3; ++i)
+      decoder.expect(std::make_unique<xmlrpc::PendingCallT<int32_t>>(log_to<int32_t>(log)));
+    decoder.feed(stream, chunk_size);
+    EXPECT_EQ(decoder.pending(), 2);
+    // What Client::read_returned_zero does.
+    int allow_deletion_count = 0;
+    decoder.end_of_input(allow_deletion_count);
+    decoder.fail_all("Connection closed by peer.");
+
+    std::vector<std::string> const expected = {
+      "1",
+      "2",
+      "fault -32300 Connection closed by peer."
+    };
+    EXPECT_EQ(log, expected) << "chunk_size = " << chunk_size;
+  }
+}
+
+TEST(XMLRPCClient, InterimResponse)
+{
+  using namespace test_xmlrpc_client;
+
+  // 1xx responses don't complete a call.
+  std::string const stream =
+    "HTTP/1.1 100 Continue\r\n\r\n" +
+    result("<int>1</int>") +
+    "HTTP/1.1 102 Processing\r\n\r\n"
+    "HTTP/1.1 103 Early Hints\r\n"
+    "Link: </style.css>; rel=preload\r\n"
+    "\r\n" +
+    result("<int>2</int>");
+
+  for (size_t chunk_size : { 1UL, 7UL, 4096UL })
+  {
+    FeedingDecoder decoder;
+    std::vector<std::string> log;
+    for (int i = 0; i < 3; ++i)
+      decoder.expect(std::make_unique<xmlrpc::PendingCallT<int32_t>>(log_to<int32_t>(log)));
+    decoder.feed(stream, chunk_size);
+    EXPECT_EQ(decoder.pending(), 1);
+    decoder.feed("HTTP/1.1 100 Continue\r\n\r\n", chunk_size);
+    EXPECT_EQ(decoder.pending(), 1);
+    decoder.fail_all("Connection closed by peer.");
+
+    std::vector<std::string> const expected = {
+      "1",
+      "2",
+      "fault -32300 Connection closed by peer."
+    };
+    EXPECT_EQ(log, expected) << "chunk_size = " << chunk_size;
+  }
+}
+
+#include "EventLoopFixture.h"
+
+using XMLRPCClientFixture = EventLoopFixture<XmlRpcServerFixture>;
+
+TEST_F(XMLRPCClientFixture, Pipelining)
+{
+  using namespace test_xmlrpc_client;
+
+  std::mutex log_mutex;
+  std::vector<std::string> log;
+  std::atomic<int> completed = 0;
+  auto callback = [&](auto& result, xmlrpc::Fault const* fault){
+    std::ostringstream oss;
+    if (fault)
+      oss << "fault " << fault->m_code << " " << fault->m_string;
+    else
+      oss << result;
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log.push_back(oss.str());
+    ++completed;
+  };
+
+  auto client = evio::create<xmlrpc::Client>("localhost:9003");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));          // Dumb way to wait until the server is up.
+  client->connect(evio::SocketAddress("127.0.0.1:9003"));
+
+  // All calls are written before the first response is received.
+  std::vector<std::string> expected;
+  for (int i = 0; i < 10; ++i)
+  {
+    client->call<int64_t>("sum", callback, i, 1000, int64_t{4000000000});
+    expected.push_back(std::to_string(i + 4000001000));
+  }
+  client->call<int32_t>("fail", callback);
+  expected.push_back("fault 4 Requested fault.");
+  client->call<std::string>("echo", callback, "a < b");
+  expected.push_back("a < b");
+  // The response to "last" has no Content-Length; the server closes the connection after it.
+  client->call<std::string>("last", callback, "bye");
+  expected.push_back("bye");
+  client->call<int32_t>("sum", callback, 1);
+  expected.push_back("fault -32300 Connection closed by peer.");
+
+  // Wait until all calls completed.
+  for (int i = 0; i < 500 && completed < static_cast<int>(expected.size()); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  EXPECT_EQ(log, expected);
+  EXPECT_EQ(client->pending(), 0);
+  EXPECT_EQ(server_connections(), 1);                                   // Everything was sent over one connection.
+  client->close();
+}
+
+TEST_F(XMLRPCClientFixture, LocalClose)
+{
+  using namespace test_xmlrpc_client;
+
+  std::atomic<int> completed = 0;
+  std::atomic<int> failed = 0;
+  auto callback = [&](int64_t& UNUSED_ARG(result), xmlrpc::Fault const* fault){
+    if (fault)
+    {
+      EXPECT_EQ(fault->m_string, "Connection closed.");
+      ++failed;
+    }
+    ++completed;
+  };
+
+  auto client = evio::create<xmlrpc::Client>("localhost:9003");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));          // Dumb way to wait until the server is up.
+  client->connect(evio::SocketAddress("127.0.0.1:9003"));
+  client->call<int64_t>("sum", callback, 1, 2);
+  for (int i = 0; i < 500 && completed < 1; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(completed, 1);
+
+  // Calls that are pending when the client is closed are failed, not forgotten.
+  for (int i = 0; i < 10; ++i)
+    client->call<int64_t>("sum", callback, i);
+  client->close();
+  for (int i = 0; i < 500 && completed < 11; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(completed, 11);
+  EXPECT_GT(failed, 0);
+  EXPECT_EQ(client->pending(), 0);
+}
@@ -0,0 +1,245 @@
+#include "src/XMLRPCDecoder.h"
+#include "DecoderFeeder.h"
+#include <string>
+#include <vector>
+
+namespace test_xmlrpc_decoder {
+
+struct Tag
+{
+  int32_t m_id = 0;
+  std::string m_label;
+};
+
+struct Item
+{
+  int64_t m_id = 0;
+  std::string m_name;
+  double m_price = 0;
+  bool m_available = false;
+  xmlrpc::Timestamp m_created{};
+  xmlrpc::Binary m_thumbnail;
+  std::vector<Tag> m_tags;
+  std::vector<std::vector<int32_t>> m_matrix;
+};
+
+struct Result
+{
+  std::vector<Item> m_items;
+  std::string m_cursor;
+};
+
+} // namespace test_xmlrpc_decoder
+
+template<>
+struct xmlrpc::Members<test_xmlrpc_decoder::Tag>
+{
+  static constexpr auto value = std::make_tuple(
+      xmlrpc::member("id", &test_xmlrpc_decoder::Tag::m_id),
+      xmlrpc::member("label", &test_xmlrpc_decoder::Tag::m_label));
+};
+
+template<>
+struct xmlrpc::Members<test_xmlrpc_decoder::Item>
+{
+  static constexpr auto value = std::make_tuple(
+      xmlrpc::member("id", &test_xmlrpc_decoder::Item::m_id),
+      xmlrpc::member("name", &test_xmlrpc_decoder::Item::m_name),
+      xmlrpc::member("price", &test_xmlrpc_decoder::Item::m_price),
+      xmlrpc::member("available", &test_xmlrpc_decoder::Item::m_available),
+      xmlrpc::member("created", &test_xmlrpc_decoder::Item::m_created),
+      xmlrpc::member("thumbnail", &test_xmlrpc_decoder::Item::m_thumbnail),
+      xmlrpc::member("tags", &test_xmlrpc_decoder::Item::m_tags),
+      xmlrpc::member("matrix", &test_xmlrpc_decoder::Item::m_matrix));
+};
+
+template<>
+struct xmlrpc::Members<test_xmlrpc_decoder::Result>
+{
+  static constexpr auto value = std::make_tuple(
+      xmlrpc::member("items", &test_xmlrpc_decoder::Result::m_items),
+      xmlrpc::member("cursor", &test_xmlrpc_decoder::Result::m_cursor));
+};
+
+namespace test_xmlrpc_decoder {
+
+// Records what the decoder reports.
+template<typename T>
+class RecordingDecoder : public DecoderFeeder<xmlrpc::Decoder<T>>
+{
+ public:
+  std::vector<T> m_responses;
+  std::vector<xmlrpc::Fault> m_faults;
+  std::vector<std::string> m_errors;
+
+ protected:
+  void on_response(int& UNUSED_ARG(allow_deletion_count), T& result) override
+  {
+    m_responses.push_back(std::move(result));
+  }
+
+  void on_fault(int& UNUSED_ARG(allow_deletion_count), xmlrpc::Fault const& fault) override
+  {
+    m_faults.push_back(fault);
+  }
+
+  void on_error(int& UNUSED_ARG(allow_deletion_count), char const* what) override
+  {
+    m_errors.emplace_back(what);
+  }
+};
+
+std::string const response =
+  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
+  "<methodResponse>\r\n"
+  "  <params>\r\n"
+  "    <param>\r\n"
+  "      <value><struct>\r\n"
+  "        <member><name>items</name><value><array><data>\r\n"
+  "          <value><struct>\r\n"
+  "            <member><name>id</name><value><i8>-9000000000</i8></value></member>\r\n"
+  "            <member><name>name</name><value><string>Fish &amp; chips &lt;large&gt; &#233;&#x20AC;</string></value></member>\r\n"
+  "            <member><name>price</name><value><double>12.5</double></value></member>\r\n"
+  "            <member><name>available</name><value><boolean>1</boolean></value></member>\r\n"
+  "            <member><name>created</name><value><dateTime.iso8601>20210129T15:37:23</dateTime.iso8601></value></member>\r\n"
+  "            <member><name>thumbnail</name><value><base64>\r\n"
+  "SGVsbG8g\r\nd29ybGQ=\r\n"
+  "            </base64></value></member>\r\n"
+  "            <!-- A member that isn't in the map. -->\r\n"
+  "            <member><name>unknown</name><value><struct><member><name>x</name><value><array><data><value>1</value></data></array></value></member></struct></value></member>\r\n"
+  "            <member><name>tags</name><value><array><data>\r\n"
+  "              <value><struct><member><name>id</name><value><int>1</int></value></member><member><name>label</name><value>  untyped </value></member></struct></value>\r\n"
+  "              <value><struct><member><name>label</name><value><string></string></value></member><member><name>id</name><value><i4>2</i4></value></member></struct></value>\r\n"
+  "            </data></array></value></member>\r\n"
+  "            <member><name>matrix</name><value><array><data>\r\n"
+  "              <value><array><data><value><int>1</int></value><value><int>2</int></value></data></array></value>\r\n"
+  "              <value><array><data/></array></value>\r\n"
+  "            </data></array></value></member>\r\n"
+  "          </struct></value>\r\n"
+  "          <value><struct><member><name>id</name><value><int>7</int></value></member><member><name>price</name><value><nil/></value></member></struct></value>\r\n"
+  "        </data></array></value></member>\r\n"
+  "        <member><name>cursor</name><value></value></member>\r\n"
+  "      </struct></value>\r\n"
+  "    </param>\r\n"
+  "    <param><value><string>An extra param is ignored.</string></value></param>\r\n"
+  "  </params>\r\n"
+  "</methodResponse>\r\n";
+
+std::string const fault =
+  "<methodResponse><fault><value><struct>"
+  "<member><name>faultCode</name><value><int>4</int></value></member>"
+  "<member><name>faultString</name><value><string>Too many parameters.</string></value></member>"
+  "</struct></value></fault></methodResponse>";
+
+} // namespace test_xmlrpc_decoder
+
+TEST(XMLRPCDecoder, Response)
+{
+  using namespace test_xmlrpc_decoder;
+  for (size_t chunk_size : { 1, 2, 3, 7, 64, 1000000 })
+  {
+    RecordingDecoder<Result> decoder;
+    decoder.feed(response + response, chunk_size);
+    EXPECT_TRUE(decoder.m_errors.empty()) << decoder.m_errors[0];
+    EXPECT_TRUE(decoder.m_faults.empty());
+    ASSERT_EQ(decoder.m_responses.size(), 2UL);
+    for (Result const& result : decoder.m_responses)
+    {
+      ASSERT_EQ(result.m_items.size(), 2UL);
+      Item const& item = result.m_items[0];
+      EXPECT_EQ(item.m_id, -9000000000);
+      EXPECT_EQ(item.m_name, "Fish & chips <large> \xc3\xa9\xe2\x82\xac");
+      EXPECT_EQ(item.m_price, 12.5);
+      EXPECT_TRUE(item.m_available);
+      EXPECT_EQ(item.m_created.m_seconds, 1611934643);
+      EXPECT_EQ(item.m_thumbnail.m_data, "Hello world");
+      ASSERT_EQ(item.m_tags.size(), 2UL);
+      EXPECT_EQ(item.m_tags[0].m_id, 1);
+      EXPECT_EQ(item.m_tags[0].m_label, "  untyped ");
+      EXPECT_EQ(item.m_tags[1].m_id, 2);
+      EXPECT_EQ(item.m_tags[1].m_label, "");
+      ASSERT_EQ(item.m_matrix.size(), 2UL);
+      EXPECT_EQ(item.m_matrix[0], (std::vector<int32_t>{ 1, 2 }));
+      EXPECT_TRUE(item.m_matrix[1].empty());
+      EXPECT_EQ(result.m_items[1].m_id, 7);
+      EXPECT_EQ(result.m_items[1].m_price, 0);
+      EXPECT_EQ(result.m_cursor, "");
+    }
+  }
+}
+
+TEST(XMLRPCDecoder, Fault)
+{
+  using namespace test_xmlrpc_decoder;
+  RecordingDecoder<Result> decoder;
+  decoder.feed(fault + response, 5);
+  EXPECT_TRUE(decoder.m_errors.empty());
+  ASSERT_EQ(decoder.m_faults.size(), 1UL);
+  EXPECT_EQ(decoder.m_faults[0].m_code, 4);
+  EXPECT_EQ(decoder.m_faults[0].m_string, "Too many parameters.");
+  EXPECT_EQ(decoder.m_responses.size(), 1UL);
+}
+
+TEST(XMLRPCDecoder, Base64Chunks)
+{
+  using namespace test_xmlrpc_decoder;
+  std::string data;
+  for (int i = 0; i < 1000; ++i)
+    data += static_cast<char>(i * 13);
+  std::string encoded(base64::encoded_size(data.size()), '\0');
+  base64::encode(data.data(), data.size(), encoded.data());
+  std::string lines;
+  for (size_t pos = 0; pos < encoded.size(); pos += 76)
+    lines += encoded.substr(pos, 76) + "\r\n";
+  for (size_t chunk_size : { 1, 5, 17, 100 })
+  {
+    RecordingDecoder<xmlrpc::Binary> decoder;
+    decoder.feed("<methodResponse><params><param><value><base64>" + lines + "</base64></value></param></params></methodResponse>", chunk_size);
+    EXPECT_TRUE(decoder.m_errors.empty());
+    ASSERT_EQ(decoder.m_responses.size(), 1UL);
+    EXPECT_EQ(decoder.m_responses[0].m_data, data);
+  }
+}
+
+TEST(XMLRPCDecoder, Errors)
+{
+  using namespace test_xmlrpc_decoder;
+  std::pair<std::string, char const*> const invalid[] = {
+    { "<methodResponse><params><param><value><int>1</int></value></param></params></methodResponse>", "Type mismatch." },
+    { "<methodResponse><params><param><value>text</value></param></params></methodResponse>", "Type mismatch." },
+    { "<methodResponse><params><param><value><struct><member><name>cursor</name><value><i4>x</i4></value></member></struct></value></param></params></methodResponse>", "Type mismatch." },
+    { "<methodResponse><params><param><value><struct><member><name>items</name><value><array><data><value><struct><member><name>id</name><value><int>1x</int></value></member></struct></value></data></array></value></member></struct></value></param></params></methodResponse>", "Invalid value." },
+    { "<methodResponse><params><param><value><struct></value></param></params></methodResponse>", "Mismatched end tag." },
+    { "<methodResponse><params><param><value><struct><foo/></struct></value></param></params></methodResponse>", "Unknown element." },
+    { "<methodResponse><params><value><struct></struct></value></params></methodResponse>", "Unexpected element." },
+    { "<methodResponse><params><param><value><struct><member><value><int>1</int></value></member></struct></value></param></params></methodResponse>", "Unexpected element." },
+    { "<methodResponse><params><param><value><struct>x</struct></value></param></params></methodResponse>", "Unexpected character data." },
+    { "<methodResponse><params><param><value>&bogus;</value></param></params></methodResponse>", "Invalid entity reference." },
+    { "<!DOCTYPE methodResponse>", "Unsupported markup." },
+    { "<methodResponse" + std::string(100, ' ') + ">", "Tag too long." }
+  };
+  for (auto const& value : invalid)
+  {
+    RecordingDecoder<Result> decoder;
+    decoder.feed(value.first + response, 3);
+    ASSERT_EQ(decoder.m_errors.size(), 1UL) << value.first;
+    EXPECT_EQ(decoder.m_errors[0], value.second) << value.first;
+    EXPECT_TRUE(decoder.m_responses.empty());
+  }
+  {
+    // Nesting is limited, also in ignored values.
+    std::string deep = "<methodResponse><params><param><value><struct></struct></value></param><param>";
+    for (int i = 0; i < xmlrpc::Parser::max_depth; ++i)
+      deep += "<value><array><data>";
+    RecordingDecoder<Result> decoder;
+    decoder.feed(deep, 1000);
+    ASSERT_EQ(decoder.m_errors.size(), 1UL);
+    EXPECT_EQ(decoder.m_errors[0], "Elements nested too deep.");
+  }
+  {
+    RecordingDecoder<xmlrpc::Binary> decoder;
+    decoder.feed("<methodResponse><params><param><value><base64>SGVsbG8!</base64></value></param></params></methodResponse>", 1);
+    ASSERT_EQ(decoder.m_errors.size(), 1UL);
+    EXPECT_EQ(decoder.m_errors[0], "Invalid base64.");
+  }
+}